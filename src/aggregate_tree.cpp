@@ -0,0 +1,314 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file aggregate_tree.cpp
+/// @brief Implementation of AggregateTree class.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// cell
+#include <aggregate_tree.hpp>
+#include <scan_kernel.hpp>
+
+namespace cell {
+
+namespace {
+
+typedef SectorClassifier<InfluenceRing::NUM_DIRECTIONS> Sectors;
+
+/// Spreads the bits of v out to the even bit positions.
+std::uint64_t spread_bits(std::uint32_t v)
+{
+  std::uint64_t x = v;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+  x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+  x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  x = (x | (x << 2)) & 0x3333333333333333ULL;
+  x = (x | (x << 1)) & 0x5555555555555555ULL;
+  return x;
+}
+
+double distance_falloff(std::int64_t d2, double range)
+{
+  return 1.0 - std::max(0.0, std::min(1.0, std::sqrt(double(d2)) / range));
+}
+
+} // end anonymous namespace
+
+struct AggregateTree::Query {
+  std::int64_t ox, oy;
+  RingBounds bounds;
+  double range;
+  double max_error;
+  InfluenceRing::vals_t* vals;
+};
+
+void AggregateTree::build(std::vector<Entry> entries)
+{
+  entries_.clear();
+  codes_.clear();
+  nodes_.clear();
+  leaf_of_.clear();
+  extra_.clear();
+  extra_index_.clear();
+  erased_ = 0;
+  entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& e) {
+    return e.type == Reward::RewardType::DIST_TIME;
+  }), entries.end());
+  if (entries.empty()) return;
+
+  std::int64_t min_x = entries[0].x, min_y = entries[0].y, max_x = min_x, max_y = min_y;
+  for (const auto& e : entries) {
+    min_x = std::min<std::int64_t>(min_x, e.x);
+    min_y = std::min<std::int64_t>(min_y, e.y);
+    max_x = std::max<std::int64_t>(max_x, e.x);
+    max_y = std::max<std::int64_t>(max_y, e.y);
+  }
+  min_x_ = min_x;
+  min_y_ = min_y;
+
+  // Z-order codes of the offsets from the bottom left corner.
+  std::vector<std::uint64_t> codes(entries.size());
+  for (std::size_t i = 0; i < entries.size(); ++i) code_of(entries[i].x, entries[i].y, codes[i]);
+  std::vector<std::uint32_t> order(entries.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::uint32_t a, std::uint32_t b) { return codes[a] < codes[b]; });
+  entries_.reserve(entries.size());
+  codes_.reserve(entries.size());
+  for (std::uint32_t i : order) {
+    entries_.push_back(entries[i]);
+    codes_.push_back(codes[i]);
+  }
+
+  // The root's side is the smallest power of two covering every offset.
+  const std::int64_t extent = std::max(max_x - min_x, max_y - min_y);
+  int level = 0;
+  while ((std::int64_t(1) << level) <= extent) ++level;
+  leaf_of_.assign(entries_.size(), -1);
+  build_node(level, -1, 0, std::uint32_t(entries_.size()));
+}
+
+std::int32_t AggregateTree::build_node(int level, std::int32_t parent, std::uint32_t begin,
+                                       std::uint32_t end)
+{
+  const std::int32_t index = std::int32_t(nodes_.size());
+  Node node;
+  node.min_x = node.max_x = entries_[begin].x;
+  node.min_y = node.max_y = entries_[begin].y;
+  node.begin = begin;
+  node.end = end;
+  node.parent = parent;
+  std::fill(node.children, node.children + 4, -1);
+  node.leaf = end - begin <= std::uint32_t(LEAF_SIZE) || level == 0;
+  node.trivial_quantity = node.distance_quantity = 0;
+  for (std::uint32_t i = begin; i < end; ++i) {
+    const Entry& e = entries_[i];
+    node.min_x = std::min(node.min_x, e.x);
+    node.min_y = std::min(node.min_y, e.y);
+    node.max_x = std::max(node.max_x, e.x);
+    node.max_y = std::max(node.max_y, e.y);
+    if (e.type == Reward::RewardType::TRIVIAL) {
+      node.trivial_quantity += e.quantity;
+    } else {
+      node.distance_quantity += e.quantity;
+    }
+  }
+  // Offsets from the corner keep the sums small enough to update in place.
+  node.distance_sx = node.distance_sy = 0.0;
+  for (std::uint32_t i = begin; i < end; ++i) {
+    const Entry& e = entries_[i];
+    if (e.type != Reward::RewardType::DISTANCE) continue;
+    node.distance_sx += double(e.quantity) * (double(e.x) - node.min_x);
+    node.distance_sy += double(e.quantity) * (double(e.y) - node.min_y);
+  }
+  nodes_.push_back(node);
+  if (node.leaf) {
+    std::fill(leaf_of_.begin() + begin, leaf_of_.begin() + end, index);
+    return index;
+  }
+
+  // The run is sorted by code, so each quadrant is a contiguous part of it.
+  const int shift = 2 * (level - 1);
+  std::uint32_t first = begin;
+  for (std::uint64_t quadrant = 0; quadrant < 4; ++quadrant) {
+    const std::uint32_t last = std::uint32_t(
+        std::partition_point(codes_.begin() + first, codes_.begin() + end,
+                             [&](std::uint64_t c) { return ((c >> shift) & 3) <= quadrant; }) -
+        codes_.begin());
+    if (last > first) {
+      const std::int32_t child = build_node(level - 1, index, first, last);
+      nodes_[index].children[quadrant] = child;
+    }
+    first = last;
+  }
+  return index;
+}
+
+bool AggregateTree::code_of(int x, int y, std::uint64_t& code) const
+{
+  const std::int64_t dx = x - min_x_, dy = y - min_y_;
+  if (dx < 0 || dy < 0 || dx > 0xffffffffLL || dy > 0xffffffffLL) return false;
+  code = spread_bits(std::uint32_t(dx)) | (spread_bits(std::uint32_t(dy)) << 1);
+  return true;
+}
+
+void AggregateTree::update(const Entry& e)
+{
+  const bool live = e.type != Reward::RewardType::DIST_TIME;
+  const auto replace = [&](Entry& old) {
+    const bool was_live = old.type != Reward::RewardType::DIST_TIME;
+    if (was_live && !live) ++erased_;
+    if (!was_live && live) --erased_;
+    old.quantity = live ? e.quantity : 0;
+    old.type = e.type;
+  };
+
+  // Locations are unique, and so are their codes.
+  std::uint64_t code;
+  if (!entries_.empty() && code_of(e.x, e.y, code)) {
+    const auto it = std::lower_bound(codes_.begin(), codes_.end(), code);
+    if (it != codes_.end() && *it == code) {
+      const std::size_t i = std::size_t(it - codes_.begin());
+      add_to_path(leaf_of_[i], entries_[i], -1);
+      replace(entries_[i]);
+      add_to_path(leaf_of_[i], entries_[i], 1);
+      return;
+    }
+  }
+
+  const std::uint64_t key = (std::uint64_t(std::uint32_t(e.x)) << 32) | std::uint32_t(e.y);
+  const auto it = extra_index_.find(key);
+  if (it != extra_index_.end()) {
+    replace(extra_[it->second]);
+  } else if (live) {
+    extra_index_.emplace(key, std::uint32_t(extra_.size()));
+    extra_.push_back(e);
+  }
+}
+
+void AggregateTree::add_to_path(std::int32_t leaf, const Entry& e, int sign)
+{
+  if (e.type == Reward::RewardType::DIST_TIME) return;
+  const std::int64_t quantity = sign * std::int64_t(e.quantity);
+  for (std::int32_t i = leaf; i >= 0; i = nodes_[i].parent) {
+    Node& node = nodes_[i];
+    if (e.type == Reward::RewardType::TRIVIAL) {
+      node.trivial_quantity += quantity;
+      continue;
+    }
+    node.distance_quantity += quantity;
+    if (node.distance_quantity == 0) {
+      // Quantities aren't negative, so nothing is left and the sums are
+      // exactly zero, whatever rounding says.
+      node.distance_sx = node.distance_sy = 0.0;
+    } else {
+      node.distance_sx += double(quantity) * (double(e.x) - node.min_x);
+      node.distance_sy += double(quantity) * (double(e.y) - node.min_y);
+    }
+  }
+}
+
+bool AggregateTree::fragmented() const
+{
+  return extra_.size() + erased_ > entries_.size() / 8 + LEAF_SIZE;
+}
+
+void AggregateTree::rebuild()
+{
+  std::vector<Entry> entries;
+  entries.reserve(size());
+  for (const Entry& e : entries_) entries.push_back(e);
+  for (const Entry& e : extra_) entries.push_back(e);
+  build(std::move(entries));
+}
+
+void AggregateTree::scan_ring(const Location& origin, int min_dist, int max_dist,
+                              double max_error, InfluenceRing& ring) const
+{
+  if (nodes_.empty() && extra_.empty()) return;
+  const Query q{ origin.x, origin.y, RingBounds(min_dist, max_dist),
+                 double(max_dist - min_dist), max_error, &ring.vals() };
+  if (!nodes_.empty()) visit(q, 0, TRIVIAL_BIT | DISTANCE_BIT);
+  for (const Entry& e : extra_) scan_entry(q, e, TRIVIAL_BIT | DISTANCE_BIT);
+}
+
+void AggregateTree::visit(const Query& q, std::int32_t index, unsigned types) const
+{
+  const Node& node = nodes_[index];
+
+  // Squared distances to the nearest and farthest points of the box.
+  const std::int64_t near_x = std::min<std::int64_t>(std::max<std::int64_t>(q.ox, node.min_x), node.max_x) - q.ox;
+  const std::int64_t near_y = std::min<std::int64_t>(std::max<std::int64_t>(q.oy, node.min_y), node.max_y) - q.oy;
+  const std::int64_t far_x = std::max(std::abs(node.min_x - q.ox), std::abs(node.max_x - q.ox));
+  const std::int64_t far_y = std::max(std::abs(node.min_y - q.oy), std::abs(node.max_y - q.oy));
+  const std::int64_t dmin2 = distance_squared(near_x, near_y);
+  const std::int64_t dmax2 = distance_squared(far_x, far_y);
+  if (dmax2 < q.bounds.min2 || dmin2 > q.bounds.max2) return;
+
+  if (dmin2 > 0 && q.bounds.contains(dmin2) && q.bounds.contains(dmax2)) {
+    // Directions are convex wedges, so a box whose corners share one lies
+    // entirely inside it.
+    const int dir = Sectors::direction(node.min_x - q.ox, node.min_y - q.oy);
+    if (dir == Sectors::direction(node.max_x - q.ox, node.min_y - q.oy) &&
+        dir == Sectors::direction(node.min_x - q.ox, node.max_y - q.oy) &&
+        dir == Sectors::direction(node.max_x - q.ox, node.max_y - q.oy)) {
+      int& out = (*q.vals)[dir];
+      if (types & TRIVIAL_BIT) {
+        out += int(node.trivial_quantity);
+        types &= ~TRIVIAL_BIT;
+      }
+      if (types & DISTANCE_BIT) {
+        const double dmin = std::sqrt(double(dmin2));
+        if (node.distance_quantity == 0 || (q.range > 0 && dmin >= q.range)) {
+          // Nothing there, or past the falloff range where every reward is zero.
+          types &= ~DISTANCE_BIT;
+        } else if (q.max_error > 0 && q.range > 0 && double(dmax2) <= q.range * q.range) {
+          // Taking the distance at the centroid underestimates the total by
+          // at most diag^2 / (2 * dmin) per unit of quantity.
+          const double w = double(node.max_x) - node.min_x, h = double(node.max_y) - node.min_y;
+          if (w * w + h * h <= 2.0 * q.max_error * dmin * q.range) {
+            const double cx = node.min_x + node.distance_sx / double(node.distance_quantity);
+            const double cy = node.min_y + node.distance_sy / double(node.distance_quantity);
+            const double dc = std::hypot(cx - double(q.ox), cy - double(q.oy));
+            out += int(double(node.distance_quantity) *
+                       (1.0 - std::max(0.0, std::min(1.0, dc / q.range))));
+            types &= ~DISTANCE_BIT;
+          }
+        }
+      }
+      if (types == 0) return;
+    }
+  }
+
+  if (!node.leaf) {
+    for (std::int32_t child : node.children) {
+      if (child >= 0) visit(q, child, types);
+    }
+    return;
+  }
+
+  for (std::uint32_t i = node.begin; i < node.end; ++i) scan_entry(q, entries_[i], types);
+}
+
+void AggregateTree::scan_entry(const Query& q, const Entry& e, unsigned types)
+{
+  // Erased entries are left behind as DIST_TIME ones.
+  if (e.type == Reward::RewardType::DIST_TIME) return;
+  const bool trivial = e.type == Reward::RewardType::TRIVIAL;
+  if (!(types & (trivial ? TRIVIAL_BIT : DISTANCE_BIT))) return;
+  const std::int64_t dx = std::int64_t(e.x) - q.ox, dy = std::int64_t(e.y) - q.oy;
+  const std::int64_t d2 = distance_squared(dx, dy);
+  if (!q.bounds.contains(d2)) return;
+  (*q.vals)[Sectors::direction(dx, dy)] +=
+    trivial ? e.quantity : int(double(e.quantity) * distance_falloff(d2, q.range));
+}
+
+} // end namespace cell
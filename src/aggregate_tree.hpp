@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file aggregate_tree.hpp
+/// @brief Quadtree over rewards with per node aggregates, for approximate
+///        scans of large rings.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_AGGREGATE_TREE_HPP
+#define CELL_AGGREGATE_TREE_HPP
+
+// std
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// cell
+#include <influence_ring.hpp>
+#include <location.hpp>
+#include <reward.hpp>
+
+namespace cell {
+
+/** @brief Rewards are sorted along a Z-order curve and split into a quadtree
+  *        whose nodes each own a contiguous run of them. Every node keeps its
+  *        bounding box, the total TRIVIAL quantity, and the total DISTANCE
+  *        quantity with its quantity weighted centroid.
+  *
+  *        A ring scan uses a node whole when its box lies inside the ring and
+  *        inside a single direction. TRIVIAL influence is then exact. The
+  *        DISTANCE influence of the node is taken at its centroid, which is
+  *        accurate to second order in the node size, and only when the error
+  *        bound allows it; otherwise the node is refined down to its rewards.
+  *
+  *        DIST_TIME rewards depend on per reward scan history and are not
+  *        stored here. Quantities are copied in, and update and erase keep
+  *        them in step by adjusting the aggregates on the path from the
+  *        entry's leaf up to the root. Boxes don't shrink when an entry goes,
+  *        which only makes them conservative. Entries at locations the tree
+  *        wasn't built with are kept aside and scanned one by one until
+  *        rebuild folds them in.
+  */
+class AggregateTree {
+public:
+
+  /// Largest number of rewards in a leaf.
+  constexpr static int LEAF_SIZE = 16;
+
+  struct Entry {
+    int x;
+    int y;
+    int quantity;
+    Reward::RewardType type;   // TRIVIAL or DISTANCE.
+  };
+
+  AggregateTree() = default;
+
+  /// Replaces the contents of the tree. DIST_TIME entries are ignored.
+  void build(std::vector<Entry> entries);
+
+  /** @brief Sets the quantity and type of the entry at (e.x, e.y), adding
+    *        it if there is none. A DIST_TIME entry erases it instead.
+    *        O(log n) plus the depth of the tree.
+    */
+  void update(const Entry& e);
+  void erase(const Location& l) {
+    update(Entry{ l.x, l.y, 0, Reward::RewardType::DIST_TIME });
+  }
+
+  /// True once enough entries were added or erased since the last build that
+  /// scans slow down noticeably, see rebuild.
+  bool fragmented() const;
+
+  /// Builds the tree again from its current entries.
+  void rebuild();
+
+  /** @brief Adds the influence of every stored reward in the ring
+    *        [min_dist, max_dist] around origin into ring.
+    *
+    *        Where a node's DISTANCE rewards are taken at their centroid, the
+    *        distance falloff of each of them is overestimated by at most
+    *        max_error, so the total for the node is at most max_error times
+    *        its DISTANCE quantity too high. Exact scans also round every
+    *        reward down separately, while a node is rounded once. A
+    *        max_error of zero gives the exact result.
+    */
+  void scan_ring(const Location& origin, int min_dist, int max_dist, double max_error,
+                 InfluenceRing& ring) const;
+
+  std::size_t size() const { return entries_.size() + extra_.size() - erased_; }
+  std::size_t num_nodes() const { return nodes_.size(); }
+
+private:
+
+  enum : unsigned { TRIVIAL_BIT = 1, DISTANCE_BIT = 2 };
+
+  struct Node {
+    // Bounding box of the node's entries, inclusive.
+    int min_x, min_y, max_x, max_y;
+    std::uint32_t begin, end;
+    std::int32_t parent;        // -1 for the root.
+    std::int32_t children[4];   // -1 where the quadrant is empty.
+    bool leaf;
+    std::int64_t trivial_quantity;
+    std::int64_t distance_quantity;
+    // Quantity weighted sums of the DISTANCE offsets from (min_x, min_y).
+    double distance_sx, distance_sy;
+  };
+
+  struct Query;
+
+  std::int32_t build_node(int level, std::int32_t parent, std::uint32_t begin, std::uint32_t end);
+  void visit(const Query& q, std::int32_t index, unsigned types) const;
+  static void scan_entry(const Query& q, const Entry& e, unsigned types);
+
+  /// Adds sign times the contribution of e to every node from leaf up.
+  void add_to_path(std::int32_t leaf, const Entry& e, int sign);
+
+  /// Z-order code of a location relative to the built corner, false if the
+  /// location is outside of what the codes cover.
+  bool code_of(int x, int y, std::uint64_t& code) const;
+
+  std::vector<Entry> entries_;
+  std::vector<std::uint64_t> codes_;
+  std::vector<Node> nodes_;
+  // Leaf holding each of entries_.
+  std::vector<std::int32_t> leaf_of_;
+  // Corner the codes are taken from.
+  std::int64_t min_x_ = 0, min_y_ = 0;
+
+  // Entries added since the build, found by location.
+  std::vector<Entry> extra_;
+  std::unordered_map<std::uint64_t, std::uint32_t> extra_index_;
+  // Erased entries still taking up room in entries_ or extra_.
+  std::size_t erased_ = 0;
+
+};
+
+} // end namespace cell
+
+#endif // CELL_AGGREGATE_TREE_HPP
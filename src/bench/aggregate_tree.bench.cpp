@@ -0,0 +1,88 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid.hpp>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 14;
+
+// The outer ring of a default scan.
+constexpr int MIN_DIST = 100, MAX_DIST = 1000;
+
+void fill_grid(Grid& grid, int num_rewards) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1), quantity(1, 1000);
+  for (int i = 0; i < num_rewards; ++i) {
+    Reward r(i, i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::TRIVIAL);
+    r.quantity() = quantity(gen);
+    r.location() = Location(coord(gen), coord(gen));
+    grid.add_reward(r);
+  }
+}
+
+vector<Player> make_players() {
+  mt19937 gen(4321);
+  uniform_int_distribution<int> coord(MAX_DIST, BOARD_SIDE - 1 - MAX_DIST);
+  vector<Player> players;
+  for (int i = 0; i < 64; ++i) {
+    players.emplace_back(i);
+    players.back().location() = Location(coord(gen), coord(gen));
+  }
+  return players;
+}
+
+} // end anonymous namespace
+
+/// The exact outer ring, as the baseline.
+static void BM_OuterRingExact(benchmark::State& state) {
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  const auto players = make_players();
+
+  size_t p = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(grid.scan_single_ring(players[p++ % players.size()], MIN_DIST, MAX_DIST));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/** The outer ring from the aggregate tree. rel_error is the summed absolute
+  * difference from the exact ring over the summed exact ring, across all
+  * directions and players.
+  */
+static void BM_OuterRingAggregate(benchmark::State& state) {
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  grid.set_aggregate_error(state.range(1) / 1000.0);
+  const auto players = make_players();
+
+  double abs_error = 0.0, total = 0.0;
+  for (const auto& player : players) {
+    InfluenceRing approx;
+    grid.scan_rings_aggregate(player, &MIN_DIST, &MAX_DIST, 1, &approx);
+    const InfluenceRing exact = grid.scan_single_ring(player, MIN_DIST, MAX_DIST);
+    for (int d = 0; d < InfluenceRing::NUM_DIRECTIONS; ++d) {
+      abs_error += std::abs(approx.vals()[d] - exact.vals()[d]);
+      total += exact.vals()[d];
+    }
+  }
+
+  size_t p = 0;
+  for (auto _ : state) {
+    InfluenceRing ring;
+    grid.scan_rings_aggregate(players[p++ % players.size()], &MIN_DIST, &MAX_DIST, 1, &ring);
+    benchmark::DoNotOptimize(ring);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["rel_error"] = abs_error / total;
+}
+
+// { rewards on the board, aggregate error in thousandths }
+BENCHMARK(BM_OuterRingExact)->Arg(200000)->Arg(2000000);
+BENCHMARK(BM_OuterRingAggregate)->ArgsProduct({{200000, 2000000}, {0, 10, 20, 50, 100}});
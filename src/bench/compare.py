@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+################################################################################
+##
+## @file compare.py
+## @brief Compares two cell.bench.x JSON result files and flags regressions.
+## @author Zenon Parker
+## @author Matthew Avery
+## @date 2014
+##
+################################################################################
+
+"""Usage: compare.py BASELINE CURRENT [--threshold PCT] [--filter REGEX]
+
+Both files are the output of cell.bench.x --benchmark_out_format=json, see
+the json target of the Makefile. A benchmark is compared on its CPU time,
+or on its real time when it was registered with UseRealTime. With
+repetitions the median is used, otherwise the mean of its runs.
+
+Exits with status 1 if any benchmark got slower by more than the threshold
+percentage (10 by default), so it can gate a build.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+# Nanoseconds per time_unit of the JSON output.
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    """Benchmark name -> time in nanoseconds."""
+    with open(path) as f:
+        runs = json.load(f)["benchmarks"]
+    medians, sums, counts = {}, {}, {}
+    for run in runs:
+        if run.get("error_occurred"):
+            continue
+        name = run.get("run_name", run["name"])
+        metric = "real_time" if "/real_time" in name else "cpu_time"
+        time = run[metric] * UNITS[run.get("time_unit", "ns")]
+        if run.get("run_type") == "aggregate":
+            if run.get("aggregate_name") == "median":
+                medians[name] = time
+        else:
+            sums[name] = sums.get(name, 0.0) + time
+            counts[name] = counts.get(name, 0) + 1
+    times = {name: sums[name] / counts[name] for name in sums}
+    times.update(medians)
+    return times
+
+
+def format_time(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return "%.3g %s" % (ns / scale, unit)
+    return "%.3g ns" % ns
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percentage slowdown reported as a regression")
+    parser.add_argument("--filter", default="", help="only compare names matching this regex")
+    args = parser.parse_args()
+
+    baseline, current = load(args.baseline), load(args.current)
+    pattern = re.compile(args.filter)
+    names = [n for n in current if pattern.search(n)]
+    width = max([len(n) for n in names] + [9])
+
+    regressions = 0
+    print("%-*s %12s %12s %9s" % (width, "benchmark", "baseline", "current", "change"))
+    for name in names:
+        now = current[name]
+        if name not in baseline:
+            print("%-*s %12s %12s %9s  new" % (width, name, "-", format_time(now), "-"))
+            continue
+        before = baseline[name]
+        change = (now - before) / before * 100 if before > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-*s %12s %12s %+8.1f%%%s" % (width, name, format_time(before), format_time(now),
+                                             change, flag))
+    for name in baseline:
+        if pattern.search(name) and name not in current:
+            print("%-*s %12s %12s %9s  missing" % (width, name, format_time(baseline[name]), "-", "-"))
+
+    if regressions:
+        print("\n%d benchmark(s) more than %g%% slower than the baseline."
+              % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,110 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid_map.hpp>
+#include <grid_multimap.hpp>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 20;
+
+/// Reward positions spread uniformly over a BOARD_SIDE square.
+vector<Location> make_board(int num_rewards) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  vector<Location> locs;
+  locs.reserve(num_rewards);
+  for (int i = 0; i < num_rewards; ++i) locs.emplace_back(coord(gen), coord(gen));
+  return locs;
+}
+
+vector<Location> make_queries() {
+  mt19937 gen(4321);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  vector<Location> locs;
+  for (int i = 0; i < 1024; ++i) locs.emplace_back(coord(gen), coord(gen));
+  return locs;
+}
+
+} // end anonymous namespace
+
+/// The x-major std::map strip scan GridMap used before the tiled index. Every
+/// node in [x - radius, x + radius] is visited regardless of its y.
+static void BM_StripScanFind(benchmark::State& state) {
+  const int num_rewards = state.range(0), radius = state.range(1);
+  map<Location, int> grid;
+  for (const auto& l : make_board(num_rewards)) grid.emplace(l, 0);
+  const auto queries = make_queries();
+
+  size_t q = 0, visited = 0, found = 0, scans = 0;
+  for (auto _ : state) {
+    const Location& c = queries[q++ % queries.size()];
+    Location bl(c.x - radius, c.y - radius), tr(c.x + radius, c.y + radius);
+    const auto end = grid.upper_bound(tr);
+    for (auto it = grid.lower_bound(bl); it != end; ++it) {
+      ++visited;
+      if (it->first.y >= bl.y && it->first.y <= tr.y) ++found;
+    }
+    ++scans;
+  }
+  benchmark::DoNotOptimize(found);
+  state.counters["candidates"] = double(visited) / double(scans);
+  state.counters["found"] = double(found) / double(scans);
+}
+
+static void BM_GridMapFind(benchmark::State& state) {
+  const int num_rewards = state.range(0), radius = state.range(1);
+  GridMap<int> grid(state.range(2));
+  for (const auto& l : make_board(num_rewards)) grid.insert(l, 0);
+  const auto queries = make_queries();
+
+  size_t q = 0, found = 0, scans = 0;
+  for (auto _ : state) {
+    const Location& c = queries[q++ % queries.size()];
+    Location bl(c.x - radius, c.y - radius), tr(c.x + radius, c.y + radius);
+    found += grid.find(bl, tr).size();
+    ++scans;
+  }
+
+  size_t visited = 0;
+  for (const auto& c : queries) {
+    visited += grid.candidates(Location(c.x - radius, c.y - radius),
+                               Location(c.x + radius, c.y + radius));
+  }
+  state.counters["candidates"] = double(visited) / double(queries.size());
+  state.counters["found"] = double(found) / double(scans);
+}
+
+/// Players crowd together, so the multimap is measured with several entries
+/// stacked on each location.
+static void BM_GridMultiMapFind(benchmark::State& state) {
+  const int num_entries = state.range(0), stack = state.range(1), radius = state.range(2);
+  GridMultiMap<int> grid;
+  const auto locs = make_board(num_entries / stack);
+  for (int i = 0; i < num_entries; ++i) grid.insert(locs[i / stack], i);
+  const auto queries = make_queries();
+
+  size_t q = 0, found = 0, scans = 0;
+  for (auto _ : state) {
+    const Location& c = queries[q++ % queries.size()];
+    Location bl(c.x - radius, c.y - radius), tr(c.x + radius, c.y + radius);
+    found += grid.find(bl, tr).size();
+    ++scans;
+  }
+  state.counters["found"] = double(found) / double(scans);
+}
+
+// { rewards on the board, half side of the query rectangle, cell shift }. 1025
+// is the outer scan ring's largest radius once variance is applied.
+BENCHMARK(BM_StripScanFind)
+  ->ArgsProduct({{100000, 1000000, 4000000}, {100, 1025}});
+BENCHMARK(BM_GridMapFind)
+  ->ArgsProduct({{100000, 1000000, 4000000}, {100, 1025}, {6, 8, 10}});
+// { entries, entries per location, half side of the query rectangle }.
+BENCHMARK(BM_GridMultiMapFind)
+  ->ArgsProduct({{100000, 1000000}, {1, 8}, {100, 1025}});
@@ -0,0 +1,140 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <journal.hpp>
+#include <world.hpp>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 16;
+constexpr int NUM_PLAYERS = 100000;
+constexpr int NUM_REWARDS = 100000;
+constexpr int MOVES_PER_TICK = 10000;
+
+const string JOURNAL_PATH = "/tmp/cell.bench.journal";
+
+void fill_world(World& world) {
+  mt19937 gen(5);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  for (int i = 0; i < NUM_REWARDS; ++i) {
+    Reward r(i, Reward::RewardType::DIST_TIME);
+    r.level() = Reward::RewardLevel(i % Reward::RewardLevel::NUM_LEVELS);
+    r.quantity() = 100;
+    r.location() = Location(coord(gen), coord(gen));
+    world.grid().add_reward(r);
+  }
+  for (int i = 0; i < NUM_PLAYERS; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+}
+
+/// Ticks of small moves, like players walking.
+vector<vector<Move>> make_ticks(const World& world, int num_ticks) {
+  mt19937 gen(7);
+  uniform_int_distribution<int> player(0, NUM_PLAYERS - 1);
+  uniform_int_distribution<int> step(-3, 3);
+  vector<Location> at(NUM_PLAYERS, Location(0, 0));
+  for (const Player& p : world.players()) at[p.id()] = p.location();
+  vector<vector<Move>> ticks(num_ticks);
+  for (vector<Move>& tick : ticks) {
+    for (int i = 0; i < MOVES_PER_TICK; ++i) {
+      const PlayerId id = player(gen);
+      at[id] = Location(at[id].x + step(gen), at[id].y + step(gen));
+      tick.push_back(Move{ id, at[id] });
+    }
+  }
+  return ticks;
+}
+
+} // end anonymous namespace
+
+/// A tick of moves and quantity changes, with range(0) == 1 journaled and
+/// committed at the end of the tick. The difference per item is the cost of
+/// journaling a mutation on the game thread; the writes and fdatasync happen
+/// on the writer thread.
+static void BM_JournaledTick(benchmark::State& state) {
+  World world;
+  fill_world(world);
+  const vector<vector<Move>> ticks = make_ticks(world, 64);
+  RewardManager& rm = world.grid().reward_manager();
+  vector<RewardHandle> handles;
+  for (RewardId id = 0; id < MOVES_PER_TICK; ++id) handles.push_back(rm.find(id * 7));
+  Journal journal;
+  if (state.range(0)) {
+    journal.open(JOURNAL_PATH);
+    world.set_journal(&journal);
+  }
+  size_t t = 0;
+  for (auto _ : state) {
+    const vector<Move>& tick = ticks[t++ % ticks.size()];
+    world.apply_moves(tick);
+    for (size_t i = 0; i < handles.size(); ++i) rm.set_quantity(handles[i], int(100 + (t + i) % 7));
+    journal.commit();
+  }
+  state.SetItemsProcessed(state.iterations() * (MOVES_PER_TICK + handles.size()));
+  journal.close();
+  remove(JOURNAL_PATH.c_str());
+}
+BENCHMARK(BM_JournaledTick)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+/// commit plus sync of one tick's records: the latency until a tick is
+/// durable, mostly the fdatasync.
+static void BM_JournalCommitSync(benchmark::State& state) {
+  Journal journal;
+  journal.open(JOURNAL_PATH);
+  for (auto _ : state) {
+    for (int i = 0; i < state.range(0); ++i) journal.player_move(i, Location(i, i));
+    journal.commit();
+    journal.sync();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  journal.close();
+  remove(JOURNAL_PATH.c_str());
+}
+BENCHMARK(BM_JournalCommitSync)->Arg(1000)->Arg(20000)->Unit(benchmark::kMicrosecond);
+
+/// Recovery: replays a journal of about a million records, moves and
+/// quantity changes in 64 ticks, onto a fresh copy of the world it started
+/// from. Building the world is not timed.
+static void BM_JournalReplay(benchmark::State& state) {
+  const int num_ticks = 64;
+  {
+    World world;
+    fill_world(world);
+    const vector<vector<Move>> ticks = make_ticks(world, num_ticks);
+    RewardManager& rm = world.grid().reward_manager();
+    Journal journal;
+    journal.open(JOURNAL_PATH);
+    world.set_journal(&journal);
+    for (int t = 0; t < num_ticks; ++t) {
+      world.apply_moves(ticks[t]);
+      for (RewardId id = 0; id < 6000; ++id) rm.set_quantity(rm.find((id * 13 + t) % NUM_REWARDS), 50 + t);
+      journal.commit();
+    }
+    journal.close();
+  }
+  JournalReplayStats stats;
+  for (auto _ : state) {
+    state.PauseTiming();
+    unique_ptr<World> world(new World);
+    fill_world(*world);
+    state.ResumeTiming();
+    Journal::replay(JOURNAL_PATH, *world, &stats);
+    state.PauseTiming();
+    world.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * stats.records);
+  state.counters["records"] = double(stats.records);
+  remove(JOURNAL_PATH.c_str());
+}
+BENCHMARK(BM_JournalReplay)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,327 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid.hpp>
+#include <rewardclass.hpp>
+#include <rewardmanager.hpp>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int NUM_REWARDS = 100000;
+
+/// Shared by every benchmark thread, built once by whichever gets here first.
+const vector<Reward*>& managed_rewards() {
+  static RewardManager rm;
+  static const vector<Reward*> rewards = [] {
+    for (int i = 0; i < NUM_REWARDS; ++i) {
+      Reward r(i, Reward::RewardType::DIST_TIME);
+      r.quantity() = 100;
+      rm.add_reward(r);
+    }
+    vector<Reward*> v;
+    rm.for_each_reward(Reward::RewardLevel::SMALL, [&v](RewardHandle, Reward& r) {
+      v.push_back(&r);
+    });
+    return v;
+  }();
+  return rewards;
+}
+
+constexpr int BOARD_REWARDS = 10000000;
+constexpr int BOARD_SIDE = 1 << 16;
+
+/// A board of BOARD_REWARDS rewards and their locations in the order they
+/// were added. Built once and shared, since it takes a while.
+struct Board {
+  Grid grid;
+  vector<Location> locations;
+  size_t oldest = 0;
+  RewardId next_id = 0;
+  mt19937 gen{ 77 };
+
+  Location random_location() {
+    uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+    return Location(coord(gen), coord(gen));
+  }
+
+  /// Adds a reward at a free location, which replaces locations[slot].
+  void add_reward(size_t slot) {
+    Reward r(next_id++, Reward::RewardType::DISTANCE);
+    r.quantity() = 100;
+    do {
+      r.location() = random_location();
+    } while (!add_if_free(r));
+    locations[slot] = r.location();
+  }
+
+  bool add_if_free(const Reward& r) {
+    const size_t before = grid.reward_manager().size();
+    grid.add_reward(r);
+    return grid.reward_manager().size() != before;
+  }
+};
+
+Board& board() {
+  static Board* b = [] {
+    Board* board = new Board;
+    board->locations.resize(BOARD_REWARDS, Location(0, 0));
+    for (size_t i = 0; i < board->locations.size(); ++i) board->add_reward(i);
+    return board;
+  }();
+  return *b;
+}
+
+vector<Reward> class_rewards(int num_rewards) {
+  mt19937 gen(3);
+  uniform_int_distribution<int> value(0, 1000);
+  vector<Reward> rewards;
+  for (int i = 0; i < num_rewards; ++i) {
+    rewards.emplace_back(i, Reward::RewardType::DISTANCE);
+    rewards.back().quantity() = value(gen);
+  }
+  return rewards;
+}
+
+/// RewardClass::distribute_quantity before water filling, as a baseline.
+void stepwise_distribute(vector<Reward>& rewards, uint64_t total, uint64_t quantity) {
+  auto cur = rewards.begin();
+  while (quantity > 0) {
+    const uint64_t avg = total / rewards.size();
+    while (quantity > 0 && cur != rewards.end()) {
+      if (uint64_t(cur->quantity()) <= avg) {
+        const uint64_t amount = RewardClass::distribution_step(cur->quantity(), quantity, avg);
+        cur->quantity() += int(amount);
+        total += amount;
+        quantity -= amount;
+      }
+      if (uint64_t(cur->quantity()) >= avg) ++cur;
+    }
+    if (cur == rewards.end()) cur = rewards.begin();
+  }
+}
+
+/// Largest quantity over the average, how unevenly a distribution ended up.
+double max_over_avg(const vector<Reward>& rewards) {
+  uint64_t total = 0;
+  int highest = 0;
+  for (const Reward& r : rewards) {
+    total += r.quantity();
+    highest = max(highest, r.quantity());
+  }
+  return double(highest) * rewards.size() / double(total);
+}
+
+} // end anonymous namespace
+
+/// get_influence on random rewards from every thread at once, i.e. the scan
+/// bookkeeping concurrent scanners do. items_per_second is across all threads.
+static void BM_ConcurrentGetInfluence(benchmark::State& state) {
+  const vector<Reward*>& rewards = managed_rewards();
+  mt19937 gen(state.thread_index());
+  uniform_int_distribution<int> pick(0, NUM_REWARDS - 1);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rewards[pick(gen)]->get_influence(0.5, 1));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Same with every thread hammering one reward, the worst case for contention.
+static void BM_ContendedGetInfluence(benchmark::State& state) {
+  const vector<Reward*>& rewards = managed_rewards();
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rewards[0]->get_influence(0.5, 1));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ConcurrentGetInfluence)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_ContendedGetInfluence)->ThreadRange(1, 16)->UseRealTime();
+
+/// Single threaded get_influence for one RewardType, with the player at a
+/// random spot of the outer scan ring's range. Time moves on by a second per
+/// call so DIST_TIME rewards go through both their fresh and recovering states.
+static void BM_GetInfluence(benchmark::State& state) {
+  const Reward::RewardType type = Reward::RewardType(state.range(0));
+  mt19937 gen(9);
+  uniform_int_distribution<int> offset(-1025, 1025);
+  vector<Reward> rewards;
+  vector<Player> players;
+  for (int i = 0; i < 4096; ++i) {
+    rewards.emplace_back(i, type);
+    rewards.back().quantity() = 1 + i % 1000;
+    rewards.back().location() = Location(0, 0);
+    players.emplace_back(i);
+    players.back().location() = Location(offset(gen), offset(gen));
+  }
+  size_t i = 0;
+  uint64_t now = 0;
+  for (auto _ : state) {
+    const size_t k = i++ & 4095;
+    benchmark::DoNotOptimize(rewards[k].get_influence(players[k], 0, 1025, now += 1000));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetInfluence)
+  ->Arg(int(Reward::RewardType::TRIVIAL))
+  ->Arg(int(Reward::RewardType::DISTANCE))
+  ->Arg(int(Reward::RewardType::DIST_TIME));
+
+/// value_from_location from hits within range(0) of the reward, most of them
+/// outside HIT_RADIUS for the larger range.
+static void BM_ValueFromLocation(benchmark::State& state) {
+  const int range = state.range(0);
+  mt19937 gen(10);
+  uniform_int_distribution<int> offset(-range, range);
+  Reward reward(0, Reward::RewardType::DISTANCE);
+  reward.quantity() = 1000;
+  reward.location() = Location(500, 500);
+  vector<Location> hits;
+  for (int i = 0; i < 4096; ++i) hits.emplace_back(500 + offset(gen), 500 + offset(gen));
+  size_t i = 0;
+  for (auto _ : state) benchmark::DoNotOptimize(reward.value_from_location(hits[i++ & 4095]));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ValueFromLocation)->Arg(10)->Arg(100);
+
+/// Remove the oldest reward and add a new one, on a manager holding range(0).
+static void BM_RewardManagerChurn(benchmark::State& state) {
+  const int num_rewards = state.range(0);
+  RewardManager rm;
+  for (int i = 0; i < num_rewards; ++i) rm.add_reward(Reward(i, Reward::RewardType::DISTANCE));
+
+  RewardId next = num_rewards;
+  for (auto _ : state) {
+    rm.remove_reward(rm.find(next - num_rewards));
+    rm.add_reward(Reward(next++, Reward::RewardType::DISTANCE));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_RewardManagerFind(benchmark::State& state) {
+  const int num_rewards = state.range(0);
+  RewardManager rm;
+  for (int i = 0; i < num_rewards; ++i) rm.add_reward(Reward(i, Reward::RewardType::DISTANCE));
+  mt19937 gen(7);
+  vector<RewardId> ids(4096);
+  for (auto& id : ids) id = gen() % num_rewards;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rm.get(rm.find(ids[i++ % ids.size()])));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Sum of quantities over a whole level, what distribution has to sweep.
+static void BM_RewardManagerSweepLevel(benchmark::State& state) {
+  const int num_rewards = state.range(0);
+  RewardManager rm;
+  for (int i = 0; i < num_rewards; ++i) rm.add_reward(Reward(i, Reward::RewardType::DISTANCE));
+
+  for (auto _ : state) {
+    int64_t total = 0;
+    rm.for_each_reward(Reward::RewardLevel::SMALL, [&total](RewardHandle, const Reward& r) {
+      total += r.quantity();
+    });
+    benchmark::DoNotOptimize(total);
+  }
+  state.SetItemsProcessed(state.iterations() * num_rewards);
+}
+
+BENCHMARK(BM_RewardManagerChurn)->Arg(1 << 20);
+BENCHMARK(BM_RewardManagerFind)->Arg(1 << 20);
+BENCHMARK(BM_RewardManagerSweepLevel)->Arg(1 << 20);
+
+/// Collects the range(0) oldest rewards of a 10M reward board in one batch
+/// and adds as many new ones, so the board keeps its size. items_per_second
+/// counts removals, including their redistribution and the replacements.
+static void BM_GridRemoveRewards(benchmark::State& state) {
+  Board& b = board();
+  const size_t batch = state.range(0);
+  vector<Location> collected(batch, Location(0, 0));
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch; ++i) collected[i] = b.locations[(b.oldest + i) % BOARD_REWARDS];
+    b.grid.remove_rewards(collected);
+    for (size_t i = 0; i < batch; ++i) b.add_reward((b.oldest + i) % BOARD_REWARDS);
+    b.oldest = (b.oldest + batch) % BOARD_REWARDS;
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK(BM_GridRemoveRewards)->Arg(1)->Arg(64)->Arg(4096);
+
+/// One tick of range(0) hits at random locations of the 10M reward board.
+/// Rewards the hits empty are not replaced, a tick takes a small share of the
+/// board. items_per_second counts hits.
+static void BM_GridResolveHits(benchmark::State& state) {
+  Board& b = board();
+  const size_t num_hits = state.range(0);
+  vector<HitRequest> hits;
+  hits.reserve(num_hits);
+  int64_t collected = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    hits.clear();
+    for (size_t i = 0; i < num_hits; ++i) hits.emplace_back(PlayerId(i), b.random_location());
+    state.ResumeTiming();
+    b.grid.resolve_hits(hits);
+    for (const HitRequest& hit : hits) collected += hit.value;
+  }
+  state.SetItemsProcessed(state.iterations() * num_hits);
+  state.counters["collected_per_hit"] = double(collected) / double(state.iterations() * num_hits);
+}
+
+BENCHMARK(BM_GridResolveHits)->Arg(1000)->Arg(50000);
+
+/// Distributes range(1) percent of the class total over a class of range(0)
+/// rewards. Quantities above 100% take the water filling path.
+static void BM_DistributeQuantity(benchmark::State& state) {
+  const vector<Reward> rewards = class_rewards(state.range(0));
+  uint64_t total = 0;
+  for (const Reward& r : rewards) total += r.quantity();
+  const uint64_t quantity = total * state.range(1) / 100;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    vector<Reward> copy = rewards;
+    RewardClass rc(move(copy));
+    state.ResumeTiming();
+    rc.distribute_quantity(quantity);
+    benchmark::DoNotOptimize(rc.total_quantity());
+    state.PauseTiming();
+    state.counters["max_over_avg"] = max_over_avg(rc.rewards());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_DistributeQuantityStepwise(benchmark::State& state) {
+  const vector<Reward> rewards = class_rewards(state.range(0));
+  uint64_t total = 0;
+  for (const Reward& r : rewards) total += r.quantity();
+  const uint64_t quantity = total * state.range(1) / 100;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    vector<Reward> copy = rewards;
+    state.ResumeTiming();
+    stepwise_distribute(copy, total, quantity);
+    benchmark::DoNotOptimize(copy.data());
+    state.PauseTiming();
+    state.counters["max_over_avg"] = max_over_avg(copy);
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// { rewards in the class, quantity as a percentage of the class total }
+BENCHMARK(BM_DistributeQuantity)->ArgsProduct({{1000, 100000, 1000000}, {10, 200, 10000}});
+BENCHMARK(BM_DistributeQuantityStepwise)->ArgsProduct({{1000, 100000, 1000000}, {10, 200, 10000}});
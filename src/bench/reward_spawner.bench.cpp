@@ -0,0 +1,82 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid.hpp>
+#include <reward_spawner.hpp>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int SPACING = 10;
+
+/// Request for about num_rewards rewards over a square region that a fill at
+/// SPACING just about covers.
+SpawnRequest fill_request(size_t num_rewards) {
+  SpawnRequest req;
+  req.level = Reward::RewardLevel::SMALL;
+  req.type = Reward::RewardType::DISTANCE;
+  req.quantity = 100;
+  req.count = num_rewards;
+  req.min_spacing = SPACING;
+  const int side = int(sqrt(double(num_rewards) * SPACING * SPACING / 0.6));
+  req.top_right = Location(side - 1, side - 1);
+  return req;
+}
+
+} // end anonymous namespace
+
+/// Generates range(0) rewards into an empty board on range(1) threads.
+static void BM_SpawnerGenerate(benchmark::State& state) {
+  const SpawnRequest req = fill_request(state.range(0));
+  Grid grid;
+  RewardSpawner spawner(1, unsigned(state.range(1)));
+  size_t generated = 0;
+  for (auto _ : state) {
+    generated = spawner.generate(grid, req).size();
+  }
+  state.SetItemsProcessed(state.iterations() * generated);
+  state.counters["rewards"] = double(generated);
+}
+
+/// Generates range(0) rewards and adds them to a new grid.
+static void BM_SpawnerSpawn(benchmark::State& state) {
+  const SpawnRequest req = fill_request(state.range(0));
+  size_t added = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    unique_ptr<Grid> grid(new Grid);
+    RewardSpawner spawner(1);
+    state.ResumeTiming();
+    added = spawner.spawn(*grid, req);
+    state.PauseTiming();
+    grid.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * added);
+}
+
+/// Replaces range(0) rewards at a time on a 1M reward board, the way
+/// collected rewards are replenished during play.
+static void BM_SpawnerReplenish(benchmark::State& state) {
+  static Grid* grid = [] {
+    Grid* g = new Grid;
+    RewardSpawner spawner(2);
+    spawner.spawn(*g, fill_request(1000000));
+    return g;
+  }();
+  SpawnRequest req = fill_request(1000000);
+  req.count = state.range(0);
+  RewardSpawner spawner(3);
+  spawner.set_next_id(1 << 30);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(spawner.generate(*grid, req));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_SpawnerGenerate)->ArgsProduct({{1000000, 10000000}, {1, 4}})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SpawnerSpawn)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SpawnerReplenish)->Arg(100)->Arg(10000);
@@ -0,0 +1,120 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid.hpp>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 14;
+
+/// Grid with rewards spread uniformly over a BOARD_SIDE square.
+void fill_grid(Grid& grid, int num_rewards) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1), quantity(1, 1000);
+  for (int i = 0; i < num_rewards; ++i) {
+    Reward r(i, i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::TRIVIAL);
+    r.quantity() = quantity(gen);
+    r.location() = Location(coord(gen), coord(gen));
+    grid.add_reward(r);
+  }
+}
+
+vector<Player> make_players() {
+  mt19937 gen(4321);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  vector<Player> players;
+  for (int i = 0; i < 256; ++i) {
+    players.emplace_back(i);
+    players.back().location() = Location(coord(gen), coord(gen));
+  }
+  return players;
+}
+
+/// num_rings consecutive rings evenly splitting the default [20, 1000] range.
+void make_rings(int num_rings, vector<int>& min_dists, vector<int>& max_dists) {
+  const int lo = Scan::RING_RANGES[0], hi = Scan::RING_RANGES[Scan::NUM_RINGS * 2 - 1];
+  for (int i = 0; i < num_rings; ++i) {
+    min_dists.push_back(lo + (hi - lo) * i / num_rings);
+    max_dists.push_back(lo + (hi - lo) * (i + 1) / num_rings);
+  }
+}
+
+} // end anonymous namespace
+
+/// One scan_single_ring query per ring, as scan_player used to do.
+static void BM_ScanPerRing(benchmark::State& state) {
+  const int num_rings = state.range(1);
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  const auto players = make_players();
+  vector<int> min_dists, max_dists;
+  make_rings(num_rings, min_dists, max_dists);
+
+  size_t p = 0;
+  for (auto _ : state) {
+    const Player& player = players[p++ % players.size()];
+    for (int r = 0; r < num_rings; ++r) {
+      benchmark::DoNotOptimize(grid.scan_single_ring(player, min_dists[r], max_dists[r]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_ScanRingsSinglePass(benchmark::State& state) {
+  const int num_rings = state.range(1);
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  const auto players = make_players();
+  vector<int> min_dists, max_dists;
+  make_rings(num_rings, min_dists, max_dists);
+  vector<InfluenceRing> rings(num_rings);
+
+  size_t p = 0;
+  for (auto _ : state) {
+    const Player& player = players[p++ % players.size()];
+    grid.scan_rings(player, min_dists.data(), max_dists.data(), num_rings, rings.data());
+    benchmark::DoNotOptimize(rings.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_ScanPlayer(benchmark::State& state) {
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  grid.reset_seed(42);
+  const auto players = make_players();
+
+  size_t p = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(grid.scan_player(players[p++ % players.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// One scan_players batch of 256 players per iteration. Wall time is what
+/// matters here, items_per_second is scans per second across all threads.
+static void BM_ScanPlayers(benchmark::State& state) {
+  Grid grid;
+  fill_grid(grid, state.range(0));
+  grid.reset_seed(42);
+  grid.set_scan_threads(state.range(1));
+  const auto players = make_players();
+  vector<Scan> scans(players.size());
+
+  for (auto _ : state) {
+    grid.scan_players(players, scans);
+    benchmark::DoNotOptimize(scans.data());
+  }
+  state.SetItemsProcessed(state.iterations() * players.size());
+}
+
+// { rewards on the board, number of rings }
+BENCHMARK(BM_ScanPerRing)->ArgsProduct({{200000}, {2, 4, 8, 16}});
+BENCHMARK(BM_ScanRingsSinglePass)->ArgsProduct({{200000}, {2, 4, 8, 16}});
+BENCHMARK(BM_ScanPlayer)->Arg(200000);
+// { rewards on the board, scan threads }
+BENCHMARK(BM_ScanPlayers)->ArgsProduct({{200000}, {1, 2, 4, 8, 16}})->UseRealTime();
@@ -0,0 +1,86 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <grid.hpp>
+#include <scan_batch.hpp>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 14;
+constexpr int NUM_POSITIONS = 1 << 16;
+
+/// Positions in the square around the outer scan ring, stored the way the
+/// index buckets store them.
+void make_positions(vector<int>& xs, vector<int>& ys) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(-1025, 1025);
+  for (int i = 0; i < NUM_POSITIONS; ++i) {
+    xs.push_back(coord(gen));
+    ys.push_back(coord(gen));
+  }
+}
+
+} // end anonymous namespace
+
+/// Classification alone, items_per_second is rewards per second on one core.
+static void BM_ClassifyBatch(benchmark::State& state) {
+  const BatchKernel kernel = BatchKernel(state.range(0));
+  if (!batch_kernel_supported(kernel)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  vector<int> xs, ys;
+  make_positions(xs, ys);
+  const int min_dists[] = { Scan::RING_RANGES[0], Scan::RING_RANGES[2] };
+  const int max_dists[] = { Scan::RING_RANGES[1], Scan::RING_RANGES[3] };
+  const ScanBatchRings rings(Location(0, 0), min_dists, max_dists, Scan::NUM_RINGS);
+
+  ScanBatch batch;
+  for (auto _ : state) {
+    for (int i = 0; i < NUM_POSITIONS; i += ScanBatch::SIZE) {
+      classify_batch(kernel, rings, &xs[i], &ys[i], ScanBatch::SIZE, batch);
+      benchmark::DoNotOptimize(batch);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * NUM_POSITIONS);
+}
+
+/// Whole fixed-radius scans, including the per reward influence bookkeeping.
+/// items_per_second is scans per second on one core.
+static void BM_ScanPlayerKernel(benchmark::State& state) {
+  const BatchKernel kernel = BatchKernel(state.range(0));
+  if (!batch_kernel_supported(kernel)) {
+    state.SkipWithError("kernel not supported on this CPU");
+    return;
+  }
+  Grid grid;
+  grid.set_batch_kernel(kernel);
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  for (int i = 0; i < 200000; ++i) {
+    Reward r(i, Reward::RewardType::DISTANCE);
+    r.quantity() = 100;
+    r.location() = Location(coord(gen), coord(gen));
+    grid.add_reward(r);
+  }
+  vector<Player> players;
+  for (int i = 0; i < 256; ++i) {
+    players.emplace_back(i);
+    players.back().location() = Location(coord(gen), coord(gen));
+  }
+
+  size_t p = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(grid.scan_player_fixed(players[p++ % players.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_ClassifyBatch)
+  ->ArgName("kernel")->Arg(int(BatchKernel::SCALAR))->Arg(int(BatchKernel::AVX2));
+BENCHMARK(BM_ScanPlayerKernel)
+  ->ArgName("kernel")->Arg(int(BatchKernel::SCALAR))->Arg(int(BatchKernel::AVX2));
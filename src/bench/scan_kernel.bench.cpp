@@ -0,0 +1,70 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <influence_ring.hpp>
+#include <location.hpp>
+#include <scan_kernel.hpp>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int NUM_OFFSETS = 4096;
+constexpr int MIN_DIST = 100, MAX_DIST = 1000;
+
+/// Offsets spread over the square around the outer scan ring.
+vector<Location> make_offsets() {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(-MAX_DIST, MAX_DIST);
+  vector<Location> offsets;
+  for (int i = 0; i < NUM_OFFSETS; ++i) offsets.emplace_back(coord(gen), coord(gen));
+  return offsets;
+}
+
+} // end anonymous namespace
+
+/// sqrt distance check and atan2 slice, as scan_single_ring used to classify.
+static void BM_ClassifyAtan2(benchmark::State& state) {
+  const auto offsets = make_offsets();
+  const double PI = 3.141592653589793238462;
+  const double PI2_BY_DIRS = (PI * 2.0) / double(InfluenceRing::NUM_DIRECTIONS * 2);
+  const Location origin(0, 0);
+
+  for (auto _ : state) {
+    InfluenceRing ring;
+    for (const auto& loc : offsets) {
+      double dist = origin.distanceTo(loc);
+      if (dist >= double(MIN_DIST) && dist <= double(MAX_DIST)) {
+        double rads = atan2(double(loc.y), double(loc.x));
+        int slice = (int(rads / PI2_BY_DIRS) + (InfluenceRing::NUM_DIRECTIONS * 2)) %
+                     (InfluenceRing::NUM_DIRECTIONS * 2);
+        ring.vals()[((slice + 1) / 2) % InfluenceRing::NUM_DIRECTIONS] += 1;
+      }
+    }
+    benchmark::DoNotOptimize(ring);
+  }
+  state.SetItemsProcessed(state.iterations() * NUM_OFFSETS);
+}
+
+/// Squared distance bounds and integer cross product directions.
+static void BM_ClassifyKernel(benchmark::State& state) {
+  const auto offsets = make_offsets();
+  const RingBounds bounds(MIN_DIST, MAX_DIST);
+
+  for (auto _ : state) {
+    InfluenceRing ring;
+    for (const auto& loc : offsets) {
+      if (bounds.contains(distance_squared(loc.x, loc.y))) {
+        ring.vals()[SectorClassifier<InfluenceRing::NUM_DIRECTIONS>::direction(loc.x, loc.y)] += 1;
+      }
+    }
+    benchmark::DoNotOptimize(ring);
+  }
+  state.SetItemsProcessed(state.iterations() * NUM_OFFSETS);
+}
+
+BENCHMARK(BM_ClassifyAtan2);
+BENCHMARK(BM_ClassifyKernel);
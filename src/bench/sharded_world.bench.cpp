@@ -0,0 +1,148 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <sharded_world.hpp>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 14;
+constexpr int NUM_REWARDS = 200000;
+constexpr int NUM_PLAYERS = 20000;
+
+void fill_world(ShardedWorld& world) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1), quantity(1, 1000);
+  for (int i = 0; i < NUM_REWARDS; ++i) {
+    Reward r(i, i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::TRIVIAL);
+    r.quantity() = quantity(gen);
+    r.location() = Location(coord(gen), coord(gen));
+    world.add_reward(r);
+  }
+  for (int i = 0; i < NUM_PLAYERS; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+}
+
+} // end anonymous namespace
+
+/// A batch of 1024 scans per iteration, spread over range(0) shards. Wall
+/// time is what matters, items_per_second is scans per second.
+static void BM_ShardedScanPlayers(benchmark::State& state) {
+  ShardedWorld world(unsigned(state.range(0)), 0, BOARD_SIDE);
+  fill_world(world);
+  world.reset_seed(42);
+  vector<PlayerId> ids;
+  for (PlayerId id = 0; id < NUM_PLAYERS; id += NUM_PLAYERS / 1024) ids.push_back(id);
+  vector<Scan> scans(ids.size());
+
+  for (auto _ : state) {
+    world.scan_players(ids, scans);
+    benchmark::DoNotOptimize(scans.data());
+  }
+  state.SetItemsProcessed(state.iterations() * ids.size());
+}
+BENCHMARK(BM_ShardedScanPlayers)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Arg(16)->UseRealTime()
+  ->Unit(benchmark::kMicrosecond);
+
+/// A tick of moves of every player, steps of up to range(1) per axis, back
+/// and forth, over range(0) shards. Large steps hand players off.
+static void BM_ShardedApplyMoves(benchmark::State& state) {
+  ShardedWorld world(unsigned(state.range(0)), 0, BOARD_SIDE);
+  fill_world(world);
+  mt19937 gen(4321);
+  uniform_int_distribution<int> step(-int(state.range(1)), int(state.range(1)));
+  vector<vector<Move>> moves(2);
+  for (PlayerId id = 0; id < NUM_PLAYERS; ++id) {
+    const Location l = world.find_player(id)->location();
+    moves[0].push_back(Move{ id, Location(l.x + step(gen), l.y + step(gen)) });
+    moves[1].push_back(Move{ id, l });
+  }
+
+  size_t tick = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(world.apply_moves(moves[tick++ % 2]));
+  }
+  state.SetItemsProcessed(state.iterations() * NUM_PLAYERS);
+  state.counters["handoffs"] = benchmark::Counter(double(world.handoffs()),
+                                                  benchmark::Counter::kAvgIterations);
+}
+// { shards, largest step per axis }
+BENCHMARK(BM_ShardedApplyMoves)->ArgsProduct({{1, 4, 16}, {4, 256}})->UseRealTime()
+  ->Unit(benchmark::kMicrosecond);
+
+/// The rebalancing scenario: 100k players spread over the board walk towards
+/// one point, a tenth of the way per tick with some jitter, and 2000 of them
+/// scan every tick, over 8 shards. With range(0) == 1 rebalance gets 2ms per
+/// tick. On a machine with a core per shard a tick takes as long as its
+/// busiest shard plus the rebalance, so critical_path is the sum of those per
+/// tick, and max_share is the busiest shard's share of all the shard work
+/// (1/8 at best).
+static void BM_ShardedHotSpot(benchmark::State& state) {
+  const int num_players = 100000, num_shards = 8, scans_per_tick = 2000;
+  ShardedWorld world(num_shards, 0, BOARD_SIDE);
+  mt19937 gen(99);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1), quantity(1, 1000), jitter(-50, 50);
+  for (int i = 0; i < NUM_REWARDS; ++i) {
+    Reward r(i, i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::TRIVIAL);
+    r.quantity() = quantity(gen);
+    r.location() = Location(coord(gen), coord(gen));
+    world.add_reward(r);
+  }
+  for (int i = 0; i < num_players; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+  const Location target(BOARD_SIDE / 3, BOARD_SIDE / 2);
+  world.reset_seed(1);
+  vector<Move> moves(num_players, Move{ 0, target });
+  vector<PlayerId> ids(scans_per_tick);
+  vector<Scan> scans(scans_per_tick);
+  double critical_ns = 0;
+  vector<uint64_t> last(num_shards, 0);
+
+  int tick = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (PlayerId id = 0; id < num_players; ++id) {
+      const Location l = world.find_player(id)->location();
+      moves[id] = Move{ id, Location(l.x + (target.x - l.x) / 10 + jitter(gen),
+                                     l.y + (target.y - l.y) / 10 + jitter(gen)) };
+    }
+    for (int i = 0; i < scans_per_tick; ++i) ids[i] = (tick * scans_per_tick + i) % num_players;
+    state.ResumeTiming();
+
+    world.apply_moves(moves);
+    world.scan_players(ids, scans);
+    const chrono::steady_clock::time_point rebalance_start = chrono::steady_clock::now();
+    if (state.range(0)) world.rebalance(chrono::milliseconds(2));
+    critical_ns += double(chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now() - rebalance_start).count());
+    ++tick;
+
+    uint64_t busiest = 0;
+    for (int s = 0; s < num_shards; ++s) {
+      busiest = max(busiest, world.shard_busy_ns(s) - last[s]);
+      last[s] = world.shard_busy_ns(s);
+    }
+    critical_ns += double(busiest);
+  }
+  uint64_t total = 0, most = 0;
+  for (int s = 0; s < num_shards; ++s) {
+    total += world.shard_busy_ns(s);
+    most = max(most, world.shard_busy_ns(s));
+  }
+  state.counters["critical_path_ms"] = critical_ns / 1e6;
+  state.counters["max_share"] = total ? double(most) / double(total) : 0.0;
+  state.counters["handoffs"] = double(world.handoffs());
+}
+BENCHMARK(BM_ShardedHotSpot)->Arg(0)->Arg(1)->Iterations(40)->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,139 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <snapshot.hpp>
+#include <world.hpp>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 16;
+constexpr int NUM_PLAYERS = 100000;
+
+/// What a world of num_rewards rewards is built from, the way a restart
+/// without snapshots has to replay it.
+struct WorldContents {
+  vector<Reward> rewards;
+  vector<Player> players;
+};
+
+const WorldContents& contents(size_t num_rewards) {
+  static WorldContents c;
+  if (c.rewards.size() != num_rewards) {
+    mt19937 gen(5);
+    uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+    c.rewards.clear();
+    for (size_t i = 0; i < num_rewards; ++i) {
+      Reward r(RewardId(i), Reward::RewardType::DIST_TIME);
+      r.level() = Reward::RewardLevel(i % Reward::RewardLevel::NUM_LEVELS);
+      r.quantity() = 100;
+      r.location() = Location(coord(gen), coord(gen));
+      c.rewards.push_back(r);
+    }
+    c.players.clear();
+    for (int i = 0; i < NUM_PLAYERS; ++i) {
+      Player p(i);
+      p.location() = Location(coord(gen), coord(gen));
+      c.players.push_back(p);
+    }
+  }
+  return c;
+}
+
+void replay(const WorldContents& c, World& world) {
+  for (const Reward& r : c.rewards) world.grid().add_reward(r);
+  for (const Player& p : c.players) world.player_join(p);
+}
+
+string snapshot_path(size_t num_rewards) {
+  return "/tmp/cell.bench." + to_string(num_rewards) + ".snapshot";
+}
+
+/// Writes the snapshot the load benchmarks start from, once per size.
+const string& saved_snapshot(size_t num_rewards) {
+  static size_t saved = 0;
+  static string path;
+  if (saved != num_rewards) {
+    if (!path.empty()) remove(path.c_str());
+    World world;
+    replay(contents(num_rewards), world);
+    path = snapshot_path(num_rewards);
+    save_snapshot(world, path);
+    saved = num_rewards;
+  }
+  return path;
+}
+
+} // end anonymous namespace
+
+/// Startup without snapshots: every reward through Grid::add_reward and every
+/// player through World::player_join.
+static void BM_StartupReplay(benchmark::State& state) {
+  const WorldContents& c = contents(state.range(0));
+  for (auto _ : state) {
+    unique_ptr<World> world(new World);
+    replay(c, *world);
+    benchmark::DoNotOptimize(world->num_players());
+    state.PauseTiming();
+    world.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Startup from a snapshot in the page cache, on range(1) threads.
+static void BM_StartupSnapshot(benchmark::State& state) {
+  const string& path = saved_snapshot(state.range(0));
+  for (auto _ : state) {
+    unique_ptr<World> world(new World);
+    if (!load_snapshot(path, *world, unsigned(state.range(1)))) state.SkipWithError("load failed");
+    state.PauseTiming();
+    world.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Opening the mapped snapshot alone, checksum included. Queries can run from
+/// here without building a Grid.
+static void BM_SnapshotMap(benchmark::State& state) {
+  const string& path = saved_snapshot(state.range(0));
+  for (auto _ : state) {
+    MappedSnapshot snapshot;
+    if (!snapshot.open(path, 1)) state.SkipWithError("open failed");
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// The part of a background snapshot the tick waits for.
+static void BM_SnapshotCapture(benchmark::State& state) {
+  World world;
+  replay(contents(state.range(0)), world);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(capture_records(world).rewards.size());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_StartupReplay)->Arg(100000)->Arg(1000000)->Arg(4000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StartupSnapshot)->ArgsProduct({{100000, 1000000, 4000000}, {1}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SnapshotMap)->Arg(100000)->Arg(1000000)->Arg(4000000)->Unit(benchmark::kMillisecond);
+/// The rest of it, on the writer thread before the checksum and write.
+static void BM_SnapshotBuild(benchmark::State& state) {
+  World world;
+  replay(contents(state.range(0)), world);
+  const SnapshotRecords records = capture_records(world);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(build_snapshot(records).size());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_SnapshotCapture)->Arg(100000)->Arg(1000000)->Arg(4000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SnapshotBuild)->Arg(100000)->Arg(1000000)->Arg(4000000)->Unit(benchmark::kMillisecond);
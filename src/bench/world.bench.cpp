@@ -0,0 +1,191 @@
+// google benchmark
+#include <benchmark/benchmark.h>
+#include <world.hpp>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+constexpr int BOARD_SIDE = 1 << 16;
+
+void fill_world(World& world, int num_players) {
+  mt19937 gen(1234);
+  uniform_int_distribution<int> coord(0, BOARD_SIDE - 1);
+  for (int i = 0; i < num_players; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+}
+
+/// Two ticks of moves, in the first every player steps up to max_step along
+/// each axis and in the second they step back.
+vector<vector<Move>> make_moves(const World& world, int num_players, int max_step) {
+  mt19937 gen(4321);
+  uniform_int_distribution<int> step(-max_step, max_step);
+  vector<vector<Move>> moves(2);
+  for (int i = 0; i < num_players; ++i) {
+    const Location& l = world.find_player(i)->location();
+    moves[0].push_back(Move{ i, Location(l.x + step(gen), l.y + step(gen)) });
+    moves[1].push_back(Move{ i, l });
+  }
+  return moves;
+}
+
+} // end anonymous namespace
+
+/// What moving a player took before move_player: leave and join again.
+static void BM_LeaveJoinMoves(benchmark::State& state) {
+  const int num_players = state.range(0);
+  World world;
+  fill_world(world, num_players);
+  const auto moves = make_moves(world, num_players, state.range(1));
+
+  size_t tick = 0;
+  for (auto _ : state) {
+    for (const Move& m : moves[tick++ % 2]) {
+      Player p = *world.find_player(m.id);
+      p.location() = m.to;
+      world.player_leave(m.id);
+      world.player_join(p);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_players);
+}
+
+static void BM_ApplyMoves(benchmark::State& state) {
+  const int num_players = state.range(0);
+  World world;
+  fill_world(world, num_players);
+  const auto moves = make_moves(world, num_players, state.range(1));
+
+  size_t tick = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(world.apply_moves(moves[tick++ % 2]));
+  }
+  state.SetItemsProcessed(state.iterations() * num_players);
+}
+
+// { players, largest step per axis }. Steps of 4 mostly stay inside an index
+// cell, steps of 1024 mostly don't.
+BENCHMARK(BM_LeaveJoinMoves)->ArgsProduct({{100000}, {4, 1024}});
+BENCHMARK(BM_ApplyMoves)->ArgsProduct({{100000}, {4, 1024}});
+
+/// The old std::map storage, kept as a baseline for the slot map.
+static void BM_MapJoinLeave(benchmark::State& state) {
+  const int num_players = state.range(0);
+  map<PlayerId, Player> players;
+  for (int i = 0; i < num_players; ++i) players.emplace(i, Player(i));
+
+  PlayerId next = num_players;
+  for (auto _ : state) {
+    players.erase(next - num_players);
+    players.emplace(next, Player(next));
+    ++next;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_SlotMapJoinLeave(benchmark::State& state) {
+  const int num_players = state.range(0);
+  SlotMap<Player> players;
+  vector<PlayerHandle> handles;
+  for (int i = 0; i < num_players; ++i) handles.push_back(players.insert(Player(i)));
+
+  size_t oldest = 0;
+  PlayerId next = num_players;
+  for (auto _ : state) {
+    players.erase(handles[oldest]);
+    handles[oldest] = players.insert(Player(next++));
+    oldest = (oldest + 1) % handles.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MapLookup(benchmark::State& state) {
+  const int num_players = state.range(0);
+  map<PlayerId, Player> players;
+  for (int i = 0; i < num_players; ++i) players.emplace(i, Player(i));
+  mt19937 gen(99);
+  vector<PlayerId> ids(4096);
+  for (auto& id : ids) id = gen() % num_players;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&players.find(ids[i++ % ids.size()])->second);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_SlotMapLookup(benchmark::State& state) {
+  const int num_players = state.range(0);
+  SlotMap<Player> players;
+  vector<PlayerHandle> handles;
+  for (int i = 0; i < num_players; ++i) handles.push_back(players.insert(Player(i)));
+  mt19937 gen(99);
+  vector<PlayerHandle> lookups(4096);
+  for (auto& h : lookups) h = handles[gen() % num_players];
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(players.get(lookups[i++ % lookups.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Join and leave through World, including the id table and player grid.
+static void BM_WorldJoinLeave(benchmark::State& state) {
+  const int num_players = state.range(0);
+  World world;
+  fill_world(world, num_players);
+
+  PlayerId next = num_players;
+  for (auto _ : state) {
+    world.player_leave(next - num_players);
+    Player p(next++);
+    p.location() = Location(next % BOARD_SIDE, (next / BOARD_SIDE) % BOARD_SIDE);
+    world.player_join(p);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_WorldFindPlayer(benchmark::State& state) {
+  const int num_players = state.range(0);
+  World world;
+  fill_world(world, num_players);
+  mt19937 gen(99);
+  vector<PlayerId> ids(4096);
+  for (auto& id : ids) id = gen() % num_players;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(world.find_player(ids[i++ % ids.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// One pass over every player, what a tick has to do at least once.
+static void BM_WorldIteratePlayers(benchmark::State& state) {
+  const int num_players = state.range(0);
+  World world;
+  fill_world(world, num_players);
+
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const Player& p : world.players()) sum += p.location().x;
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * num_players);
+}
+
+BENCHMARK(BM_MapJoinLeave)->Arg(1 << 20);
+BENCHMARK(BM_SlotMapJoinLeave)->Arg(1 << 20);
+BENCHMARK(BM_MapLookup)->Arg(1 << 20);
+BENCHMARK(BM_SlotMapLookup)->Arg(1 << 20);
+BENCHMARK(BM_WorldJoinLeave)->Arg(1 << 20);
+BENCHMARK(BM_WorldFindPlayer)->Arg(1 << 20);
+BENCHMARK(BM_WorldIteratePlayers)->Arg(1 << 20);
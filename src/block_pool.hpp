@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file block_pool.hpp
+/// @brief Pooled object storage in fixed blocks, addressed through
+///        generational handles.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_BLOCK_POOL_HPP
+#define CELL_BLOCK_POOL_HPP
+
+// std
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// cell
+#include <slot_map.hpp>
+
+namespace cell {
+
+/** @brief Objects live in blocks of BLOCK_SIZE slots that are allocated as
+  *        needed and never move, so a slot's address follows from its index
+  *        alone and pointers stay valid until the object is erased. Erased
+  *        slots are reused before the pool grows, and iterating is a sweep
+  *        over the blocks in slot order.
+  *
+  *        Unlike SlotMap, resolving a handle needs no lookup table: the block
+  *        list is small enough to stay in cache, which matters when handles
+  *        are resolved per scan candidate.
+  */
+template<class T>
+class BlockPool {
+public:
+
+  typedef SlotHandle Handle;
+
+  constexpr static int BLOCK_SHIFT = 12;
+  constexpr static std::size_t BLOCK_SIZE = std::size_t(1) << BLOCK_SHIFT;
+
+  BlockPool() = default;
+  ~BlockPool() { clear(); }
+
+  Handle insert(const T& t) { return emplace(t); }
+  Handle insert(T&& t) { return emplace(std::move(t)); }
+
+  /// @return True if h named an object, which is now gone.
+  bool erase(Handle h);
+
+  /// The object h names, nullptr if it was erased.
+  T* get(Handle h) { return contains(h) ? slot(h.index) : nullptr; }
+  const T* get(Handle h) const { return contains(h) ? slot(h.index) : nullptr; }
+
+  /// Same as get for a handle known to be valid, without checking it.
+  T& at(Handle h) { return *slot(h.index); }
+  const T& at(Handle h) const { return *slot(h.index); }
+
+  /// The object in slot i (< capacity()), nullptr if the slot is free.
+  T* get_slot(std::uint32_t i) { return live(generations_[i]) ? slot(i) : nullptr; }
+
+  bool contains(Handle h) const {
+    return h.index < generations_.size() && generations_[h.index] == h.generation;
+  }
+
+  /// Calls fn(handle, object) for every object, in slot order.
+  template<class Fn>
+  void for_each(Fn&& fn);
+  template<class Fn>
+  void for_each(Fn&& fn) const;
+
+  /// Destroys every object. Outstanding handles stop resolving.
+  void clear();
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /// Number of slots, used or not. Slots are never given back.
+  std::size_t capacity() const { return generations_.size(); }
+
+private:
+
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_t;
+
+  // Odd generations mark used slots, so a handle never matches a free slot.
+  static bool live(std::uint32_t generation) { return (generation & 1) != 0; }
+
+  T* slot(std::uint32_t i) {
+    return reinterpret_cast<T*>(&blocks_[i >> BLOCK_SHIFT][i & (BLOCK_SIZE - 1)]);
+  }
+  const T* slot(std::uint32_t i) const {
+    return reinterpret_cast<const T*>(&blocks_[i >> BLOCK_SHIFT][i & (BLOCK_SIZE - 1)]);
+  }
+
+  template<class U>
+  Handle emplace(U&& u);
+
+  std::vector<std::unique_ptr<storage_t[]>> blocks_;
+  std::vector<std::uint32_t> generations_;
+  std::vector<std::uint32_t> free_;
+  std::size_t size_ = 0;
+
+  // No copy construction/assignment.
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///                             IMPLEMENTATION                               ///
+////////////////////////////////////////////////////////////////////////////////
+
+template<class T>
+constexpr int BlockPool<T>::BLOCK_SHIFT;
+
+template<class T>
+constexpr std::size_t BlockPool<T>::BLOCK_SIZE;
+
+template<class T>
+template<class U>
+typename BlockPool<T>::Handle BlockPool<T>::emplace(U&& u) {
+  std::uint32_t i;
+  if (!free_.empty()) {
+    i = free_.back();
+    free_.pop_back();
+  } else {
+    i = std::uint32_t(generations_.size());
+    if ((i & (BLOCK_SIZE - 1)) == 0) blocks_.emplace_back(new storage_t[BLOCK_SIZE]);
+    generations_.push_back(0);
+  }
+  new (slot(i)) T(std::forward<U>(u));
+  ++size_;
+  return Handle{ i, ++generations_[i] };
+}
+
+template<class T>
+bool BlockPool<T>::erase(Handle h) {
+  if (!contains(h)) return false;
+  slot(h.index)->~T();
+  ++generations_[h.index];
+  free_.push_back(h.index);
+  --size_;
+  return true;
+}
+
+template<class T>
+template<class Fn>
+void BlockPool<T>::for_each(Fn&& fn) {
+  for (std::uint32_t i = 0; i < generations_.size(); ++i) {
+    if (live(generations_[i])) fn(Handle{ i, generations_[i] }, *slot(i));
+  }
+}
+
+template<class T>
+template<class Fn>
+void BlockPool<T>::for_each(Fn&& fn) const {
+  for (std::uint32_t i = 0; i < generations_.size(); ++i) {
+    if (live(generations_[i])) fn(Handle{ i, generations_[i] }, *slot(i));
+  }
+}
+
+template<class T>
+void BlockPool<T>::clear() {
+  for (std::uint32_t i = 0; i < generations_.size(); ++i) {
+    if (live(generations_[i])) {
+      slot(i)->~T();
+      ++generations_[i];
+      free_.push_back(i);
+    }
+  }
+  size_ = 0;
+}
+
+} // end namespace cell
+
+#endif // CELL_BLOCK_POOL_HPP
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file game_clock.hpp
+/// @brief Source of game time for scans and reward recovery.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_GAME_CLOCK_HPP
+#define CELL_GAME_CLOCK_HPP
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cell {
+
+/** @brief Game time in milliseconds. The grid samples it once per scan (or
+  *        once per scan_players batch) rather than once per reward, so every
+  *        reward in a scan sees the same time. Implementations must be safe
+  *        to read from several threads.
+  */
+class GameClock {
+public:
+  virtual ~GameClock() { }
+
+  /// Milliseconds since some fixed point, never decreasing.
+  virtual uint64_t now_ms() const = 0;
+
+  /// Shared wall clock, the default for every Grid.
+  static const GameClock& system();
+};
+
+/// Wall clock time, milliseconds since the epoch.
+class SystemClock : public GameClock {
+public:
+  uint64_t now_ms() const override {
+    return std::chrono::duration_cast<std::chrono::milliseconds>
+             (std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+};
+
+/** @brief Time that only moves when told to. Used by tests and by
+  *        simulations that step the game a fixed amount per tick.
+  */
+class ManualClock : public GameClock {
+public:
+  explicit ManualClock(uint64_t start_ms = 0) : now_(start_ms) { }
+
+  uint64_t now_ms() const override { return now_.load(std::memory_order_relaxed); }
+
+  void set(uint64_t ms) { now_.store(ms, std::memory_order_relaxed); }
+  void advance(uint64_t ms) { now_.fetch_add(ms, std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> now_;
+};
+
+/** @brief Wall clock running speed times faster than real time, starting at
+  *        start_ms when constructed. A speed of 3600 plays an hour of reward
+  *        recovery per second, for load testing.
+  */
+class ScaledClock : public GameClock {
+public:
+  explicit ScaledClock(double speed, uint64_t start_ms = 0)
+    : speed_(speed), start_ms_(start_ms), start_(std::chrono::steady_clock::now()) { }
+
+  uint64_t now_ms() const override {
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_;
+    return start_ms_ + uint64_t(elapsed.count() * speed_);
+  }
+
+  double speed() const { return speed_; }
+
+private:
+  double speed_;
+  uint64_t start_ms_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+inline const GameClock& GameClock::system() {
+  static const SystemClock clock;
+  return clock;
+}
+
+} // end namespace cell
+
+#endif // CELL_GAME_CLOCK_HPP
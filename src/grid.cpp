@@ -8,33 +8,154 @@
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
+// std
+#include <algorithm>
+#include <limits>
+
+// cell
 #include <grid.hpp>
+#include <hash.hpp>
+#include <scan_kernel.hpp>
 
-namespace {
+namespace cell {
 
-constexpr static double PI = 3.141592653589793238462;
-constexpr static double PI2_BY_DIRS = (PI * 2.0) / double(cell::InfluenceRing::NUM_DIRECTIONS * 2);
+namespace {
 
+/// Seed of the random stream for one scan of a scan_players batch.
+std::mt19937::result_type scan_stream_seed(std::uint64_t seed, std::uint64_t batch, PlayerId id)
+{
+  return std::mt19937::result_type(
+      mix64(mix64(seed + batch * 0x9e3779b97f4a7c15ULL) + std::uint32_t(id)));
 }
 
-namespace cell {
+} // end anonymous namespace
+
+constexpr double Grid::DEFAULT_AGGREGATE_ERROR;
 
 void Grid::add_reward(const Reward& reward)
 {
-  reward_grid_.insert(reward.location(), reward_man_.add_reward(reward));
+  if (reward_grid_.contains(reward.location()) || reward_man_.contains(reward.id())) return;
+  const RewardHandle h = reward_man_.add_reward(reward);
+  if (reward_grid_.insert(reward.location(), h) &&
+      reward_man_.get(h)->type() == Reward::RewardType::DIST_TIME) {
+    timed_reward_grid_.insert(reward.location(), h);
+  }
+  apply_reward_changes();
+}
+
+std::size_t Grid::add_rewards(span<const Reward> rewards)
+{
+  reward_man_.reserve(rewards.size());
+  std::size_t added = 0;
+  for (const Reward& reward : rewards) {
+    if (reward_grid_.contains(reward.location()) || reward_man_.contains(reward.id())) continue;
+    const RewardHandle h = reward_man_.add_reward(reward);
+    if (reward_grid_.insert(reward.location(), h)) {
+      ++added;
+      if (reward.type() == Reward::RewardType::DIST_TIME) {
+        timed_reward_grid_.insert(reward.location(), h);
+      }
+    }
+  }
+  apply_reward_changes();
+  return added;
 }
 
 void Grid::remove_reward(const Location& location)
 {
-  Reward* r;
-  if (reward_grid_.remove(location, r)) {
-    reward_man_.remove_reward(*r);
+  RewardHandle h;
+  if (reward_grid_.remove(location, h)) {
+    timed_reward_grid_.erase(location);
+    reward_man_.remove_reward(h);
+    apply_reward_changes();
   }
 }
 
-Scan Grid::scan_player(const Player& player)
+void Grid::discard_reward(const Location& location)
+{
+  RewardHandle h;
+  if (reward_grid_.remove(location, h)) {
+    timed_reward_grid_.erase(location);
+    reward_man_.discard_reward(h);
+    apply_reward_changes();
+  }
+}
+
+void Grid::remove_rewards(span<const Location> locations)
+{
+  removed_.clear();
+  for (const Location& l : locations) {
+    RewardHandle h;
+    if (reward_grid_.remove(l, h)) {
+      timed_reward_grid_.erase(l);
+      removed_.push_back(h);
+    }
+  }
+  if (removed_.empty()) return;
+  reward_man_.remove_rewards(removed_);
+  apply_reward_changes();
+}
+
+void Grid::resolve_hits(span<HitRequest> hits)
+{
+  const int reach = int(Reward::HIT_RADIUS);
+  hit_claims_.clear();
+  for (std::uint32_t i = 0; i < hits.size(); ++i) {
+    HitRequest& hit = hits[i];
+    hit.value = 0;
+    const Location& l = hit.location;
+    // Straight over the index storage, the distance test also drops everything
+    // outside the rectangle.
+    reward_grid_.for_each_cell_in_rect(Location(l.x - reach, l.y - reach),
+                                       Location(l.x + reach, l.y + reach),
+      [&](const int* xs, const int* ys, const RewardHandle* rewards, std::size_t count) {
+        for (std::size_t j = 0; j < count; ++j) {
+          const std::int64_t d2 = distance_squared(std::int64_t(xs[j]) - l.x,
+                                                   std::int64_t(ys[j]) - l.y);
+          if (d2 <= Reward::MAX_HIT_DISTANCE2) {
+            hit_claims_.push_back(HitClaim{ rewards[j], d2, hit.player, i });
+          }
+        }
+      });
+  }
+  if (hit_claims_.empty()) return;
+
+  // Group the claims by reward, in payout order within each reward.
+  std::sort(hit_claims_.begin(), hit_claims_.end(), [](const HitClaim& a, const HitClaim& b) {
+    if (a.reward.level != b.reward.level) return a.reward.level < b.reward.level;
+    if (a.reward.slot.index != b.reward.slot.index) return a.reward.slot.index < b.reward.slot.index;
+    if (a.distance2 != b.distance2) return a.distance2 < b.distance2;
+    if (a.player != b.player) return a.player < b.player;
+    return a.hit < b.hit;
+  });
+
+  removed_.clear();
+  for (std::size_t first = 0; first < hit_claims_.size(); ) {
+    const RewardHandle h = hit_claims_[first].reward;
+    Reward& reward = reward_man_.at(h);
+    int remaining = reward.quantity();
+    std::size_t last = first;
+    for (; last < hit_claims_.size() && hit_claims_[last].reward == h; ++last) {
+      const int value = std::min(remaining, reward.hit_value(hit_claims_[last].distance2));
+      hits[hit_claims_[last].hit].value += value;
+      remaining -= value;
+    }
+    first = last;
+
+    // Collected quantity leaves the board, only what is left gets redistributed.
+    reward_man_.set_quantity(h, remaining);
+    if (remaining == 0) {
+      reward_grid_.erase(reward.location());
+      timed_reward_grid_.erase(reward.location());
+      removed_.push_back(h);
+    }
+  }
+  reward_man_.remove_rewards(removed_);
+  apply_reward_changes();
+}
+
+void Grid::random_ring_ranges(std::mt19937& gen, int* min_dists, int* max_dists)
 {
-  Scan result;
   for (int i = 0; i < Scan::NUM_RINGS; ++i) {
     // A scan with range [min, max] will be [min +- var, max +- var].
     std::uniform_int_distribution<int> dist(-Scan::RING_RANGE_VARIANCE[i],
@@ -42,69 +163,308 @@ Scan Grid::scan_player(const Player& player)
     // Declaring these beforehand rather than inline so that we are guaranteed
     // the order of the random number generations (this makes unit testing with
     // a given seed possible).
-    int var1 = dist(rand_gen_);
-    int var2 = dist(rand_gen_);
-    result.rings()[i] = scan_single_ring(player, 
-                                         Scan::RING_RANGES[i*2] + var1,
-                                         Scan::RING_RANGES[(i*2)+1] + var2);
+    int var1 = dist(gen);
+    int var2 = dist(gen);
+    min_dists[i] = Scan::RING_RANGES[i*2] + var1;
+    max_dists[i] = Scan::RING_RANGES[(i*2)+1] + var2;
   }
+}
+
+Scan Grid::scan_player(const Player& player)
+{
+  Scan result;
+  int min_dists[Scan::NUM_RINGS], max_dists[Scan::NUM_RINGS];
+  random_ring_ranges(rand_gen_, min_dists, max_dists);
+  const StatsTimer timer;
+  ScanCounts counts;
+  const std::uint64_t now = clock_->now_ms();
+  scan_all_rings(player, min_dists, max_dists, result,
+                 [now](Reward* r, double falloff) { return r->get_influence(falloff, now); }, counts);
+  stats_.record_scan(counts, timer.elapsed_ns());
   return result;
 }
 
+void Grid::scan_players(span<const Player> players, span<Scan> out)
+{
+  const std::size_t n = std::min(players.size(), out.size());
+  const std::uint64_t batch = scan_batches_++;
+  const std::uint64_t now = clock_->now_ms();
+  if (scan_hits_.size() < n) scan_hits_.resize(n);
+  if (!scan_pool_) scan_pool_.reset(new ThreadPool(scan_threads_));
+  update_aggregates();
+
+  // Scans only read the rewards, so they can run side by side.
+  scan_pool_->parallel_for(n, 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      int min_dists[Scan::NUM_RINGS], max_dists[Scan::NUM_RINGS];
+      scan_players_ranges(scan_seed_, batch, players[i].id(), min_dists, max_dists);
+      scan_hits_[i].clear();
+      out[i] = Scan();
+      scan_player_into(players[i], min_dists, max_dists, now, out[i], scan_hits_[i]);
+    }
+  });
+
+  // Every scan records the same time, so the order the records land in
+  // doesn't change the outcome.
+  scan_pool_->parallel_for(n, 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) record_hits(scan_hits_[i], now);
+  });
+}
+
+void Grid::scan_players_ranges(std::uint64_t seed, std::uint64_t batch, PlayerId id,
+                               int* min_dists, int* max_dists)
+{
+  std::mt19937 gen(scan_stream_seed(seed, batch, id));
+  random_ring_ranges(gen, min_dists, max_dists);
+}
+
+void Grid::scan_player_into(const Player& player, const int* min_dists, const int* max_dists,
+                            std::uint64_t now, Scan& out, std::vector<Reward*>& hits)
+{
+  const StatsTimer timer;
+  ScanCounts counts;
+  scan_all_rings(player, min_dists, max_dists, out, [&](Reward* r, double falloff) {
+    hits.push_back(r);
+    return r->influence_at(falloff, now);
+  }, counts);
+  stats_.record_scan(counts, timer.elapsed_ns());
+}
+
 Scan Grid::scan_player_fixed(const Player& player)
 {
   Scan result;
+  int min_dists[Scan::NUM_RINGS], max_dists[Scan::NUM_RINGS];
   for (int i = 0; i < Scan::NUM_RINGS; ++i) {
-    result.rings()[i] = scan_single_ring(player, 
-                                         Scan::RING_RANGES[i*2],
-                                         Scan::RING_RANGES[(i*2)+1]);
+    min_dists[i] = Scan::RING_RANGES[i*2];
+    max_dists[i] = Scan::RING_RANGES[(i*2)+1];
   }
+  const StatsTimer timer;
+  ScanCounts counts;
+  const std::uint64_t now = clock_->now_ms();
+  scan_all_rings(player, min_dists, max_dists, result,
+                 [now](Reward* r, double falloff) { return r->get_influence(falloff, now); }, counts);
+  stats_.record_scan(counts, timer.elapsed_ns());
   return result;
 }
 
 InfluenceRing Grid::scan_single_ring(const Player& player, int minDist, int maxDist)
 {
   InfluenceRing result;
+  scan_rings(player, &minDist, &maxDist, 1, &result);
+  return result;
+}
 
-  const Location& ploc = player.location();
+void Grid::scan_rings(const Player& player, const int* min_dists, const int* max_dists,
+                      int num_rings, InfluenceRing* rings)
+{
+  const StatsTimer timer;
+  ScanCounts counts;
+  // One timestamp for the whole scan.
+  const std::uint64_t now = clock_->now_ms();
+  scan_rings_with(reward_grid_, player, min_dists, max_dists, num_rings, rings,
+                  [now](Reward* r, double falloff) { return r->get_influence(falloff, now); }, counts);
+  stats_.record_ring_scan(counts, timer.elapsed_ns());
+}
 
-  // Obtain vector of possible rewards based on the rectangle around the player's
-  // location that encompasses the largest scan ring.
-  Location bottom_left(ploc.x - maxDist, ploc.y - maxDist);
-  Location top_right(ploc.x + maxDist, ploc.y + maxDist);
-  auto potential_rewards = reward_grid_.find(bottom_left, top_right);
-
-  for (auto& reward_pair : potential_rewards) {
-    const Location& loc = reward_pair.first;
-
-    // Distance check first.
-    double dist = ploc.distanceTo(loc);
-
-    if (dist >= double(minDist) && dist <= double(maxDist)) {
-
-      // Satisfied distance contraint, determine which slice of 
-      // the scan pie this rewards falls into.
-      double rads = atan2(double(loc.y - ploc.y), double(loc.x - ploc.x));
-      int slice = (int(rads / PI2_BY_DIRS) + 
-                   (InfluenceRing::NUM_DIRECTIONS * 2)) % 
-                    (InfluenceRing::NUM_DIRECTIONS * 2);
-
-      // slice is now in range [0, num_dirs*2], actual slice to go in will be
-      // ((slice + 1) / 2) % num_dirs
-      // For example, slice index 15 = (15 + 1)/2 = 8 % 8 = zeroth slice. (east)
-      //              slice index 0 = (0 + 1)/2 = 0.5 % 8 = zeroth slice. (east)
-      //              slice index 1 = (1 + 1)/2 = 1 % 8 = index 1 slice (north-east)
-      result.vals()[ ((slice + 1) / 2) % InfluenceRing::NUM_DIRECTIONS ] += 
-        reward_pair.second->get_influence(player, minDist, maxDist);
+void Grid::scan_rings_aggregate(const Player& player, const int* min_dists, const int* max_dists,
+                                int num_rings, InfluenceRing* rings)
+{
+  update_aggregates();
+  for (int r = 0; r < num_rings; ++r) {
+    aggregate_tree_.scan_ring(player.location(), min_dists[r], max_dists[r], aggregate_error_,
+                              rings[r]);
+  }
+  const StatsTimer timer;
+  ScanCounts counts;
+  const std::uint64_t now = clock_->now_ms();
+  scan_rings_with(timed_reward_grid_, player, min_dists, max_dists, num_rings, rings,
+                  [now](Reward* r, double falloff) { return r->get_influence(falloff, now); }, counts);
+  stats_.record_ring_scan(counts, timer.elapsed_ns());
+}
+
+template<class Influence>
+void Grid::scan_all_rings(const Player& player, const int* min_dists, const int* max_dists,
+                          Scan& result, Influence&& influence, ScanCounts& counts)
+{
+  int num_exact = 0, num_aggregate = 0;
+  int exact[Scan::NUM_RINGS], aggregate[Scan::NUM_RINGS];
+  for (int i = 0; i < Scan::NUM_RINGS; ++i) {
+    if (ring_modes_[i] == RingMode::EXACT) {
+      exact[num_exact++] = i;
+    } else {
+      aggregate[num_aggregate++] = i;
     }
   }
+  if (num_aggregate == 0) {
+    scan_rings_with(reward_grid_, player, min_dists, max_dists, Scan::NUM_RINGS,
+                    &result.rings()[0], influence, counts);
+    return;
+  }
 
-  return result;
+  // Each group of rings is scanned in one pass over its own rewards.
+  const auto scan_group = [&](GridMap<RewardHandle>& rewards, const int* group, int num) {
+    int group_min[Scan::NUM_RINGS], group_max[Scan::NUM_RINGS];
+    InfluenceRing group_rings[Scan::NUM_RINGS];
+    for (int k = 0; k < num; ++k) {
+      group_min[k] = min_dists[group[k]];
+      group_max[k] = max_dists[group[k]];
+    }
+    scan_rings_with(rewards, player, group_min, group_max, num, group_rings, influence, counts,
+                    group);
+    for (int k = 0; k < num; ++k) result.rings()[group[k]] += group_rings[k];
+  };
+
+  scan_group(reward_grid_, exact, num_exact);
+  update_aggregates();
+  for (int k = 0; k < num_aggregate; ++k) {
+    const int i = aggregate[k];
+    aggregate_tree_.scan_ring(player.location(), min_dists[i], max_dists[i], aggregate_error_,
+                              result.rings()[i]);
+  }
+  scan_group(timed_reward_grid_, aggregate, num_aggregate);
+}
+
+void Grid::invalidate_aggregates()
+{
+  aggregates_stale_.store(true);
+  reward_man_.set_change_log(nullptr);
+  reward_changes_.clear();
+}
+
+void Grid::update_aggregates()
+{
+  if (!aggregates_stale_.load(std::memory_order_acquire)) return;
+  std::lock_guard<std::mutex> lock(aggregates_mutex_);
+  if (!aggregates_stale_.load(std::memory_order_relaxed)) return;
+
+  std::vector<AggregateTree::Entry> entries;
+  entries.reserve(reward_grid_.size());
+  const int lo = std::numeric_limits<int>::min(), hi = std::numeric_limits<int>::max();
+  reward_grid_.for_each_in_rect(Location(lo, lo), Location(hi, hi),
+                                [&](const Location& l, RewardHandle h) {
+    const Reward* r = reward_man_.get(h);
+    entries.push_back(AggregateTree::Entry{ l.x, l.y, r->quantity(), r->type() });
+  });
+  aggregate_tree_.build(std::move(entries));
+  // From here on the tree follows the changes instead of being rebuilt.
+  reward_changes_.clear();
+  reward_man_.set_change_log(&reward_changes_);
+  aggregates_stale_.store(false, std::memory_order_release);
+}
+
+void Grid::apply_reward_changes()
+{
+  if (reward_changes_.empty()) return;
+  for (const Location& l : reward_changes_) {
+    const RewardHandle* h = reward_grid_.get(l);
+    if (h == nullptr) {
+      aggregate_tree_.erase(l);
+      continue;
+    }
+    const Reward* r = reward_man_.get(*h);
+    aggregate_tree_.update(AggregateTree::Entry{ l.x, l.y, r->quantity(), r->type() });
+  }
+  reward_changes_.clear();
+  // Still on the thread changing the rewards, not on the scans.
+  if (aggregate_tree_.fragmented()) aggregate_tree_.rebuild();
+}
+
+template<class Influence>
+void Grid::scan_rings_with(GridMap<RewardHandle>& rewards, const Player& player, const int* min_dists,
+                           const int* max_dists, int num_rings, InfluenceRing* rings,
+                           Influence&& influence, ScanCounts& counts, const int* ring_ids)
+{
+  // The batch kernels take a limited number of rings at once. Later chunks
+  // still reach each reward after the earlier ones, so every reward sees its
+  // rings in order.
+  for (int first = 0; first < num_rings; first += ScanBatchRings::MAX_RINGS) {
+    scan_ring_batch(rewards, player, ScanBatchRings(player.location(), min_dists + first,
+                                           max_dists + first, num_rings - first),
+                    max_dists + first, rings + first, influence, counts,
+                    ring_ids ? ring_ids + first : nullptr, first);
+  }
+}
+
+template<class Influence>
+void Grid::scan_ring_batch(GridMap<RewardHandle>& reward_map, const Player& player,
+                           const ScanBatchRings& batch_rings, const int* max_dists,
+                           InfluenceRing* rings, Influence& influence, ScanCounts& counts,
+                           const int* ring_ids, int first_ring)
+{
+  const Location& ploc = player.location();
+
+  // One query over the rectangle that encompasses the largest ring.
+  int max_range = std::numeric_limits<int>::min();
+  for (int r = 0; r < batch_rings.num_rings; ++r) max_range = std::max(max_range, max_dists[r]);
+  if (max_range < 0) return;
+
+  // Index cells overlapping the rectangle can hold rewards up to one cell
+  // further out. The vector kernels are only exact for offsets they can hold.
+  const std::int64_t reach = std::int64_t(max_range) + (std::int64_t(1) << reward_map.cell_shift());
+  const BatchKernel kernel = reach < ScanBatchRings::MAX_VECTOR_OFFSET ? batch_kernel_ :
+                                                                         BatchKernel::SCALAR;
+
+  // The cells around the player's location are classified a batch at a time
+  // straight from the index storage, nothing is allocated per candidate.
+  // Ring membership is exact, so rewards outside the rectangle drop out there.
+  Location bottom_left(ploc.x - max_range, ploc.y - max_range);
+  Location top_right(ploc.x + max_range, ploc.y + max_range);
+  ScanBatch batch;
+  // Counted in locals and added to counts once the query is done.
+  std::uint64_t cells = 0, fetched = 0;
+  std::uint64_t accepted[ScanBatchRings::MAX_RINGS] = {};
+  std::uint64_t calls[GridStats::NUM_TYPES] = {};
+  reward_map.for_each_cell_in_rect(bottom_left, top_right,
+                                   [&](const int* xs, const int* ys, const RewardHandle* rewards,
+                                       std::size_t count) {
+    if (STATS_ENABLED) {
+      ++cells;
+      fetched += count;
+    }
+    for (std::size_t first = 0; first < count; first += ScanBatch::SIZE) {
+      const int lanes = int(std::min<std::size_t>(ScanBatch::SIZE, count - first));
+      classify_batch(kernel, batch_rings, xs + first, ys + first, lanes, batch);
+
+      for (int i = 0; i < lanes; ++i) {
+        if (batch.ring_mask[i] == 0) continue;
+        Reward* reward = &reward_man_.at(rewards[first + i]);
+        if (STATS_ENABLED) calls[int(reward->type())] += __builtin_popcount(batch.ring_mask[i]);
+        // Rings are visited in order so each reward sees the same sequence of
+        // get_influence calls as it would with one scan_single_ring per ring.
+        for (std::uint32_t mask = batch.ring_mask[i]; mask != 0; mask &= mask - 1) {
+          const int r = __builtin_ctz(mask);
+          rings[r].vals()[batch.direction[i]] +=
+            influence(reward, batch.falloff[r][i]);
+          if (STATS_ENABLED) ++accepted[r];
+        }
+      }
+    }
+  });
+  if (STATS_ENABLED) {
+    ++counts.queries;
+    counts.cells += cells;
+    counts.candidates += fetched;
+    // Every reward fetched is a candidate for each ring of the batch.
+    for (int r = 0; r < batch_rings.num_rings; ++r) {
+      GridStats::Ring& ring = counts.ring(ring_ids ? ring_ids[r] : first_ring + r);
+      ring.candidates += fetched;
+      ring.accepted += accepted[r];
+    }
+    for (int t = 0; t < GridStats::NUM_TYPES; ++t) counts.influence_calls[t] += calls[t];
+  }
 }
 
 void Grid::reset_seed(std::mt19937::result_type seed)
 {
   rand_gen_.seed(seed);
+  scan_seed_ = seed;
+  scan_batches_ = 0;
+}
+
+void Grid::set_scan_threads(unsigned num_threads)
+{
+  if (num_threads != scan_threads_) scan_pool_.reset();
+  scan_threads_ = num_threads;
 }
 
 } // end namespace cell
@@ -12,31 +12,90 @@
 #define CELL_GRID_HPP
 
 // std
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <vector>
 
 // cell
+#include <aggregate_tree.hpp>
+#include <game_clock.hpp>
 #include <grid_map.hpp>
 #include <grid_multimap.hpp>
+#include <grid_stats.hpp>
 #include <player.hpp>
 #include <reward.hpp>
 #include <scan.hpp>
+#include <scan_batch.hpp>
+#include <span.hpp>
+#include <thread_pool.hpp>
 #include <rewardmanager.hpp>
 
 namespace cell {
 
+/// One player's hit at a location, see Grid::resolve_hits.
+struct HitRequest {
+  PlayerId player;
+  Location location;
+  /// Output, the quantity the hit collected.
+  int value;
+
+  HitRequest(PlayerId p, const Location& l) : player(p), location(l), value(0) { }
+};
+
 class Grid {
 public:
 
+  /// How the rings of scan_player, scan_player_fixed and scan_players are
+  /// computed, see set_ring_mode.
+  enum class RingMode {
+    EXACT,       // Every reward in range is visited.
+    AGGREGATE    // Approximated from the aggregate tree, see AggregateTree.
+  };
+
+  /// Default for aggregate_error().
+  constexpr static double DEFAULT_AGGREGATE_ERROR = 0.02;
+
   // Constructors
-  Grid() { rand_gen_.seed(rand_device_()); }
+  Grid() { reset_seed(rand_device_()); }
 
   /// Adds a reward to the grid. The location at which this reward will be
-  /// added is stored inside the Reward itself.
+  /// added is stored inside the Reward itself. Does nothing if another reward
+  /// is already at that location or has the same id.
   void add_reward(const Reward& reward);
 
-  /// Removes a reward from the grid at a given location.
+  /// Adds a batch of rewards, such as a RewardSpawner's, the same way.
+  /// @return Number of rewards added.
+  std::size_t add_rewards(span<const Reward> rewards);
+
+  /// Removes a reward from the grid at a given location. Its remaining
+  /// quantity goes back to its level, see RewardManager::remove_reward.
   void remove_reward(const Location& location);
 
+  /// Removes the rewards at a batch of locations, with one redistribution per
+  /// level for the whole batch. Locations without a reward are skipped.
+  void remove_rewards(span<const Location> locations);
+
+  /// Removes the reward at a location without redistributing its quantity,
+  /// see RewardManager::discard_reward.
+  void discard_reward(const Location& location);
+
+  /** @brief Resolves a tick's worth of hits at once. Each hit collects from
+    *        every reward within Reward::HIT_RADIUS, the value given by
+    *        Reward::hit_value from the quantity the reward had at the start of
+    *        the batch, into its value member.
+    *
+    *        When the hits on a reward want more than it holds, the closest
+    *        hits are paid first, ties going to the lower player id and then
+    *        the earlier request, so the outcome does not depend on the order
+    *        of the requests. Rewards are decremented by what was collected and
+    *        the ones left empty are removed from the grid.
+    */
+  void resolve_hits(span<HitRequest> hits);
+
   /** @brief Obtains a scan of the rewards around the given player.
     *        The location of the player is not verified in the grid, it
     *        is simply taken from the provided player object.
@@ -44,34 +103,206 @@ public:
   Scan scan_player(const Player& player);
 
   /** @brief Same functionality as scan_player EXCEPT does not randomize
-    *        the radii of the scan rings.
+    *        the radii of the scan rings. Unlike scan_player this can be
+    *        called from several threads at once, as can scan_rings, as long
+    *        as nothing adds or removes rewards meanwhile.
     */
   Scan scan_player_fixed(const Player& player);
 
+  /** @brief Randomized scans of a whole batch of players, spread over the
+    *        scan thread pool. out[i] receives the scan of players[i]; out
+    *        must hold at least players.size() scans.
+    *
+    *        Every scan in the batch sees the rewards as they were when the
+    *        batch started, and the rewards' scan bookkeeping is applied after
+    *        the last scan. Ring variance for each scan comes
+    *        from its own random stream, derived from the grid's seed, the
+    *        number of batches scanned since then and the player's id. The
+    *        results are therefore the same for any number of threads.
+    */
+  void scan_players(span<const Player> players, span<Scan> out);
+
+  /// Ring ranges of the scan of player id in the batch-th scan_players call
+  /// since reset_seed(seed).
+  static void scan_players_ranges(std::uint64_t seed, std::uint64_t batch, PlayerId id,
+                                  int* min_dists, int* max_dists);
+
+  /** @brief One scan of a scan_players batch, ADDED into out, for splitting
+    *        a scan over several grids. Rewards are only read, as they are at
+    *        time now, and the ones read are appended to hits, which go to
+    *        record_hits once nothing scans the grid any more. Can be called
+    *        from several threads at once.
+    */
+  void scan_player_into(const Player& player, const int* min_dists, const int* max_dists,
+                        std::uint64_t now, Scan& out, std::vector<Reward*>& hits);
+
+  /// The deferred scan bookkeeping of scan_player_into.
+  static void record_hits(span<Reward* const> hits, std::uint64_t now) {
+    for (Reward* r : hits) r->record_scan(now);
+  }
+
   /** @brief Obtains influence values for a given range around a player.
     *        This function will typically be used by scan_player to obtain
     *        a full scan.
     */
   InfluenceRing scan_single_ring(const Player& player, int minDist, int maxDist);
 
+  /** @brief Obtains influence values for several ranges around a player in a
+    *        single pass. Ring i covers [min_dists[i], max_dists[i]] and is
+    *        ADDED into rings[i]. Only one query is made over the largest
+    *        range, and distance and direction are computed once per reward.
+    *        The result is identical to calling scan_single_ring once per ring.
+    */
+  void scan_rings(const Player& player, const int* min_dists, const int* max_dists,
+                  int num_rings, InfluenceRing* rings);
+
+  /** @brief Same as scan_rings with every ring in AGGREGATE mode. TRIVIAL and
+    *        DISTANCE rewards come from the aggregate tree within
+    *        aggregate_error(), DIST_TIME rewards are still scanned exactly.
+    */
+  void scan_rings_aggregate(const Player& player, const int* min_dists, const int* max_dists,
+                            int num_rings, InfluenceRing* rings);
+
+  /** @brief Picks how ring i (in [0, Scan::NUM_RINGS)) of full scans is
+    *        computed. All rings are EXACT by default. AGGREGATE pays off for
+    *        the large outer ring. Exact rings are scanned before aggregated
+    *        ones, which only matters for DIST_TIME rewards in both.
+    */
+  void set_ring_mode(int ring, RingMode mode) { ring_modes_[ring] = mode; }
+  RingMode ring_mode(int ring) const { return ring_modes_[ring]; }
+
+  /// Error bound of aggregated rings, see AggregateTree::scan_ring. Zero
+  /// makes aggregated rings exact, but without the speedup.
+  double aggregate_error() const { return aggregate_error_; }
+  void set_aggregate_error(double max_error) { aggregate_error_ = max_error; }
+
+  /** @brief The aggregate tree copies reward quantities. Once it is built,
+    *        the changes made through the grid and its reward manager are
+    *        applied to it along the way, at the end of the grid call making
+    *        them. Call this after changing quantities any other way, or
+    *        through the reward manager alone, so that the tree is rebuilt on
+    *        next use.
+    */
+  void invalidate_aggregates();
+
   /** @brief Used for testing purposes, reset the random number generator with
-    *        a given seed.
+    *        a given seed. Also restarts the random streams of scan_players.
     */
   void reset_seed(std::mt19937::result_type seed);
 
+  /// Clock that timestamps scans, sampled once per scan (or per
+  /// scan_players batch). Not owned, it must outlive the grid. Defaults to
+  /// the wall clock.
+  const GameClock& clock() const { return *clock_; }
+  void set_clock(const GameClock& clock) { clock_ = &clock; }
+
+  /// Threads used by scan_players, zero for one per hardware thread.
+  unsigned scan_threads() const { return scan_threads_; }
+  void set_scan_threads(unsigned num_threads);
+
+  /// Kernel used to classify scan candidates. Defaults to the fastest one the
+  /// CPU supports, mostly here so tests and benchmarks can compare them.
+  BatchKernel batch_kernel() const { return batch_kernel_; }
+  void set_batch_kernel(BatchKernel kernel) { batch_kernel_ = kernel; }
+
+  /// Counters and latencies of the scans so far, summed over every thread
+  /// that scanned. Empty when built with CELL_NO_STATS.
+  GridStats stats() const { return stats_.snapshot(); }
+  void reset_stats() { stats_.reset(); }
+
   // Basic Accessors
-  const GridMultiMap<Player*>& player_grid() const { return player_grid_; }
-  GridMultiMap<Player*>& player_grid() { return player_grid_; }
+  const RewardManager& reward_manager() const { return reward_man_; }
+  /// Rewards must still be added and removed through the grid, this is for
+  /// quantities and level bookkeeping.
+  RewardManager& reward_manager() { return reward_man_; }
+  const GridMap<RewardHandle>& reward_grid() const { return reward_grid_; }
+  /// Journal of the reward manager, see World::set_journal.
+  Journal* journal() const { return reward_man_.journal(); }
+  void set_journal(Journal* journal) { reward_man_.set_journal(journal); }
+  const GridMultiMap<PlayerHandle>& player_grid() const { return player_grid_; }
+  GridMultiMap<PlayerHandle>& player_grid() { return player_grid_; }
 
 private:
 
+  /// One pass of scan_rings over at most ScanBatchRings::MAX_RINGS rings,
+  /// the ones from first_ring on.
+  template<class Influence>
+  void scan_ring_batch(GridMap<RewardHandle>& reward_map, const Player& player,
+                       const ScanBatchRings& batch_rings, const int* max_dists,
+                       InfluenceRing* rings, Influence& influence, ScanCounts& counts,
+                       const int* ring_ids, int first_ring);
+
+  /// scan_rings over the given rewards, with influence(reward, falloff) in
+  /// place of get_influence. Ring i is counted in counts as ring_ids[i], or
+  /// as i without ring_ids.
+  template<class Influence>
+  void scan_rings_with(GridMap<RewardHandle>& rewards, const Player& player, const int* min_dists,
+                       const int* max_dists, int num_rings, InfluenceRing* rings,
+                       Influence&& influence, ScanCounts& counts, const int* ring_ids = nullptr);
+
+  /// All Scan::NUM_RINGS rings of a full scan, in their configured modes.
+  template<class Influence>
+  void scan_all_rings(const Player& player, const int* min_dists, const int* max_dists,
+                      Scan& result, Influence&& influence, ScanCounts& counts);
+
+  /// Builds the aggregate tree if it isn't built, or was invalidated.
+  void update_aggregates();
+
+  /// Applies the reward changes logged since the last call to the aggregate
+  /// tree. Every call changing rewards ends with this.
+  void apply_reward_changes();
+
+  /// Draws the randomized ring ranges of one scan.
+  static void random_ring_ranges(std::mt19937& gen, int* min_dists, int* max_dists);
+
   // Utilities for random initialization
   std::random_device rand_device_;
   std::mt19937 rand_gen_;
 
+  // State of the per scan random streams used by scan_players.
+  std::uint64_t scan_seed_ = 0;
+  std::uint64_t scan_batches_ = 0;
+
+  unsigned scan_threads_ = 0;
+  std::unique_ptr<ThreadPool> scan_pool_;
+
+  // A reward within reach of one hit of a resolve_hits batch.
+  struct HitClaim {
+    RewardHandle reward;
+    std::int64_t distance2;
+    PlayerId player;
+    std::uint32_t hit;
+  };
+
+  // Handles removed by the current remove_rewards or resolve_hits batch.
+  std::vector<RewardHandle> removed_;
+
+  // Claims of the current resolve_hits batch.
+  std::vector<HitClaim> hit_claims_;
+
+  // Rewards each scan of the current batch read, for the deferred bookkeeping.
+  std::vector<std::vector<Reward*>> scan_hits_;
+
+  BatchKernel batch_kernel_ = best_batch_kernel();
+  const GameClock* clock_ = &GameClock::system();
+
+  std::array<RingMode, Scan::NUM_RINGS> ring_modes_ = {};
+  double aggregate_error_ = DEFAULT_AGGREGATE_ERROR;
+  AggregateTree aggregate_tree_;
+  std::atomic<bool> aggregates_stale_{true};
+  std::mutex aggregates_mutex_;
+  // Change log of reward_man_ while the aggregate tree is built.
+  std::vector<Location> reward_changes_;
+
+  // Scans that only read the grid still record their stats.
+  mutable StatsCollector stats_;
+
   RewardManager reward_man_;
-  GridMap<Reward*> reward_grid_;
-  GridMultiMap<Player*> player_grid_;
+  // Handles into reward_man_, resolved per scan candidate.
+  GridMap<RewardHandle> reward_grid_;
+  // The DIST_TIME subset of reward_grid_, scanned exactly in aggregated rings.
+  GridMap<RewardHandle> timed_reward_grid_;
+  GridMultiMap<PlayerHandle> player_grid_;
 
   // No copy construction/assignment.
   Grid(const Grid&) = delete;
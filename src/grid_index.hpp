@@ -0,0 +1,281 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file grid_index.hpp
+/// @brief Uniform-cell spatial hash used as the storage behind GridMap and
+///        GridMultiMap.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_GRID_INDEX_HPP
+#define CELL_GRID_INDEX_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <location.hpp>
+
+namespace cell {
+
+/** @brief The board is tiled into square cells of (1 << cell_shift) units per
+  *        side and every occupied cell keeps its entries in a small bucket.
+  *        A rectangle query only visits the cells that overlap the rectangle,
+  *        rather than the whole vertical strip an x-major ordered map would
+  *        have to walk.
+  *
+  *        Buckets store their coordinates as separate x/y arrays so that the
+  *        scan code can run over them without touching the values. Entries
+  *        inside a bucket are in no particular order: erasing one moves the
+  *        bucket's last entry into its place.
+  */
+template<class T>
+class GridIndex {
+public:
+
+  /// Default side length of a cell is 1 << DEFAULT_CELL_SHIFT units.
+  constexpr static int DEFAULT_CELL_SHIFT = 8;
+
+  struct Bucket {
+    std::vector<int> xs;
+    std::vector<int> ys;
+    std::vector<T> values;
+
+    std::size_t size() const { return values.size(); }
+    Location location(std::size_t i) const { return Location(xs[i], ys[i]); }
+  };
+
+  explicit GridIndex(int cell_shift = DEFAULT_CELL_SHIFT) : cell_shift_(cell_shift) { }
+
+  /// @return Position of the new entry in its cell's bucket.
+  std::size_t insert(const Location &l, const T &t);
+
+  /// Bucket that would hold the given location, nullptr if that cell is empty.
+  Bucket* bucket_at(const Location &l);
+  const Bucket* bucket_at(const Location &l) const;
+
+  /** @brief Removes entry i of the bucket holding location l in O(1) by
+    *        moving the bucket's last entry into its place.
+    * @return True if an entry was moved into position i. The bucket is
+    *         freed once it runs empty, and is only safe to touch again if
+    *         this returns true.
+    */
+  bool erase_at(const Location &l, Bucket& bucket, std::size_t i);
+
+  /// True if both locations fall in the same cell.
+  bool same_cell(const Location &a, const Location &b) const {
+    return cell_of(a.x) == cell_of(b.x) && cell_of(a.y) == cell_of(b.y);
+  }
+
+  /** @brief Calls fn(bucket, fully_inside) for every occupied cell that
+    *        overlaps the INCLUSIVE rectangle [bottom_left, top_right].
+    *        fully_inside is true when every point in the cell lies inside the
+    *        rectangle, in which case the caller can skip the bounds test.
+    *        Returning true from fn stops the walk early.
+    * @return True if fn stopped the walk.
+    */
+  template<class Fn>
+  bool visit_cells(const Location &bottom_left, const Location &top_right, Fn&& fn);
+  template<class Fn>
+  bool visit_cells(const Location &bottom_left, const Location &top_right, Fn&& fn) const;
+
+  /** @brief Calls fn(location, value) for every entry inside the INCLUSIVE
+    *        rectangle [bottom_left, top_right], in no particular order.
+    *        Returning true from fn stops the walk early.
+    * @return True if fn stopped the walk.
+    */
+  template<class Fn>
+  bool visit(const Location &bottom_left, const Location &top_right, Fn&& fn);
+  template<class Fn>
+  bool visit(const Location &bottom_left, const Location &top_right, Fn&& fn) const;
+
+  /** @brief Number of stored entries a query over the given rectangle has to
+    *        examine, i.e. the total size of all overlapping cells. Used to
+    *        tune the cell size.
+    */
+  std::size_t candidates(const Location &bottom_left, const Location &top_right) const;
+
+  std::size_t size() const { return size_; }
+  int cell_shift() const { return cell_shift_; }
+
+private:
+
+  struct KeyHash {
+    std::size_t operator()(std::uint64_t k) const {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      return std::size_t(k);
+    }
+  };
+
+  // Arithmetic shift, so negative coordinates round towards negative infinity.
+  int cell_of(int v) const { return v >> cell_shift_; }
+
+  static std::uint64_t key(int cx, int cy) {
+    return (std::uint64_t(std::uint32_t(cx)) << 32) | std::uint32_t(cy);
+  }
+
+  template<class Self, class Fn>
+  static bool visit_cells_impl(Self& self, const Location &bottom_left,
+                               const Location &top_right, Fn&& fn);
+
+  template<class B, class Fn>
+  static bool visit_bucket(B& b, bool inside, const Location &bottom_left,
+                           const Location &top_right, Fn& fn);
+
+  int cell_shift_;
+  std::size_t size_ = 0;
+  std::unordered_map<std::uint64_t, Bucket, KeyHash> cells_;
+
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///                             IMPLEMENTATION                               ///
+////////////////////////////////////////////////////////////////////////////////
+
+template<class T>
+std::size_t GridIndex<T>::insert(const Location &l, const T &t) {
+  Bucket& b = cells_[key(cell_of(l.x), cell_of(l.y))];
+  b.xs.push_back(l.x);
+  b.ys.push_back(l.y);
+  b.values.push_back(t);
+  ++size_;
+  return b.size() - 1;
+}
+
+template<class T>
+typename GridIndex<T>::Bucket* GridIndex<T>::bucket_at(const Location &l) {
+  const auto it = cells_.find(key(cell_of(l.x), cell_of(l.y)));
+  return it == cells_.end() ? nullptr : &(it->second);
+}
+
+template<class T>
+const typename GridIndex<T>::Bucket* GridIndex<T>::bucket_at(const Location &l) const {
+  const auto it = cells_.find(key(cell_of(l.x), cell_of(l.y)));
+  return it == cells_.end() ? nullptr : &(it->second);
+}
+
+template<class T>
+bool GridIndex<T>::erase_at(const Location &l, Bucket& bucket, std::size_t i) {
+  const std::size_t last = bucket.size() - 1;
+  if (i != last) {
+    bucket.xs[i] = bucket.xs[last];
+    bucket.ys[i] = bucket.ys[last];
+    bucket.values[i] = std::move(bucket.values[last]);
+  }
+  bucket.xs.pop_back();
+  bucket.ys.pop_back();
+  bucket.values.pop_back();
+  --size_;
+  // Drop empty cells so that walks over all occupied cells stay cheap.
+  if (bucket.values.empty()) {
+    cells_.erase(key(cell_of(l.x), cell_of(l.y)));
+    return false;
+  }
+  return i != last;
+}
+
+template<class T>
+template<class Self, class Fn>
+bool GridIndex<T>::visit_cells_impl(Self& self, const Location &bottom_left,
+                                    const Location &top_right, Fn&& fn) {
+  if (top_right.x < bottom_left.x || bottom_left.y > top_right.y || self.cells_.empty()) {
+    return false;
+  }
+  const int cx0 = self.cell_of(bottom_left.x), cx1 = self.cell_of(top_right.x);
+  const int cy0 = self.cell_of(bottom_left.y), cy1 = self.cell_of(top_right.y);
+  const std::int64_t side = std::int64_t(1) << self.cell_shift_;
+
+  const auto inside = [&](int cx, int cy) {
+    const std::int64_t x0 = std::int64_t(cx) * side, y0 = std::int64_t(cy) * side;
+    return x0 >= bottom_left.x && x0 + side - 1 <= top_right.x &&
+           y0 >= bottom_left.y && y0 + side - 1 <= top_right.y;
+  };
+
+  const std::uint64_t num_cells = std::uint64_t(std::int64_t(cx1) - cx0 + 1) *
+                                  std::uint64_t(std::int64_t(cy1) - cy0 + 1);
+  if (num_cells > self.cells_.size()) {
+    // Huge rectangle over a sparse board, cheaper to walk the occupied cells.
+    for (auto& cell : self.cells_) {
+      const int cx = int(std::int32_t(cell.first >> 32));
+      const int cy = int(std::int32_t(cell.first & 0xffffffffULL));
+      if (cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1) continue;
+      if (fn(cell.second, inside(cx, cy))) return true;
+    }
+    return false;
+  }
+
+  for (std::int64_t cx = cx0; cx <= cx1; ++cx) {
+    for (std::int64_t cy = cy0; cy <= cy1; ++cy) {
+      const auto it = self.cells_.find(key(int(cx), int(cy)));
+      if (it == self.cells_.end()) continue;
+      if (fn(it->second, inside(int(cx), int(cy)))) return true;
+    }
+  }
+  return false;
+}
+
+template<class T>
+template<class Fn>
+bool GridIndex<T>::visit_cells(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+  return visit_cells_impl(*this, bottom_left, top_right, std::forward<Fn>(fn));
+}
+
+template<class T>
+template<class Fn>
+bool GridIndex<T>::visit_cells(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+  return visit_cells_impl(*this, bottom_left, top_right, std::forward<Fn>(fn));
+}
+
+template<class T>
+template<class B, class Fn>
+bool GridIndex<T>::visit_bucket(B& b, bool inside, const Location &bottom_left,
+                                const Location &top_right, Fn& fn) {
+  const std::size_t n = b.size();
+  if (inside) {
+    for (std::size_t i = 0; i < n; ++i) {
+      if (fn(Location(b.xs[i], b.ys[i]), b.values[i])) return true;
+    }
+    return false;
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    const int x = b.xs[i], y = b.ys[i];
+    if (x >= bottom_left.x && x <= top_right.x && y >= bottom_left.y && y <= top_right.y) {
+      if (fn(Location(x, y), b.values[i])) return true;
+    }
+  }
+  return false;
+}
+
+template<class T>
+template<class Fn>
+bool GridIndex<T>::visit(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+  return visit_cells(bottom_left, top_right, [&](Bucket& b, bool inside) {
+    return visit_bucket(b, inside, bottom_left, top_right, fn);
+  });
+}
+
+template<class T>
+template<class Fn>
+bool GridIndex<T>::visit(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+  return visit_cells(bottom_left, top_right, [&](const Bucket& b, bool inside) {
+    return visit_bucket(b, inside, bottom_left, top_right, fn);
+  });
+}
+
+template<class T>
+std::size_t GridIndex<T>::candidates(const Location &bottom_left, const Location &top_right) const {
+  std::size_t total = 0;
+  visit_cells(bottom_left, top_right, [&total](const Bucket& b, bool) {
+    total += b.size();
+    return false;
+  });
+  return total;
+}
+
+} // end namespace cell
+
+#endif // CELL_GRID_INDEX_HPP
@@ -11,20 +11,35 @@
 #ifndef CELL_GRID_MAP_HPP
 #define CELL_GRID_MAP_HPP
 
-#include <map>
+#include <algorithm>
 #include <vector>
+#include <grid_index.hpp>
 #include <location.hpp>
 
 namespace cell {
 
+/** @brief Map from unique locations to objects, backed by a GridIndex so
+  *        that rectangle queries only look at the cells they overlap.
+  */
 template<class T>
 class GridMap {
 public:
-  
-  void insert(const Location &l, const T &t);
+
+  explicit GridMap(int cell_shift = GridIndex<T>::DEFAULT_CELL_SHIFT) : index_(cell_shift) { }
+
+  /// Inserts t at l. Does nothing if something is already stored at l.
+  /// @return True if t was inserted.
+  bool insert(const Location &l, const T &t);
 
   void erase(const Location &l);
 
+  /// True if something is stored at l.
+  bool contains(const Location &l) const;
+
+  /// The object stored at l, nullptr if there is none. Valid until the map
+  /// is next modified.
+  const T* get(const Location &l) const;
+
   /** @brief Removes and returns a copy of the removed object in the 
     *        reference provided.
     * @return True if an item was found and removed, false otherwise.
@@ -36,14 +51,57 @@ public:
     *        Range is INCLUSIVE.
     * @param bottom_left   BOTTOM LEFT location of the rectangle of points to search.
     * @param top_right     TOP RIGHT location of the rectangle of points to search.
-    * @return Vector of all objects found in the range.
+    * @return Vector of all objects found in the range, ordered by location.
+    *         Pointers from find_ptr stay valid until the map is next modified.
     */
   std::vector<std::pair<Location, T> > find(const Location &bottom_left, const Location &top_right) const;
   std::vector<std::pair<Location, T*> > find_ptr(const Location &bottom_left, const Location &top_right);
 
+  /** @brief Streams every object between two locations to fn(location, object)
+    *        without building a result vector. Range is INCLUSIVE, objects are
+    *        visited in no particular order and the map must not be modified
+    *        from inside fn.
+    */
+  template<class Fn>
+  void for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn);
+  template<class Fn>
+  void for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) const;
+
+  /** @brief Same as for_each_in_rect except fn returns a bool, true stops the
+    *        walk early.
+    * @return True if fn stopped the walk, false if every object was visited.
+    */
+  template<class Fn>
+  bool for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn);
+  template<class Fn>
+  bool for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn) const;
+
+  /** @brief Streams the raw storage of every index cell overlapping the
+    *        rectangle to fn(xs, ys, objects, count) for batch processing.
+    *        Object i is at (xs[i], ys[i]). Entries are NOT filtered against
+    *        the rectangle, the caller has to do that.
+    */
+  template<class Fn>
+  void for_each_cell_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn);
+  template<class Fn>
+  void for_each_cell_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) const;
+
+  /// Number of stored objects a query over the given rectangle has to examine.
+  std::size_t candidates(const Location &bottom_left, const Location &top_right) const {
+    return index_.candidates(bottom_left, top_right);
+  }
+
+  std::size_t size() const { return index_.size(); }
+  int cell_shift() const { return index_.cell_shift(); }
+
 private:
 
-  std::map<Location,T> grid_map_;
+  typedef typename GridIndex<T>::Bucket Bucket;
+
+  /// Position of l inside bucket b, or b.size() if it isn't there.
+  static std::size_t position(const Bucket& b, const Location &l);
+
+  GridIndex<T> index_;
 
 };
 
@@ -52,62 +110,128 @@ private:
 ////////////////////////////////////////////////////////////////////////////////
 
 template<class T>
-void GridMap<T>::insert(const Location &l, const T &t) {
-  grid_map_.emplace(l, t);
+std::size_t GridMap<T>::position(const Bucket& b, const Location &l) {
+  for (std::size_t i = 0; i < b.size(); ++i) {
+    if (b.xs[i] == l.x && b.ys[i] == l.y) return i;
+  }
+  return b.size();
+}
+
+template<class T>
+bool GridMap<T>::insert(const Location &l, const T &t) {
+  const Bucket* b = index_.bucket_at(l);
+  if (b == nullptr || position(*b, l) == b->size()) {
+    index_.insert(l, t);
+    return true;
+  }
+  return false;
+}
+
+template<class T>
+bool GridMap<T>::contains(const Location &l) const {
+  const Bucket* b = index_.bucket_at(l);
+  return b != nullptr && position(*b, l) != b->size();
+}
+
+template<class T>
+const T* GridMap<T>::get(const Location &l) const {
+  const Bucket* b = index_.bucket_at(l);
+  if (b == nullptr) return nullptr;
+  const std::size_t i = position(*b, l);
+  return i == b->size() ? nullptr : &b->values[i];
 }
 
 template<class T>
 void GridMap<T>::erase(const Location &l) {
-  grid_map_.erase(l);
+  Bucket* b = index_.bucket_at(l);
+  if (b == nullptr) return;
+  const std::size_t i = position(*b, l);
+  if (i != b->size()) index_.erase_at(l, *b, i);
 }
 
 template<class T>
 bool GridMap<T>::remove(const Location &l, T& t) {
-  const auto it = grid_map_.find(l);
-  if (it != grid_map_.end()) {
-    t = it->second;
-    grid_map_.erase(it);
-    return true;
-  }
-  return false;
+  Bucket* b = index_.bucket_at(l);
+  if (b == nullptr) return false;
+  const std::size_t i = position(*b, l);
+  if (i == b->size()) return false;
+  t = b->values[i];
+  index_.erase_at(l, *b, i);
+  return true;
+}
+
+template<class T>
+template<class Fn>
+void GridMap<T>::for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+  index_.visit(bottom_left, top_right, [&fn](const Location &l, T &t) {
+    fn(l, t);
+    return false;
+  });
+}
+
+template<class T>
+template<class Fn>
+void GridMap<T>::for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+  index_.visit(bottom_left, top_right, [&fn](const Location &l, const T &t) {
+    fn(l, t);
+    return false;
+  });
+}
+
+template<class T>
+template<class Fn>
+bool GridMap<T>::for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+  return index_.visit(bottom_left, top_right, fn);
+}
+
+template<class T>
+template<class Fn>
+bool GridMap<T>::for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+  return index_.visit(bottom_left, top_right, fn);
+}
+
+template<class T>
+template<class Fn>
+void GridMap<T>::for_each_cell_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+  index_.visit_cells(bottom_left, top_right, [&fn](Bucket& b, bool) {
+    fn(b.xs.data(), b.ys.data(), b.values.data(), b.size());
+    return false;
+  });
+}
+
+template<class T>
+template<class Fn>
+void GridMap<T>::for_each_cell_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+  index_.visit_cells(bottom_left, top_right, [&fn](const Bucket& b, bool) {
+    fn(b.xs.data(), b.ys.data(), b.values.data(), b.size());
+    return false;
+  });
 }
 
 template<class T>
 std::vector<std::pair<Location,T> > GridMap<T>::find(const Location &bottom_left, const Location &top_right) const {
-  if (top_right.x < bottom_left.x || bottom_left.y > top_right.y) {
-    return{};
-  }
-  const auto begin = grid_map_.lower_bound(bottom_left);
-  auto end = grid_map_.upper_bound(top_right);
-  if ( begin == end && begin == grid_map_.end() ) {
-    return{};
-  }
   std::vector<std::pair<Location, T> > ret;
-  for (auto it = begin; it != end; ++it) {
-    if (it->first.y >= bottom_left.y && it->first.y <= top_right.y) {
-      ret.emplace_back(*it);
-    }
-  }
+  for_each_in_rect(bottom_left, top_right, [&ret](const Location &l, const T &t) {
+    ret.emplace_back(l, t);
+  });
+  std::sort(ret.begin(), ret.end(), [](const std::pair<Location, T>& a,
+                                       const std::pair<Location, T>& b) {
+    return a.first < b.first;
+  });
   return ret;
 }
 
 template<class T>
 std::vector<std::pair<Location, T*> > GridMap<T>::find_ptr(const Location &bottom_left, const Location &top_right) {
-  if (top_right.x < bottom_left.x || bottom_left.y > top_right.y) {
-    return{};
-  }
-  const auto begin = grid_map_.lower_bound(bottom_left);
-  auto end = grid_map_.upper_bound(top_right);
-  if (begin == end && begin == grid_map_.end()) {
-    return{};
-  }
   typedef std::vector<std::pair<Location, T*> > RetType;
   RetType ret;
-  for (auto it = begin; it != end; ++it) {
-    if (it->first.y >= bottom_left.y && it->first.y <= top_right.y) {
-      ret.emplace_back(it->first, &(it->second));
-    }
-  }
+  for_each_in_rect(bottom_left, top_right, [&ret](const Location &l, T &t) {
+    ret.emplace_back(l, &t);
+  });
+  std::sort(ret.begin(), ret.end(), [](const typename RetType::value_type& a,
+                                       const typename RetType::value_type& b) {
+    return a.first < b.first;
+  });
   return ret;
 }
 
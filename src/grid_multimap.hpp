@@ -11,94 +11,226 @@
 #ifndef CELL_GRID_MULTIMAP_HPP
 #define CELL_GRID_MULTIMAP_HPP
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
+#include <grid_index.hpp>
 #include <location.hpp>
+#include <slot_map.hpp>
 
 namespace cell {
 
+  /** @brief Lets a GridMultiMap find the entry of an object without searching
+    *        its bucket. Specialisations set enabled and map every object to a
+    *        small number, unique among the objects stored at the same time.
+    */
+  template<class T>
+  struct GridBackReference {
+    constexpr static bool enabled = false;
+    static std::size_t slot(const T&) { return 0; }
+  };
+
+  /// SlotHandles are looked up by their slot index.
+  template<>
+  struct GridBackReference<SlotHandle> {
+    constexpr static bool enabled = true;
+    static std::size_t slot(const SlotHandle& h) { return h.index; }
+  };
+
+  /** @brief Multimap from locations to objects, several objects may share a
+    *        location. Backed by a GridIndex so that rectangle queries only look
+    *        at the cells they overlap.
+    *
+    *        If GridBackReference<T> is enabled the map remembers where each
+    *        object sits in its bucket, which makes erase_one and move_one O(1)
+    *        rather than a walk over the bucket. Each object may then only be
+    *        stored once.
+    */
   template<class T>
   class GridMultiMap {
   public:
+    explicit GridMultiMap(int cell_shift = GridIndex<T>::DEFAULT_CELL_SHIFT) : index_(cell_shift) { }
+
     void insert(const Location &l, const T &t);
     void erase_one(const Location &l, const T &t);
     void erase_all(const Location &l, const T &t);
+
+    /// Moves a t stored at from over to to, in place when both are in the
+    /// same index cell. Returns false if t wasn't at from.
+    bool move_one(const Location &from, const Location &to, const T &t);
+
+    /// Objects in the INCLUSIVE rectangle [l1, l2], ordered by location.
+    /// Pointers from find_ptr stay valid until the map is next modified.
     std::vector<std::pair<Location, T> >  find(const Location &l1, const Location &l2) const;
     std::vector<std::pair<Location, T*> >  find_ptr(const Location &l1, const Location &l2);
+
+    /// Streams every object in the INCLUSIVE rectangle [l1, l2] to
+    /// fn(location, object) without allocating. Objects are visited in no
+    /// particular order and the map must not be modified from inside fn.
+    template<class Fn>
+    void for_each_in_rect(const Location &l1, const Location &l2, Fn&& fn);
+    template<class Fn>
+    void for_each_in_rect(const Location &l1, const Location &l2, Fn&& fn) const;
+
+    /// Same as for_each_in_rect except fn returns a bool, true stops the walk
+    /// early. Returns true if fn stopped the walk.
+    template<class Fn>
+    bool for_each_in_rect_until(const Location &l1, const Location &l2, Fn&& fn);
+    template<class Fn>
+    bool for_each_in_rect_until(const Location &l1, const Location &l2, Fn&& fn) const;
+
+    /// Number of stored objects a query over the given rectangle has to examine.
+    std::size_t candidates(const Location &l1, const Location &l2) const {
+      return index_.candidates(l1, l2);
+    }
+
+    std::size_t size() const { return index_.size(); }
   private:
-    std::multimap<Location, T> grid_map_;
+    typedef typename GridIndex<T>::Bucket Bucket;
+    typedef GridBackReference<T> BackReference;
+
+    /// Position of a t at l inside bucket b, or b.size() if there is none.
+    std::size_t position(const Bucket& b, const Location &l, const T &t) const;
+    /// Records that t is entry i of its bucket.
+    void track(const T &t, std::size_t i);
+    /// Erases entry i of b, keeping track of the entry moved into its place.
+    void erase_entry(const Location &l, Bucket& b, std::size_t i);
+
+    GridIndex<T> index_;
+    // Position of each object in its bucket, by BackReference::slot. Only
+    // correct for objects in the map, position checks the entry it names.
+    std::vector<std::uint32_t> positions_;
   };
 
+  template<class T>
+  std::size_t GridMultiMap<T>::position(const Bucket& b, const Location &l, const T &t) const {
+    if (BackReference::enabled) {
+      const std::size_t slot = BackReference::slot(t);
+      if (slot < positions_.size()) {
+        const std::size_t i = positions_[slot];
+        if (i < b.size() && b.xs[i] == l.x && b.ys[i] == l.y && b.values[i] == t) return i;
+      }
+      return b.size();
+    }
+    for (std::size_t i = 0; i < b.size(); ++i) {
+      if (b.xs[i] == l.x && b.ys[i] == l.y && b.values[i] == t) return i;
+    }
+    return b.size();
+  }
+
+  template<class T>
+  void GridMultiMap<T>::track(const T &t, std::size_t i) {
+    if (!BackReference::enabled) return;
+    const std::size_t slot = BackReference::slot(t);
+    if (slot >= positions_.size()) positions_.resize(slot + 1);
+    positions_[slot] = std::uint32_t(i);
+  }
+
+  template<class T>
+  void GridMultiMap<T>::erase_entry(const Location &l, Bucket& b, std::size_t i) {
+    if (index_.erase_at(l, b, i)) track(b.values[i], i);
+  }
+
   template<class T>
   void GridMultiMap<T>::insert(const Location &l, const T &t) {
-    grid_map_.emplace(l, t);
+    track(t, index_.insert(l, t));
   }
 
   template<class T>
   void GridMultiMap<T>::erase_one(const Location &l, const T &t) {
-    auto begin = grid_map_.lower_bound(l);
-    auto end   = grid_map_.upper_bound(l);
-    for (auto it = begin; it != end;) {
-      if (it->second == t) {
-        grid_map_.erase(it);
-        it = end;
-      }
-      else {
-        ++it;
-      }
+    Bucket* b = index_.bucket_at(l);
+    if (b == nullptr) return;
+    const std::size_t i = position(*b, l, t);
+    if (i != b->size()) erase_entry(l, *b, i);
+  }
+
+  template<class T>
+  bool GridMultiMap<T>::move_one(const Location &from, const Location &to, const T &t) {
+    Bucket* b = index_.bucket_at(from);
+    if (b == nullptr) return false;
+    const std::size_t i = position(*b, from, t);
+    if (i == b->size()) return false;
+    if (index_.same_cell(from, to)) {
+      b->xs[i] = to.x;
+      b->ys[i] = to.y;
+      return true;
     }
+    // erase_entry can free the bucket, so take the value out first.
+    const T moved = b->values[i];
+    erase_entry(from, *b, i);
+    insert(to, moved);
+    return true;
   }
 
   template<class T>
   void GridMultiMap<T>::erase_all(const Location &l, const T &t) {
-    auto begin = grid_map_.lower_bound(l);
-    auto end = grid_map_.upper_bound(l);
-    for (auto it = begin; it != end;) {
-      if (it->second == t) {
-        grid_map_.erase(it++);
-      }
-      else {
-        ++it;
+    Bucket* b = index_.bucket_at(l);
+    if (b == nullptr) return;
+    // Walking down, the entry moved into a hole has already been looked at.
+    for (std::size_t i = b->size(); i-- > 0;) {
+      if (b->xs[i] == l.x && b->ys[i] == l.y && b->values[i] == t) {
+        const bool last = b->size() == 1;
+        erase_entry(l, *b, i);
+        // The bucket itself is released once it runs empty.
+        if (last) return;
       }
     }
   }
 
+  template<class T>
+  template<class Fn>
+  void GridMultiMap<T>::for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+    index_.visit(bottom_left, top_right, [&fn](const Location &l, T &t) {
+      fn(l, t);
+      return false;
+    });
+  }
+
+  template<class T>
+  template<class Fn>
+  void GridMultiMap<T>::for_each_in_rect(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+    index_.visit(bottom_left, top_right, [&fn](const Location &l, const T &t) {
+      fn(l, t);
+      return false;
+    });
+  }
+
+  template<class T>
+  template<class Fn>
+  bool GridMultiMap<T>::for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn) {
+    return index_.visit(bottom_left, top_right, fn);
+  }
+
+  template<class T>
+  template<class Fn>
+  bool GridMultiMap<T>::for_each_in_rect_until(const Location &bottom_left, const Location &top_right, Fn&& fn) const {
+    return index_.visit(bottom_left, top_right, fn);
+  }
+
   template<class T>
   std::vector<std::pair<Location, T> >  GridMultiMap<T>::find(const Location &bottom_left, const Location &top_right) const {
-    if (top_right.x < bottom_left.x || bottom_left.y > top_right.y) {
-      return{};
-    }
-    const auto begin = grid_map_.lower_bound(bottom_left);
-    auto end = grid_map_.upper_bound(top_right);
-    if (begin == end && begin == grid_map_.end()) {
-      return{};
-    }
     std::vector<std::pair<Location, T> > ret;
-    for (auto it = begin; it != end; ++it) {
-      if (it->first.y >= bottom_left.y && it->first.y <= top_right.y) {
-        ret.emplace_back(*it);
-      }
-    }
+    for_each_in_rect(bottom_left, top_right, [&ret](const Location &l, const T &t) {
+      ret.emplace_back(l, t);
+    });
+    std::stable_sort(ret.begin(), ret.end(), [](const std::pair<Location, T>& a,
+                                                const std::pair<Location, T>& b) {
+      return a.first < b.first;
+    });
     return ret;
   }
 
   template<class T>
   std::vector<std::pair<Location, T*> >  GridMultiMap<T>::find_ptr(const Location &bottom_left, const Location &top_right) {
-    if (top_right.x < bottom_left.x || bottom_left.y > top_right.y) {
-      return{};
-    }
-    const auto begin = grid_map_.lower_bound(bottom_left);
-    auto end = grid_map_.upper_bound(top_right);
-    if (begin == end && begin == grid_map_.end()) {
-      return{};
-    }
     typedef std::vector<std::pair<Location, T*> > RetType;
     RetType ret;
-    for (auto it = begin; it != end; ++it) {
-      if (it->first.y >= bottom_left.y && it->first.y <= top_right.y) {
-        ret.emplace_back(it->first, &(it->second));
-      }
-    }
+    for_each_in_rect(bottom_left, top_right, [&ret](const Location &l, T &t) {
+      ret.emplace_back(l, &t);
+    });
+    std::stable_sort(ret.begin(), ret.end(), [](const typename RetType::value_type& a,
+                                                const typename RetType::value_type& b) {
+      return a.first < b.first;
+    });
     return ret;
   }
 
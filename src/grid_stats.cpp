@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file grid_stats.cpp
+/// @brief Implementation of the scan engine statistics.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <iomanip>
+
+// cell
+#include <grid_stats.hpp>
+
+namespace cell {
+
+namespace {
+
+typedef std::atomic<std::uint64_t> Counter;
+
+void add(Counter& c, std::uint64_t n) {
+  if (n) c.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t get(const Counter& c) { return c.load(std::memory_order_relaxed); }
+
+/// Slot of the calling thread, the same for every collector.
+int thread_slot() {
+  static std::atomic<unsigned> next_thread{0};
+  thread_local const int slot = int(next_thread.fetch_add(1) % StatsCollector::MAX_SLOTS);
+  return slot;
+}
+
+struct HistogramCounters {
+  Counter buckets[LatencyHistogram::NUM_BUCKETS];
+  Counter total_ns;
+
+  void add_sample(std::uint64_t ns) {
+    add(buckets[LatencyHistogram::bucket_of(ns)], 1);
+    add(total_ns, ns);
+  }
+
+  void read_into(LatencyHistogram& h) const {
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) h.add_samples(i, get(buckets[i]));
+    h.add_total_ns(get(total_ns));
+  }
+
+  void reset() {
+    for (Counter& c : buckets) c.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+  }
+};
+
+} // end anonymous namespace
+
+constexpr int LatencyHistogram::NUM_BUCKETS;
+constexpr int GridStats::MAX_RINGS;
+constexpr int GridStats::NUM_TYPES;
+constexpr int StatsCollector::MAX_SLOTS;
+
+double LatencyHistogram::percentile_ns(double q) const
+{
+  if (count_ == 0) return 0;
+  const double rank = q * double(count_);
+  std::uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets_[i];
+    if (buckets_[i] != 0 && double(seen) >= rank) {
+      if (i < 4) return double(i);
+      // Buckets of a power of two 2^k are 2^(k-2) wide.
+      return double(bucket_floor(i)) + double(std::uint64_t(1) << (i / 4 - 1)) / 2;
+    }
+  }
+  return double(bucket_floor(NUM_BUCKETS - 1));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+  for (int i = 0; i < NUM_BUCKETS; ++i) buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  total_ns_ += other.total_ns_;
+}
+
+std::uint64_t GridStats::accepted() const
+{
+  std::uint64_t total = 0;
+  for (const Ring& r : rings) total += r.accepted;
+  return total;
+}
+
+std::ostream& operator<<(std::ostream& out, const GridStats& s)
+{
+  const auto latency = [&](const char* name, const LatencyHistogram& h) {
+    out << name << ": " << h.count() << " calls, mean " << h.mean_ns() / 1000
+        << "us, p50 " << h.percentile_ns(0.5) / 1000 << "us, p99 " << h.percentile_ns(0.99) / 1000
+        << "us, p99.9 " << h.percentile_ns(0.999) / 1000 << "us\n";
+  };
+  const std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(2);
+  out << "scans: " << s.scans << " full, " << s.ring_scans << " ring\n";
+  out << "index: " << s.queries << " queries, " << s.cells << " cells, " << s.candidates
+      << " candidates\n";
+  for (int r = 0; r < GridStats::MAX_RINGS; ++r) {
+    const GridStats::Ring& ring = s.rings[r];
+    if (ring.candidates == 0) continue;
+    out << "ring " << r << ": " << ring.candidates << " candidates, " << ring.accepted
+        << " accepted, " << ring.candidates_per_accepted() << " candidates per accepted\n";
+  }
+  out << "influence: " << s.influence_calls[int(Reward::RewardType::TRIVIAL)] << " trivial, "
+      << s.influence_calls[int(Reward::RewardType::DISTANCE)] << " distance, "
+      << s.influence_calls[int(Reward::RewardType::DIST_TIME)] << " dist_time\n";
+  latency("scan latency", s.scan_latency);
+  latency("ring scan latency", s.ring_scan_latency);
+  out.flags(flags);
+  return out;
+}
+
+struct StatsCollector::Slot {
+  Counter scans;
+  Counter ring_scans;
+  Counter queries;
+  Counter cells;
+  Counter candidates;
+  Counter ring_candidates[GridStats::MAX_RINGS];
+  Counter ring_accepted[GridStats::MAX_RINGS];
+  Counter influence_calls[GridStats::NUM_TYPES];
+  HistogramCounters scan_latency;
+  HistogramCounters ring_scan_latency;
+  // Keeps the next slot's counters off this one's last cache line. Padding
+  // rather than alignas, which new[] doesn't honour before C++17.
+  char padding[64];
+};
+
+StatsCollector::StatsCollector()
+{
+  if (STATS_ENABLED) {
+    slots_.reset(new Slot[MAX_SLOTS]);
+    reset();
+  }
+}
+
+StatsCollector::~StatsCollector() = default;
+
+void StatsCollector::record(const ScanCounts& counts, std::uint64_t ns, bool ring_scan)
+{
+  Slot& slot = slots_[thread_slot()];
+  add(ring_scan ? slot.ring_scans : slot.scans, 1);
+  add(slot.queries, counts.queries);
+  add(slot.cells, counts.cells);
+  add(slot.candidates, counts.candidates);
+  for (int r = 0; r < GridStats::MAX_RINGS; ++r) {
+    add(slot.ring_candidates[r], counts.rings[r].candidates);
+    add(slot.ring_accepted[r], counts.rings[r].accepted);
+  }
+  for (int t = 0; t < GridStats::NUM_TYPES; ++t) add(slot.influence_calls[t], counts.influence_calls[t]);
+  (ring_scan ? slot.ring_scan_latency : slot.scan_latency).add_sample(ns);
+}
+
+GridStats StatsCollector::snapshot() const
+{
+  GridStats s;
+  if (!slots_) return s;
+  for (int i = 0; i < MAX_SLOTS; ++i) {
+    const Slot& slot = slots_[i];
+    s.scans += get(slot.scans);
+    s.ring_scans += get(slot.ring_scans);
+    s.queries += get(slot.queries);
+    s.cells += get(slot.cells);
+    s.candidates += get(slot.candidates);
+    for (int r = 0; r < GridStats::MAX_RINGS; ++r) {
+      s.rings[r].candidates += get(slot.ring_candidates[r]);
+      s.rings[r].accepted += get(slot.ring_accepted[r]);
+    }
+    for (int t = 0; t < GridStats::NUM_TYPES; ++t) s.influence_calls[t] += get(slot.influence_calls[t]);
+    slot.scan_latency.read_into(s.scan_latency);
+    slot.ring_scan_latency.read_into(s.ring_scan_latency);
+  }
+  return s;
+}
+
+void StatsCollector::reset()
+{
+  if (!slots_) return;
+  for (int i = 0; i < MAX_SLOTS; ++i) {
+    Slot& slot = slots_[i];
+    for (Counter* c : { &slot.scans, &slot.ring_scans, &slot.queries, &slot.cells, &slot.candidates }) {
+      c->store(0, std::memory_order_relaxed);
+    }
+    for (int r = 0; r < GridStats::MAX_RINGS; ++r) {
+      slot.ring_candidates[r].store(0, std::memory_order_relaxed);
+      slot.ring_accepted[r].store(0, std::memory_order_relaxed);
+    }
+    for (Counter& c : slot.influence_calls) c.store(0, std::memory_order_relaxed);
+    slot.scan_latency.reset();
+    slot.ring_scan_latency.reset();
+  }
+}
+
+} // end namespace cell
@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file grid_stats.hpp
+/// @brief Counters and latency histograms of the scan engine, see
+///        Grid::stats. Building with CELL_NO_STATS defined compiles them out.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_GRID_STATS_HPP
+#define CELL_GRID_STATS_HPP
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+// cell
+#include <reward.hpp>
+
+namespace cell {
+
+#ifdef CELL_NO_STATS
+constexpr bool STATS_ENABLED = false;
+#else
+constexpr bool STATS_ENABLED = true;
+#endif
+
+/** @brief Histogram of latencies in nanoseconds. Each power of two is split
+  *        into four buckets, so a percentile is within about 12% of the
+  *        actual value.
+  */
+class LatencyHistogram {
+public:
+
+  constexpr static int NUM_BUCKETS = 256;
+
+  void add(std::uint64_t ns) {
+    add_samples(bucket_of(ns), 1);
+    add_total_ns(ns);
+  }
+  /// For copying in counts kept elsewhere: times samples in a bucket, and
+  /// the sum of a number of samples.
+  void add_samples(int bucket, std::uint64_t times) {
+    buckets_[bucket] += times;
+    count_ += times;
+  }
+  void add_total_ns(std::uint64_t ns) { total_ns_ += ns; }
+
+  std::uint64_t count() const { return count_; }
+  std::uint64_t bucket(int i) const { return buckets_[i]; }
+  double mean_ns() const { return count_ ? double(total_ns_) / double(count_) : 0.0; }
+
+  /// Latency below which a fraction q of the samples fall, as the middle of
+  /// the bucket it lands in. Zero without samples.
+  double percentile_ns(double q) const;
+
+  void merge(const LatencyHistogram& other);
+
+  /// Latencies under 4ns get a bucket each, [2^k, 2^(k+1)) for k >= 2 is
+  /// split over buckets 4(k-1) to 4(k-1)+3.
+  static int bucket_of(std::uint64_t ns) {
+    if (ns < 4) return int(ns);
+    const int msb = 63 - __builtin_clzll(ns);
+    return (msb - 1) * 4 + int((ns >> (msb - 2)) & 3);
+  }
+  /// Smallest latency of a bucket.
+  static std::uint64_t bucket_floor(int bucket) {
+    if (bucket < 4) return std::uint64_t(bucket);
+    return std::uint64_t(4 + (bucket & 3)) << (bucket / 4 - 1);
+  }
+
+private:
+  std::uint64_t buckets_[NUM_BUCKETS] = {};
+  std::uint64_t count_ = 0;
+  std::uint64_t total_ns_ = 0;
+};
+
+/** @brief Snapshot of what a Grid's scans have done since it was built or
+  *        its stats were last reset.
+  *
+  *        Full scans are scan_player, scan_player_fixed and each scan of a
+  *        scan_players batch. Ring scans are direct scan_single_ring and
+  *        scan_rings calls. Per ring counts are by ring index: the Scan ring
+  *        for full scans, the position in the call for ring scans.
+  */
+struct GridStats {
+  /// Rings tracked separately, later ones are counted with the last.
+  constexpr static int MAX_RINGS = 8;
+  constexpr static int NUM_TYPES = int(Reward::RewardType::DIST_TIME) + 1;
+
+  struct Ring {
+    /// Rewards fetched from the index for this ring, and those of them that
+    /// were inside it. The index's overfetch is candidates / accepted.
+    std::uint64_t candidates = 0;
+    std::uint64_t accepted = 0;
+
+    double candidates_per_accepted() const {
+      return accepted ? double(candidates) / double(accepted) : 0.0;
+    }
+  };
+
+  std::uint64_t scans = 0;
+  std::uint64_t ring_scans = 0;
+
+  /// Rectangle queries the scans made on the reward index, the occupied
+  /// index cells they visited and the rewards those cells held.
+  std::uint64_t queries = 0;
+  std::uint64_t cells = 0;
+  std::uint64_t candidates = 0;
+
+  Ring rings[MAX_RINGS];
+
+  /// Influence calls, one per reward and ring it is in, by RewardType.
+  std::uint64_t influence_calls[NUM_TYPES] = {};
+
+  LatencyHistogram scan_latency;
+  LatencyHistogram ring_scan_latency;
+
+  /// Sum of accepted over every ring.
+  std::uint64_t accepted() const;
+};
+
+/// Text dump of a snapshot, one figure per line.
+std::ostream& operator<<(std::ostream& out, const GridStats& stats);
+
+/// What one scan counted, kept in locals while it runs and recorded at the end.
+struct ScanCounts {
+  std::uint64_t queries = 0;
+  std::uint64_t cells = 0;
+  std::uint64_t candidates = 0;
+  GridStats::Ring rings[GridStats::MAX_RINGS];
+  std::uint64_t influence_calls[GridStats::NUM_TYPES] = {};
+
+  GridStats::Ring& ring(int r) { return rings[r < GridStats::MAX_RINGS ? r : GridStats::MAX_RINGS - 1]; }
+};
+
+/// Times a scan, nothing when stats are compiled out.
+class StatsTimer {
+public:
+  StatsTimer() : start_(STATS_ENABLED ? std::chrono::steady_clock::now()
+                                      : std::chrono::steady_clock::time_point()) { }
+
+  std::uint64_t elapsed_ns() const {
+    if (!STATS_ENABLED) return 0;
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_).count());
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+/** @brief The live counters behind Grid::stats. Every thread records into
+  *        its own slot, on its own cache lines, so scans on different
+  *        threads never contend; snapshot adds the slots up. Slots are
+  *        handed out per thread round robin, threads past MAX_SLOTS share,
+  *        which the atomic adds keep correct.
+  */
+class StatsCollector {
+public:
+
+  constexpr static int MAX_SLOTS = 16;
+
+  StatsCollector();
+  ~StatsCollector();
+
+  /// Records a full scan or ring scan.
+  void record_scan(const ScanCounts& counts, std::uint64_t ns) {
+    if (STATS_ENABLED) record(counts, ns, false);
+  }
+  void record_ring_scan(const ScanCounts& counts, std::uint64_t ns) {
+    if (STATS_ENABLED) record(counts, ns, true);
+  }
+
+  GridStats snapshot() const;
+
+  /// Zeroes the counters. Scans recording meanwhile may be partly kept.
+  void reset();
+
+private:
+
+  struct Slot;
+
+  void record(const ScanCounts& counts, std::uint64_t ns, bool ring_scan);
+
+  std::unique_ptr<Slot[]> slots_;
+
+  // No copy construction/assignment.
+  StatsCollector(const StatsCollector&) = delete;
+  StatsCollector& operator=(const StatsCollector&) = delete;
+
+};
+
+} // end namespace cell
+
+#endif // CELL_GRID_STATS_HPP
@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file hash.hpp
+/// @brief Small hashing helpers shared by the random streams and the on disk
+///        formats.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_HASH_HPP
+#define CELL_HASH_HPP
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace cell {
+
+/// splitmix64 finalizer.
+inline std::uint64_t mix64(std::uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/** @brief Checksum of the 8 byte words [begin, end) of data, each mixed with
+  *        its position and summed, so that the sums of separate ranges add
+  *        up to the sum of the whole. Word skip (if in range) counts as zero,
+  *        for a checksum stored inside the data it covers.
+  */
+inline std::uint64_t checksum_words(const char* data, std::size_t begin, std::size_t end,
+                                    std::size_t skip = std::size_t(-1)) {
+  std::uint64_t sum = 0;
+  for (std::size_t i = begin; i < end; ++i) {
+    std::uint64_t word = 0;
+    if (i != skip) std::memcpy(&word, data + i * 8, 8);
+    sum += mix64(word + (i + 1) * 0x9e3779b97f4a7c15ULL);
+  }
+  return sum;
+}
+
+} // end namespace cell
+
+#endif // CELL_HASH_HPP
@@ -13,8 +13,10 @@
 #ifndef CELL_INFLUENCE_RING_HPP
 #define CELL_INFLUENCE_RING_HPP
 
+#include <array>
 #include <limits>
 #include <climits>
+#include <type_traits>
 #include <vector>
 #include <iostream>
 
@@ -32,53 +34,79 @@ namespace cell {
   *        The zeroth slice is the one whose CENTER is the vector (1,0). For
   *        example in an eight direction ring this would be the slice facing
   *        directly east.
+  *
+  *        Values live in a fixed size array so a ring never touches the heap
+  *        and can be copied around as plain memory.
   */
-class InfluenceRing {
+template<int NumDirections>
+class BasicInfluenceRing {
 public:
   /// Number of directions in this influence ring: North, North East, East, etc...
-  static constexpr int NUM_DIRECTIONS = 8;
+  static constexpr int NUM_DIRECTIONS = NumDirections;
 
   /// The max value for influence in any given direction.
   /// Influence will be in the range [0, MAX_INFLUENCE]
   static constexpr int MAX_INFLUENCE = std::numeric_limits<int>::max();
 
+  typedef std::array<int, NumDirections> vals_t;
+
   // Constructors
-  InfluenceRing() { }
-  explicit InfluenceRing(const std::vector<int>& vals) : vals_(vals) { }
+  constexpr BasicInfluenceRing() : vals_{} { }
+  constexpr explicit BasicInfluenceRing(const vals_t& vals) : vals_(vals) { }
+  /// Takes the first NUM_DIRECTIONS values, missing ones are zero.
+  explicit BasicInfluenceRing(const std::vector<int>& vals);
 
   // Accessors
-  const std::vector<int>& vals() const { return vals_; }
-  std::vector<int>& vals() { return vals_; }
+  constexpr const vals_t& vals() const { return vals_; }
+  vals_t& vals() { return vals_; }
 
-  // Operators
-  friend bool operator==(const InfluenceRing& ir1, const InfluenceRing& ir2);
-  friend std::ostream& operator<<(std::ostream& out, const InfluenceRing& ir);
+  /// Direction-wise sum, written as a flat loop so it vectorizes.
+  BasicInfluenceRing& operator+=(const BasicInfluenceRing& ir) {
+    for (int i = 0; i < NumDirections; ++i) vals_[i] += ir.vals_[i];
+    return *this;
+  }
 
 private:
 
-  std::vector<int> vals_ = std::vector<int>(NUM_DIRECTIONS, 0);
+  vals_t vals_;
 
 };
 
-inline bool operator==(const InfluenceRing& ir1, const InfluenceRing& ir2) {
-  for (int i = 0; i < ir1.vals_.size(); ++i) {
-    if (ir1.vals_[i] != ir2.vals_[i]) return false;
-  }
-  return true;
+template<int NumDirections>
+constexpr int BasicInfluenceRing<NumDirections>::NUM_DIRECTIONS;
+template<int NumDirections>
+constexpr int BasicInfluenceRing<NumDirections>::MAX_INFLUENCE;
+
+template<int NumDirections>
+BasicInfluenceRing<NumDirections>::BasicInfluenceRing(const std::vector<int>& vals) : vals_{} {
+  for (std::size_t i = 0; i < vals.size() && i < vals_.size(); ++i) vals_[i] = vals[i];
 }
 
-inline std::ostream& operator<<(std::ostream& out, const InfluenceRing& ir) {
+template<int NumDirections>
+inline bool operator==(const BasicInfluenceRing<NumDirections>& ir1,
+                       const BasicInfluenceRing<NumDirections>& ir2) {
+  return ir1.vals() == ir2.vals();
+}
+
+template<int NumDirections>
+inline std::ostream& operator<<(std::ostream& out, const BasicInfluenceRing<NumDirections>& ir) {
   out << "(";
-  auto it = ir.vals_.begin();
-  while (it != ir.vals_.end()) {
+  auto it = ir.vals().begin();
+  while (it != ir.vals().end()) {
     out << *it++;
-    while (it != ir.vals_.end()) {
+    while (it != ir.vals().end()) {
       out << ", " << *it++;
     }
   }
   return out << ")";
 }
 
+/// The ring used by the game, eight directions.
+typedef BasicInfluenceRing<8> InfluenceRing;
+
+static_assert(std::is_trivially_copyable<InfluenceRing>::value,
+              "InfluenceRing should be copyable as plain memory");
+
 } // end namespace cell
 
 #endif // CELL_INFLUENCE_RING_HPP
@@ -0,0 +1,312 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file journal.cpp
+/// @brief Implementation of the write-ahead journal.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <cstddef>
+#include <utility>
+
+// posix
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// cell
+#include <hash.hpp>
+#include <journal.hpp>
+#include <world.hpp>
+
+namespace cell {
+
+namespace {
+
+constexpr char MAGIC[8] = { 'C', 'E', 'L', 'L', 'J', 'R', 'N', 'L' };
+
+/// Word of a frame holding its checksum, which is summed as zero.
+constexpr std::size_t CHECKSUM_WORD = offsetof(JournalFrame, checksum) / 8;
+
+std::size_t round_up8(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+bool write_all(int fd, const char* data, std::size_t size)
+{
+  while (size > 0) {
+    const ssize_t n = ::write(fd, data, size);
+    if (n < 0) return false;
+    data += n;
+    size -= std::size_t(n);
+  }
+  return true;
+}
+
+/// Reads the fields of one record, failing once the record runs out.
+class RecordReader {
+public:
+  RecordReader(const char* data, std::size_t size) : p_(data), end_(data + size) { }
+
+  bool done() const { return p_ == end_; }
+
+  template<class T>
+  bool read(T& value) {
+    if (std::size_t(end_ - p_) < sizeof(T)) return false;
+    std::memcpy(&value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+
+private:
+  const char* p_;
+  const char* end_;
+};
+
+/// Applies one record to a world.
+bool apply_record(RecordReader& in, World& world)
+{
+  Grid& grid = world.grid();
+  RewardManager& rewards = grid.reward_manager();
+  std::uint8_t op;
+  std::int32_t id, x, y, quantity;
+  std::uint8_t type, level;
+  std::uint64_t amount;
+  if (!in.read(op)) return false;
+  switch (JournalOp(op)) {
+  case JournalOp::ADD_REWARD: {
+    if (!(in.read(id) && in.read(type) && in.read(level) && in.read(x) && in.read(y) &&
+          in.read(quantity)) ||
+        type > std::uint8_t(Reward::RewardType::DIST_TIME) || level >= Reward::RewardLevel::NUM_LEVELS) {
+      return false;
+    }
+    Reward r(id, Reward::RewardType(type));
+    r.level() = Reward::RewardLevel(level);
+    r.location() = Location(x, y);
+    r.quantity() = quantity;
+    grid.add_reward(r);
+    return true;
+  }
+  case JournalOp::REMOVE_REWARD: {
+    if (!in.read(id)) return false;
+    // Where its quantity went is in the records that follow.
+    const Reward* r = rewards.get(rewards.find(id));
+    if (r) grid.discard_reward(r->location());
+    return true;
+  }
+  case JournalOp::SET_QUANTITY:
+    if (!(in.read(id) && in.read(quantity))) return false;
+    rewards.set_quantity(rewards.find(id), quantity);
+    return true;
+  case JournalOp::SET_UNDISTRIBUTED:
+    if (!(in.read(level) && in.read(amount)) || level >= Reward::RewardLevel::NUM_LEVELS) return false;
+    rewards.set_undistributed(Reward::RewardLevel(level), amount);
+    return true;
+  case JournalOp::PLAYER_JOIN: {
+    if (!(in.read(id) && in.read(x) && in.read(y))) return false;
+    Player p(id);
+    p.location() = Location(x, y);
+    world.player_join(p);
+    return true;
+  }
+  case JournalOp::PLAYER_LEAVE:
+    if (!in.read(id)) return false;
+    world.player_leave(id);
+    return true;
+  case JournalOp::PLAYER_MOVE:
+    if (!(in.read(id) && in.read(x) && in.read(y))) return false;
+    world.move_player(id, Location(x, y));
+    return true;
+  }
+  return false;
+}
+
+} // end anonymous namespace
+
+constexpr std::uint32_t JournalHeader::VERSION;
+constexpr std::uint32_t JournalHeader::ENDIAN_MARK;
+
+bool Journal::open(const std::string& path)
+{
+  close();
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  JournalHeader header = {};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = JournalHeader::VERSION;
+  header.endian_mark = JournalHeader::ENDIAN_MARK;
+  if (!write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header)) || ::fsync(fd) != 0) {
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  start_batch();
+  next_sequence_ = 1;
+  durable_ = 0;
+  failed_ = false;
+  stop_ = false;
+  writer_ = std::thread([this] { write_loop(); });
+  return true;
+}
+
+bool Journal::close()
+{
+  if (fd_ < 0) return true;
+  commit();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_writer_.notify_one();
+  writer_.join();
+  const bool ok = !failed_ && ::close(fd_) == 0;
+  fd_ = -1;
+  return ok;
+}
+
+void Journal::start_batch()
+{
+  batch_.resize(sizeof(JournalFrame));
+  pending_records_ = 0;
+}
+
+std::uint64_t Journal::commit()
+{
+  if (pending_records_ == 0 || fd_ < 0) return next_sequence_ - 1;
+  const std::size_t size = pending_bytes();
+  batch_.resize(sizeof(JournalFrame) + round_up8(size), 0);
+  JournalFrame frame = {};
+  frame.size = std::uint32_t(size);
+  frame.num_records = std::uint32_t(pending_records_);
+  frame.sequence = next_sequence_++;
+  // The writer thread fills in the checksum.
+  std::memcpy(batch_.data(), &frame, sizeof(frame));
+
+  std::vector<char> next;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(batch_));
+    if (!spare_.empty()) {
+      next = std::move(spare_.back());
+      spare_.pop_back();
+    }
+  }
+  wake_writer_.notify_one();
+  batch_ = std::move(next);
+  start_batch();
+  return frame.sequence;
+}
+
+bool Journal::sync()
+{
+  const std::uint64_t target = next_sequence_ - 1;
+  std::unique_lock<std::mutex> lock(mutex_);
+  written_.wait(lock, [&] { return failed_ || durable_ >= target; });
+  return !failed_;
+}
+
+std::uint64_t Journal::durable_sequence() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return durable_;
+}
+
+void Journal::write_loop()
+{
+  std::vector<std::vector<char>> batches;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_writer_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) break;
+    batches.swap(queue_);
+    const bool failed = failed_;
+    lock.unlock();
+
+    // Everything queued since the last round goes out with one fdatasync.
+    bool ok = !failed;
+    for (std::vector<char>& b : batches) {
+      const std::uint64_t sum = checksum_words(b.data(), 0, b.size() / 8, CHECKSUM_WORD);
+      std::memcpy(b.data() + offsetof(JournalFrame, checksum), &sum, sizeof(sum));
+      ok = ok && write_all(fd_, b.data(), b.size());
+    }
+    ok = ok && ::fdatasync(fd_) == 0;
+    std::uint64_t last;
+    std::memcpy(&last, batches.back().data() + offsetof(JournalFrame, sequence), sizeof(last));
+
+    lock.lock();
+    if (ok) durable_ = last;
+    else failed_ = true;
+    for (std::vector<char>& b : batches) spare_.push_back(std::move(b));
+    batches.clear();
+    written_.notify_all();
+  }
+}
+
+bool Journal::replay(const std::string& path, World& world, JournalReplayStats* stats)
+{
+  JournalReplayStats local;
+  JournalReplayStats& st = stats ? *stats : local;
+  st = JournalReplayStats();
+
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  std::vector<std::uint64_t> words;
+  bool ok = ::fstat(fd, &info) == 0;
+  std::size_t size = ok ? std::size_t(info.st_size) : 0;
+  if (ok) {
+    words.resize(round_up8(size) / 8);
+    char* out = reinterpret_cast<char*>(words.data());
+    std::size_t got = 0;
+    while (got < size) {
+      const ssize_t n = ::read(fd, out + got, size - got);
+      if (n <= 0) break;
+      got += std::size_t(n);
+    }
+    size = got;
+  }
+  ::close(fd);
+  const char* data = reinterpret_cast<const char*>(words.data());
+
+  JournalHeader header;
+  if (!ok || size < sizeof(header)) return false;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != JournalHeader::VERSION ||
+      header.endian_mark != JournalHeader::ENDIAN_MARK) {
+    return false;
+  }
+
+  Journal* attached = world.journal();
+  world.set_journal(nullptr);
+  std::size_t at = sizeof(header);
+  std::uint64_t expected = 1;
+  while (ok && at < size) {
+    JournalFrame frame;
+    if (size - at < sizeof(frame)) {
+      st.torn_tail = true;
+      break;
+    }
+    std::memcpy(&frame, data + at, sizeof(frame));
+    const std::size_t length = sizeof(frame) + round_up8(frame.size);
+    if (frame.sequence != expected || length > size - at ||
+        checksum_words(data + at, 0, length / 8, CHECKSUM_WORD) != frame.checksum) {
+      st.torn_tail = true;
+      break;
+    }
+    RecordReader in(data + at + sizeof(frame), frame.size);
+    for (std::uint32_t i = 0; ok && i < frame.num_records; ++i) {
+      ok = apply_record(in, world);
+      if (ok) ++st.records;
+    }
+    ok = ok && in.done();
+    if (ok) ++st.frames;
+    at += length;
+    ++expected;
+  }
+  world.grid().invalidate_aggregates();
+  world.set_journal(attached);
+  return ok;
+}
+
+} // end namespace cell
@@ -0,0 +1,220 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file journal.hpp
+/// @brief Write-ahead journal of the mutations of a World, for recovering
+///        everything since the last snapshot after a crash.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_JOURNAL_HPP
+#define CELL_JOURNAL_HPP
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// cell
+#include <location.hpp>
+#include <player.hpp>
+#include <reward.hpp>
+
+namespace cell {
+
+class World;
+
+/// Kinds of journal record. Each is the opcode byte followed by the fields
+/// named, in the host's byte order.
+enum class JournalOp : std::uint8_t {
+  ADD_REWARD = 1,        // id, type, level, x, y, quantity
+  REMOVE_REWARD,         // id
+  SET_QUANTITY,          // id, quantity
+  SET_UNDISTRIBUTED,     // level, quantity
+  PLAYER_JOIN,           // id, x, y
+  PLAYER_LEAVE,          // id
+  PLAYER_MOVE            // id, x, y
+};
+
+/** @brief A journal file is a JournalHeader followed by frames, one per
+  *        commit: a JournalFrame, then its records padded with zeros to a
+  *        multiple of 8 bytes. Frames are numbered from one and each carries
+  *        a checksum of itself, so a frame torn by a crash ends the journal.
+  */
+struct JournalHeader {
+  constexpr static std::uint32_t VERSION = 1;
+  constexpr static std::uint32_t ENDIAN_MARK = 0x01020304;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t endian_mark;
+};
+
+struct JournalFrame {
+  /// Bytes of records, without the padding.
+  std::uint32_t size;
+  std::uint32_t num_records;
+  std::uint64_t sequence;
+  /// Checksum of the frame and its padded records, with this field taken as
+  /// zero. Computed on the writer thread.
+  std::uint64_t checksum;
+};
+
+static_assert(sizeof(JournalHeader) == 16, "journal header layout");
+static_assert(sizeof(JournalFrame) == 24, "journal frame layout");
+
+/// What Journal::replay found.
+struct JournalReplayStats {
+  std::uint64_t frames = 0;
+  std::uint64_t records = 0;
+  /// True if the journal ended in a partly written or damaged frame, which
+  /// was ignored along with anything after it.
+  bool torn_tail = false;
+};
+
+/** @brief Records the mutations of a World as they happen and writes them out
+  *        a tick at a time.
+  *
+  *        Attached with World::set_journal, the world, its grid and reward
+  *        manager append a record for every reward added or removed, every
+  *        quantity changed and every player joining, leaving or moving.
+  *        Quantity handed out by a distribution is journaled as the new
+  *        quantity of each reward it changed rather than as the distribution
+  *        itself, because which rewards a distribution reaches depends on slot
+  *        order that a snapshot doesn't keep.
+  *
+  *        Appending only copies a few bytes into the current batch. commit,
+  *        called once per tick, hands the batch to a background thread that
+  *        writes it and makes it durable with one fdatasync. Batches committed
+  *        while the thread is busy are written together and share the next
+  *        fdatasync, so a slow disk delays durability but never the game.
+  *
+  *        Scan bookkeeping isn't journaled, a recovered world has the scan
+  *        history of its snapshot. To keep journals short, take a snapshot
+  *        between ticks and open a new journal right after it.
+  */
+class Journal {
+public:
+
+  Journal() = default;
+  ~Journal() { close(); }
+
+  /** @brief Starts a new, empty journal at path, replacing any file there.
+    * @return False if the file could not be created.
+    */
+  bool open(const std::string& path);
+
+  /// Commits what is pending, waits for it to be written and closes the file.
+  /// @return False if any write failed.
+  bool close();
+
+  bool is_open() const { return fd_ >= 0; }
+
+  // Records, appended to the current batch.
+  void add_reward(const Reward& reward);
+  void remove_reward(RewardId id) { record(JournalOp::REMOVE_REWARD, id); }
+  void set_quantity(RewardId id, int quantity) { record(JournalOp::SET_QUANTITY, id, quantity); }
+  void set_undistributed(Reward::RewardLevel level, std::uint64_t quantity) {
+    record(JournalOp::SET_UNDISTRIBUTED, std::uint8_t(level), quantity);
+  }
+  void player_join(const Player& p) {
+    record(JournalOp::PLAYER_JOIN, p.id(), p.location().x, p.location().y);
+  }
+  void player_leave(PlayerId id) { record(JournalOp::PLAYER_LEAVE, id); }
+  void player_move(PlayerId id, const Location& to) { record(JournalOp::PLAYER_MOVE, id, to.x, to.y); }
+
+  /** @brief Hands the current batch to the writer thread without waiting for
+    *        it. Does nothing if the batch is empty.
+    * @return Sequence number of the batch's frame, or of the last frame if
+    *         there was nothing to commit.
+    */
+  std::uint64_t commit();
+
+  /// Waits until every committed batch is durable.
+  /// @return False if a write failed, the journal stops writing after one.
+  bool sync();
+
+  /// Sequence number of the last frame known to be durable.
+  std::uint64_t durable_sequence() const;
+
+  /// Records and bytes appended since the last commit.
+  std::size_t pending_records() const { return pending_records_; }
+  std::size_t pending_bytes() const { return batch_.size() - sizeof(JournalFrame); }
+
+  /** @brief Applies a journal to a world, normally one just restored from the
+    *        snapshot taken before the journal was opened. Applying stops at a
+    *        torn tail. Any journal attached to the world is detached while
+    *        replaying, so the replay isn't journaled again.
+    * @return False if the file is missing, isn't a journal, or holds a
+    *         record that doesn't decode. Frames before a bad record stay
+    *         applied.
+    */
+  static bool replay(const std::string& path, World& world, JournalReplayStats* stats = nullptr);
+
+private:
+
+  template<class... Fields>
+  void record(JournalOp op, const Fields&... fields) {
+    constexpr std::size_t MAX_FIELDS = 24;
+    static_assert(sum_sizes<Fields...>() <= MAX_FIELDS, "journal record too long");
+    char buf[1 + MAX_FIELDS];
+    std::size_t n = 1;
+    buf[0] = char(op);
+    // Expands to one memcpy per field.
+    const int expand[] = { 0, (std::memcpy(buf + n, &fields, sizeof(fields)), n += sizeof(fields), 0)... };
+    (void)expand;
+    batch_.insert(batch_.end(), buf, buf + n);
+    ++pending_records_;
+  }
+
+  template<class... Fields>
+  constexpr static std::size_t sum_sizes() {
+    std::size_t total = 0;
+    for (std::size_t size : { std::size_t(0), sizeof(Fields)... }) total += size;
+    return total;
+  }
+
+  /// Starts an empty batch with room for its frame header.
+  void start_batch();
+
+  /// Body of the writer thread.
+  void write_loop();
+
+  // Owned by the game thread.
+  std::vector<char> batch_ = std::vector<char>(sizeof(JournalFrame));
+  std::size_t pending_records_ = 0;
+  std::uint64_t next_sequence_ = 1;
+
+  // Shared with the writer thread, guarded by mutex_.
+  mutable std::mutex mutex_;
+  std::condition_variable wake_writer_;
+  std::condition_variable written_;
+  std::vector<std::vector<char>> queue_;
+  std::vector<std::vector<char>> spare_;
+  std::uint64_t durable_ = 0;
+  bool failed_ = false;
+  bool stop_ = false;
+
+  int fd_ = -1;
+  std::thread writer_;
+
+  // No copy construction/assignment.
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+};
+
+inline void Journal::add_reward(const Reward& r) {
+  record(JournalOp::ADD_REWARD, r.id(), std::uint8_t(r.type()), std::uint8_t(r.level()),
+         r.location().x, r.location().y, r.quantity());
+}
+
+} // end namespace cell
+
+#endif // CELL_JOURNAL_HPP
@@ -20,11 +20,11 @@ struct Location {
   Location(int xin, int yin) : x(xin), y(yin) {}
   int x;
   int y;
-  bool between(const Location& top_left, const Location& bottom_right);
+  bool between(const Location& bottom_left, const Location& top_right) const;
   double distanceTo(const Location& loc) const;
 };
 
-inline bool Location::between(const Location& bottom_left, const Location& top_right) {
+inline bool Location::between(const Location& bottom_left, const Location& top_right) const {
   return x >= bottom_left.x && x <= top_right.x && y >= bottom_left.y && y <= top_right.y;
 }
 
@@ -13,11 +13,15 @@
 
 #include <cstdint>
 #include <location.hpp>
+#include <slot_map.hpp>
 
 namespace cell {
 
 typedef int PlayerId;
 
+/// Names a player in a World, see SlotMap.
+typedef SlotHandle PlayerHandle;
+
 class Player {
 public:
 
@@ -0,0 +1,179 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file protocol.cpp
+/// @brief Implementation of the ScanServer wire format.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// cell
+#include <protocol.hpp>
+
+namespace cell {
+
+namespace {
+
+constexpr std::size_t LENGTH_SIZE = 4;
+/// Op and tag.
+constexpr std::size_t HEADER_SIZE = 5;
+
+void put_u8(std::vector<char>& out, std::uint8_t v) { out.push_back(char(v)); }
+
+void put_u32(std::vector<char>& out, std::uint32_t v)
+{
+  const char bytes[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+  out.insert(out.end(), bytes, bytes + 4);
+}
+
+void put_i32(std::vector<char>& out, std::int32_t v) { put_u32(out, std::uint32_t(v)); }
+
+std::uint32_t get_u32(const char* p)
+{
+  const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+  return std::uint32_t(b[0]) | std::uint32_t(b[1]) << 8 | std::uint32_t(b[2]) << 16 |
+         std::uint32_t(b[3]) << 24;
+}
+
+/// Starts a frame, leaving room for its length.
+std::size_t begin_frame(std::vector<char>& out, WireOp op, std::uint32_t tag)
+{
+  const std::size_t start = out.size();
+  put_u32(out, 0);
+  put_u8(out, std::uint8_t(op));
+  put_u32(out, tag);
+  return start;
+}
+
+void end_frame(std::vector<char>& out, std::size_t start)
+{
+  const std::uint32_t length = std::uint32_t(out.size() - start - LENGTH_SIZE);
+  for (int i = 0; i < 4; ++i) out[start + i] = char(length >> (8 * i));
+}
+
+/// Fields of a request after the op and tag.
+std::size_t request_fields(WireOp op)
+{
+  switch (op) {
+  case WireOp::JOIN:
+  case WireOp::MOVE:
+  case WireOp::HIT:
+    return 3;
+  case WireOp::LEAVE:
+  case WireOp::SCAN:
+    return 1;
+  }
+  return 0;
+}
+
+/// Fields of an OK response after the status.
+std::size_t response_fields(WireOp op)
+{
+  switch (op) {
+  case WireOp::SCAN: return std::size_t(Scan::NUM_RINGS) * Scan::ring_t::NUM_DIRECTIONS;
+  case WireOp::HIT: return 1;
+  default: return 0;
+  }
+}
+
+bool valid_op(std::uint8_t op)
+{
+  return op >= std::uint8_t(WireOp::JOIN) && op <= std::uint8_t(WireOp::HIT);
+}
+
+/** @brief Finds the frame at the front of a buffer.
+  * @param body Set to the first byte after the length.
+  * @param length Set to the length field.
+  */
+WireResult find_frame(const char* data, std::size_t size, const char*& body, std::size_t& length)
+{
+  if (size < LENGTH_SIZE) return WireResult::INCOMPLETE;
+  length = get_u32(data);
+  if (length < HEADER_SIZE || length > MAX_WIRE_FRAME - LENGTH_SIZE) return WireResult::BAD;
+  if (size - LENGTH_SIZE < length) return WireResult::INCOMPLETE;
+  body = data + LENGTH_SIZE;
+  return WireResult::OK;
+}
+
+} // end anonymous namespace
+
+void encode_request(const WireRequest& request, std::vector<char>& out)
+{
+  const std::size_t start = begin_frame(out, request.op, request.tag);
+  put_i32(out, request.player);
+  if (request_fields(request.op) == 3) {
+    put_i32(out, request.location.x);
+    put_i32(out, request.location.y);
+  }
+  end_frame(out, start);
+}
+
+void encode_response(const WireResponse& response, std::vector<char>& out)
+{
+  const std::size_t start = begin_frame(out, response.op, response.tag);
+  put_u8(out, std::uint8_t(response.status));
+  if (response.status == WireStatus::OK) {
+    if (response.op == WireOp::HIT) put_i32(out, response.value);
+    if (response.op == WireOp::SCAN) {
+      for (const Scan::ring_t& ring : response.scan.rings()) {
+        for (int v : ring.vals()) put_i32(out, v);
+      }
+    }
+  }
+  end_frame(out, start);
+}
+
+WireResult decode_request(const char* data, std::size_t size, WireRequest& out, std::size_t& used)
+{
+  const char* body;
+  std::size_t length;
+  const WireResult found = find_frame(data, size, body, length);
+  if (found != WireResult::OK) return found;
+  const std::uint8_t op = std::uint8_t(body[0]);
+  if (!valid_op(op) || length != HEADER_SIZE + 4 * request_fields(WireOp(op))) return WireResult::BAD;
+
+  out.op = WireOp(op);
+  out.tag = get_u32(body + 1);
+  out.player = PlayerId(get_u32(body + HEADER_SIZE));
+  out.location = Location(0, 0);
+  if (request_fields(out.op) == 3) {
+    out.location = Location(int(get_u32(body + HEADER_SIZE + 4)), int(get_u32(body + HEADER_SIZE + 8)));
+  }
+  used = LENGTH_SIZE + length;
+  return WireResult::OK;
+}
+
+WireResult decode_response(const char* data, std::size_t size, WireResponse& out, std::size_t& used)
+{
+  const char* body;
+  std::size_t length;
+  const WireResult found = find_frame(data, size, body, length);
+  if (found != WireResult::OK) return found;
+  const std::uint8_t op = std::uint8_t(body[0]);
+  if (!valid_op(op) || length < HEADER_SIZE + 1) return WireResult::BAD;
+  const std::uint8_t status = std::uint8_t(body[HEADER_SIZE]);
+  if (status > std::uint8_t(WireStatus::DUPLICATE_PLAYER)) return WireResult::BAD;
+  const std::size_t fields = status == std::uint8_t(WireStatus::OK) ? response_fields(WireOp(op)) : 0;
+  if (length != HEADER_SIZE + 1 + 4 * fields) return WireResult::BAD;
+
+  out.op = WireOp(op);
+  out.tag = get_u32(body + 1);
+  out.status = WireStatus(status);
+  out.value = 0;
+  out.scan = Scan();
+  const char* p = body + HEADER_SIZE + 1;
+  if (fields > 0 && out.op == WireOp::HIT) out.value = int(get_u32(p));
+  if (fields > 0 && out.op == WireOp::SCAN) {
+    for (Scan::ring_t& ring : out.scan.rings()) {
+      for (int& v : ring.vals()) {
+        v = int(get_u32(p));
+        p += 4;
+      }
+    }
+  }
+  used = LENGTH_SIZE + length;
+  return WireResult::OK;
+}
+
+} // end namespace cell
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file protocol.hpp
+/// @brief Binary wire format of the requests and responses of ScanServer.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_PROTOCOL_HPP
+#define CELL_PROTOCOL_HPP
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// cell
+#include <location.hpp>
+#include <player.hpp>
+#include <scan.hpp>
+
+namespace cell {
+
+/** @brief Kinds of request. A request frame is
+  *
+  *            u32 length, u8 op, u32 tag, fields
+  *
+  *        and its response frame is
+  *
+  *            u32 length, u8 op, u32 tag, u8 status, fields
+  *
+  *        where length counts the bytes after itself and every field is a
+  *        little endian 32 bit integer. The tag is the client's own and is
+  *        sent back with the response. Responses to the requests sent on a
+  *        connection come back in the order the requests were sent.
+  */
+enum class WireOp : std::uint8_t {
+  JOIN = 1,    // id, x, y
+  LEAVE,       // id
+  MOVE,        // id, x, y
+  SCAN,        // id; responds with the rings of the scan, innermost first,
+               // each NUM_DIRECTIONS values
+  HIT          // id, x, y; responds with the value collected
+};
+
+/// Outcome of a request. Only a request with status OK has response fields.
+enum class WireStatus : std::uint8_t {
+  OK = 0,
+  UNKNOWN_PLAYER,   // Leave, move, scan or hit of a player not in the world.
+  DUPLICATE_PLAYER  // Join of a player already in the world.
+};
+
+/// Largest frame either side accepts, length field included.
+constexpr std::size_t MAX_WIRE_FRAME = 256;
+
+struct WireRequest {
+  WireOp op;
+  std::uint32_t tag;
+  PlayerId player;
+  /// JOIN, MOVE and HIT only.
+  Location location = Location{0, 0};
+};
+
+struct WireResponse {
+  WireOp op;
+  std::uint32_t tag;
+  WireStatus status;
+  /// HIT only.
+  int value;
+  /// SCAN only.
+  Scan scan;
+};
+
+/// What decoding the front of a buffer found.
+enum class WireResult {
+  OK,
+  INCOMPLETE,  // Not a whole frame yet, wait for more bytes.
+  BAD          // Not a valid frame, the connection can't be read any further.
+};
+
+/// Appends the frame of a request to out.
+void encode_request(const WireRequest& request, std::vector<char>& out);
+
+/// Appends the frame of a response to out.
+void encode_response(const WireResponse& response, std::vector<char>& out);
+
+/** @brief Decodes the frame at the front of [data, data + size).
+  * @param used Set to the size of the frame if the result is OK.
+  */
+WireResult decode_request(const char* data, std::size_t size, WireRequest& out, std::size_t& used);
+WireResult decode_response(const char* data, std::size_t size, WireResponse& out, std::size_t& used);
+
+} // end namespace cell
+
+#endif // CELL_PROTOCOL_HPP
@@ -10,38 +10,69 @@
 
 // std
 #include <algorithm>
-#include <chrono>
+#include <cmath>
 
 // cell
 #include <reward.hpp>
 #include <scan.hpp>
+#include <scan_kernel.hpp>
 
 namespace cell {
 
-int Reward::get_influence(const Player& player, int minDist, int maxDist)
-{
-  int influence = 0;
+namespace {
+
+/// ((HIT_RADIUS - dist) / HIT_RADIUS) ^ HIT_VALUE_FALLOFF at every whole squared
+/// distance within HIT_RADIUS, evaluated the way value_from_location did per hit.
+struct HitFalloffTable {
+  double falloff[Reward::MAX_HIT_DISTANCE2 + 1];
+
+  HitFalloffTable() {
+    for (int d2 = 0; d2 <= Reward::MAX_HIT_DISTANCE2; ++d2) {
+      falloff[d2] = pow((Reward::HIT_RADIUS - sqrt(double(d2))) / Reward::HIT_RADIUS,
+                        Reward::HIT_VALUE_FALLOFF);
+    }
+  }
+};
 
-  uint64_t cur_time = std::chrono::duration_cast<std::chrono::milliseconds>
-                        (std::chrono::system_clock::now().time_since_epoch()).count();
+const HitFalloffTable HIT_FALLOFF;
+
+} // end anonymous namespace
+
+constexpr int Reward::MAX_HIT_DISTANCE2;
+
+static_assert(Reward::NUM_SCANS_BEFORE_RESET <= int(RewardScanState::SCAN_MASK),
+              "scan count must fit in the packed scan state");
+
+int Reward::get_influence(const Player& player, int minDist, int maxDist, uint64_t now)
+{
   double dist_range = maxDist - minDist;
+  double dist = player.location().distanceTo(location_);
+  return get_influence(1.0 - std::max(0.0, std::min(1.0, dist / dist_range)), now);
+}
+
+int Reward::get_influence(double dist_mod, uint64_t now)
+{
+  const int influence = influence_at(dist_mod, now);
+  record_scan(now);
+  return influence;
+}
+
+int Reward::influence_at(double dist_mod, uint64_t now) const
+{
+  int influence = 0;
 
   switch (type_) {
     case RewardType::TRIVIAL:
       influence = quantity_;
       break;
     case RewardType::DISTANCE:
-      {
-        double dist = player.location().distanceTo(location_);
-        double dist_mod = 1.0 - std::max(0.0, std::min(1.0, dist / dist_range));
-        influence = int(double(quantity_) * dist_mod);
-      }
+      influence = int(double(quantity_) * dist_mod);
       break;
     case RewardType::DIST_TIME:
       {
-        double dist = player.location().distanceTo(location_);
-        double dist_mod = 1.0 - std::max(0.0, std::min(1.0, dist / dist_range));
-        double time_mod = std::min(double(cur_time - last_scanned_) / double(RECOVERY_TIME), 1.0);
+        // A concurrent reset can make last scanned newer than now.
+        const uint64_t last = scan_state().last_scanned();
+        double time_mod = now > last ? std::min(double(now - last) / double(RECOVERY_TIME), 1.0) : 0.0;
         influence = int(double(quantity_) * time_mod * dist_mod);
       }
       break;
@@ -49,22 +80,52 @@ int Reward::get_influence(const Player& player, int minDist, int maxDist)
       influence = quantity_;
   }
 
-  scans_++;
-  if (scans_ >= NUM_SCANS_BEFORE_RESET) {
-    last_scanned_ = cur_time;
-    scans_ = 0;
-  }
-
   return influence;
 }
 
+void Reward::record_scan(uint64_t now)
+{
+  scan_state_ptr()->record(now, NUM_SCANS_BEFORE_RESET);
+}
+
+Reward::Reward(const Reward& other) noexcept
+  : id_(other.id_), type_(other.type_), level_(other.level_), location_(other.location_),
+    quantity_(other.quantity_), own_state_(other.scan_state())
+{
+}
+
+Reward& Reward::operator=(const Reward& other) noexcept
+{
+  id_ = other.id_;
+  type_ = other.type_;
+  level_ = other.level_;
+  location_ = other.location_;
+  quantity_ = other.quantity_;
+  if (this != &other) *scan_state_ptr() = other.scan_state();
+  return *this;
+}
+
+RewardScanState* Reward::detach_scan_state()
+{
+  RewardScanState* state = hot_state_;
+  if (state) {
+    own_state_ = *state;
+    hot_state_ = nullptr;
+  }
+  return state;
+}
+
 int Reward::value_from_location(const Location& loc) const
 {
-  double dist = loc.distanceTo(location_);
-  double reward_percent = pow(((HIT_RADIUS - dist) / HIT_RADIUS), HIT_VALUE_FALLOFF);
+  return hit_value(distance_squared(std::int64_t(loc.x) - location_.x,
+                                    std::int64_t(loc.y) - location_.y));
+}
 
+int Reward::hit_value(std::int64_t d2) const
+{
+  if (d2 > MAX_HIT_DISTANCE2) return 0;
   // Minimum reward from any hit is always one!
-  return std::max(dist <= HIT_RADIUS ? 1 : 0, int(reward_percent * double(quantity_)));
+  return std::max(1, int(HIT_FALLOFF.falloff[d2] * double(quantity_)));
 }
 
 } // end namespace cell
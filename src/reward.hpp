@@ -13,6 +13,7 @@
 
 #include <player.hpp>
 #include <location.hpp>
+#include <scan_state.hpp>
 
 namespace cell {
 
@@ -28,6 +29,9 @@ public:
   /// value = (((radius - distance) / radius) ^ falloff) * quantity
   constexpr static double HIT_VALUE_FALLOFF = 3.0;
 
+  /// Largest squared distance between whole locations that is within HIT_RADIUS.
+  constexpr static int MAX_HIT_DISTANCE2 = int(HIT_RADIUS * HIT_RADIUS);
+
   /// Time after a reset of last scanned that this reward will exert full
   /// influence again. (in milliseconds)
   constexpr static uint64_t RECOVERY_TIME = 60000;
@@ -55,13 +59,37 @@ public:
   /// Constructor
   Reward(RewardId id, RewardType type) : id_(id), type_(type) {}
 
+  /// Copies take their own snapshot of the scan bookkeeping and never share
+  /// the ScanStateTable slot of a reward owned by a RewardManager. Assigning
+  /// to an attached reward writes into the slot it already has. There are no
+  /// separate moves: a slot stays with the reward it was attached to.
+  Reward(const Reward& other) noexcept;
+  Reward& operator=(const Reward& other) noexcept;
+
   /** @brief Obtain the influence that this reward is exerting on the given player.
     * @param player   Player whom is performing the scan.
     * @param minDist  Minimum distance for this scan.
     * @param maxDist  Maximum distance for this scan.
+    * @param now      Game time of the scan in milliseconds, see GameClock.
     * @return Influence value.
     */
-  int get_influence(const Player& player, int minDist, int maxDist);
+  int get_influence(const Player& player, int minDist, int maxDist, uint64_t now);
+
+  /** @brief Same as above with the distance falloff for this scan already
+    *        worked out by the caller, as 1 - clamp(dist / (maxDist - minDist), 0, 1).
+    *        Used by the batch scan kernels.
+    */
+  int get_influence(double dist_mod, uint64_t now);
+
+  /** @brief The influence get_influence(dist_mod, now) would return, without
+    *        counting it as a scan. Safe to call from several threads while
+    *        nothing records scans.
+    */
+  int influence_at(double dist_mod, uint64_t now) const;
+
+  /// The bookkeeping half of get_influence: counts one scan made at time now.
+  /// Safe to call from several threads at once.
+  void record_scan(uint64_t now);
 
   /** @brief Obtains the value of this reward given that it was "hit" by a player
     *        at the provided location. The goal of this mechanic is to allow a player
@@ -73,6 +101,12 @@ public:
     */
   int value_from_location(const Location& loc) const;
 
+  /** @brief Same as value_from_location for a hit at squared distance d2 from
+    *        this reward. The falloff comes from a table over every squared
+    *        distance within HIT_RADIUS, worked out once.
+    */
+  int hit_value(std::int64_t d2) const;
+
   // Accessors
 
   const RewardLevel& level() const { return level_; }
@@ -87,6 +121,18 @@ public:
   const RewardType& type() const { return type_; }
   const RewardId& id() const { return id_; }
 
+  /// Scan bookkeeping, kept in a ScanStateTable for rewards owned by a
+  /// RewardManager and inside the reward otherwise.
+  const RewardScanState& scan_state() const { return *scan_state_ptr(); }
+
+  /** @brief Moves the scan bookkeeping into the given table slot, which is
+    *        initialised from the current state. Used by RewardManager.
+    */
+  void attach_scan_state(RewardScanState* state) { *state = scan_state(); hot_state_ = state; }
+  /// Overwrites the scan bookkeeping, e.g. when loading a snapshot.
+  void set_scan_state(const RewardScanState& state) { *scan_state_ptr() = state; }
+  RewardScanState* detach_scan_state();
+
   friend std::ostream& operator<<(std::ostream& out, const Reward& r);
 
 private:
@@ -96,8 +142,11 @@ private:
   RewardLevel level_ = RewardLevel::SMALL;
   Location location_ = Location{0, 0};
   int quantity_ = 0;
-  int scans_ = 0;
-  uint64_t last_scanned_ = 0;
+  RewardScanState* hot_state_ = nullptr;
+  RewardScanState own_state_;
+
+  RewardScanState* scan_state_ptr() { return hot_state_ ? hot_state_ : &own_state_; }
+  const RewardScanState* scan_state_ptr() const { return hot_state_ ? hot_state_ : &own_state_; }
 
 };
 
@@ -107,8 +156,8 @@ inline std::ostream& operator<<(std::ostream& out, const Reward& r) {
              << " level: " << r.level_
              << " location: " << r.location_
              << " quantity: " << r.quantity_
-             << " scans: " << r.scans_
-             << " last_scanned: " << r.last_scanned_
+             << " scans: " << r.scan_state().scans()
+             << " last_scanned: " << r.scan_state().last_scanned()
              << " }";
 }
 
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file reward_spawner.cpp
+/// @brief Implementation of RewardSpawner class.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+// cell
+#include <hash.hpp>
+#include <reward_spawner.hpp>
+#include <scan_kernel.hpp>
+
+namespace cell {
+
+namespace {
+
+/// Largest min_spacing handled, so that a point's offset inside its background
+/// cell fits in 16 bits per axis.
+constexpr int MAX_SPACING = 1 << 16;
+
+/// True if a reward already in the grid is closer than spacing to l.
+bool near_existing(const Grid& grid, const Location& l, int spacing)
+{
+  const GridMap<RewardHandle>& rewards = grid.reward_grid();
+  if (rewards.size() == 0) return false;
+  const std::int64_t limit2 = std::int64_t(spacing) * spacing;
+  const int reach = spacing - 1;
+  return rewards.for_each_in_rect_until(Location(l.x - reach, l.y - reach),
+                                        Location(l.x + reach, l.y + reach),
+    [&](const Location& rl, const RewardHandle&) {
+      return distance_squared(std::int64_t(rl.x) - l.x, std::int64_t(rl.y) - l.y) < limit2;
+    });
+}
+
+} // end anonymous namespace
+
+constexpr int RewardSpawner::FILL_ROUNDS;
+constexpr int RewardSpawner::DART_TRIES;
+
+RewardSpawner::RewardSpawner(std::uint64_t seed, unsigned num_threads)
+  : seed_(seed), num_threads_(num_threads)
+{
+}
+
+std::vector<Reward> RewardSpawner::generate(const Grid& grid, const SpawnRequest& request)
+{
+  std::vector<Reward> rewards;
+  const std::uint64_t stream = mix64(seed_ + mix64(++calls_));
+  if (request.count == 0 || request.top_right.x < request.bottom_left.x ||
+      request.top_right.y < request.bottom_left.y) {
+    return rewards;
+  }
+
+  SpawnRequest req = request;
+  req.min_spacing = std::min(std::max(req.min_spacing, 1), MAX_SPACING);
+
+  // Fill when the request is over about a third of what a fill of the region
+  // holds, which is around 0.7 rewards per min_spacing^2.
+  const double width = double(req.top_right.x) - req.bottom_left.x + 1;
+  const double height = double(req.top_right.y) - req.bottom_left.y + 1;
+  const double spacing = req.min_spacing;
+  std::vector<Location> locations;
+  if (double(req.count) * 4 * spacing * spacing >= width * height) {
+    fill(grid, req, stream, locations);
+  } else {
+    throw_darts(grid, req, stream, locations);
+  }
+
+  rewards.reserve(locations.size());
+  for (const Location& l : locations) {
+    Reward r(next_id_++, req.type);
+    r.level() = req.level;
+    r.quantity() = req.quantity;
+    r.location() = l;
+    rewards.push_back(r);
+  }
+  return rewards;
+}
+
+std::size_t RewardSpawner::spawn(Grid& grid, const SpawnRequest& request)
+{
+  const std::vector<Reward> rewards = generate(grid, request);
+  return grid.add_rewards(rewards);
+}
+
+void RewardSpawner::fill(const Grid& grid, const SpawnRequest& request, std::uint64_t stream,
+                         std::vector<Location>& out)
+{
+  const int r = request.min_spacing;
+  const std::int64_t limit2 = std::int64_t(r) * r;
+  // Smallest cell side c whose points, at offsets [0, c) from its corner, are
+  // all closer than r to each other, so that a cell holds at most one reward.
+  int c = 1;
+  while (2 * std::int64_t(c) * c < limit2) ++c;
+  // Rewards in cells more than n apart can't be closer than r, and cells m
+  // apart in both directions can be tried at the same time.
+  const int n = r >= 2 ? (r - 2) / c + 1 : 0;
+  const int m = n + 1;
+
+  const Location& origin = request.bottom_left;
+  const std::int64_t width = std::int64_t(request.top_right.x) - origin.x + 1;
+  const std::int64_t height = std::int64_t(request.top_right.y) - origin.y + 1;
+  const std::int64_t cols = (width + c - 1) / c, rows = (height + c - 1) / c;
+
+  // Each cell holds the offset of its reward from the cell's corner, x in the
+  // high half and y in the low half, plus one. Zero for an empty cell. The
+  // array has n empty cells of padding on every side so that neighbours need
+  // no bounds checks.
+  const std::int64_t stride = cols + 2 * n;
+  std::vector<std::uint32_t> cells(std::size_t(stride * (rows + 2 * n)), 0);
+  const auto cell_index = [&](std::int64_t cx, std::int64_t cy) {
+    return std::size_t((cy + n) * stride + cx + n);
+  };
+
+  // Neighbour cells that can hold a reward closer than r, as index deltas.
+  struct Neighbour {
+    std::ptrdiff_t delta;
+    std::int64_t dx;
+    std::int64_t dy;
+  };
+  std::vector<Neighbour> neighbours;
+  for (int ny = -n; ny <= n; ++ny) {
+    for (int nx = -n; nx <= n; ++nx) {
+      const std::int64_t gx = std::max(0, std::abs(nx) * c - c + 1);
+      const std::int64_t gy = std::max(0, std::abs(ny) * c - c + 1);
+      if ((nx != 0 || ny != 0) && distance_squared(gx, gy) < limit2) {
+        neighbours.push_back(Neighbour{ ny * stride + nx, std::int64_t(nx) * c, std::int64_t(ny) * c });
+      }
+    }
+  }
+
+  if (!pool_) pool_.reset(new ThreadPool(num_threads_));
+
+  const auto try_cell = [&](std::int64_t cx, std::int64_t cy, int round) {
+    const std::size_t idx = cell_index(cx, cy);
+    if (cells[idx] != 0) return;
+    // Cells on the far edges can be cut short by the region.
+    const std::int64_t cw = std::min<std::int64_t>(c, width - cx * c);
+    const std::int64_t ch = std::min<std::int64_t>(c, height - cy * c);
+    const std::uint64_t h = mix64(stream + mix64(std::uint64_t(idx) * FILL_ROUNDS + round));
+    // Each half of h scaled to [0, side), cheaper than taking a remainder.
+    const std::int64_t ox = std::int64_t(((h & 0xffffffffULL) * std::uint64_t(cw)) >> 32);
+    const std::int64_t oy = std::int64_t(((h >> 32) * std::uint64_t(ch)) >> 32);
+
+    for (const Neighbour& nb : neighbours) {
+      const std::uint32_t v = cells[idx + nb.delta];
+      if (v == 0) continue;
+      const std::int64_t px = nb.dx + ((v - 1) >> 16), py = nb.dy + ((v - 1) & 0xffff);
+      if (distance_squared(px - ox, py - oy) < limit2) return;
+    }
+    const Location l(int(origin.x + cx * c + ox), int(origin.y + cy * c + oy));
+    if (near_existing(grid, l, r)) return;
+    cells[idx] = std::uint32_t((ox << 16) | oy) + 1;
+  };
+
+  for (int round = 0; round < FILL_ROUNDS; ++round) {
+    for (int py = 0; py < m; ++py) {
+      const std::int64_t phase_rows = rows > py ? (rows - py + m - 1) / m : 0;
+      for (int px = 0; px < m; ++px) {
+        // Cells of one phase are m apart, too far to see each other's rewards.
+        const std::size_t grain = std::max<std::size_t>(1, std::size_t(phase_rows) / (pool_->size() * 8));
+        pool_->parallel_for(std::size_t(phase_rows), grain, [&](std::size_t begin, std::size_t end) {
+          for (std::size_t i = begin; i < end; ++i) {
+            const std::int64_t cy = py + std::int64_t(i) * m;
+            for (std::int64_t cx = px; cx < cols; cx += m) try_cell(cx, cy, round);
+          }
+        });
+      }
+    }
+  }
+
+  // Every cell's reward with a random key, a random subset of count of them
+  // keeps the spacing.
+  std::vector<std::pair<std::uint64_t, Location>> found;
+  for (std::int64_t cy = 0; cy < rows; ++cy) {
+    for (std::int64_t cx = 0; cx < cols; ++cx) {
+      const std::size_t idx = cell_index(cx, cy);
+      const std::uint32_t v = cells[idx];
+      if (v == 0) continue;
+      found.emplace_back(mix64(~stream + idx),
+                         Location(int(origin.x + cx * c + ((v - 1) >> 16)),
+                                  int(origin.y + cy * c + ((v - 1) & 0xffff))));
+    }
+  }
+  if (found.size() > request.count) {
+    const auto by_key = [](const std::pair<std::uint64_t, Location>& a,
+                           const std::pair<std::uint64_t, Location>& b) {
+      return a.first < b.first;
+    };
+    std::nth_element(found.begin(), found.begin() + request.count, found.end(), by_key);
+    found.erase(found.begin() + request.count, found.end());
+    std::sort(found.begin(), found.end(), [](const std::pair<std::uint64_t, Location>& a,
+                                             const std::pair<std::uint64_t, Location>& b) {
+      return a.second < b.second;
+    });
+  }
+  out.reserve(found.size());
+  for (const auto& f : found) out.push_back(f.second);
+}
+
+void RewardSpawner::throw_darts(const Grid& grid, const SpawnRequest& request, std::uint64_t stream,
+                                std::vector<Location>& out)
+{
+  const int r = request.min_spacing;
+  const std::int64_t limit2 = std::int64_t(r) * r;
+  const int reach = r - 1;
+  const Location& origin = request.bottom_left;
+  const std::uint64_t width = std::uint64_t(std::int64_t(request.top_right.x) - origin.x + 1);
+  const std::uint64_t height = std::uint64_t(std::int64_t(request.top_right.y) - origin.y + 1);
+
+  // Darts that hit, with cells about as wide as the spacing.
+  int shift = 0;
+  while ((1 << shift) < r && shift < 30) ++shift;
+  GridMap<char> placed(shift);
+
+  const std::uint64_t tries = std::uint64_t(request.count) * DART_TRIES;
+  for (std::uint64_t t = 0; t < tries && out.size() < request.count; ++t) {
+    const Location l(int(origin.x + std::int64_t(mix64(stream + 2 * t) % width)),
+                     int(origin.y + std::int64_t(mix64(stream + 2 * t + 1) % height)));
+    const bool near_placed = placed.for_each_in_rect_until(
+      Location(l.x - reach, l.y - reach), Location(l.x + reach, l.y + reach),
+      [&](const Location& pl, char) {
+        return distance_squared(std::int64_t(pl.x) - l.x, std::int64_t(pl.y) - l.y) < limit2;
+      });
+    if (near_placed || near_existing(grid, l, r)) continue;
+    placed.insert(l, 0);
+    out.push_back(l);
+  }
+}
+
+} // end namespace cell
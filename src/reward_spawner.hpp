@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file reward_spawner.hpp
+/// @brief Places new rewards over the board with blue noise (Poisson-disc)
+///        spacing, for filling the world and replenishing it.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_REWARD_SPAWNER_HPP
+#define CELL_REWARD_SPAWNER_HPP
+
+// std
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// cell
+#include <grid.hpp>
+#include <location.hpp>
+#include <reward.hpp>
+#include <thread_pool.hpp>
+
+namespace cell {
+
+/// What one RewardSpawner::spawn call places.
+struct SpawnRequest {
+  /// Level, type and quantity of every new reward.
+  Reward::RewardLevel level = Reward::RewardLevel::SMALL;
+  Reward::RewardType type = Reward::RewardType::TRIVIAL;
+  int quantity = 1;
+
+  /// Most rewards to place. Fewer are placed when the region can't hold
+  /// that many at min_spacing.
+  std::size_t count = 0;
+
+  /// No new reward is closer than this to another reward, new or already in
+  /// the grid. At least one.
+  int min_spacing = 1;
+
+  /// INCLUSIVE region new rewards are placed in.
+  Location bottom_left = Location(0, 0);
+  Location top_right = Location(0, 0);
+};
+
+/** @brief Spawns rewards with Poisson-disc spacing: no two rewards closer than
+  *        min_spacing, otherwise uniformly spread, without the clumps and gaps
+  *        of independent random placement.
+  *
+  *        Requests that cover a good share of what the region can hold are
+  *        FILLED: the region is split into background cells small enough to
+  *        hold one reward each, and every cell gets a few tries at a random
+  *        point that keeps its distance from the rewards around it. Cells are
+  *        tried in phases in which no two cells are close enough to affect
+  *        each other, so each phase runs on all threads of the spawner's pool.
+  *        When the fill ends up with more than count rewards, a random subset
+  *        of count is kept, which keeps the spacing.
+  *
+  *        Smaller requests, such as replacing collected rewards, throw darts
+  *        at random points of the region instead, so their cost follows the
+  *        count rather than the region's area.
+  *
+  *        Results depend only on the seed, the number of earlier spawn calls
+  *        and the grid's rewards, not on the number of threads.
+  */
+class RewardSpawner {
+public:
+
+  /// Tries per background cell when filling, and per reward when throwing darts.
+  constexpr static int FILL_ROUNDS = 8;
+  constexpr static int DART_TRIES = 32;
+
+  /// A num_threads of zero uses one thread per hardware thread.
+  explicit RewardSpawner(std::uint64_t seed = 0, unsigned num_threads = 0);
+
+  /// Generates the rewards of a request without adding them to the grid,
+  /// spaced against the rewards already in it.
+  std::vector<Reward> generate(const Grid& grid, const SpawnRequest& request);
+
+  /// Generates the rewards of a request and adds them to the grid. Rewards
+  /// whose id is already in the grid aren't added, see set_next_id.
+  /// @return Number of rewards added.
+  std::size_t spawn(Grid& grid, const SpawnRequest& request);
+
+  /// Id of the next reward spawned, ids are handed out consecutively. Set it
+  /// past the ids of the grid when spawning into one that isn't empty.
+  RewardId next_id() const { return next_id_; }
+  void set_next_id(RewardId id) { next_id_ = id; }
+
+private:
+
+  /// Candidate locations of a request in one of the two ways described above.
+  void fill(const Grid& grid, const SpawnRequest& request, std::uint64_t stream,
+            std::vector<Location>& out);
+  void throw_darts(const Grid& grid, const SpawnRequest& request, std::uint64_t stream,
+                   std::vector<Location>& out);
+
+  std::uint64_t seed_;
+  std::uint64_t calls_ = 0;
+  RewardId next_id_ = 0;
+  unsigned num_threads_;
+  std::unique_ptr<ThreadPool> pool_;
+
+  // No copy construction/assignment.
+  RewardSpawner(const RewardSpawner&) = delete;
+  RewardSpawner& operator=(const RewardSpawner&) = delete;
+
+};
+
+} // end namespace cell
+
+#endif // CELL_REWARD_SPAWNER_HPP
@@ -8,6 +8,10 @@
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
+// std
+#include <algorithm>
+#include <numeric>
+
 // cell
 #include <rewardclass.hpp>
 
@@ -20,18 +24,86 @@ RewardClass::RewardClass(const reward_vec_t&& rewards) : rewards_(std::move(rewa
   for (const auto& r : rewards_) total_quantity_ += r.quantity();
 }
 
+constexpr uint64_t RewardClass::BULK_FACTOR;
+
+uint64_t RewardClass::distribution_step(uint64_t current, uint64_t quantity, uint64_t avg)
+{
+  // To discourage perfect distribution, if simply adding the entire quantity
+  // to this reward's current quantity would still be under 120% of the average
+  // then simply add it. Otherwise add a 'fair' amount.
+  return (current + quantity < (avg + (avg / 5))) ? quantity :
+          std::max(std::max(quantity / 10, uint64_t(1)), std::min(quantity, avg - current));
+}
+
+uint64_t RewardClass::water_level(std::vector<uint64_t>& quantities, uint64_t quantity)
+{
+  // Quickselect over the level: [lo, hi) holds the quantities not yet known
+  // to be below or above it, count and sum cover the ones known to be below.
+  std::size_t lo = 0, hi = quantities.size(), count = 0;
+  uint64_t sum = 0;
+  while (lo < hi) {
+    const auto mid = quantities.begin() + (lo + (hi - lo) / 2);
+    std::nth_element(quantities.begin() + lo, mid, quantities.begin() + hi);
+    const std::size_t mid_count = count + (mid - quantities.begin()) - lo + 1;
+    const uint64_t mid_sum = std::accumulate(quantities.begin() + lo, mid + 1, sum);
+    // Raising everything up to and including mid to its value.
+    if (*mid * mid_count - mid_sum <= quantity) {
+      count = mid_count;
+      sum = mid_sum;
+      lo = mid - quantities.begin() + 1;
+    } else {
+      hi = mid - quantities.begin();
+    }
+  }
+  return (quantity + sum) / count;
+}
+
 void RewardClass::distribute_quantity(uint64_t quantity)
+{
+  if (rewards_.empty()) return;
+  if (quantity > BULK_FACTOR * (total_quantity_ / rewards_.size())) {
+    distribute_bulk(quantity);
+  } else {
+    distribute_stepwise(quantity);
+  }
+}
+
+void RewardClass::distribute_bulk(uint64_t quantity)
+{
+  total_quantity_ += quantity;
+  std::vector<uint64_t> quantities;
+  quantities.reserve(rewards_.size());
+  for (const Reward& r : rewards_) quantities.push_back(r.quantity());
+  const uint64_t level = water_level(quantities, quantity);
+  for (Reward& r : rewards_) {
+    if (uint64_t(r.quantity()) < level) {
+      quantity -= level - r.quantity();
+      r.quantity() = int(level);
+    }
+  }
+
+  // Less than one unit per raised reward is left. Topping raised rewards up
+  // from the cursor keeps the result uneven without going over 120% of the
+  // average, which is at least the level.
+  const uint64_t top_up = std::max(total_quantity_ / rewards_.size() / 5, uint64_t(1));
+  while (quantity > 0) {
+    if (cur_reward_ == rewards_.end()) cur_reward_ = rewards_.begin();
+    if (uint64_t(cur_reward_->quantity()) == level) {
+      const uint64_t amount = std::min(quantity, top_up);
+      cur_reward_->quantity() += int(amount);
+      quantity -= amount;
+    }
+    ++cur_reward_;
+  }
+}
+
+void RewardClass::distribute_stepwise(uint64_t quantity)
 {
   while (quantity > 0) {
     uint64_t avg = total_quantity_ / rewards_.size();
     while (quantity > 0 && cur_reward_ != rewards_.end()) {
       if (cur_reward_->quantity() <= avg) {
-        // To discourage perfect distribution, if simply adding the entire quantity
-        // to this reward's current quantity would still be under 120% of the average
-        // then simply add it. Otherwise add a 'fair' amount.
-        uint64_t dist_amount = (cur_reward_->quantity() + quantity < (avg + (avg / 5))) ? quantity :
-                                std::max(std::max(quantity / 10, uint64_t(1)),
-                                        std::min(quantity, avg - cur_reward_->quantity()));
+        uint64_t dist_amount = distribution_step(cur_reward_->quantity(), quantity, avg);
         cur_reward_->quantity() += dist_amount;
         total_quantity_ += dist_amount;
         quantity -= dist_amount;
@@ -23,9 +23,34 @@ public:
   /// Create a RewardClass to take ownership of a given vector of rewards.
   RewardClass(const reward_vec_t&& rewards);
 
-  /// Distributes a given quantity.
+  /** @brief Distributes a given quantity. Rewards at or below the class
+    *        average are topped up in turn, each getting all of what is left
+    *        if that keeps it under 120% of the average, so the result is
+    *        deliberately not perfectly even.
+    *
+    *        Quantities over BULK_FACTOR times the average would have the
+    *        walk hand out a tenth of the remainder per step, well past 120%,
+    *        so they are poured in by water filling instead: every reward
+    *        below water_level() is raised to it in one pass, and the rounding
+    *        remainder tops rewards up by at most a fifth of the average.
+    */
   void distribute_quantity(uint64_t quantity);
 
+  /// Quantities over this many times the class average are water filled.
+  constexpr static uint64_t BULK_FACTOR = 10;
+
+  /** @brief One step of distribute_quantity: how much of the quantity still
+    *        to hand out a reward currently holding current receives, given
+    *        the class average avg. Only called for rewards at or below avg.
+    */
+  static uint64_t distribution_step(uint64_t current, uint64_t quantity, uint64_t avg);
+
+  /** @brief The largest level L such that raising every one of quantities
+    *        below L up to L takes at most quantity. Found by selection in
+    *        expected O(n), which reorders quantities. Must not be empty.
+    */
+  static uint64_t water_level(std::vector<uint64_t>& quantities, uint64_t quantity);
+
   // Accessors
   const uint64_t total_quantity() const { return total_quantity_; }
   uint64_t& total_quantity() { return total_quantity_; }
@@ -33,6 +58,10 @@ public:
 
 private:
 
+  /// The two ways distribute_quantity hands quantity out.
+  void distribute_stepwise(uint64_t quantity);
+  void distribute_bulk(uint64_t quantity);
+
   reward_vec_t rewards_;
   reward_vec_t::iterator cur_reward_;
   uint64_t total_quantity_ = 0;
@@ -8,20 +8,169 @@
 ///
 ////////////////////////////////////////////////////////////////////////////////
 
+// std
+#include <algorithm>
+
 // cell
+#include <journal.hpp>
+#include <rewardclass.hpp>
 #include <rewardmanager.hpp>
 
 namespace cell {
 
-Reward* RewardManager::add_reward(const Reward& reward)
+RewardHandle RewardManager::add_reward(const Reward& reward)
+{
+  const auto ret = handles_.emplace(reward.id(), RewardHandle());
+  if (!ret.second) return ret.first->second;
+
+  Level& level = reward_levels_[reward.level()];
+  const RewardHandle handle{ level.rewards.insert(reward), reward.level() };
+  Reward* r = get(handle);
+  r->attach_scan_state(scan_states_.acquire(RewardScanState()));
+  level.total_quantity += r->quantity();
+  ret.first->second = handle;
+  if (journal_) journal_->add_reward(*r);
+  log_change(*r);
+  return handle;
+}
+
+void RewardManager::erase_reward(RewardHandle handle, Reward& reward)
+{
+  Level& level = reward_levels_[handle.level];
+  level.total_quantity -= reward.quantity();
+  if (journal_) journal_->remove_reward(reward.id());
+  log_change(reward);
+  handles_.erase(reward.id());
+  scan_states_.release(reward.detach_scan_state());
+  level.rewards.erase(handle.slot);
+}
+
+bool RewardManager::remove_reward(RewardHandle handle)
+{
+  Reward* r = get(handle);
+  if (!r) return false;
+  const std::uint64_t quantity = r->quantity();
+  erase_reward(handle, *r);
+  distribute_quantity(handle.level, quantity);
+  return true;
+}
+
+bool RewardManager::discard_reward(RewardHandle handle)
+{
+  Reward* r = get(handle);
+  if (!r) return false;
+  erase_reward(handle, *r);
+  return true;
+}
+
+std::size_t RewardManager::remove_rewards(span<const RewardHandle> handles)
+{
+  std::uint64_t freed[Reward::RewardLevel::NUM_LEVELS] = {};
+  std::size_t removed = 0;
+  for (const RewardHandle& h : handles) {
+    Reward* r = get(h);
+    if (!r) continue;
+    freed[h.level] += r->quantity();
+    erase_reward(h, *r);
+    ++removed;
+  }
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    if (freed[level] > 0) distribute_quantity(Reward::RewardLevel(level), freed[level]);
+  }
+  return removed;
+}
+
+void RewardManager::distribute_quantity(Reward::RewardLevel level_id, std::uint64_t quantity)
+{
+  Level& level = reward_levels_[level_id];
+  const std::uint64_t undistributed = level.undistributed;
+  quantity += level.undistributed;
+  level.undistributed = 0;
+  if (level.rewards.empty()) {
+    level.undistributed = quantity;
+    journal_undistributed(level_id, undistributed);
+    return;
+  }
+  journal_undistributed(level_id, undistributed);
+
+  // Same as RewardClass::distribute_quantity, over the level's slots.
+  const std::uint32_t num_slots = std::uint32_t(level.rewards.capacity());
+  if (quantity > RewardClass::BULK_FACTOR * (level.total_quantity / level.rewards.size())) {
+    // Rather than water filling the whole level, the rewards from the cursor
+    // on are raised to the average the level ends up with. That takes at
+    // most one lap, and stops as soon as the quantity is used up. Rounding
+    // leaves less than one unit per reward, which goes out stepwise below.
+    const std::uint64_t target = (level.total_quantity + quantity) / level.rewards.size();
+    for (std::uint32_t visited = 0; quantity > 0 && visited < num_slots; ++visited) {
+      if (level.cursor >= num_slots) level.cursor = 0;
+      Reward* r = level.rewards.get_slot(level.cursor++);
+      if (r == nullptr || std::uint64_t(r->quantity()) >= target) continue;
+      const std::uint64_t amount = std::min(quantity, target - r->quantity());
+      r->quantity() += int(amount);
+      level.total_quantity += amount;
+      quantity -= amount;
+      if (journal_) journal_->set_quantity(r->id(), r->quantity());
+      log_change(*r);
+    }
+  }
+
+  while (quantity > 0) {
+    const std::uint64_t avg = level.total_quantity / level.rewards.size();
+    while (quantity > 0 && level.cursor < num_slots) {
+      Reward* r = level.rewards.get_slot(level.cursor);
+      if (r == nullptr) {
+        ++level.cursor;
+        continue;
+      }
+      if (std::uint64_t(r->quantity()) <= avg) {
+        const std::uint64_t amount = RewardClass::distribution_step(r->quantity(), quantity, avg);
+        r->quantity() += int(amount);
+        level.total_quantity += amount;
+        quantity -= amount;
+        if (journal_) journal_->set_quantity(r->id(), r->quantity());
+        log_change(*r);
+      }
+      if (std::uint64_t(r->quantity()) >= avg) ++level.cursor;
+    }
+    if (level.cursor >= num_slots) level.cursor = 0;
+  }
+}
+
+void RewardManager::set_quantity(RewardHandle handle, int quantity)
+{
+  Reward* r = get(handle);
+  if (!r) return;
+  Level& level = reward_levels_[handle.level];
+  level.total_quantity = level.total_quantity - r->quantity() + quantity;
+  r->quantity() = quantity;
+  if (journal_) journal_->set_quantity(r->id(), quantity);
+  log_change(*r);
+}
+
+void RewardManager::set_undistributed(Reward::RewardLevel level, std::uint64_t quantity)
+{
+  const std::uint64_t before = reward_levels_[level].undistributed;
+  reward_levels_[level].undistributed = quantity;
+  journal_undistributed(level, before);
+}
+
+void RewardManager::journal_undistributed(Reward::RewardLevel level, std::uint64_t before)
+{
+  const std::uint64_t now = reward_levels_[level].undistributed;
+  if (journal_ && now != before) journal_->set_undistributed(level, now);
+}
+
+std::uint64_t RewardManager::total_quantity() const
 {
-  auto ret = reward_levels_[reward.level()].emplace(reward.id(), reward);
-  return &(ret.first->second);
+  std::uint64_t total = 0;
+  for (const Level& level : reward_levels_) total += level.total_quantity;
+  return total;
 }
 
-bool RewardManager::remove_reward(const Reward& reward)
+RewardHandle RewardManager::find(RewardId id) const
 {
-  return false;
+  const auto it = handles_.find(id);
+  return it == handles_.end() ? RewardHandle() : it->second;
 }
 
 } // end namespace cell
@@ -12,43 +12,195 @@
 #ifndef CELL_REWARD_MANAGER_HPP
 #define CELL_REWARD_MANAGER_HPP
 
+#include <block_pool.hpp>
 #include <reward.hpp>
+#include <scan_state.hpp>
+#include <span.hpp>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
-#include <map>
 
 namespace cell {
 
+class Journal;
+
 // TODO: Reward manager should be able to:
-//    - Remove a reward and redistribute the remaining quantity.
-//    - Generate a new reward based on some strategy for reward distribution.
 //    - When removing a reward, first generate at least one replacement
 //      in an appropriate allocation class.
-//    - Distribute some provided quantity over existing rewards and potentially
-//      generate new rewards if applicable.
-//    - Track the total quantity in the world of rewards, and total quantity
-//      in each reward allocation class.
+//    - Generate new rewards when distributing a provided quantity, if
+//      applicable.
+
+/** @brief Names a reward owned by a RewardManager: the level it is stored in
+  *        and its slot there. Stays valid until the reward is removed, and is
+  *        never reused for another reward.
+  */
+struct RewardHandle {
+  SlotHandle slot;
+  Reward::RewardLevel level = Reward::RewardLevel::SMALL;
+
+  bool is_null() const { return slot.is_null(); }
+};
+
+inline bool operator==(const RewardHandle& a, const RewardHandle& b) {
+  return a.slot == b.slot && a.level == b.level;
+}
+
+inline bool operator!=(const RewardHandle& a, const RewardHandle& b) {
+  return !(a == b);
+}
 
 class RewardManager {
 public:
 
   RewardManager() : reward_levels_(Reward::RewardLevel::NUM_LEVELS) { }
 
-  /// Used for testing purposes and perhaps loading from database. New rewards
-  /// in the live game should be generated elsewhere by the RewardManager.
-  Reward* add_reward(const Reward& reward);
+  /** @brief Used for testing purposes and perhaps loading from database. New
+    *        rewards in the live game come from a RewardSpawner.
+    * @return Handle of the new reward, or of the reward already added with
+    *         the same id.
+    */
+  RewardHandle add_reward(const Reward& reward);
+
+  /// Makes room for num_rewards more rewards to be added.
+  void reserve(std::size_t num_rewards) { handles_.reserve(handles_.size() + num_rewards); }
 
-  /** @brief Remove a reward.
+  /** @brief Remove a reward. Its remaining quantity is redistributed over
+    *        the other rewards of its level, see distribute_quantity.
     * @return True if a reward was removed, false otherwise.
     */
-  bool remove_reward(const Reward& reward);
+  bool remove_reward(const Reward& reward) { return remove_reward(find(reward.id())); }
+  bool remove_reward(RewardHandle handle);
+
+  /** @brief Removes a batch of rewards, e.g. everything collected in one
+    *        tick, and redistributes their remaining quantity with one
+    *        distribute_quantity per level. Null and stale handles are skipped.
+    * @return Number of rewards removed.
+    */
+  std::size_t remove_rewards(span<const RewardHandle> handles);
+
+  /** @brief Removes a reward WITHOUT redistributing its quantity, which
+    *        leaves its level's total. For replaying a Journal, which records
+    *        where the quantity of a removed reward went on its own.
+    * @return True if a reward was removed, false otherwise.
+    */
+  bool discard_reward(RewardHandle handle);
+
+  /** @brief Hands quantity out over the rewards of a level the way
+    *        RewardClass::distribute_quantity does, carrying on from where the
+    *        last distribution over the level stopped. Quantities over
+    *        RewardClass::BULK_FACTOR times the average aren't water filled:
+    *        rewards from the cursor on are raised to the level's new average
+    *        instead, in at most one lap. Either way, only the rewards up to
+    *        where the quantity runs out are visited. A level without rewards
+    *        holds on to the quantity until one is added and quantity is next
+    *        distributed.
+    */
+  void distribute_quantity(Reward::RewardLevel level, std::uint64_t quantity);
+
+  /// Changes the quantity of a managed reward, keeping the totals in step.
+  /// Quantities changed directly through get are not seen by the totals.
+  void set_quantity(RewardHandle handle, int quantity);
+
+  /// Total quantity of the rewards in one level, and in all of them.
+  std::uint64_t total_quantity(Reward::RewardLevel level) const {
+    return reward_levels_[level].total_quantity;
+  }
+  std::uint64_t total_quantity() const;
+
+  /// Quantity distributed to a level while it had no rewards.
+  std::uint64_t undistributed(Reward::RewardLevel level) const {
+    return reward_levels_[level].undistributed;
+  }
+  /// For restoring a saved manager, distribute_quantity adds to it otherwise.
+  void set_undistributed(Reward::RewardLevel level, std::uint64_t quantity);
+
+  /// Journal every change to the rewards and their quantities is recorded
+  /// in, nullptr for none. See World::set_journal.
+  Journal* journal() const { return journal_; }
+  void set_journal(Journal* journal) { journal_ = journal; }
+
+  /// Log the location of every reward added, removed or given a new quantity
+  /// is appended to, nullptr for none. The same location can come up more
+  /// than once. Used by Grid to keep its aggregate tree in step.
+  std::vector<Location>* change_log() const { return change_log_; }
+  void set_change_log(std::vector<Location>* log) { change_log_ = log; }
+
+  /// The reward a handle names, nullptr if it was removed. Rewards never
+  /// move, so pointers stay valid until the reward is removed. The level of a
+  /// managed reward must not be changed through them.
+  Reward* get(RewardHandle handle) { return reward_levels_[handle.level].rewards.get(handle.slot); }
+  const Reward* get(RewardHandle handle) const {
+    return reward_levels_[handle.level].rewards.get(handle.slot);
+  }
+
+  /// Same as get for a handle that names a live reward, without checking it.
+  /// For the scan loop, whose handles come from the grid.
+  Reward& at(RewardHandle handle) { return reward_levels_[handle.level].rewards.at(handle.slot); }
+
+  /// Handle of the reward with the given id, a null handle if there is none.
+  RewardHandle find(RewardId id) const;
+  bool contains(RewardId id) const { return handles_.count(id) != 0; }
+
+  /// Calls fn(handle, reward) for every reward of one level, in storage order.
+  template<class Fn>
+  void for_each_reward(Reward::RewardLevel level, Fn&& fn);
+  template<class Fn>
+  void for_each_reward(Reward::RewardLevel level, Fn&& fn) const;
+
+  /// Number of rewards in one level, and in all of them.
+  std::size_t size(Reward::RewardLevel level) const { return reward_levels_[level].rewards.size(); }
+  std::size_t size() const { return handles_.size(); }
+
+  /// Scan bookkeeping of every reward added here.
+  const ScanStateTable& scan_states() const { return scan_states_; }
 
 private:
 
+  /// Rewards of a level share blocks so that distributing over a level is a
+  /// linear sweep, and removed slots are reused.
+  struct Level {
+    BlockPool<Reward> rewards;
+    std::uint64_t total_quantity = 0;
+    std::uint64_t undistributed = 0;
+    // Slot the next distribution starts from.
+    std::uint32_t cursor = 0;
+  };
+
+  /// Takes a reward out of its level, leaving its quantity to the caller.
+  void erase_reward(RewardHandle handle, Reward& reward);
+
+  /// Records a level's undistributed quantity if it changed from before.
+  void journal_undistributed(Reward::RewardLevel level, std::uint64_t before);
+
+  /// Records a reward change in the change log, if there is one.
+  void log_change(const Reward& reward) {
+    if (change_log_) change_log_->push_back(reward.location());
+  }
+
+  ScanStateTable scan_states_;
+  Journal* journal_ = nullptr;
+  std::vector<Location>* change_log_ = nullptr;
+
   /// Each entry in the vector represents a "level" of reward type.
-  std::vector<std::map<RewardId, Reward>> reward_levels_;
+  std::vector<Level> reward_levels_;
+  std::unordered_map<RewardId, RewardHandle> handles_;
 
 };
 
+template<class Fn>
+void RewardManager::for_each_reward(Reward::RewardLevel level, Fn&& fn) {
+  reward_levels_[level].rewards.for_each([&](SlotHandle slot, Reward& r) {
+    fn(RewardHandle{ slot, level }, r);
+  });
+}
+
+template<class Fn>
+void RewardManager::for_each_reward(Reward::RewardLevel level, Fn&& fn) const {
+  reward_levels_[level].rewards.for_each([&](SlotHandle slot, const Reward& r) {
+    fn(RewardHandle{ slot, level }, r);
+  });
+}
+
 } // end namespace cell
 
 #endif // CELL_REWARD_MANAGER_HPP
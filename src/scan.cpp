@@ -1,7 +1,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 ///
 /// @file scan.cpp
-/// @brief Implementation of the Scan class.
+/// @brief Ring configuration of the Scan used by the game.
 /// @author Zenon Parker
 /// @author Matthew Avery
 /// @date 2014
@@ -12,8 +12,8 @@
 
 namespace cell {
 
-  const int Scan::RING_RANGES[Scan::NUM_RINGS * 2] = { 20, 100, 100, 1000 };
-  const int Scan::RING_RANGE_VARIANCE[Scan::NUM_RINGS] = { 10, 25 };
+  template<> const int Scan::RING_RANGES[Scan::NUM_RINGS * 2] = { 20, 100, 100, 1000 };
+  template<> const int Scan::RING_RANGE_VARIANCE[Scan::NUM_RINGS] = { 10, 25 };
 
 } // end namespace cell
 
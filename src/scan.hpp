@@ -11,54 +11,90 @@
 #ifndef CELL_SCAN_HPP
 #define CELL_SCAN_HPP
 
-#include <influence_ring.hpp>
+#include <array>
 #include <iostream>
+#include <type_traits>
+#include <vector>
+#include <influence_ring.hpp>
 
 namespace cell {
 
-class Scan {
+/** @brief A scan is NumRings influence rings, innermost first. Rings are held
+  *        by value in a fixed size array, so a scan never touches the heap.
+  */
+template<int NumRings, int NumDirections = InfluenceRing::NUM_DIRECTIONS>
+class BasicScan {
 public:
   /// Number of rings of influence in a given Scan.
-  constexpr static int NUM_RINGS = 2;
+  constexpr static int NUM_RINGS = NumRings;
   /// Array of range values for distances that the rings encompass. Should always
   /// be equal to 2*NUM_RINGS in size. { ring1_min, ring1_max, ring2_min, etc. }
-  const static int RING_RANGES[NUM_RINGS * 2]; /*= { { 20, 100, 100, 1000 } };*/
-  const static int RING_RANGE_VARIANCE[NUM_RINGS]; /*= { { 10, 25 } };*/
+  /// Only defined for the ring counts the game is configured with (see scan.cpp).
+  const static int RING_RANGES[NumRings * 2];
+  const static int RING_RANGE_VARIANCE[NumRings];
+
+  typedef BasicInfluenceRing<NumDirections> ring_t;
+  typedef std::array<ring_t, NumRings> rings_t;
 
   // Constructors
-  Scan() { }
-  explicit Scan(const std::vector<InfluenceRing>& rings) : rings_(rings) { }
+  constexpr BasicScan() : rings_{} { }
+  constexpr explicit BasicScan(const rings_t& rings) : rings_(rings) { }
+  /// Takes the first NUM_RINGS rings, missing ones are empty.
+  explicit BasicScan(const std::vector<ring_t>& rings);
 
   // Accessors
-  const std::vector<InfluenceRing>& rings() const { return rings_; }
-  std::vector<InfluenceRing>& rings() { return rings_; }
+  constexpr const rings_t& rings() const { return rings_; }
+  rings_t& rings() { return rings_; }
 
-  // Operators
-  friend bool operator==(const Scan& s1, const Scan& s2);
-  friend std::ostream& operator<<(std::ostream& out, const Scan& s);
+  /// Ring-wise sum.
+  BasicScan& operator+=(const BasicScan& s) {
+    for (int i = 0; i < NumRings; ++i) rings_[i] += s.rings_[i];
+    return *this;
+  }
 
 private:
 
-  std::vector<InfluenceRing> rings_{NUM_RINGS, InfluenceRing{}};
+  rings_t rings_;
 
 };
 
-inline bool operator==(const Scan& s1, const Scan& s2) {
-  for (int i = 0; i < s1.rings_.size(); ++i) {
-    if (!(s1.rings_[i] == s2.rings_[i])) return false;
+template<int NumRings, int NumDirections>
+constexpr int BasicScan<NumRings, NumDirections>::NUM_RINGS;
+
+template<int NumRings, int NumDirections>
+BasicScan<NumRings, NumDirections>::BasicScan(const std::vector<ring_t>& rings) : rings_{} {
+  for (std::size_t i = 0; i < rings.size() && i < rings_.size(); ++i) rings_[i] = rings[i];
+}
+
+template<int NumRings, int NumDirections>
+inline bool operator==(const BasicScan<NumRings, NumDirections>& s1,
+                       const BasicScan<NumRings, NumDirections>& s2) {
+  for (int i = 0; i < NumRings; ++i) {
+    if (!(s1.rings()[i] == s2.rings()[i])) return false;
   }
   return true;
 }
 
-inline std::ostream& operator<<(std::ostream& out, const Scan& s) {
+template<int NumRings, int NumDirections>
+inline std::ostream& operator<<(std::ostream& out, const BasicScan<NumRings, NumDirections>& s) {
   out << "{ ";
-  for (int i = 0; i < s.rings_.size(); ++i) {
+  for (int i = 0; i < NumRings; ++i) {
     if (i > 0) out << "\n  ";
-    out << "[" << i << "] " << s.rings_[i];
+    out << "[" << i << "] " << s.rings()[i];
   }
   return out << " }";
 }
 
+/// The scan used by the game, two rings of eight directions.
+typedef BasicScan<2> Scan;
+
+static_assert(std::is_trivially_copyable<Scan>::value,
+              "Scan should be copyable as plain memory");
+
+// Defined in scan.cpp.
+template<> const int Scan::RING_RANGES[Scan::NUM_RINGS * 2]; /*= { { 20, 100, 100, 1000 } };*/
+template<> const int Scan::RING_RANGE_VARIANCE[Scan::NUM_RINGS]; /*= { { 10, 25 } };*/
+
 } // end namespace cell
 
 #endif // CELL_SCAN_HPP
@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_batch.cpp
+/// @brief Implementation of the batch scan kernels.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CELL_HAS_AVX2_KERNEL 1
+#endif
+
+// cell
+#include <scan_batch.hpp>
+#include <scan_kernel.hpp>
+
+namespace cell {
+
+namespace {
+
+typedef SectorClassifier<InfluenceRing::NUM_DIRECTIONS> Sectors;
+
+void classify_scalar(const ScanBatchRings& rings, const int* xs, const int* ys,
+                     int count, ScanBatch& out)
+{
+  for (int i = 0; i < ScanBatch::SIZE; ++i) out.ring_mask[i] = 0;
+
+  for (int i = 0; i < count; ++i) {
+    const std::int64_t dx = std::int64_t(xs[i]) - rings.origin.x;
+    const std::int64_t dy = std::int64_t(ys[i]) - rings.origin.y;
+    const std::int64_t d2 = distance_squared(dx, dy);
+
+    std::uint32_t mask = 0;
+    for (int r = 0; r < rings.num_rings; ++r) {
+      mask |= std::uint32_t(d2 >= rings.min2[r] && d2 <= rings.max2[r]) << r;
+    }
+    out.ring_mask[i] = mask;
+    if (mask == 0) continue;
+
+    out.direction[i] = Sectors::direction(dx, dy);
+    const double dist = std::sqrt(double(d2));
+    for (int r = 0; r < rings.num_rings; ++r) {
+      out.falloff[r][i] = 1.0 - std::max(0.0, std::min(1.0, dist / rings.dist_range[r]));
+    }
+  }
+}
+
+#ifdef CELL_HAS_AVX2_KERNEL
+
+/// Works on doubles, four lanes per register and two registers per batch.
+/// Offsets within MAX_VECTOR_OFFSET keep every product below 2^53, so all the
+/// arithmetic is exact and matches the scalar kernel bit for bit. No FMA is
+/// used since it would round differently.
+__attribute__((target("avx2")))
+void classify_avx2(const ScanBatchRings& rings, const int* xs, const int* ys,
+                   int count, ScanBatch& out)
+{
+  constexpr int NUM_BOUNDARIES = InfluenceRing::NUM_DIRECTIONS - 1;
+
+  // Short batches are padded, the padding lanes get masked off below.
+  alignas(32) int pad_x[ScanBatch::SIZE] = {}, pad_y[ScanBatch::SIZE] = {};
+  if (count < ScanBatch::SIZE) {
+    std::copy(xs, xs + count, pad_x);
+    std::copy(ys, ys + count, pad_y);
+    xs = pad_x;
+    ys = pad_y;
+  }
+
+  // Wrapping 32 bit subtraction, exact because offsets are small.
+  const __m256i dx32 = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs)),
+                                        _mm256_set1_epi32(rings.origin.x));
+  const __m256i dy32 = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys)),
+                                        _mm256_set1_epi32(rings.origin.y));
+
+  const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+  alignas(32) double above[ScanBatch::SIZE], below[ScanBatch::SIZE];
+  std::uint32_t mask[ScanBatch::SIZE] = {};
+
+  for (int h = 0; h < 2; ++h) {
+    const __m128i dxh = h ? _mm256_extracti128_si256(dx32, 1) : _mm256_castsi256_si128(dx32);
+    const __m128i dyh = h ? _mm256_extracti128_si256(dy32, 1) : _mm256_castsi256_si128(dy32);
+    const __m256d dx = _mm256_cvtepi32_pd(dxh), dy = _mm256_cvtepi32_pd(dyh);
+    const __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    const __m256d dist = _mm256_sqrt_pd(d2);
+
+    for (int r = 0; r < rings.num_rings; ++r) {
+      const __m256d in = _mm256_and_pd(
+          _mm256_cmp_pd(d2, _mm256_set1_pd(double(rings.min2[r])), _CMP_GE_OQ),
+          _mm256_cmp_pd(d2, _mm256_set1_pd(double(rings.max2[r])), _CMP_LE_OQ));
+      const int bits = _mm256_movemask_pd(in);
+      for (int lane = 0; lane < 4; ++lane) {
+        mask[h * 4 + lane] |= std::uint32_t((bits >> lane) & 1) << r;
+      }
+
+      // Same operand order as std::min(1.0, x) and std::max(0.0, x).
+      const __m256d ratio = _mm256_div_pd(dist, _mm256_set1_pd(rings.dist_range[r]));
+      const __m256d clamped = _mm256_max_pd(_mm256_min_pd(ratio, one), zero);
+      _mm256_storeu_pd(&out.falloff[r][h * 4], _mm256_sub_pd(one, clamped));
+    }
+
+    __m256d above_h = zero, below_h = zero;
+    for (int k = 0; k < NUM_BOUNDARIES; ++k) {
+      const __m256d cy = _mm256_mul_pd(_mm256_set1_pd(double(Sectors::BOUNDARIES[k].c)), dy);
+      const __m256d sx = _mm256_mul_pd(_mm256_set1_pd(double(Sectors::BOUNDARIES[k].s)), dx);
+      above_h = _mm256_add_pd(above_h,
+          _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(cy, sx), zero, _CMP_GE_OQ), one));
+      below_h = _mm256_add_pd(below_h,
+          _mm256_and_pd(_mm256_cmp_pd(_mm256_add_pd(cy, sx), zero, _CMP_LE_OQ), one));
+    }
+    _mm256_store_pd(above + h * 4, above_h);
+    _mm256_store_pd(below + h * 4, below_h);
+  }
+
+  for (int i = 0; i < ScanBatch::SIZE; ++i) {
+    out.ring_mask[i] = i < count ? mask[i] : 0;
+    if (out.ring_mask[i] == 0) continue;
+    out.direction[i] = Sectors::direction_from_counts(std::int64_t(xs[i]) - rings.origin.x,
+                                                      std::int64_t(ys[i]) - rings.origin.y,
+                                                      int(above[i]), int(below[i]));
+  }
+}
+
+#endif // CELL_HAS_AVX2_KERNEL
+
+} // end anonymous namespace
+
+ScanBatchRings::ScanBatchRings(const Location& origin_in, const int* min_dists,
+                               const int* max_dists, int num_rings_in)
+  : origin(origin_in), num_rings(std::min(num_rings_in, int(MAX_RINGS)))
+{
+  for (int r = 0; r < num_rings; ++r) {
+    const RingBounds bounds(min_dists[r], max_dists[r]);
+    min2[r] = bounds.min2;
+    max2[r] = bounds.max2;
+    dist_range[r] = max_dists[r] - min_dists[r];
+  }
+}
+
+bool batch_kernel_supported(BatchKernel kernel)
+{
+  switch (kernel) {
+    case BatchKernel::SCALAR:
+      return true;
+    case BatchKernel::AVX2:
+#ifdef CELL_HAS_AVX2_KERNEL
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+BatchKernel best_batch_kernel()
+{
+  static const BatchKernel best = batch_kernel_supported(BatchKernel::AVX2) ?
+                                    BatchKernel::AVX2 : BatchKernel::SCALAR;
+  return best;
+}
+
+void classify_batch(BatchKernel kernel, const ScanBatchRings& rings,
+                    const int* xs, const int* ys, int count, ScanBatch& out)
+{
+#ifdef CELL_HAS_AVX2_KERNEL
+  if (kernel == BatchKernel::AVX2) {
+    classify_avx2(rings, xs, ys, count, out);
+    return;
+  }
+#endif
+  classify_scalar(rings, xs, ys, count, out);
+}
+
+} // end namespace cell
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_batch.hpp
+/// @brief Classifies rewards around a scan origin a batch at a time, with a
+///        vectorized kernel picked at runtime and a scalar fallback.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SCAN_BATCH_HPP
+#define CELL_SCAN_BATCH_HPP
+
+#include <cstdint>
+#include <influence_ring.hpp>
+#include <location.hpp>
+
+namespace cell {
+
+/// Instruction sets the batch kernel can run on.
+enum class BatchKernel {
+  SCALAR,      // Plain C++, always available.
+  AVX2         // 256 bit vectors, picked when the CPU supports it.
+};
+
+/// True if the running CPU can execute the given kernel.
+bool batch_kernel_supported(BatchKernel kernel);
+
+/// The fastest kernel the running CPU supports.
+BatchKernel best_batch_kernel();
+
+/** @brief The rings of one scan, prepared once and shared by every batch of
+  *        that scan. At most MAX_RINGS rings can be classified together.
+  */
+struct ScanBatchRings {
+  constexpr static int MAX_RINGS = 8;
+
+  /// Rewards further than this from the origin along either axis are not
+  /// exact in the vectorized kernels; larger scans must use SCALAR.
+  constexpr static int MAX_VECTOR_OFFSET = 1 << 22;
+
+  ScanBatchRings(const Location& origin, const int* min_dists, const int* max_dists,
+                 int num_rings);
+
+  Location origin;
+  int num_rings;
+  std::int64_t min2[MAX_RINGS];
+  std::int64_t max2[MAX_RINGS];
+  double dist_range[MAX_RINGS];
+};
+
+/** @brief Classification of up to SIZE rewards (lanes) against the rings of
+  *        a scan.
+  */
+struct ScanBatch {
+  constexpr static int SIZE = 8;
+
+  /// Bit r is set when lane i lies in ring r. Always zero for unused lanes.
+  std::uint32_t ring_mask[SIZE];
+  /// Direction of lane i, see InfluenceRing. Only valid if ring_mask[i] != 0.
+  int direction[SIZE];
+  /// DISTANCE falloff of lane i in ring r, 1 - clamp(dist / (max - min), 0, 1)
+  /// as Reward::get_influence computes it. Only valid for lanes in ring r.
+  double falloff[ScanBatchRings::MAX_RINGS][SIZE];
+};
+
+/** @brief Computes distance, ring membership, direction and distance falloff
+  *        for the count (<= ScanBatch::SIZE) positions (xs[i], ys[i]). Every
+  *        kernel gives bit-identical results.
+  */
+void classify_batch(BatchKernel kernel, const ScanBatchRings& rings,
+                    const int* xs, const int* ys, int count, ScanBatch& out);
+
+} // end namespace cell
+
+#endif // CELL_SCAN_BATCH_HPP
@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_kernel.hpp
+/// @brief Integer-only ring and direction classification for scans.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SCAN_KERNEL_HPP
+#define CELL_SCAN_KERNEL_HPP
+
+#include <cstdint>
+
+namespace cell {
+
+namespace kernel_detail {
+
+constexpr long double PI = 3.141592653589793238462643383279502884L;
+
+constexpr std::int64_t gcd(std::int64_t a, std::int64_t b) {
+  while (b != 0) {
+    const std::int64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/// Taylor series, good to long double precision for x in [0, pi/2].
+constexpr long double cos_series(long double x) {
+  long double sum = 1.0L, term = 1.0L;
+  for (int n = 1; n < 30; ++n) {
+    term *= -x * x / ((2 * n - 1) * (2 * n));
+    sum += term;
+  }
+  return sum;
+}
+
+/// cos(num/den * pi) for num/den in [0, 1]. Angles are reduced to [0, pi/2]
+/// in exact integer arithmetic, so angles with the same value always produce
+/// the same result (e.g. cos(pi/4) and sin(pi/4) are bit-identical).
+constexpr long double cos_pi_fraction(std::int64_t num, std::int64_t den) {
+  if (2 * num > den) return -cos_pi_fraction(den - num, den);
+  const std::int64_t g = gcd(num, den);
+  num /= g;
+  den /= g;
+  if (2 * num == den) return 0.0L;
+  return cos_series(PI * (long double)(num) / (long double)(den));
+}
+
+/// sin(num/den * pi) for num/den in [0, 1], as cos((1/2 - num/den) * pi).
+constexpr long double sin_pi_fraction(std::int64_t num, std::int64_t den) {
+  return 2 * num > den ? sin_pi_fraction(den - num, den)
+                       : cos_pi_fraction(den - 2 * num, 2 * den);
+}
+
+constexpr std::int64_t to_fixed(long double v, int shift) {
+  const long double scaled = v * (long double)(std::int64_t(1) << shift);
+  return scaled < 0 ? -std::int64_t(-scaled + 0.5L) : std::int64_t(scaled + 0.5L);
+}
+
+} // end namespace kernel_detail
+
+/** @brief Squared distance bounds of one scan ring. A point at squared distance
+  *        d2 is in the ring exactly when sqrt(d2) is in [min_dist, max_dist].
+  */
+struct RingBounds {
+  constexpr RingBounds(int min_dist, int max_dist)
+    : min2(min_dist <= 0 ? 0 : std::int64_t(min_dist) * min_dist),
+      max2(max_dist < 0 ? -1 : std::int64_t(max_dist) * max_dist) { }
+
+  constexpr bool contains(std::int64_t d2) const { return d2 >= min2 && d2 <= max2; }
+
+  std::int64_t min2;
+  std::int64_t max2;
+};
+
+/// Squared distance between two points. Components must fit in 32 bits.
+constexpr std::int64_t distance_squared(std::int64_t dx, std::int64_t dy) {
+  return dx * dx + dy * dy;
+}
+
+/** @brief Picks the direction (see InfluenceRing) an offset (dx, dy) from the
+  *        scan origin falls into, without atan2 or floating point.
+  *
+  *        The circle is cut into 2 * NumDirections half slices of pi /
+  *        NumDirections radians, and direction i owns the two half slices
+  *        either side of angle i * 2pi / NumDirections. The half slice is
+  *        found by testing the offset against the boundary directions
+  *        (cos(k pi / N), sin(k pi / N)) with integer cross products. The
+  *        boundaries are computed at compile time as 2^30 fixed point values.
+  *
+  *        Points exactly on a boundary go to the half slice further from the
+  *        positive x axis, and offsets with dy == 0 use the upper half plane.
+  *        This matches the original atan2 classification
+  *        int(atan2(dy, dx) / (pi / N)), which truncates towards zero.
+  */
+template<int NumDirections>
+class SectorClassifier {
+public:
+  constexpr static int FIXED_SHIFT = 30;
+
+  /// Direction index in [0, NumDirections). Offsets must be within +-2^31.
+  static int direction(std::int64_t dx, std::int64_t dy);
+
+  /** @brief Final step of direction(), for kernels that test the boundaries
+    *        themselves. above is the number of boundaries with
+    *        c * dy - s * dx >= 0 and below the number with c * dy + s * dx <= 0.
+    */
+  static int direction_from_counts(std::int64_t dx, std::int64_t dy, int above, int below);
+
+  static_assert(NumDirections >= 2, "a ring needs at least two directions");
+
+  struct Boundary {
+    std::int64_t c;
+    std::int64_t s;
+  };
+  // Plain array wrapper, std::array can't be written to in a C++14 constexpr.
+  struct boundaries_t {
+    Boundary b[NumDirections - 1];
+    constexpr const Boundary& operator[](int k) const { return b[k]; }
+  };
+
+private:
+
+  static constexpr boundaries_t make_boundaries() {
+    boundaries_t b{};
+    for (int k = 1; k < NumDirections; ++k) {
+      b.b[k - 1] = Boundary{
+        kernel_detail::to_fixed(kernel_detail::cos_pi_fraction(k, NumDirections), FIXED_SHIFT),
+        kernel_detail::to_fixed(kernel_detail::sin_pi_fraction(k, NumDirections), FIXED_SHIFT) };
+    }
+    return b;
+  }
+
+public:
+
+  /// Boundary k - 1 is the direction of angle k * pi / NumDirections, for k
+  /// in [1, NumDirections). Public so that batch kernels can use it.
+  static constexpr boundaries_t BOUNDARIES = make_boundaries();
+
+};
+
+template<int NumDirections>
+constexpr int SectorClassifier<NumDirections>::FIXED_SHIFT;
+
+template<int NumDirections>
+constexpr typename SectorClassifier<NumDirections>::boundaries_t
+  SectorClassifier<NumDirections>::BOUNDARIES;
+
+template<int NumDirections>
+inline int SectorClassifier<NumDirections>::direction(std::int64_t dx, std::int64_t dy) {
+  // Upper half plane: count the boundaries at or below the offset's angle.
+  // Lower half plane: count the mirrored boundaries at or above the angle.
+  int above = 0, below = 0;
+  for (int k = 0; k < NumDirections - 1; ++k) {
+    above += (BOUNDARIES[k].c * dy - BOUNDARIES[k].s * dx) >= 0;
+    below += (BOUNDARIES[k].c * dy + BOUNDARIES[k].s * dx) <= 0;
+  }
+  return direction_from_counts(dx, dy, above, below);
+}
+
+template<int NumDirections>
+inline int SectorClassifier<NumDirections>::direction_from_counts(std::int64_t dx, std::int64_t dy,
+                                                                  int above, int below) {
+  constexpr int half_slices = NumDirections * 2;
+  int slice = 0;
+  if (dy >= 0) {
+    if (dx == 0 && dy == 0) return 0;
+    slice = above + (dy == 0 && dx < 0);
+  } else {
+    slice = (half_slices - below) % half_slices;
+  }
+  return ((slice + 1) / 2) % NumDirections;
+}
+
+} // end namespace cell
+
+#endif // CELL_SCAN_KERNEL_HPP
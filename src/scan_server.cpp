@@ -0,0 +1,491 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_server.cpp
+/// @brief Implementation of ScanServer.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// posix
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// cell
+#include <scan_server.hpp>
+
+namespace cell {
+
+namespace {
+
+// epoll tokens of the server's own descriptors, connections come after.
+constexpr std::uint64_t WAKE_TOKEN = 0;
+constexpr std::uint64_t TCP_TOKEN = 1;
+constexpr std::uint64_t UNIX_TOKEN = 2;
+constexpr std::uint64_t FIRST_CONNECTION = 16;
+
+constexpr int MAX_EVENTS = 64;
+/// Bytes read per call, and at most from one connection per round so a busy
+/// client can't starve the others.
+constexpr std::size_t READ_CHUNK = 64 * 1024;
+constexpr std::size_t MAX_READ_PER_ROUND = 4 * READ_CHUNK;
+/// Written bytes kept at the front of a connection's output until then.
+constexpr std::size_t MAX_WRITTEN_KEPT = 64 * 1024;
+
+bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+/// Order in which a run of a tick applies each kind of request.
+int tick_phase(WireOp op)
+{
+  switch (op) {
+    case WireOp::JOIN:
+    case WireOp::LEAVE:
+      return 0;
+    case WireOp::MOVE:
+      return 1;
+    case WireOp::SCAN:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+bool make_ipv4(const std::string& address, std::uint16_t port, sockaddr_in& out)
+{
+  std::memset(&out, 0, sizeof(out));
+  out.sin_family = AF_INET;
+  out.sin_port = htons(port);
+  return ::inet_pton(AF_INET, address.c_str(), &out.sin_addr) == 1;
+}
+
+bool make_unix(const std::string& path, sockaddr_un& out)
+{
+  std::memset(&out, 0, sizeof(out));
+  out.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(out.sun_path)) return false;
+  std::memcpy(out.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+} // end anonymous namespace
+
+constexpr std::size_t ScanServer::MAX_OUTPUT;
+constexpr std::chrono::microseconds ScanServer::DEFAULT_TICK;
+
+ScanServer::ScanServer(World& world)
+  : world_(world),
+    epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+    wake_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    next_tick_(std::chrono::steady_clock::now()),
+    next_connection_(FIRST_CONNECTION)
+{
+  if (epoll_fd_ >= 0 && wake_fd_ >= 0 && !listen_on(wake_fd_, WAKE_TOKEN)) {
+    ::close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+}
+
+ScanServer::~ScanServer()
+{
+  for (auto& entry : connections_) ::close(entry.second.fd);
+  for (int fd : { tcp_fd_, unix_fd_, wake_fd_, epoll_fd_ }) {
+    if (fd >= 0) ::close(fd);
+  }
+  if (!unix_path_.empty()) ::unlink(unix_path_.c_str());
+}
+
+bool ScanServer::listen_on(int fd, std::uint64_t token)
+{
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.u64 = token;
+  return ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool ScanServer::listen_tcp(const std::string& address, std::uint16_t port)
+{
+  sockaddr_in addr;
+  if (epoll_fd_ < 0 || tcp_fd_ >= 0 || !make_ipv4(address, port, addr)) return false;
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  const int one = 1;
+  socklen_t length = sizeof(addr);
+  if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      ::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, SOMAXCONN) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) != 0 ||
+      !listen_on(fd, TCP_TOKEN)) {
+    ::close(fd);
+    return false;
+  }
+  tcp_fd_ = fd;
+  tcp_port_ = ntohs(addr.sin_port);
+  return true;
+}
+
+bool ScanServer::listen_unix(const std::string& path)
+{
+  sockaddr_un addr;
+  if (epoll_fd_ < 0 || unix_fd_ >= 0 || !make_unix(path, addr)) return false;
+  // Only ever a stale socket is replaced, never some other file.
+  struct stat info;
+  if (::lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) ::unlink(path.c_str());
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return false;
+  }
+  if (::listen(fd, SOMAXCONN) != 0 || !listen_on(fd, UNIX_TOKEN)) {
+    ::close(fd);
+    ::unlink(path.c_str());
+    return false;
+  }
+  unix_fd_ = fd;
+  unix_path_ = path;
+  return true;
+}
+
+void ScanServer::poll(std::chrono::milliseconds timeout)
+{
+  typedef std::chrono::steady_clock Clock;
+  if (epoll_fd_ < 0) return;
+  std::chrono::milliseconds wait = timeout;
+  if (!pending_.empty()) {
+    // Rounded up, so a tick is never run early.
+    const Clock::duration left = std::max(next_tick_ - Clock::now(), Clock::duration::zero());
+    const std::chrono::milliseconds left_ms(
+      (std::chrono::duration_cast<std::chrono::microseconds>(left).count() + 999) / 1000);
+    wait = std::min(wait, left_ms);
+  }
+
+  epoll_event events[MAX_EVENTS];
+  const int n = ::epoll_wait(epoll_fd_, events, MAX_EVENTS, int(wait.count()));
+  for (int i = 0; i < n; ++i) {
+    const std::uint64_t token = events[i].data.u64;
+    const std::uint32_t ev = events[i].events;
+    if (token == WAKE_TOKEN) {
+      std::uint64_t count;
+      while (::read(wake_fd_, &count, sizeof(count)) > 0) { }
+      continue;
+    }
+    if (token == TCP_TOKEN || token == UNIX_TOKEN) {
+      accept_all(token == TCP_TOKEN ? tcp_fd_ : unix_fd_);
+      continue;
+    }
+    // Gone if it was closed earlier in this round.
+    const auto it = connections_.find(token);
+    if (it == connections_.end()) continue;
+    Connection& c = it->second;
+    if ((ev & EPOLLERR) || ((ev & EPOLLHUP) && c.eof)) {
+      close_connection(token);
+      continue;
+    }
+    if ((ev & (EPOLLIN | EPOLLHUP)) && !read_from(token, c)) continue;
+    if (ev & EPOLLOUT) write_to(token, c);
+  }
+
+  const Clock::time_point now = Clock::now();
+  if (!pending_.empty() && now >= next_tick_) {
+    run_tick();
+    next_tick_ = now + tick_;
+  }
+}
+
+void ScanServer::run()
+{
+  while (!stopping_.load(std::memory_order_acquire)) poll(std::chrono::milliseconds(100));
+  stopping_.store(false, std::memory_order_release);
+}
+
+void ScanServer::stop()
+{
+  stopping_.store(true, std::memory_order_release);
+  const std::uint64_t one = 1;
+  if (::write(wake_fd_, &one, sizeof(one)) < 0) {
+    // Full, so poll wakes up anyway.
+  }
+}
+
+void ScanServer::accept_all(int listener)
+{
+  for (;;) {
+    const int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return;
+    }
+    if (listener == tcp_fd_) {
+      // Responses are written a tick's worth at a time, Nagle only delays them.
+      const int one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    const std::uint64_t id = next_connection_++;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      ::close(fd);
+      continue;
+    }
+    Connection& c = connections_[id];
+    c.fd = fd;
+    c.events = EPOLLIN;
+    ++stats_.connections;
+  }
+}
+
+bool ScanServer::read_from(std::uint64_t id, Connection& c)
+{
+  std::size_t got = 0;
+  while (got < MAX_READ_PER_ROUND) {
+    const std::size_t size = c.in.size();
+    c.in.resize(size + READ_CHUNK);
+    const ssize_t n = ::read(c.fd, c.in.data() + size, READ_CHUNK);
+    c.in.resize(size + std::size_t(std::max<ssize_t>(n, 0)));
+    if (n > 0) {
+      got += std::size_t(n);
+      continue;
+    }
+    if (n == 0) c.eof = true;
+    else if (errno == EINTR) continue;
+    else if (!would_block()) {
+      close_connection(id);
+      return false;
+    }
+    break;
+  }
+  stats_.bytes_in += got;
+
+  std::size_t at = 0;
+  for (;;) {
+    Pending p;
+    std::size_t used;
+    const WireResult result = decode_request(c.in.data() + at, c.in.size() - at, p.request, used);
+    if (result == WireResult::INCOMPLETE) break;
+    if (result == WireResult::BAD) {
+      ++stats_.bad_frames;
+      close_connection(id);
+      return false;
+    }
+    p.connection = id;
+    pending_.push_back(p);
+    ++c.pending;
+    ++stats_.requests;
+    at += used;
+  }
+  c.in.erase(c.in.begin(), c.in.begin() + std::ptrdiff_t(at));
+
+  // A frame cut short by the end of the stream is dropped.
+  if (c.eof && c.pending == 0 && c.written == c.out.size()) {
+    close_connection(id);
+    return false;
+  }
+  update_events(id, c);
+  return true;
+}
+
+bool ScanServer::write_to(std::uint64_t id, Connection& c)
+{
+  while (c.written < c.out.size()) {
+    const ssize_t n = ::send(c.fd, c.out.data() + c.written, c.out.size() - c.written, MSG_NOSIGNAL);
+    if (n > 0) {
+      c.written += std::size_t(n);
+      stats_.bytes_out += std::uint64_t(n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && would_block()) break;
+    close_connection(id);
+    return false;
+  }
+  if (c.written == c.out.size()) {
+    c.out.clear();
+    c.written = 0;
+  } else if (c.written > MAX_WRITTEN_KEPT) {
+    c.out.erase(c.out.begin(), c.out.begin() + std::ptrdiff_t(c.written));
+    c.written = 0;
+  }
+  if (c.eof && c.pending == 0 && c.out.empty()) {
+    close_connection(id);
+    return false;
+  }
+  update_events(id, c);
+  return true;
+}
+
+void ScanServer::update_events(std::uint64_t id, Connection& c)
+{
+  const std::size_t unsent = c.out.size() - c.written;
+  std::uint32_t events = 0;
+  if (!c.eof && unsent < MAX_OUTPUT) events |= EPOLLIN;
+  if (unsent > 0) events |= EPOLLOUT;
+  if (events == c.events) return;
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.u64 = id;
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+  c.events = events;
+}
+
+void ScanServer::close_connection(std::uint64_t id)
+{
+  const auto it = connections_.find(id);
+  if (it == connections_.end()) return;
+  // Closing the descriptor also takes it out of the epoll set. Its pending
+  // requests are still applied, their responses dropped.
+  ::close(it->second.fd);
+  connections_.erase(it);
+}
+
+std::size_t ScanServer::run_end(std::size_t begin)
+{
+  run_phases_.clear();
+  for (std::size_t i = begin; i < pending_.size(); ++i) {
+    const WireRequest& req = pending_[i].request;
+    const int phase = tick_phase(req.op);
+    const auto ret = run_phases_.emplace(req.player, phase);
+    if (ret.second) continue;
+    // Applied in phase order, this one would overtake the player's earlier
+    // request.
+    if (phase < ret.first->second) return i;
+    ret.first->second = phase;
+  }
+  return pending_.size();
+}
+
+void ScanServer::run_requests(std::size_t begin, std::size_t end)
+{
+  moves_.clear();
+  scanners_.clear();
+  hits_.clear();
+  scan_requests_.clear();
+  hit_requests_.clear();
+
+  // Joins and leaves, in order.
+  for (std::size_t i = begin; i < end; ++i) {
+    const WireRequest& req = pending_[i].request;
+    WireResponse& res = responses_[i];
+    res.op = req.op;
+    res.tag = req.tag;
+    res.status = WireStatus::OK;
+    res.value = 0;
+    res.scan = Scan();
+    if (req.op == WireOp::JOIN) {
+      Player p(req.player);
+      p.location() = req.location;
+      if (!world_.player_join(p)) res.status = WireStatus::DUPLICATE_PLAYER;
+    } else if (req.op == WireOp::LEAVE) {
+      if (!world_.player_leave(req.player)) res.status = WireStatus::UNKNOWN_PLAYER;
+    }
+  }
+
+  // Moves, as one batch.
+  for (std::size_t i = begin; i < end; ++i) {
+    const WireRequest& req = pending_[i].request;
+    if (req.op != WireOp::MOVE) continue;
+    if (world_.find_player(req.player)) moves_.push_back(Move{ req.player, req.location });
+    else responses_[i].status = WireStatus::UNKNOWN_PLAYER;
+  }
+  world_.apply_moves(moves_);
+
+  // Then scans and hits, where everyone is now.
+  for (std::size_t i = begin; i < end; ++i) {
+    const WireRequest& req = pending_[i].request;
+    if (req.op != WireOp::SCAN && req.op != WireOp::HIT) continue;
+    const Player* p = world_.find_player(req.player);
+    if (!p) {
+      responses_[i].status = WireStatus::UNKNOWN_PLAYER;
+    } else if (req.op == WireOp::SCAN) {
+      scanners_.push_back(*p);
+      scan_requests_.push_back(i);
+    } else {
+      hits_.emplace_back(req.player, req.location);
+      hit_requests_.push_back(i);
+    }
+  }
+  if (!scanners_.empty()) {
+    scans_.resize(scanners_.size());
+    world_.grid().scan_players(scanners_, scans_);
+    for (std::size_t k = 0; k < scanners_.size(); ++k) responses_[scan_requests_[k]].scan = scans_[k];
+  }
+  if (!hits_.empty()) {
+    world_.grid().resolve_hits(hits_);
+    for (std::size_t k = 0; k < hits_.size(); ++k) responses_[hit_requests_[k]].value = hits_[k].value;
+  }
+}
+
+void ScanServer::run_tick()
+{
+  const std::size_t n = pending_.size();
+  responses_.resize(n);
+  for (std::size_t begin = 0; begin < n;) {
+    const std::size_t end = run_end(begin);
+    run_requests(begin, end);
+    begin = end;
+  }
+
+  // Responses go out in the order the requests came in.
+  touched_.clear();
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::uint64_t id = pending_[i].connection;
+    const auto it = connections_.find(id);
+    if (it == connections_.end()) continue;
+    encode_response(responses_[i], it->second.out);
+    --it->second.pending;
+    if (touched_.empty() || touched_.back() != id) touched_.push_back(id);
+  }
+  pending_.clear();
+  ++stats_.ticks;
+
+  std::sort(touched_.begin(), touched_.end());
+  touched_.erase(std::unique(touched_.begin(), touched_.end()), touched_.end());
+  for (std::uint64_t id : touched_) {
+    const auto it = connections_.find(id);
+    if (it != connections_.end()) write_to(id, it->second);
+  }
+}
+
+int connect_tcp(const std::string& address, std::uint16_t port)
+{
+  sockaddr_in addr;
+  if (!make_ipv4(address, port, addr)) return -1;
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  const int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+int connect_unix(const std::string& path)
+{
+  sockaddr_un addr;
+  if (!make_unix(path, addr)) return -1;
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+} // end namespace cell
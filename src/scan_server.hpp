@@ -0,0 +1,195 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_server.hpp
+/// @brief Non-blocking TCP and Unix socket server answering the requests of
+///        protocol.hpp against a World, a tick's worth at a time.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SCAN_SERVER_HPP
+#define CELL_SCAN_SERVER_HPP
+
+// std
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// cell
+#include <protocol.hpp>
+#include <world.hpp>
+
+namespace cell {
+
+/// What a ScanServer has done so far.
+struct ScanServerStats {
+  std::uint64_t connections = 0;
+  std::uint64_t requests = 0;
+  /// Ticks run, each answering the requests pending at the time.
+  std::uint64_t ticks = 0;
+  /// Connections closed for sending a frame that doesn't decode.
+  std::uint64_t bad_frames = 0;
+  std::uint64_t bytes_in = 0;
+  std::uint64_t bytes_out = 0;
+};
+
+/** @brief Serves a World over TCP and Unix sockets with one epoll loop on the
+  *        thread calling poll or run. Linux only.
+  *
+  *        Clients may pipeline: requests are read from every connection as
+  *        they arrive and held until the tick is due, then answered in
+  *        batches through the World's batch calls. A batch applies its joins
+  *        and leaves in order, then its moves with World::apply_moves, then
+  *        its scans with one Grid::scan_players and its hits with one
+  *        Grid::resolve_hits. So a join, move and scan sent together are
+  *        answered in the same batch, and see each other. A tick is one
+  *        batch unless that order would apply a player's request before an
+  *        earlier one of the same player, e.g. a leave after a scan; the
+  *        next batch then starts at that request. The responses of a
+  *        connection go out in the order its requests came in, with as few
+  *        writes as the socket allows.
+  *
+  *        A connection whose responses pile up beyond MAX_OUTPUT isn't read
+  *        until it catches up, and one sending a frame that doesn't decode is
+  *        closed. Nothing else the server does blocks.
+  */
+class ScanServer {
+public:
+
+  /// Bytes of unsent responses above which a connection isn't read.
+  constexpr static std::size_t MAX_OUTPUT = 1 << 20;
+
+  /// Default for tick().
+  constexpr static std::chrono::microseconds DEFAULT_TICK = std::chrono::microseconds(1000);
+
+  /// Serves world, which must outlive the server and be left alone while
+  /// the server runs.
+  explicit ScanServer(World& world);
+  ~ScanServer();
+
+  /** @brief Listens on an IPv4 address, e.g. "127.0.0.1". Port 0 picks a
+    *        free one, see tcp_port.
+    * @return False if the socket could not be set up.
+    */
+  bool listen_tcp(const std::string& address, std::uint16_t port);
+  std::uint16_t tcp_port() const { return tcp_port_; }
+
+  /** @brief Listens on a Unix socket at path, replacing a socket left there
+    *        before. The socket file is removed with the server.
+    * @return False if the socket could not be set up.
+    */
+  bool listen_unix(const std::string& path);
+
+  /// How long requests are gathered before a tick answers them, zero to
+  /// answer them as soon as they are read.
+  std::chrono::microseconds tick() const { return tick_; }
+  void set_tick(std::chrono::microseconds tick) { tick_ = tick; }
+
+  /** @brief One round of the event loop: waits for sockets up to timeout,
+    *        or until the tick is due if requests are waiting, then accepts,
+    *        reads, runs the tick if due and writes what it can.
+    */
+  void poll(std::chrono::milliseconds timeout);
+
+  /// Polls until stop is called.
+  void run();
+
+  /// Makes run return soon. Can be called from any thread.
+  void stop();
+
+  std::size_t num_connections() const { return connections_.size(); }
+
+  /// Requests read but not answered yet.
+  std::size_t pending_requests() const { return pending_.size(); }
+
+  const ScanServerStats& stats() const { return stats_; }
+
+private:
+
+  struct Connection {
+    int fd = -1;
+    std::vector<char> in;
+    std::vector<char> out;
+    // Bytes of out already written.
+    std::size_t written = 0;
+    // Requests of this connection in pending_.
+    std::size_t pending = 0;
+    // The peer is done sending, close once everything is answered.
+    bool eof = false;
+    // Events the connection is registered for.
+    std::uint32_t events = 0;
+  };
+
+  struct Pending {
+    std::uint64_t connection;
+    WireRequest request;
+  };
+
+  bool listen_on(int fd, std::uint64_t token);
+  void accept_all(int listener);
+  /// Reads and decodes what a connection has sent. False if it was closed.
+  bool read_from(std::uint64_t id, Connection& c);
+  /// Writes what it can of a connection's responses. False if it was closed.
+  bool write_to(std::uint64_t id, Connection& c);
+  /// Registers for the events a connection needs now.
+  void update_events(std::uint64_t id, Connection& c);
+  void close_connection(std::uint64_t id);
+
+  /// Answers every pending request, see the class comment.
+  void run_tick();
+  /// End of the batch of pending requests starting at begin.
+  std::size_t run_end(std::size_t begin);
+  /// Applies the pending requests [begin, end) as one batch.
+  void run_requests(std::size_t begin, std::size_t end);
+
+  World& world_;
+  int epoll_fd_ = -1;
+  // Wakes poll up for stop.
+  int wake_fd_ = -1;
+  int tcp_fd_ = -1;
+  int unix_fd_ = -1;
+  std::uint16_t tcp_port_ = 0;
+  std::string unix_path_;
+  std::atomic<bool> stopping_{ false };
+
+  std::chrono::microseconds tick_ = DEFAULT_TICK;
+  std::chrono::steady_clock::time_point next_tick_;
+
+  std::unordered_map<std::uint64_t, Connection> connections_;
+  std::uint64_t next_connection_;
+  std::vector<Pending> pending_;
+  ScanServerStats stats_;
+
+  // Scratch of run_tick.
+  std::vector<WireResponse> responses_;
+  std::vector<Move> moves_;
+  std::vector<Player> scanners_;
+  std::vector<Scan> scans_;
+  std::vector<HitRequest> hits_;
+  // Index in pending_ of each scan and hit.
+  std::vector<std::size_t> scan_requests_;
+  std::vector<std::size_t> hit_requests_;
+  std::vector<std::uint64_t> touched_;
+  // Latest phase of each player's requests in the batch run_end is cutting.
+  std::unordered_map<PlayerId, int> run_phases_;
+
+  // No copy construction/assignment.
+  ScanServer(const ScanServer&) = delete;
+  ScanServer& operator=(const ScanServer&) = delete;
+
+};
+
+/// A blocking TCP connection to an IPv4 address, -1 if it fails.
+int connect_tcp(const std::string& address, std::uint16_t port);
+
+/// A blocking connection to a Unix socket, -1 if it fails.
+int connect_unix(const std::string& path);
+
+} // end namespace cell
+
+#endif // CELL_SCAN_SERVER_HPP
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file scan_state.hpp
+/// @brief Per reward scan/recovery bookkeeping that concurrent scanners can
+///        update, and the table the live rewards keep it in.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SCAN_STATE_HPP
+#define CELL_SCAN_STATE_HPP
+
+// std
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cell {
+
+/** @brief Number of scans since the last reset and the time of that reset,
+  *        packed into a single atomic word so that both always change
+  *        together: the time in milliseconds takes the upper 56 bits and the
+  *        scan count the lower 8.
+  */
+class RewardScanState {
+public:
+
+  constexpr static int SCAN_BITS = 8;
+  constexpr static std::uint64_t SCAN_MASK = (std::uint64_t(1) << SCAN_BITS) - 1;
+
+  explicit RewardScanState(std::uint64_t last_scanned = 0, int scans = 0)
+    : packed_(pack(last_scanned, scans)) { }
+
+  // Copies take a snapshot, they do not share the state.
+  RewardScanState(const RewardScanState& other) : packed_(other.packed_.load()) { }
+  RewardScanState& operator=(const RewardScanState& other) {
+    packed_.store(other.packed_.load());
+    return *this;
+  }
+
+  int scans() const { return int(packed_.load(std::memory_order_relaxed) & SCAN_MASK); }
+  std::uint64_t last_scanned() const { return packed_.load(std::memory_order_relaxed) >> SCAN_BITS; }
+
+  /** @brief Counts one scan at time now. Every scans_before_reset-th scan
+    *        resets the count and makes now the last scanned time.
+    * @return True if this scan caused the reset.
+    */
+  bool record(std::uint64_t now, int scans_before_reset);
+
+private:
+
+  static std::uint64_t pack(std::uint64_t last_scanned, int scans) {
+    return (last_scanned << SCAN_BITS) | (std::uint64_t(scans) & SCAN_MASK);
+  }
+
+  std::atomic<std::uint64_t> packed_;
+
+};
+
+inline bool RewardScanState::record(std::uint64_t now, int scans_before_reset) {
+  std::uint64_t cur = packed_.load(std::memory_order_relaxed);
+  for (;;) {
+    const int scans = int(cur & SCAN_MASK) + 1;
+    const bool reset = scans >= scans_before_reset;
+    const std::uint64_t next = reset ? pack(now, 0) : pack(cur >> SCAN_BITS, scans);
+    if (packed_.compare_exchange_weak(cur, next, std::memory_order_relaxed)) return reset;
+  }
+}
+
+/** @brief Dense storage for the scan state of every live reward. The states
+  *        are written on every scan while the rest of a reward is only read,
+  *        so keeping them apart stops scans from invalidating the cache lines
+  *        that hold reward quantities and locations. States are allocated in
+  *        fixed blocks and never move.
+  */
+class ScanStateTable {
+public:
+
+  constexpr static std::size_t BLOCK_SIZE = 4096;
+
+  ScanStateTable() = default;
+
+  /// A state for a new reward, initialised to a copy of initial.
+  RewardScanState* acquire(const RewardScanState& initial);
+
+  /// Returns a state to the table. It may be handed out again. Null is
+  /// ignored.
+  void release(RewardScanState* state);
+
+  /// Number of states currently handed out.
+  std::size_t size() const { return size_; }
+
+private:
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<RewardScanState[]>> blocks_;
+  std::vector<RewardScanState*> free_;
+  std::size_t used_in_block_ = BLOCK_SIZE;
+  std::size_t size_ = 0;
+
+  // No copy construction/assignment.
+  ScanStateTable(const ScanStateTable&) = delete;
+  ScanStateTable& operator=(const ScanStateTable&) = delete;
+
+};
+
+inline RewardScanState* ScanStateTable::acquire(const RewardScanState& initial) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RewardScanState* state;
+  if (!free_.empty()) {
+    state = free_.back();
+    free_.pop_back();
+  } else {
+    if (used_in_block_ == BLOCK_SIZE) {
+      blocks_.emplace_back(new RewardScanState[BLOCK_SIZE]);
+      used_in_block_ = 0;
+    }
+    state = &blocks_.back()[used_in_block_++];
+  }
+  *state = initial;
+  ++size_;
+  return state;
+}
+
+inline void ScanStateTable::release(RewardScanState* state) {
+  if (!state) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(state);
+  --size_;
+}
+
+} // end namespace cell
+
+#endif // CELL_SCAN_STATE_HPP
@@ -0,0 +1,480 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file server.cpp
+/// @brief Runs a ScanServer in front of a World, and a load test client that
+///        reports requests per second and latency percentiles against it.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// posix
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// cell
+#include <grid_stats.hpp>
+#include <reward_spawner.hpp>
+#include <scan_server.hpp>
+
+using namespace cell;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char* const USAGE =
+  "usage: cell.server.x [--option=value ...]\n"
+  "\n"
+  "  --mode=serve|client|loopback\n"
+  "                     serve: run the server until interrupted; client: load\n"
+  "                     test a running server; loopback: both in one process\n"
+  "                     (serve)\n"
+  "\n"
+  "Server\n"
+  "  --tcp=ADDR:PORT    IPv4 address to listen on or connect to, off for none,\n"
+  "                     port 0 picks one in loopback mode (127.0.0.1:7600)\n"
+  "  --unix=PATH        Unix socket to listen on or connect to (none)\n"
+  "  --tick-us=N        how long requests are gathered into a tick (1000)\n"
+  "  --board=N          side of the square board (65536)\n"
+  "  --rewards=N        rewards spread over the board (200000)\n"
+  "  --scan-threads=N   threads of a tick's scans, 0 for all (1)\n"
+  "  --seed=N           random seed (1)\n"
+  "\n"
+  "Load test\n"
+  "  --connect=tcp|unix which address the client uses (tcp)\n"
+  "  --connections=N    client connections (8)\n"
+  "  --depth=N          requests in flight per connection (64)\n"
+  "  --players=N        players joined by each connection (1000)\n"
+  "  --mix=M,S,H        percent of moves, scans and hits (60,30,10)\n"
+  "  --seconds=N        length of the test (5)\n";
+
+enum class Mode { SERVE, CLIENT, LOOPBACK };
+
+/// Command line settings, see USAGE.
+struct Config {
+  Mode mode = Mode::SERVE;
+
+  std::string tcp_address = "127.0.0.1";
+  long tcp_port = 7600;
+  bool tcp = true;
+  std::string unix_path;
+  long tick_us = 1000;
+  int board = 65536;
+  long rewards = 200000;
+  unsigned scan_threads = 1;
+  std::uint64_t seed = 1;
+
+  bool connect_unix = false;
+  long connections = 8;
+  long depth = 64;
+  long players = 1000;
+  long mix[3] = { 60, 30, 10 };
+  long seconds = 5;
+};
+
+bool parse_mix(const char* s, long (&mix)[3])
+{
+  long values[3];
+  for (int i = 0; i < 3; ++i) {
+    char* end;
+    values[i] = std::strtol(s, &end, 10);
+    if (end == s || values[i] < 0 || *end != (i < 2 ? ',' : '\0')) return false;
+    s = end + 1;
+  }
+  if (values[0] + values[1] + values[2] != 100) return false;
+  std::copy(values, values + 3, mix);
+  return true;
+}
+
+bool parse_tcp(const std::string& value, Config& config)
+{
+  if (value == "off") {
+    config.tcp = false;
+    return true;
+  }
+  const std::size_t colon = value.rfind(':');
+  if (colon == std::string::npos) return false;
+  config.tcp = true;
+  config.tcp_address = value.substr(0, colon);
+  config.tcp_port = std::strtol(value.c_str() + colon + 1, nullptr, 10);
+  return config.tcp_port >= 0 && config.tcp_port < 65536;
+}
+
+/// @return False, after saying why, on an unknown or malformed option.
+bool parse_args(int argc, char** argv, Config& config)
+{
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::size_t eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    const long n = std::strtol(value, nullptr, 10);
+    bool ok = eq != std::string::npos;
+    if (name == "--mode") {
+      if (std::strcmp(value, "serve") == 0) config.mode = Mode::SERVE;
+      else if (std::strcmp(value, "client") == 0) config.mode = Mode::CLIENT;
+      else if (std::strcmp(value, "loopback") == 0) config.mode = Mode::LOOPBACK;
+      else ok = false;
+    }
+    else if (name == "--tcp") ok = ok && parse_tcp(value, config);
+    else if (name == "--unix") config.unix_path = value;
+    else if (name == "--tick-us") config.tick_us = n;
+    else if (name == "--board") config.board = int(n);
+    else if (name == "--rewards") config.rewards = n;
+    else if (name == "--scan-threads") config.scan_threads = unsigned(n);
+    else if (name == "--seed") config.seed = std::uint64_t(n);
+    else if (name == "--connect") {
+      config.connect_unix = std::strcmp(value, "unix") == 0;
+      ok = ok && (config.connect_unix || std::strcmp(value, "tcp") == 0);
+    }
+    else if (name == "--connections") config.connections = n;
+    else if (name == "--depth") config.depth = n;
+    else if (name == "--players") config.players = n;
+    else if (name == "--mix") ok = ok && parse_mix(value, config.mix);
+    else if (name == "--seconds") config.seconds = n;
+    else if (name == "--help" || name == "-h") ok = false;
+    else {
+      std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+      ok = false;
+    }
+    if (!ok) {
+      std::fputs(USAGE, stderr);
+      return false;
+    }
+  }
+  if (config.board < 2 || config.connections < 1 || config.depth < 1 || config.players < 1 ||
+      config.tick_us < 0) {
+    std::fputs("board, connections, depth and players must be positive\n", stderr);
+    return false;
+  }
+  if (config.connect_unix ? config.unix_path.empty() : !config.tcp) {
+    std::fputs("--connect names an address that isn't set\n", stderr);
+    return false;
+  }
+  return true;
+}
+
+void fill_world(const Config& config, World& world)
+{
+  const Clock::time_point start = Clock::now();
+  RewardSpawner spawner(config.seed);
+  SpawnRequest req;
+  req.type = Reward::RewardType::DIST_TIME;
+  req.quantity = 100;
+  req.count = std::size_t(std::max(config.rewards, 0L));
+  req.min_spacing = 8;
+  req.top_right = Location(config.board - 1, config.board - 1);
+  for (const Reward& r : spawner.generate(world.grid(), req)) world.grid().add_reward(r);
+  world.grid().reset_seed(std::mt19937::result_type(config.seed));
+  world.grid().set_scan_threads(config.scan_threads);
+  std::printf("built %zu rewards in %.2fs\n", world.grid().reward_manager().size(),
+              std::chrono::duration<double>(Clock::now() - start).count());
+}
+
+/// Sets up a server as configured. False, after saying why, if it can't
+/// listen.
+bool start_server(const Config& config, ScanServer& server)
+{
+  server.set_tick(std::chrono::microseconds(config.tick_us));
+  if (config.tcp && !server.listen_tcp(config.tcp_address, std::uint16_t(config.tcp_port))) {
+    std::fprintf(stderr, "can't listen on %s:%ld: %s\n", config.tcp_address.c_str(), config.tcp_port,
+                 std::strerror(errno));
+    return false;
+  }
+  if (!config.unix_path.empty() && !server.listen_unix(config.unix_path)) {
+    std::fprintf(stderr, "can't listen on %s: %s\n", config.unix_path.c_str(), std::strerror(errno));
+    return false;
+  }
+  if (config.tcp) std::printf("listening on %s:%u\n", config.tcp_address.c_str(), server.tcp_port());
+  if (!config.unix_path.empty()) std::printf("listening on %s\n", config.unix_path.c_str());
+  return true;
+}
+
+void print_server_stats(const ScanServerStats& s)
+{
+  std::printf("server: %llu connections, %llu requests in %llu ticks (%.1f per tick), "
+              "%llu bad frames, %.1f MB in, %.1f MB out\n",
+              (unsigned long long)s.connections, (unsigned long long)s.requests, (unsigned long long)s.ticks,
+              s.ticks ? double(s.requests) / double(s.ticks) : 0.0, (unsigned long long)s.bad_frames,
+              double(s.bytes_in) / 1e6, double(s.bytes_out) / 1e6);
+}
+
+ScanServer* serving = nullptr;
+
+void on_signal(int)
+{
+  if (serving) serving->stop();
+}
+
+/// Latencies of one kind of request, from being queued to send to its
+/// response being read.
+struct OpStats {
+  explicit OpStats(const char* n) : name(n) { }
+
+  const char* name;
+  LatencyHistogram latency;
+  std::uint64_t failed = 0;
+  std::uint64_t max_ns = 0;
+
+  void add(std::uint64_t ns, bool ok) {
+    latency.add(ns);
+    max_ns = std::max(max_ns, ns);
+    if (!ok) ++failed;
+  }
+
+  void print(double seconds) const {
+    if (latency.count() == 0) return;
+    std::printf("%-8s %10llu %11.0f %8llu %9.1f %9.1f %9.1f %9.1f\n", name,
+                (unsigned long long)latency.count(), double(latency.count()) / seconds,
+                (unsigned long long)failed, latency.percentile_ns(0.5) / 1000,
+                latency.percentile_ns(0.99) / 1000, latency.percentile_ns(0.999) / 1000,
+                double(max_ns) / 1000);
+  }
+};
+
+/** @brief Pipelining load test client: every connection joins its own
+  *        players, then keeps depth requests in flight, a mix of moves of its
+  *        players, scans and hits near them. All connections share one epoll
+  *        loop.
+  */
+class LoadClient {
+public:
+
+  explicit LoadClient(const Config& config) : config_(config), gen_(std::mt19937::result_type(config.seed)) { }
+
+  ~LoadClient() {
+    for (Connection& c : connections_) {
+      if (c.fd >= 0) ::close(c.fd);
+    }
+    if (epoll_fd_ >= 0) ::close(epoll_fd_);
+  }
+
+  /// @return False, after saying why, if a connection fails.
+  bool connect(std::uint16_t tcp_port) {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    std::uniform_int_distribution<int> coord(0, config_.board - 1);
+    connections_.resize(std::size_t(config_.connections));
+    for (std::size_t i = 0; i < connections_.size(); ++i) {
+      Connection& c = connections_[i];
+      c.fd = config_.connect_unix ? connect_unix(config_.unix_path)
+                                  : connect_tcp(config_.tcp_address, tcp_port);
+      if (c.fd < 0) {
+        std::fprintf(stderr, "can't connect: %s\n", std::strerror(errno));
+        return false;
+      }
+      ::fcntl(c.fd, F_SETFL, ::fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.u64 = i;
+      ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev);
+      c.first_player = PlayerId(i * std::size_t(config_.players));
+      for (long p = 0; p < config_.players; ++p) c.players.push_back(Location(coord(gen_), coord(gen_)));
+    }
+    return true;
+  }
+
+  void run() {
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + std::chrono::seconds(config_.seconds);
+    // Whatever is still in flight gets this long to come back.
+    const Clock::time_point give_up = end + std::chrono::seconds(5);
+    for (;;) {
+      const Clock::time_point now = Clock::now();
+      bool in_flight = false;
+      for (Connection& c : connections_) {
+        if (now < end) fill(c, now);
+        flush(c);
+        in_flight = in_flight || !c.sent.empty();
+      }
+      if ((now >= end && !in_flight) || now >= give_up || broken_) break;
+      epoll_event events[64];
+      const int n = ::epoll_wait(epoll_fd_, events, 64, 1);
+      for (int i = 0; i < n; ++i) receive(connections_[events[i].data.u64]);
+    }
+    elapsed_ = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  void print() const {
+    OpStats all("all");
+    std::uint64_t in_flight = 0;
+    for (const OpStats& op : ops_) {
+      all.latency.merge(op.latency);
+      all.failed += op.failed;
+      all.max_ns = std::max(all.max_ns, op.max_ns);
+    }
+    for (const Connection& c : connections_) in_flight += c.sent.size();
+    std::printf("ran %.2fs over %ld connections, %ld in flight each: %.0f requests/s",
+                elapsed_, config_.connections, config_.depth, double(all.latency.count()) / elapsed_);
+    if (in_flight) std::printf(", %llu never answered", (unsigned long long)in_flight);
+    if (broken_) std::printf(", stopped by a broken connection");
+    std::printf("\n\n%-8s %10s %11s %8s %9s %9s %9s %9s\n", "request", "count", "per second", "failed",
+                "p50 us", "p99 us", "p99.9 us", "max us");
+    for (const OpStats& op : ops_) op.print(elapsed_);
+    all.print(elapsed_);
+  }
+
+private:
+
+  struct Sent {
+    std::uint32_t tag;
+    WireOp op;
+    Clock::time_point at;
+  };
+
+  struct Connection {
+    int fd = -1;
+    std::vector<char> out;
+    std::size_t written = 0;
+    std::vector<char> in;
+    std::deque<Sent> sent;
+    std::uint32_t next_tag = 0;
+    PlayerId first_player = 0;
+    std::vector<Location> players;
+    std::size_t joined = 0;
+  };
+
+  /// Queues requests until depth are in flight.
+  void fill(Connection& c, Clock::time_point now) {
+    std::uniform_int_distribution<std::size_t> pick(0, c.players.size() - 1);
+    std::uniform_int_distribution<int> percent(0, 99), step(-16, 16);
+    while (c.sent.size() < std::size_t(config_.depth)) {
+      WireRequest req;
+      req.tag = c.next_tag++;
+      if (c.joined < c.players.size()) {
+        req.op = WireOp::JOIN;
+        req.player = c.first_player + PlayerId(c.joined);
+        req.location = c.players[c.joined++];
+      } else {
+        const std::size_t k = pick(gen_);
+        const int roll = percent(gen_);
+        req.player = c.first_player + PlayerId(k);
+        Location& at = c.players[k];
+        if (roll < config_.mix[0]) {
+          req.op = WireOp::MOVE;
+          at = Location(std::min(std::max(at.x + step(gen_), 0), config_.board - 1),
+                        std::min(std::max(at.y + step(gen_), 0), config_.board - 1));
+          req.location = at;
+        } else if (roll < config_.mix[0] + config_.mix[1]) {
+          req.op = WireOp::SCAN;
+        } else {
+          req.op = WireOp::HIT;
+          req.location = Location(at.x + step(gen_) / 4, at.y + step(gen_) / 4);
+        }
+      }
+      encode_request(req, c.out);
+      c.sent.push_back(Sent{ req.tag, req.op, now });
+    }
+  }
+
+  void flush(Connection& c) {
+    while (c.written < c.out.size()) {
+      const ssize_t n = ::send(c.fd, c.out.data() + c.written, c.out.size() - c.written, MSG_NOSIGNAL);
+      if (n > 0) c.written += std::size_t(n);
+      else {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) broken_ = true;
+        break;
+      }
+    }
+    if (c.written == c.out.size()) {
+      c.out.clear();
+      c.written = 0;
+    }
+  }
+
+  void receive(Connection& c) {
+    char buf[64 * 1024];
+    const ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) broken_ = true;
+      return;
+    }
+    c.in.insert(c.in.end(), buf, buf + n);
+    const Clock::time_point now = Clock::now();
+    std::size_t at = 0, used;
+    WireResponse res;
+    WireResult result;
+    while ((result = decode_response(c.in.data() + at, c.in.size() - at, res, used)) == WireResult::OK) {
+      at += used;
+      if (c.sent.empty() || c.sent.front().tag != res.tag) {
+        std::fputs("response out of order\n", stderr);
+        broken_ = true;
+        return;
+      }
+      const Sent& s = c.sent.front();
+      const std::uint64_t ns = std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now - s.at).count());
+      ops_[int(s.op) - int(WireOp::JOIN)].add(ns, res.status == WireStatus::OK);
+      c.sent.pop_front();
+    }
+    if (result == WireResult::BAD) broken_ = true;
+    c.in.erase(c.in.begin(), c.in.begin() + std::ptrdiff_t(at));
+  }
+
+  const Config& config_;
+  std::mt19937 gen_;
+  int epoll_fd_ = -1;
+  std::vector<Connection> connections_;
+  bool broken_ = false;
+  double elapsed_ = 0;
+  // By WireOp, JOIN first.
+  OpStats ops_[5] = { OpStats("join"), OpStats("leave"), OpStats("move"), OpStats("scan"), OpStats("hit") };
+};
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+  Config config;
+  if (!parse_args(argc, argv, config)) return 2;
+
+  if (config.mode == Mode::CLIENT) {
+    LoadClient client(config);
+    if (!client.connect(std::uint16_t(config.tcp_port))) return 1;
+    client.run();
+    client.print();
+    return 0;
+  }
+
+  World world;
+  fill_world(config, world);
+  ScanServer server(world);
+  if (!start_server(config, server)) return 1;
+
+  if (config.mode == Mode::SERVE) {
+    serving = &server;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    server.run();
+    print_server_stats(server.stats());
+    return 0;
+  }
+
+  // Loopback: the server on a thread of its own, the client on this one.
+  std::thread server_thread([&server] { server.run(); });
+  LoadClient client(config);
+  const bool connected = client.connect(server.tcp_port());
+  if (connected) client.run();
+  server.stop();
+  server_thread.join();
+  if (!connected) return 1;
+  client.print();
+  print_server_stats(server.stats());
+  return 0;
+}
@@ -0,0 +1,388 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file sharded_world.cpp
+/// @brief Implementation of ShardedWorld.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+// cell
+#include <sharded_world.hpp>
+
+namespace cell {
+
+namespace {
+
+int clamp_x(std::int64_t x)
+{
+  return int(std::max<std::int64_t>(std::numeric_limits<int>::min(),
+                                    std::min<std::int64_t>(std::numeric_limits<int>::max(), x)));
+}
+
+/// Players looked at per step of the handoffs after a rebalance.
+constexpr std::size_t PLAYERS_PER_STEP = 1024;
+
+} // end anonymous namespace
+
+constexpr int ShardedWorld::NUM_COLUMNS;
+constexpr double ShardedWorld::DEFAULT_REBALANCE_THRESHOLD;
+constexpr std::uint32_t ShardedWorld::DEFAULT_SCAN_COST;
+
+ShardedWorld::ShardedWorld(unsigned num_shards, int min_x, int max_x)
+  : min_x_(min_x),
+    column_width_(int(std::max<std::int64_t>(1, (std::int64_t(max_x) - min_x + NUM_COLUMNS - 1) /
+                                                  NUM_COLUMNS))),
+    columns_(NUM_COLUMNS),
+    pool_(std::max(num_shards, 1u))
+{
+  num_shards = std::max(num_shards, 1u);
+  const std::int64_t width = (std::int64_t(max_x) - min_x) / num_shards;
+  for (unsigned i = 1; i < num_shards; ++i) boundaries_.push_back(clamp_x(min_x + width * i));
+  reward_boundaries_ = boundaries_;
+  for (unsigned i = 0; i < num_shards; ++i) shards_.emplace_back(new World);
+  work_.resize(num_shards);
+  for (ShardWork& w : work_) w.load.resize(NUM_COLUMNS);
+  busy_ns_.resize(num_shards);
+  reset_seed(0);
+}
+
+unsigned ShardedWorld::shard_of(int x) const
+{
+  return unsigned(std::upper_bound(boundaries_.begin(), boundaries_.end(), x) - boundaries_.begin());
+}
+
+unsigned ShardedWorld::reward_shard_of(int x) const
+{
+  return unsigned(std::upper_bound(reward_boundaries_.begin(), reward_boundaries_.end(), x) -
+                  reward_boundaries_.begin());
+}
+
+template<class Fn>
+void ShardedWorld::for_each_shard(Fn&& fn)
+{
+  pool_.parallel_for(shards_.size(), 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t s = begin; s < end; ++s) {
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn(unsigned(s));
+      busy_ns_[s] += std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    }
+  });
+}
+
+int ShardedWorld::column_of(int x) const
+{
+  const std::int64_t c = (std::int64_t(x) - min_x_) / column_width_;
+  return int(std::max<std::int64_t>(0, std::min<std::int64_t>(NUM_COLUMNS - 1, c)));
+}
+
+int ShardedWorld::column_start(int column) const
+{
+  return clamp_x(min_x_ + std::int64_t(column) * column_width_);
+}
+
+void ShardedWorld::add_reward(const Reward& reward)
+{
+  min_reward_y_ = std::min(min_reward_y_, reward.location().y);
+  max_reward_y_ = std::max(max_reward_y_, reward.location().y);
+  shards_[reward_shard_of(reward.location().x)]->grid().add_reward(reward);
+}
+
+bool ShardedWorld::player_join(const Player& p)
+{
+  const unsigned s = shard_of(p.location().x);
+  if (!owners_.emplace(p.id(), s).second) return false;
+  return shards_[s]->player_join(p);
+}
+
+bool ShardedWorld::player_leave(PlayerId id)
+{
+  const auto it = owners_.find(id);
+  if (it == owners_.end()) return false;
+  shards_[it->second]->player_leave(id);
+  owners_.erase(it);
+  return true;
+}
+
+const Player* ShardedWorld::find_player(PlayerId id) const
+{
+  const auto it = owners_.find(id);
+  return it == owners_.end() ? nullptr : shards_[it->second]->find_player(id);
+}
+
+int ShardedWorld::shard_of_player(PlayerId id) const
+{
+  const auto it = owners_.find(id);
+  return it == owners_.end() ? -1 : int(it->second);
+}
+
+void ShardedWorld::hand_off(Player p, unsigned from, unsigned to)
+{
+  shards_[from]->player_leave(p.id());
+  shards_[to]->player_join(p);
+  owners_[p.id()] = to;
+  ++handoffs_;
+}
+
+bool ShardedWorld::move_player(PlayerId id, const Location& to)
+{
+  const auto it = owners_.find(id);
+  if (it == owners_.end()) return false;
+  const unsigned from = it->second;
+  shards_[from]->move_player(id, to);
+  const unsigned dest = shard_of(to.x);
+  if (dest != from) hand_off(*shards_[from]->find_player(id), from, dest);
+  return true;
+}
+
+std::size_t ShardedWorld::apply_moves(span<const Move> moves)
+{
+  for (ShardWork& w : work_) {
+    w.moves.clear();
+    w.outgoing.clear();
+  }
+  // A player's moves all go to the shard they start the tick in, in order.
+  for (const Move& m : moves) {
+    const auto it = owners_.find(m.id);
+    if (it != owners_.end()) work_[it->second].moves.push_back(m);
+  }
+
+  for_each_shard([&](unsigned s) {
+    ShardWork& w = work_[s];
+    World& world = *shards_[s];
+    w.applied = world.apply_moves(w.moves);
+    for (const Move& m : w.moves) {
+      ++w.load[column_of(m.to.x)];
+      if (shard_of(m.to.x) == s) continue;
+      // Only where the player ends up counts, and they leave once.
+      const Player* p = world.find_player(m.id);
+      if (p && shard_of(p->location().x) != s) {
+        w.outgoing.push_back(*p);
+        world.player_leave(m.id);
+      }
+    }
+  });
+  for_each_shard([&](unsigned s) {
+    for (const ShardWork& w : work_) {
+      for (const Player& p : w.outgoing) {
+        if (shard_of(p.location().x) == s) shards_[s]->player_join(p);
+      }
+    }
+  });
+
+  std::size_t applied = 0;
+  for (const ShardWork& w : work_) {
+    applied += w.applied;
+    for (const Player& p : w.outgoing) owners_[p.id()] = shard_of(p.location().x);
+    handoffs_ += w.outgoing.size();
+  }
+  return applied;
+}
+
+void ShardedWorld::scan_players(span<const PlayerId> ids, span<Scan> out)
+{
+  const std::size_t n = std::min(ids.size(), out.size());
+  const std::uint64_t batch = scan_batches_++;
+  const std::uint64_t now = clock_->now_ms();
+  for (ShardWork& w : work_) {
+    w.items.clear();
+    w.hits.clear();
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto it = owners_.find(ids[i]);
+    if (it == owners_.end()) out[i] = Scan();
+    else work_[it->second].items.push_back(std::uint32_t(i));
+  }
+
+  // Scans only read the rewards, so shards can read each other's meanwhile.
+  for_each_shard([&](unsigned s) {
+    ShardWork& w = work_[s];
+    const World& world = *shards_[s];
+    for (std::uint32_t i : w.items) {
+      const Player& player = *world.find_player(ids[i]);
+      w.load[column_of(player.location().x)] += scan_cost_;
+      int min_dists[Scan::NUM_RINGS], max_dists[Scan::NUM_RINGS];
+      Grid::scan_players_ranges(scan_seed_, batch, ids[i], min_dists, max_dists);
+      const std::int64_t reach = *std::max_element(max_dists, max_dists + Scan::NUM_RINGS);
+      const unsigned first = reward_shard_of(clamp_x(player.location().x - reach));
+      const unsigned last = reward_shard_of(clamp_x(player.location().x + reach));
+      out[i] = Scan();
+      for (unsigned t = first; t <= last; ++t) {
+        shards_[t]->grid().scan_player_into(player, min_dists, max_dists, now, out[i], w.hits);
+      }
+    }
+  });
+  for_each_shard([&](unsigned s) { Grid::record_hits(work_[s].hits, now); });
+}
+
+void ShardedWorld::resolve_hits(span<HitRequest> hits)
+{
+  const int reach = int(Reward::HIT_RADIUS);
+  for (ShardWork& w : work_) {
+    w.items.clear();
+    w.hit_requests.clear();
+  }
+  // Requests keep their order within each shard, so ties are broken the
+  // same way as in one grid.
+  for (std::uint32_t i = 0; i < hits.size(); ++i) {
+    const Location& l = hits[i].location;
+    const unsigned last = reward_shard_of(clamp_x(std::int64_t(l.x) + reach));
+    for (unsigned t = reward_shard_of(clamp_x(std::int64_t(l.x) - reach)); t <= last; ++t) {
+      work_[t].items.push_back(i);
+      work_[t].hit_requests.emplace_back(hits[i].player, l);
+    }
+  }
+
+  for_each_shard([&](unsigned s) { shards_[s]->grid().resolve_hits(work_[s].hit_requests); });
+
+  for (HitRequest& hit : hits) hit.value = 0;
+  for (const ShardWork& w : work_) {
+    for (std::size_t k = 0; k < w.items.size(); ++k) hits[w.items[k]].value += w.hit_requests[k].value;
+  }
+}
+
+bool ShardedWorld::rebalance(std::chrono::microseconds budget)
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  plan();
+  do {
+    // Players first, they are what the load follows.
+    if (misplaced_) hand_off_misplaced(PLAYERS_PER_STEP);
+    else if (!step_reward_boundary()) break;
+  } while (std::chrono::steady_clock::now() - start < budget);
+  return !misplaced_ && reward_boundaries_ == boundaries_;
+}
+
+double ShardedWorld::imbalance() const
+{
+  std::vector<std::uint64_t> loads(shards_.size());
+  std::uint64_t total = 0;
+  for (int c = 0; c < NUM_COLUMNS; ++c) {
+    loads[shard_of(column_start(c))] += columns_[c];
+    total += columns_[c];
+  }
+  if (total == 0) return 1.0;
+  return double(*std::max_element(loads.begin(), loads.end())) * double(loads.size()) / double(total);
+}
+
+void ShardedWorld::plan()
+{
+  // Nothing new, e.g. several calls between ticks, leaves the history be.
+  bool fresh = false;
+  for (const ShardWork& w : work_) {
+    fresh = fresh || std::any_of(w.load.begin(), w.load.end(), [](std::uint64_t l) { return l != 0; });
+  }
+  if (!fresh) return;
+
+  std::uint64_t total = 0;
+  for (int c = 0; c < NUM_COLUMNS; ++c) {
+    std::uint64_t load = columns_[c] / 2;
+    for (ShardWork& w : work_) {
+      load += w.load[c];
+      w.load[c] = 0;
+    }
+    columns_[c] = load;
+    total += load;
+  }
+  const std::uint64_t n = shards_.size();
+  if (n < 2 || imbalance() <= rebalance_threshold_) return;
+
+  // Boundary b goes to the first column edge with (b + 1) / n of the load
+  // before it.
+  std::uint64_t before = 0;
+  unsigned b = 0;
+  for (int c = 0; c < NUM_COLUMNS && b + 1 < n; ++c) {
+    while (b + 1 < n && before * n >= total * (b + 1)) boundaries_[b++] = column_start(c);
+    before += columns_[c];
+  }
+  for (; b + 1 < n; ++b) boundaries_[b] = column_start(NUM_COLUMNS);
+  misplaced_ = true;
+  misplaced_shard_ = 0;
+  misplaced_index_ = 0;
+}
+
+bool ShardedWorld::step_reward_boundary()
+{
+  const unsigned n = unsigned(boundaries_.size());
+  for (unsigned k = 0; k < n; ++k) {
+    const unsigned i = (next_boundary_ + k) % n;
+    const int at = reward_boundaries_[i], target = boundaries_[i];
+    if (at == target) continue;
+    int next;
+    if (target < at) {
+      next = std::max(target, column_start(column_of(at - 1)));
+      if (next >= at) next = target;
+    } else {
+      next = std::min(target, column_start(column_of(at) + 1));
+      if (next <= at) next = target;
+    }
+    // Boundaries can't pass each other, one waits for its neighbour instead.
+    if (i > 0) next = std::max(next, reward_boundaries_[i - 1]);
+    if (i + 1 < n) next = std::min(next, reward_boundaries_[i + 1]);
+    if (next == at) continue;
+
+    if (next < at) migrate_rewards(i, i + 1, next, at);
+    else migrate_rewards(i + 1, i, at, next);
+    reward_boundaries_[i] = next;
+    next_boundary_ = i + 1;
+    return true;
+  }
+  return false;
+}
+
+void ShardedWorld::migrate_rewards(unsigned from, unsigned to, int lo, int hi)
+{
+  if (min_reward_y_ > max_reward_y_) return;
+  Grid& source = shards_[from]->grid();
+  Grid& dest = shards_[to]->grid();
+  std::vector<Reward> moving;
+  source.reward_grid().for_each_in_rect(Location(lo, min_reward_y_), Location(hi - 1, max_reward_y_),
+                                        [&](const Location&, RewardHandle h) {
+    moving.push_back(*source.reward_manager().get(h));
+  });
+  // The quantities go along, nothing is redistributed.
+  for (const Reward& r : moving) {
+    source.discard_reward(r.location());
+    dest.add_reward(r);
+  }
+}
+
+bool ShardedWorld::hand_off_misplaced(std::size_t max_players)
+{
+  std::size_t seen = 0;
+  for (; misplaced_shard_ < shards_.size(); ++misplaced_shard_, misplaced_index_ = 0) {
+    World& world = *shards_[misplaced_shard_];
+    while (misplaced_index_ < world.num_players()) {
+      if (seen++ == max_players) return true;
+      const Player& p = world.players()[misplaced_index_];
+      const unsigned dest = shard_of(p.location().x);
+      // Leaving fills the player's place with another one, which is next.
+      if (dest != misplaced_shard_) hand_off(p, misplaced_shard_, dest);
+      else ++misplaced_index_;
+    }
+  }
+  misplaced_ = false;
+  return false;
+}
+
+void ShardedWorld::reset_seed(std::mt19937::result_type seed)
+{
+  scan_seed_ = seed;
+  scan_batches_ = 0;
+  for (const std::unique_ptr<World>& world : shards_) world->grid().reset_seed(seed);
+}
+
+void ShardedWorld::set_clock(const GameClock& clock)
+{
+  clock_ = &clock;
+  for (const std::unique_ptr<World>& world : shards_) world->set_clock(clock);
+}
+
+} // end namespace cell
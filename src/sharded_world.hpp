@@ -0,0 +1,254 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file sharded_world.hpp
+/// @brief A world split into strips of the board, each one a World of its
+///        own processed on a worker thread.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SHARDED_WORLD_HPP
+#define CELL_SHARDED_WORLD_HPP
+
+// std
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// cell
+#include <thread_pool.hpp>
+#include <world.hpp>
+
+namespace cell {
+
+/** @brief The board split along x into strips, the shards. Shard i owns the
+  *        players with x in [boundary(i - 1), boundary(i)) and the rewards
+  *        with x in [reward_boundary(i - 1), reward_boundary(i)), the first
+  *        and last shards run out to the edges of the board. Each shard is a
+  *        World, and the batch calls below process every shard as one task
+  *        of a pool with a thread per shard.
+  *
+  *        A scan is made by the shard of its player, which adds up its own
+  *        rewards and those of every other shard its outer ring reaches
+  *        into. Scans of a batch only read rewards, so shards read each
+  *        other's grids side by side, and the scan bookkeeping is applied
+  *        once every scan is done. The result is that of one World holding
+  *        every reward.
+  *
+  *        Players moving out of their shard's strip are handed off to the
+  *        shard they moved into at the end of apply_moves.
+  *
+  *        The boundaries follow the load, see rebalance. Scans and moves are
+  *        counted per column of the board, NUM_COLUMNS of them across
+  *        [min_x, max_x), and the player boundaries are set to the split that
+  *        gives every shard the same share. The reward boundaries catch up a
+  *        column at a time. They start out the same.
+  *
+  *        Rewards must be added through the sharded world, which places them
+  *        in their shard. Everything else about them, e.g. removal, is done
+  *        on shard(reward_shard_of(x)) directly. Each shard's RewardManager keeps
+  *        the quantities of its own rewards, so a removed reward's quantity
+  *        stays in its shard.
+  */
+class ShardedWorld {
+public:
+
+  /// Columns the load is counted in.
+  constexpr static int NUM_COLUMNS = 1024;
+
+  /// Default for rebalance_threshold().
+  constexpr static double DEFAULT_REBALANCE_THRESHOLD = 1.25;
+
+  /// Default for scan_cost(), about what a scan takes over a move.
+  constexpr static std::uint32_t DEFAULT_SCAN_COST = 200;
+
+  /// num_shards strips of equal width covering [min_x, max_x).
+  ShardedWorld(unsigned num_shards, int min_x, int max_x);
+
+  unsigned num_shards() const { return unsigned(shards_.size()); }
+
+  /// First x of the players of shard i + 1, i in [0, num_shards() - 1).
+  int boundary(unsigned i) const { return boundaries_[i]; }
+  /// First x of the rewards of shard i + 1.
+  int reward_boundary(unsigned i) const { return reward_boundaries_[i]; }
+
+  /// The shard whose strip holds players at x.
+  unsigned shard_of(int x) const;
+  /// The shard whose strip holds rewards at x.
+  unsigned reward_shard_of(int x) const;
+
+  World& shard(unsigned i) { return *shards_[i]; }
+  const World& shard(unsigned i) const { return *shards_[i]; }
+
+  /// Adds a reward to the shard it is in, see Grid::add_reward.
+  void add_reward(const Reward& reward);
+
+  /// Same as World::player_join, into the shard the player is in.
+  bool player_join(const Player& p);
+
+  /// Same as World::player_leave.
+  bool player_leave(PlayerId id);
+
+  /// The player with the given id, nullptr if they are not in the world.
+  /// The pointer is invalidated by the next join, leave or handoff.
+  const Player* find_player(PlayerId id) const;
+
+  /// Index of the shard the player is in, -1 if they are not in the world.
+  int shard_of_player(PlayerId id) const;
+
+  std::size_t num_players() const { return owners_.size(); }
+
+  /// Same as World::move_player, handing the player off if they leave their
+  /// shard.
+  bool move_player(PlayerId id, const Location& to);
+
+  /** @brief Same as World::apply_moves. Each shard applies the moves of its
+    *        players on its own thread, then the players who ended up outside
+    *        their shard are handed off.
+    */
+  std::size_t apply_moves(span<const Move> moves);
+
+  /** @brief Randomized scans of the given players, out[i] receiving the scan
+    *        of ids[i], or an empty scan for a player who is not in the world.
+    *        Same ring ranges and results as Grid::scan_players over a World
+    *        holding everything, given the same seed.
+    */
+  void scan_players(span<const PlayerId> ids, span<Scan> out);
+
+  /** @brief Same as Grid::resolve_hits. A hit is resolved by every shard
+    *        within Reward::HIT_RADIUS of it, each paying from its own
+    *        rewards, and collects the sum.
+    */
+  void resolve_hits(span<HitRequest> hits);
+
+  /// Same as Grid::reset_seed, for scan_players.
+  void reset_seed(std::mt19937::result_type seed);
+
+  /// Clock of every shard, see World::set_clock.
+  const GameClock& clock() const { return *clock_; }
+  void set_clock(const GameClock& clock);
+
+  /// Players handed off between shards so far, by moves and rebalancing.
+  std::uint64_t handoffs() const { return handoffs_; }
+
+  /** @brief Splits the board more evenly by the recent load, working for
+    *        about budget at most. Call it between ticks, e.g. once per tick
+    *        with what is left of the tick.
+    *
+    *        Every call adds the load counted since the last one, if any, to
+    *        the history, which is halved each time. If a shard then carries more
+    *        than rebalance_threshold() times the mean, the player boundaries
+    *        move to the even split at once. The players left on the wrong
+    *        side are handed off a thousand or so at a time, after which the
+    *        reward boundaries follow a column at a time, taking the column's
+    *        rewards along. Every call makes some progress, and a single step
+    *        can overrun the budget by the cost of one column.
+    *
+    *        Meanwhile the world stays fully usable. A player waiting to be
+    *        handed off is still scanned and moved correctly, and scans read
+    *        rewards from whichever shard holds them. Only the load lags.
+    *
+    *        A column is the finest split, so load on a single column stays
+    *        on one shard, whose neighbours may then be left empty.
+    * @return True if nothing is left to do.
+    */
+  bool rebalance(std::chrono::microseconds budget);
+
+  /// Load of the busiest shard over the mean, from the load history.
+  double imbalance() const;
+
+  double rebalance_threshold() const { return rebalance_threshold_; }
+  void set_rebalance_threshold(double threshold) { rebalance_threshold_ = threshold; }
+
+  /// Load of a scan, where a move counts one.
+  std::uint32_t scan_cost() const { return scan_cost_; }
+  void set_scan_cost(std::uint32_t cost) { scan_cost_ = cost; }
+
+  /// Time the batch calls have spent on a shard's tasks so far. The largest
+  /// is the critical path of the batches with one core per shard.
+  std::uint64_t shard_busy_ns(unsigned shard) const { return busy_ns_[shard]; }
+
+private:
+
+  /// Per shard scratch of the batch calls.
+  struct ShardWork {
+    // Indices into the batch of the items for this shard.
+    std::vector<std::uint32_t> items;
+    std::vector<Move> moves;
+    // Players leaving the shard at the end of apply_moves.
+    std::vector<Player> outgoing;
+    std::vector<Reward*> hits;
+    std::vector<HitRequest> hit_requests;
+    std::size_t applied = 0;
+    // Load per column counted by this shard's tasks since the last plan.
+    std::vector<std::uint64_t> load;
+  };
+
+  /// Moves a player from one shard to another, owners_ included. p is a copy,
+  /// the shard's own is gone once they leave.
+  void hand_off(Player p, unsigned from, unsigned to);
+
+  /// Calls fn(shard) for every shard, one task per shard.
+  template<class Fn>
+  void for_each_shard(Fn&& fn);
+
+  int column_of(int x) const;
+  /// First x of a column.
+  int column_start(int column) const;
+
+  /// Folds the latest load into the history and moves the player
+  /// boundaries if the shards are out of balance.
+  void plan();
+  /// Moves one reward boundary a column towards its player boundary. False
+  /// if none can move.
+  bool step_reward_boundary();
+  /// Moves the rewards with x in [lo, hi) from one shard to another.
+  void migrate_rewards(unsigned from, unsigned to, int lo, int hi);
+  /// Hands off up to max_players players on the wrong side of a boundary.
+  /// False once there are none left.
+  bool hand_off_misplaced(std::size_t max_players);
+
+  std::vector<int> boundaries_;
+  std::vector<int> reward_boundaries_;
+  unsigned next_boundary_ = 0;
+  // Players may be in the wrong shard since the boundaries moved, checked
+  // from misplaced_shard_ and misplaced_index_ on.
+  bool misplaced_ = false;
+  unsigned misplaced_shard_ = 0;
+  std::size_t misplaced_index_ = 0;
+
+  int min_x_;
+  int column_width_;
+  // Extent of the rewards in y, which bounds the columns being migrated.
+  int min_reward_y_ = std::numeric_limits<int>::max();
+  int max_reward_y_ = std::numeric_limits<int>::min();
+  // Decayed load history per column.
+  std::vector<std::uint64_t> columns_;
+  std::vector<std::uint64_t> busy_ns_;
+  double rebalance_threshold_ = DEFAULT_REBALANCE_THRESHOLD;
+  std::uint32_t scan_cost_ = DEFAULT_SCAN_COST;
+  std::vector<std::unique_ptr<World>> shards_;
+  std::vector<ShardWork> work_;
+  // Shard of every player.
+  std::unordered_map<PlayerId, unsigned> owners_;
+  ThreadPool pool_;
+
+  const GameClock* clock_ = &GameClock::system();
+  std::uint64_t scan_seed_ = 0;
+  std::uint64_t scan_batches_ = 0;
+  std::uint64_t handoffs_ = 0;
+
+  // No copy construction/assignment.
+  ShardedWorld(const ShardedWorld&) = delete;
+  ShardedWorld& operator=(const ShardedWorld&) = delete;
+
+};
+
+} // end namespace cell
+
+#endif // CELL_SHARDED_WORLD_HPP
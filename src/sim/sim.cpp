@@ -0,0 +1,448 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file sim.cpp
+/// @brief Load generator: runs a synthetic game against a World and reports
+///        throughput and latency percentiles per operation.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// cell
+#include <game_clock.hpp>
+#include <reward_spawner.hpp>
+#include <world.hpp>
+
+using namespace cell;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char* const USAGE =
+  "usage: cell.sim.x [--option=value ...]\n"
+  "\n"
+  "World\n"
+  "  --board=N          side of the square board (65536)\n"
+  "  --rewards=G,L,M,S  rewards per level, GRAND first (1,100,10000,200000)\n"
+  "  --quantity=G,L,M,S quantity of a new reward per level (1000000,10000,1000,100)\n"
+  "  --spacing=N        least distance between rewards (8)\n"
+  "  --players=N        players in the world (10000)\n"
+  "  --model=walk|cluster\n"
+  "                     walk: players wander at random; cluster: they crowd\n"
+  "                     around the GRAND reward (walk)\n"
+  "  --step=N           largest move per tick on each axis (16)\n"
+  "  --spread=N         cluster model's standard deviation around GRAND (2000)\n"
+  "\n"
+  "Load, per tick\n"
+  "  --ticks=N          ticks to run (200)\n"
+  "  --tick-ms=N        target tick period, 0 runs flat out (50)\n"
+  "  --scans=N          player scans (1000)\n"
+  "  --scan-mode=single|batch\n"
+  "                     scan_player per scan, or one scan_players batch (single)\n"
+  "  --scan-threads=N   threads of scan_players, 0 for all (0)\n"
+  "  --hits=N           hits, resolved as one batch (200)\n"
+  "  --churn=N          players leaving and as many joining (20)\n"
+  "  --removals=N       rewards removed with redistribution, then respawned (50)\n"
+  "  --seed=N           random seed (1)\n";
+
+/// Command line settings, see USAGE.
+struct Config {
+  int board = 65536;
+  std::vector<long> rewards = { 1, 100, 10000, 200000 };
+  std::vector<long> quantity = { 1000000, 10000, 1000, 100 };
+  int spacing = 8;
+  long players = 10000;
+  bool cluster = false;
+  int step = 16;
+  double spread = 2000;
+
+  long ticks = 200;
+  long tick_ms = 50;
+  long scans = 1000;
+  bool batch_scans = false;
+  unsigned scan_threads = 0;
+  long hits = 200;
+  long churn = 20;
+  long removals = 50;
+  std::uint64_t seed = 1;
+};
+
+bool parse_list(const char* s, std::vector<long>& out)
+{
+  std::vector<long> values;
+  while (*s) {
+    char* end;
+    values.push_back(std::strtol(s, &end, 10));
+    if (end == s || (*end != ',' && *end != '\0')) return false;
+    s = *end ? end + 1 : end;
+  }
+  if (values.size() != std::size_t(Reward::RewardLevel::NUM_LEVELS)) return false;
+  out = values;
+  return true;
+}
+
+/// @return False, after saying why, on an unknown or malformed option.
+bool parse_args(int argc, char** argv, Config& config)
+{
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const std::size_t eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const char* value = eq == std::string::npos ? "" : argv[i] + eq + 1;
+    const long n = std::strtol(value, nullptr, 10);
+    bool ok = eq != std::string::npos;
+    if (name == "--board") config.board = int(n);
+    else if (name == "--rewards") ok = ok && parse_list(value, config.rewards);
+    else if (name == "--quantity") ok = ok && parse_list(value, config.quantity);
+    else if (name == "--spacing") config.spacing = int(n);
+    else if (name == "--players") config.players = n;
+    else if (name == "--model") {
+      config.cluster = std::strcmp(value, "cluster") == 0;
+      ok = ok && (config.cluster || std::strcmp(value, "walk") == 0);
+    }
+    else if (name == "--step") config.step = int(n);
+    else if (name == "--spread") config.spread = double(n);
+    else if (name == "--ticks") config.ticks = n;
+    else if (name == "--tick-ms") config.tick_ms = n;
+    else if (name == "--scans") config.scans = n;
+    else if (name == "--scan-mode") {
+      config.batch_scans = std::strcmp(value, "batch") == 0;
+      ok = ok && (config.batch_scans || std::strcmp(value, "single") == 0);
+    }
+    else if (name == "--scan-threads") config.scan_threads = unsigned(n);
+    else if (name == "--hits") config.hits = n;
+    else if (name == "--churn") config.churn = n;
+    else if (name == "--removals") config.removals = n;
+    else if (name == "--seed") config.seed = std::uint64_t(n);
+    else if (name == "--help" || name == "-h") ok = false;
+    else {
+      std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+      ok = false;
+    }
+    if (!ok) {
+      std::fputs(USAGE, stderr);
+      return false;
+    }
+  }
+  if (config.board < 2 || config.players < 1 || config.spacing < 1) {
+    std::fputs("board, players and spacing must be positive\n", stderr);
+    return false;
+  }
+  return true;
+}
+
+/// Latency samples of one kind of operation. An operation can stand for
+/// several items, such as a batch of moves.
+struct OpStats {
+  explicit OpStats(const char* n) : name(n) { }
+
+  const char* name;
+  std::vector<std::uint64_t> ns;
+  std::uint64_t items = 0;
+  std::uint64_t total_ns = 0;
+
+  void add(Clock::time_point start, std::uint64_t num_items = 1) {
+    const std::uint64_t t = std::uint64_t(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    ns.push_back(t);
+    items += num_items;
+    total_ns += t;
+  }
+
+  /// Latency at quantile q of the samples, which get partly sorted.
+  double percentile_us(double q) {
+    if (ns.empty()) return 0;
+    const std::size_t k = std::min(ns.size() - 1, std::size_t(q * ns.size()));
+    std::nth_element(ns.begin(), ns.begin() + k, ns.end());
+    return double(ns[k]) / 1000;
+  }
+
+  void print() {
+    if (ns.empty()) return;
+    const double busy_s = double(total_ns) / 1e9;
+    const double p50 = percentile_us(0.5), p99 = percentile_us(0.99), p999 = percentile_us(0.999);
+    const double max = double(*std::max_element(ns.begin(), ns.end())) / 1000;
+    std::printf("%-12s %9zu %11llu %13.0f %10.1f %10.1f %10.1f %10.1f\n", name, ns.size(),
+                (unsigned long long)items, busy_s > 0 ? double(items) / busy_s : 0.0, p50, p99, p999, max);
+  }
+};
+
+/// The simulated game: a world, its players' movement and the load driven
+/// through it each tick.
+class Simulation {
+public:
+
+  explicit Simulation(const Config& config)
+    : config_(config), gen_(std::mt19937::result_type(config.seed)),
+      spawner_(config.seed, 1)
+  {
+    world_.set_clock(clock_);
+    world_.grid().reset_seed(std::mt19937::result_type(config.seed));
+    world_.grid().set_scan_threads(config.scan_threads);
+  }
+
+  void build() {
+    const Clock::time_point start = Clock::now();
+    for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+      spawn(Reward::RewardLevel(level), std::size_t(config_.rewards[level]));
+    }
+    // The GRAND reward, if any, is what clustering players crowd around.
+    center_ = Location(config_.board / 2, config_.board / 2);
+    world_.grid().reward_manager().for_each_reward(Reward::RewardLevel::GRAND,
+      [&](RewardHandle, const Reward& r) { center_ = r.location(); });
+
+    world_.reserve(std::size_t(config_.players));
+    for (long i = 0; i < config_.players; ++i) {
+      Player p(next_player_++);
+      p.location() = start_location();
+      world_.player_join(p);
+    }
+    std::printf("built %zu rewards and %zu players in %.2fs\n", world_.grid().reward_manager().size(),
+                world_.num_players(),
+                std::chrono::duration<double>(Clock::now() - start).count());
+  }
+
+  void run() {
+    const Clock::time_point start = Clock::now();
+    const Clock::duration period = std::chrono::milliseconds(config_.tick_ms);
+    long late = 0;
+    for (long tick = 0; tick < config_.ticks; ++tick) {
+      const Clock::time_point tick_start = Clock::now();
+      run_tick();
+      tick_.add(tick_start);
+      clock_.advance(std::uint64_t(std::max(config_.tick_ms, 1L)));
+      if (config_.tick_ms > 0) {
+        const Clock::time_point due = start + period * (tick + 1);
+        if (Clock::now() > due) ++late;
+        else std::this_thread::sleep_until(due);
+      }
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::printf("ran %ld ticks in %.2fs (%.1f ticks/s", config_.ticks, elapsed, config_.ticks / elapsed);
+    if (config_.tick_ms > 0) std::printf(", %ld over the %ldms budget", late, config_.tick_ms);
+    std::printf("), %zu players, %zu rewards, %llu collected\n", world_.num_players(),
+                world_.grid().reward_manager().size(), (unsigned long long)collected_);
+    std::printf("\n%-12s %9s %11s %13s %10s %10s %10s %10s\n", "operation", "calls", "items",
+                "items/s busy", "p50 us", "p99 us", "p99.9 us", "max us");
+    for (OpStats* op : { &tick_, &moves_, &scans_, &hits_, &joins_, &leaves_, &removals_, &spawns_ }) {
+      op->print();
+    }
+    if (STATS_ENABLED) {
+      std::ostringstream stats;
+      stats << world_.grid().stats();
+      std::printf("\n%s", stats.str().c_str());
+    }
+  }
+
+private:
+
+  void run_tick() {
+    move_players();
+    scan();
+    hit();
+    churn();
+    redistribute();
+  }
+
+  Location clamp(std::int64_t x, std::int64_t y) const {
+    const std::int64_t hi = config_.board - 1;
+    return Location(int(std::min(std::max(x, std::int64_t(0)), hi)),
+                    int(std::min(std::max(y, std::int64_t(0)), hi)));
+  }
+
+  Location random_location() {
+    std::uniform_int_distribution<int> coord(0, config_.board - 1);
+    return Location(coord(gen_), coord(gen_));
+  }
+
+  /// Where a new player starts.
+  Location start_location() {
+    if (!config_.cluster) return random_location();
+    std::normal_distribution<double> offset(0, config_.spread);
+    return clamp(std::int64_t(center_.x + offset(gen_)), std::int64_t(center_.y + offset(gen_)));
+  }
+
+  /// One tick's move of a player. Clustering players drift back toward the
+  /// centre the further out they are.
+  Location next_location(const Location& at) {
+    std::uniform_int_distribution<int> step(-config_.step, config_.step);
+    std::int64_t x = std::int64_t(at.x) + step(gen_), y = std::int64_t(at.y) + step(gen_);
+    if (config_.cluster) {
+      x += std::int64_t(std::lround((center_.x - at.x) / config_.spread * config_.step / 4));
+      y += std::int64_t(std::lround((center_.y - at.y) / config_.spread * config_.step / 4));
+    }
+    return clamp(x, y);
+  }
+
+  const Player& random_player() {
+    const span<const Player> players = world_.players();
+    std::uniform_int_distribution<std::size_t> pick(0, players.size() - 1);
+    return players[pick(gen_)];
+  }
+
+  void spawn(Reward::RewardLevel level, std::size_t count) {
+    if (count == 0) return;
+    SpawnRequest req;
+    req.level = level;
+    req.type = Reward::RewardType::DIST_TIME;
+    req.quantity = int(config_.quantity[level]);
+    req.count = count;
+    req.min_spacing = config_.spacing;
+    req.bottom_left = Location(0, 0);
+    req.top_right = Location(config_.board - 1, config_.board - 1);
+    for (const Reward& r : spawner_.generate(world_.grid(), req)) {
+      world_.grid().add_reward(r);
+      reward_locations_.push_back(r.location());
+    }
+  }
+
+  void join() {
+    Player p(next_player_++);
+    p.location() = start_location();
+    const Clock::time_point start = Clock::now();
+    world_.player_join(p);
+    joins_.add(start);
+  }
+
+  void move_players() {
+    moves_batch_.clear();
+    for (const Player& p : world_.players()) moves_batch_.push_back(Move{ p.id(), next_location(p.location()) });
+    const Clock::time_point start = Clock::now();
+    world_.apply_moves(moves_batch_);
+    moves_.add(start, moves_batch_.size());
+  }
+
+  void scan() {
+    if (world_.num_players() == 0 || config_.scans <= 0) return;
+    scanners_.clear();
+    for (long i = 0; i < config_.scans; ++i) scanners_.push_back(random_player());
+    if (config_.batch_scans) {
+      scan_out_.resize(scanners_.size());
+      const Clock::time_point start = Clock::now();
+      world_.grid().scan_players(scanners_, scan_out_);
+      scans_.add(start, scanners_.size());
+      return;
+    }
+    for (const Player& p : scanners_) {
+      const Clock::time_point start = Clock::now();
+      const Scan s = world_.grid().scan_player(p);
+      scans_.add(start);
+      (void)s;
+    }
+  }
+
+  /// Hits land near rewards spawned so far, some long since collected.
+  void hit() {
+    if (world_.num_players() == 0 || config_.hits <= 0 || reward_locations_.empty()) return;
+    hit_batch_.clear();
+    std::uniform_int_distribution<std::size_t> pick(0, reward_locations_.size() - 1);
+    std::uniform_int_distribution<int> jitter(-int(Reward::HIT_RADIUS), int(Reward::HIT_RADIUS));
+    for (long i = 0; i < config_.hits; ++i) {
+      const Location& target = reward_locations_[pick(gen_)];
+      hit_batch_.emplace_back(random_player().id(),
+                              clamp(std::int64_t(target.x) + jitter(gen_), std::int64_t(target.y) + jitter(gen_)));
+    }
+    const Clock::time_point start = Clock::now();
+    world_.grid().resolve_hits(hit_batch_);
+    hits_.add(start, hit_batch_.size());
+    for (const HitRequest& h : hit_batch_) collected_ += std::uint64_t(h.value);
+  }
+
+  void churn() {
+    for (long i = 0; i < config_.churn && world_.num_players() > 1; ++i) {
+      const PlayerId id = random_player().id();
+      const Clock::time_point start = Clock::now();
+      world_.player_leave(id);
+      leaves_.add(start);
+    }
+    for (long i = 0; i < config_.churn; ++i) join();
+  }
+
+  /// Removes random rewards, which hands their quantity to the rest of their
+  /// level, then tops every level back up to its configured count.
+  void redistribute() {
+    RewardManager& rm = world_.grid().reward_manager();
+    removal_batch_.clear();
+    if (!reward_locations_.empty()) {
+      std::uniform_int_distribution<std::size_t> pick(0, reward_locations_.size() - 1);
+      for (long i = 0; i < config_.removals; ++i) {
+        const std::size_t k = pick(gen_);
+        removal_batch_.push_back(reward_locations_[k]);
+        // Keep the list from filling up with collected rewards.
+        reward_locations_[k] = reward_locations_.back();
+        reward_locations_.pop_back();
+        if (reward_locations_.empty()) break;
+        pick = std::uniform_int_distribution<std::size_t>(0, reward_locations_.size() - 1);
+      }
+      const Clock::time_point start = Clock::now();
+      world_.grid().remove_rewards(removal_batch_);
+      removals_.add(start, removal_batch_.size());
+    }
+
+    for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+      const std::size_t have = rm.size(Reward::RewardLevel(level));
+      const std::size_t want = std::size_t(config_.rewards[level]);
+      if (have >= want) continue;
+      const Clock::time_point start = Clock::now();
+      spawn(Reward::RewardLevel(level), want - have);
+      spawns_.add(start, want - have);
+    }
+  }
+
+  Config config_;
+  std::mt19937 gen_;
+  ManualClock clock_;
+  World world_;
+  RewardSpawner spawner_;
+  Location center_ = Location(0, 0);
+  PlayerId next_player_ = 0;
+  std::uint64_t collected_ = 0;
+
+  // Where rewards were spawned, the targets of hits and removals.
+  std::vector<Location> reward_locations_;
+
+  // Scratch reused every tick.
+  std::vector<Move> moves_batch_;
+  std::vector<Player> scanners_;
+  std::vector<Scan> scan_out_;
+  std::vector<HitRequest> hit_batch_;
+  std::vector<Location> removal_batch_;
+
+  OpStats tick_{ "tick" };
+  OpStats moves_{ "moves" };
+  OpStats scans_{ "scan" };
+  OpStats hits_{ "hits" };
+  OpStats joins_{ "join" };
+  OpStats leaves_{ "leave" };
+  OpStats removals_{ "remove" };
+  OpStats spawns_{ "respawn" };
+};
+
+} // end anonymous namespace
+
+int main(int argc, char** argv)
+{
+  Config config;
+  if (!parse_args(argc, argv, config)) return 2;
+  Simulation sim(config);
+  sim.build();
+  sim.run();
+  return 0;
+}
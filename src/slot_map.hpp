@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file slot_map.hpp
+/// @brief Dense object storage addressed through generational handles.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SLOT_MAP_HPP
+#define CELL_SLOT_MAP_HPP
+
+// std
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// cell
+#include <span.hpp>
+
+namespace cell {
+
+/** @brief Names an object in a SlotMap. A handle stays valid until its object
+  *        is erased and is never reused for another object: the slot's
+  *        generation changes on every erase, so stale handles simply stop
+  *        resolving.
+  */
+struct SlotHandle {
+  std::uint32_t index = NULL_INDEX;
+  std::uint32_t generation = 0;
+
+  constexpr static std::uint32_t NULL_INDEX = 0xffffffffu;
+
+  bool is_null() const { return index == NULL_INDEX; }
+};
+
+inline bool operator==(const SlotHandle& a, const SlotHandle& b) {
+  return a.index == b.index && a.generation == b.generation;
+}
+
+inline bool operator!=(const SlotHandle& a, const SlotHandle& b) {
+  return !(a == b);
+}
+
+inline std::ostream& operator<<(std::ostream& out, const SlotHandle& h) {
+  return out << "Handle[" << h.index << ":" << h.generation << "]";
+}
+
+/** @brief Objects are kept packed in one vector, so iterating all of them is
+  *        a linear walk. Erasing moves the last object into the hole.
+  *        Handles go through a slot table to find the object's current
+  *        position, making insert, erase and lookup O(1). Pointers to
+  *        objects are invalidated by insert and erase, handles are not.
+  */
+template<class T>
+class SlotMap {
+public:
+
+  typedef SlotHandle Handle;
+
+  SlotMap() = default;
+
+  Handle insert(const T& t);
+  Handle insert(T&& t);
+
+  /// @return True if h named an object, which is now gone.
+  bool erase(Handle h);
+
+  /// The object h names, nullptr if it was erased.
+  T* get(Handle h);
+  const T* get(Handle h) const;
+
+  bool contains(Handle h) const { return get(h) != nullptr; }
+
+  /// Every object, densely packed in no particular order.
+  span<T> values() { return span<T>(values_.data(), values_.size()); }
+  span<const T> values() const { return span<const T>(values_.data(), values_.size()); }
+
+  /// Handle of values()[i].
+  Handle handle_at(std::size_t i) const {
+    const std::uint32_t slot = dense_to_slot_[i];
+    return Handle{ slot, slots_[slot].generation };
+  }
+
+  std::size_t size() const { return values_.size(); }
+  bool empty() const { return values_.empty(); }
+
+  void reserve(std::size_t n) {
+    values_.reserve(n);
+    dense_to_slot_.reserve(n);
+    slots_.reserve(n);
+  }
+
+private:
+
+  struct Slot {
+    // Position in values_ while in use, next free slot otherwise.
+    std::uint32_t dense;
+    std::uint32_t generation;
+  };
+
+  Handle claim_slot();
+
+  std::vector<T> values_;
+  std::vector<std::uint32_t> dense_to_slot_;
+  std::vector<Slot> slots_;
+  std::uint32_t free_head_ = Handle::NULL_INDEX;
+
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///                             IMPLEMENTATION                               ///
+////////////////////////////////////////////////////////////////////////////////
+
+template<class T>
+typename SlotMap<T>::Handle SlotMap<T>::claim_slot() {
+  std::uint32_t slot;
+  if (free_head_ != Handle::NULL_INDEX) {
+    slot = free_head_;
+    free_head_ = slots_[slot].dense;
+  } else {
+    slot = std::uint32_t(slots_.size());
+    slots_.push_back(Slot{ 0, 0 });
+  }
+  slots_[slot].dense = std::uint32_t(values_.size());
+  dense_to_slot_.push_back(slot);
+  return Handle{ slot, slots_[slot].generation };
+}
+
+template<class T>
+typename SlotMap<T>::Handle SlotMap<T>::insert(const T& t) {
+  const Handle h = claim_slot();
+  values_.push_back(t);
+  return h;
+}
+
+template<class T>
+typename SlotMap<T>::Handle SlotMap<T>::insert(T&& t) {
+  const Handle h = claim_slot();
+  values_.push_back(std::move(t));
+  return h;
+}
+
+template<class T>
+bool SlotMap<T>::erase(Handle h) {
+  if (!contains(h)) return false;
+  Slot& slot = slots_[h.index];
+  const std::uint32_t hole = slot.dense;
+  const std::uint32_t last = std::uint32_t(values_.size() - 1);
+  if (hole != last) {
+    values_[hole] = std::move(values_[last]);
+    dense_to_slot_[hole] = dense_to_slot_[last];
+    slots_[dense_to_slot_[hole]].dense = hole;
+  }
+  values_.pop_back();
+  dense_to_slot_.pop_back();
+
+  ++slot.generation;
+  slot.dense = free_head_;
+  free_head_ = h.index;
+  return true;
+}
+
+template<class T>
+T* SlotMap<T>::get(Handle h) {
+  if (h.index >= slots_.size() || slots_[h.index].generation != h.generation) return nullptr;
+  return &values_[slots_[h.index].dense];
+}
+
+template<class T>
+const T* SlotMap<T>::get(Handle h) const {
+  if (h.index >= slots_.size() || slots_[h.index].generation != h.generation) return nullptr;
+  return &values_[slots_[h.index].dense];
+}
+
+} // end namespace cell
+
+#endif // CELL_SLOT_MAP_HPP
@@ -0,0 +1,308 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file snapshot.cpp
+/// @brief Implementation of world snapshots.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+// posix
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// cell
+#include <hash.hpp>
+#include <snapshot.hpp>
+#include <thread_pool.hpp>
+
+namespace cell {
+
+namespace {
+
+constexpr char MAGIC[8] = { 'C', 'E', 'L', 'L', 'S', 'N', 'A', 'P' };
+
+/// Word of the header holding the checksum, which is summed as zero.
+constexpr std::size_t CHECKSUM_WORD = offsetof(SnapshotHeader, checksum) / 8;
+
+/// Words checksummed per parallel_for item.
+constexpr std::size_t CHECKSUM_CHUNK = std::size_t(1) << 16;
+
+std::uint64_t round_up8(std::uint64_t n) { return (n + 7) & ~std::uint64_t(7); }
+
+std::uint64_t checksum(const char* data, std::size_t size, ThreadPool* pool)
+{
+  const std::size_t words = size / 8;
+  if (!pool) return checksum_words(data, 0, words, CHECKSUM_WORD);
+  const std::size_t chunks = (words + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+  std::vector<std::uint64_t> sums(chunks, 0);
+  pool->parallel_for(chunks, 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t c = begin; c < end; ++c) {
+      sums[c] = checksum_words(data, c * CHECKSUM_CHUNK, std::min(words, (c + 1) * CHECKSUM_CHUNK),
+                               CHECKSUM_WORD);
+    }
+  });
+  std::uint64_t sum = 0;
+  for (std::uint64_t s : sums) sum += s;
+  return sum;
+}
+
+/// True if count records of record_size bytes at offset lie inside the file.
+bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t record_size, std::uint64_t file_size)
+{
+  return offset % 8 == 0 && offset <= file_size && count <= (file_size - offset) / record_size;
+}
+
+bool write_all(int fd, const char* data, std::size_t size)
+{
+  while (size > 0) {
+    const ssize_t n = ::write(fd, data, size);
+    if (n < 0) return false;
+    data += n;
+    size -= std::size_t(n);
+  }
+  return true;
+}
+
+} // end anonymous namespace
+
+constexpr std::uint32_t SnapshotHeader::VERSION;
+constexpr std::uint32_t SnapshotHeader::ENDIAN_MARK;
+
+SnapshotRecords capture_records(const World& world)
+{
+  const Grid& grid = world.grid();
+  const RewardManager& rewards = grid.reward_manager();
+  SnapshotRecords records;
+  records.cell_shift = grid.reward_grid().cell_shift();
+  records.rewards.reserve(rewards.size());
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    records.undistributed[level] = rewards.undistributed(Reward::RewardLevel(level));
+    rewards.for_each_reward(Reward::RewardLevel(level), [&](RewardHandle, const Reward& r) {
+      SnapshotReward rec = {};
+      rec.id = r.id();
+      rec.type = std::uint8_t(r.type());
+      rec.level = std::uint8_t(r.level());
+      rec.scans = std::uint16_t(r.scan_state().scans());
+      rec.x = r.location().x;
+      rec.y = r.location().y;
+      rec.quantity = r.quantity();
+      rec.last_scanned = r.scan_state().last_scanned();
+      records.rewards.push_back(rec);
+    });
+  }
+  const span<const Player> players = world.players();
+  records.players.reserve(players.size());
+  for (const Player& p : players) {
+    records.players.push_back(SnapshotPlayer{ p.id(), p.location().x, p.location().y });
+  }
+  return records;
+}
+
+std::vector<std::uint64_t> build_snapshot(SnapshotRecords records)
+{
+  // Cell order, and location order inside a cell so that the same world
+  // always gives the same file.
+  const int shift = records.cell_shift;
+  std::sort(records.rewards.begin(), records.rewards.end(),
+            [shift](const SnapshotReward& a, const SnapshotReward& b) {
+    const int acx = a.x >> shift, bcx = b.x >> shift, acy = a.y >> shift, bcy = b.y >> shift;
+    if (acx != bcx) return acx < bcx;
+    if (acy != bcy) return acy < bcy;
+    return a.x != b.x ? a.x < b.x : a.y < b.y;
+  });
+  std::vector<SnapshotCell> cells;
+  for (std::size_t i = 0; i < records.rewards.size(); ++i) {
+    const SnapshotReward& r = records.rewards[i];
+    const std::int32_t cx = r.x >> shift, cy = r.y >> shift;
+    if (cells.empty() || cells.back().cx != cx || cells.back().cy != cy) {
+      cells.push_back(SnapshotCell{ cx, cy, std::uint32_t(i), 0 });
+    }
+    ++cells.back().count;
+  }
+
+  SnapshotHeader header = {};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = SnapshotHeader::VERSION;
+  header.endian_mark = SnapshotHeader::ENDIAN_MARK;
+  header.cell_shift = shift;
+  header.num_cells = cells.size();
+  header.num_rewards = records.rewards.size();
+  header.num_players = records.players.size();
+  header.cells_offset = sizeof(SnapshotHeader);
+  header.rewards_offset = header.cells_offset + header.num_cells * sizeof(SnapshotCell);
+  header.players_offset = header.rewards_offset + header.num_rewards * sizeof(SnapshotReward);
+  header.file_size = round_up8(header.players_offset + header.num_players * sizeof(SnapshotPlayer));
+  std::copy(records.undistributed, records.undistributed + Reward::RewardLevel::NUM_LEVELS,
+            header.undistributed);
+
+  std::vector<std::uint64_t> image(std::size_t(header.file_size / 8), 0);
+  char* base = reinterpret_cast<char*>(image.data());
+  std::memcpy(base, &header, sizeof(header));
+  std::memcpy(base + header.cells_offset, cells.data(), cells.size() * sizeof(SnapshotCell));
+  std::memcpy(base + header.rewards_offset, records.rewards.data(),
+              records.rewards.size() * sizeof(SnapshotReward));
+  std::memcpy(base + header.players_offset, records.players.data(),
+              records.players.size() * sizeof(SnapshotPlayer));
+  return image;
+}
+
+std::vector<std::uint64_t> capture_snapshot(const World& world)
+{
+  return build_snapshot(capture_records(world));
+}
+
+bool write_snapshot(std::vector<std::uint64_t>& image, const std::string& path)
+{
+  char* data = reinterpret_cast<char*>(image.data());
+  const std::size_t size = image.size() * 8;
+  const std::uint64_t sum = checksum(data, size, nullptr);
+  std::memcpy(data + offsetof(SnapshotHeader, checksum), &sum, sizeof(sum));
+
+  const std::string tmp = path + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  const bool ok = write_all(fd, data, size) && ::fsync(fd) == 0;
+  if (::close(fd) != 0 || !ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool save_snapshot(const World& world, const std::string& path)
+{
+  std::vector<std::uint64_t> image = capture_snapshot(world);
+  return write_snapshot(image, path);
+}
+
+bool MappedSnapshot::open(const std::string& path, unsigned num_threads)
+{
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && std::size_t(st.st_size) >= sizeof(SnapshotHeader)) {
+    data = ::mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (data == MAP_FAILED) return false;
+  data_ = data;
+  size_ = std::size_t(st.st_size);
+
+  const SnapshotHeader& h = header();
+  bool ok = std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+            h.version == SnapshotHeader::VERSION &&
+            h.endian_mark == SnapshotHeader::ENDIAN_MARK &&
+            h.file_size == size_ && size_ % 8 == 0 &&
+            h.cell_shift >= 0 && h.cell_shift < 31 &&
+            h.num_rewards <= std::numeric_limits<std::uint32_t>::max() &&
+            fits(h.cells_offset, h.num_cells, sizeof(SnapshotCell), size_) &&
+            fits(h.rewards_offset, h.num_rewards, sizeof(SnapshotReward), size_) &&
+            fits(h.players_offset, h.num_players, sizeof(SnapshotPlayer), size_);
+
+  // The cell table has to be sorted and cover the rewards in order for
+  // for_each_reward_in_rect to work.
+  if (ok) {
+    std::uint64_t next = 0;
+    const span<const SnapshotCell> table = cells();
+    for (std::size_t i = 0; ok && i < table.size(); ++i) {
+      ok = table[i].first == next && table[i].count > 0 &&
+           (i == 0 || table[i - 1].cx < table[i].cx ||
+            (table[i - 1].cx == table[i].cx && table[i - 1].cy < table[i].cy));
+      next += table[i].count;
+    }
+    ok = ok && next == h.num_rewards;
+  }
+  if (ok) {
+    ::madvise(data_, size_, MADV_WILLNEED);
+    ThreadPool pool(num_threads);
+    ok = checksum(static_cast<const char*>(data_), size_, &pool) == h.checksum;
+  }
+  if (!ok) close();
+  return ok;
+}
+
+void MappedSnapshot::close()
+{
+  if (data_) ::munmap(data_, size_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+bool load_snapshot(const std::string& path, World& world, unsigned num_threads)
+{
+  if (world.num_players() != 0 || world.grid().reward_manager().size() != 0) return false;
+  ThreadPool pool(num_threads);
+  MappedSnapshot snapshot;
+  if (!snapshot.open(path, num_threads)) return false;
+
+  // Decode everything before touching the world, so a bad record leaves it
+  // untouched.
+  const span<const SnapshotReward> records = snapshot.rewards();
+  std::vector<Reward> rewards(records.size(), Reward(0, Reward::RewardType::TRIVIAL));
+  std::atomic<bool> valid{true};
+  pool.parallel_for(records.size(), 1 << 14, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      const SnapshotReward& rec = records[i];
+      if (rec.type > std::uint8_t(Reward::RewardType::DIST_TIME) ||
+          rec.level >= Reward::RewardLevel::NUM_LEVELS) {
+        valid = false;
+        return;
+      }
+      Reward r(rec.id, Reward::RewardType(rec.type));
+      r.level() = Reward::RewardLevel(rec.level);
+      r.location() = Location(rec.x, rec.y);
+      r.quantity() = rec.quantity;
+      r.set_scan_state(RewardScanState(rec.last_scanned, rec.scans));
+      rewards[i] = r;
+    }
+  });
+  if (!valid) return false;
+
+  Grid& grid = world.grid();
+  grid.add_rewards(rewards);
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    grid.reward_manager().set_undistributed(Reward::RewardLevel(level),
+                                            snapshot.header().undistributed[level]);
+  }
+  world.reserve(snapshot.players().size());
+  for (const SnapshotPlayer& rec : snapshot.players()) {
+    Player p(rec.id);
+    p.location() = Location(rec.x, rec.y);
+    world.player_join(p);
+  }
+  return true;
+}
+
+bool SnapshotWriter::start(const World& world, const std::string& path)
+{
+  if (busy_.load()) return false;
+  if (thread_.joinable()) thread_.join();
+  SnapshotRecords records = capture_records(world);
+  busy_ = true;
+  thread_ = std::thread([this, path, records = std::move(records)]() mutable {
+    std::vector<std::uint64_t> image = build_snapshot(std::move(records));
+    ok_ = write_snapshot(image, path);
+    busy_ = false;
+  });
+  return true;
+}
+
+bool SnapshotWriter::wait()
+{
+  if (thread_.joinable()) thread_.join();
+  return ok_;
+}
+
+} // end namespace cell
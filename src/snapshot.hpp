@@ -0,0 +1,256 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file snapshot.hpp
+/// @brief Binary snapshots of a World: written in the background while the
+///        game runs, loaded with mmap at startup.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SNAPSHOT_HPP
+#define CELL_SNAPSHOT_HPP
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// cell
+#include <location.hpp>
+#include <reward.hpp>
+#include <span.hpp>
+#include <world.hpp>
+
+namespace cell {
+
+/** @brief A snapshot file is a header followed by three arrays of fixed size
+  *        records, each starting on an 8 byte boundary:
+  *
+  *          cells    one per occupied cell of the reward index, sorted by cell
+  *          rewards  grouped by cell in the order of the cell table
+  *          players
+  *
+  *        Records are written in the host's byte order, which the header
+  *        records, and every field has a fixed size. The checksum covers the
+  *        whole file with the checksum field taken as zero. A file is written
+  *        to a temporary name and renamed into place, so a crash never leaves
+  *        a torn snapshot behind.
+  */
+struct SnapshotHeader {
+  constexpr static std::uint32_t VERSION = 1;
+  constexpr static std::uint32_t ENDIAN_MARK = 0x01020304;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t endian_mark;
+  std::uint64_t file_size;
+  std::uint64_t checksum;
+  /// Cell shift of the reward index the cell table was built for.
+  std::int32_t cell_shift;
+  std::uint32_t reserved;
+  std::uint64_t num_cells;
+  std::uint64_t num_rewards;
+  std::uint64_t num_players;
+  std::uint64_t cells_offset;
+  std::uint64_t rewards_offset;
+  std::uint64_t players_offset;
+  /// RewardManager::undistributed of every level.
+  std::uint64_t undistributed[Reward::RewardLevel::NUM_LEVELS];
+};
+
+/// Rewards [first, first + count) are the ones in reward index cell (cx, cy).
+struct SnapshotCell {
+  std::int32_t cx;
+  std::int32_t cy;
+  std::uint32_t first;
+  std::uint32_t count;
+};
+
+struct SnapshotReward {
+  std::int32_t id;
+  std::uint8_t type;
+  std::uint8_t level;
+  std::uint16_t scans;
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t quantity;
+  std::uint32_t reserved;
+  std::uint64_t last_scanned;
+};
+
+struct SnapshotPlayer {
+  std::int32_t id;
+  std::int32_t x;
+  std::int32_t y;
+};
+
+static_assert(sizeof(SnapshotHeader) == 120, "snapshot header layout");
+static_assert(sizeof(SnapshotCell) == 16, "snapshot cell layout");
+static_assert(sizeof(SnapshotReward) == 32, "snapshot reward layout");
+static_assert(sizeof(SnapshotPlayer) == 12, "snapshot player layout");
+
+/// Everything a snapshot holds, as records in no particular order.
+struct SnapshotRecords {
+  std::int32_t cell_shift = 0;
+  std::uint64_t undistributed[Reward::RewardLevel::NUM_LEVELS] = {};
+  std::vector<SnapshotReward> rewards;
+  std::vector<SnapshotPlayer> players;
+};
+
+/** @brief Copies the records of a world out in storage order, one linear
+  *        sweep over each reward level and the players. This is the only
+  *        step that needs the world to hold still.
+  */
+SnapshotRecords capture_records(const World& world);
+
+/** @brief Sorts captured records into cells and lays out the snapshot image,
+  *        leaving the checksum to write_snapshot. Doesn't touch the world.
+  */
+std::vector<std::uint64_t> build_snapshot(SnapshotRecords records);
+
+/// capture_records and build_snapshot in one go.
+std::vector<std::uint64_t> capture_snapshot(const World& world);
+
+/** @brief Fills in the checksum of an image from capture_snapshot and writes
+  *        it to path, through a temporary file that is renamed into place.
+  * @return False if the file could not be written.
+  */
+bool write_snapshot(std::vector<std::uint64_t>& image, const std::string& path);
+
+/// capture_snapshot and write_snapshot in one go.
+bool save_snapshot(const World& world, const std::string& path);
+
+/** @brief A snapshot file mapped read-only. Its cell table doubles as a
+  *        spatial index, so rewards can be queried straight from the mapped
+  *        pages without building a Grid.
+  */
+class MappedSnapshot {
+public:
+
+  MappedSnapshot() = default;
+  ~MappedSnapshot() { close(); }
+
+  /** @brief Maps a snapshot and checks its header, layout and checksum. The
+    *        checksum is verified on num_threads threads, zero for one per
+    *        hardware thread.
+    * @return False, with nothing mapped, if the file is missing or invalid.
+    */
+  bool open(const std::string& path, unsigned num_threads = 0);
+  void close();
+  bool is_open() const { return data_ != nullptr; }
+
+  const SnapshotHeader& header() const { return *static_cast<const SnapshotHeader*>(data_); }
+  span<const SnapshotCell> cells() const {
+    return array<SnapshotCell>(header().cells_offset, header().num_cells);
+  }
+  span<const SnapshotReward> rewards() const {
+    return array<SnapshotReward>(header().rewards_offset, header().num_rewards);
+  }
+  span<const SnapshotPlayer> players() const {
+    return array<SnapshotPlayer>(header().players_offset, header().num_players);
+  }
+
+  /// Calls fn(reward) for every reward inside the INCLUSIVE rectangle
+  /// [bottom_left, top_right], in no particular order.
+  template<class Fn>
+  void for_each_reward_in_rect(const Location& bottom_left, const Location& top_right, Fn&& fn) const;
+
+private:
+
+  template<class T>
+  span<const T> array(std::uint64_t offset, std::uint64_t count) const {
+    return span<const T>(reinterpret_cast<const T*>(static_cast<const char*>(data_) + offset),
+                         std::size_t(count));
+  }
+
+  void* data_ = nullptr;
+  std::size_t size_ = 0;
+
+  // No copy construction/assignment.
+  MappedSnapshot(const MappedSnapshot&) = delete;
+  MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+};
+
+/** @brief Restores a snapshot into an empty world. Records are decoded on
+  *        num_threads threads, zero for one per hardware thread, and then
+  *        bulk inserted.
+  * @return False, leaving the world untouched, if the snapshot can't be
+  *         opened or the world is not empty.
+  */
+bool load_snapshot(const std::string& path, World& world, unsigned num_threads = 0);
+
+/** @brief Takes snapshots without holding up the game for the file I/O.
+  *        start captures the records of the world on the calling thread,
+  *        between ticks, and hands building the image, the checksum and the
+  *        write to a background thread.
+  */
+class SnapshotWriter {
+public:
+
+  SnapshotWriter() = default;
+  ~SnapshotWriter() { wait(); }
+
+  /// @return False if the previous snapshot is still being written.
+  bool start(const World& world, const std::string& path);
+
+  /// True while a snapshot is being written.
+  bool busy() const { return busy_.load(); }
+
+  /// Waits for the current snapshot, if any.
+  /// @return Whether the last snapshot was written.
+  bool wait();
+
+private:
+
+  std::thread thread_;
+  std::atomic<bool> busy_{false};
+  bool ok_ = true;
+
+  // No copy construction/assignment.
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+};
+
+////////////////////////////////////////////////////////////////////////////////
+///                             IMPLEMENTATION                               ///
+////////////////////////////////////////////////////////////////////////////////
+
+template<class Fn>
+void MappedSnapshot::for_each_reward_in_rect(const Location& bottom_left, const Location& top_right,
+                                             Fn&& fn) const {
+  const span<const SnapshotCell> table = cells();
+  if (top_right.x < bottom_left.x || top_right.y < bottom_left.y || table.empty()) return;
+  const int shift = header().cell_shift;
+  const span<const SnapshotReward> all = rewards();
+  const auto before = [](const SnapshotCell& c, const SnapshotCell& key) {
+    return c.cx != key.cx ? c.cx < key.cx : c.cy < key.cy;
+  };
+  const int cy0 = bottom_left.y >> shift, cy1 = top_right.y >> shift;
+  // Only columns the table has, a rectangle over the whole board would
+  // otherwise visit every possible column.
+  const std::int64_t cx0 = std::max(bottom_left.x >> shift, table[0].cx);
+  const std::int64_t cx1 = std::min(top_right.x >> shift, table[table.size() - 1].cx);
+  for (std::int64_t cx = cx0; cx <= cx1; ++cx) {
+    const SnapshotCell key{ std::int32_t(cx), cy0, 0, 0 };
+    for (auto it = std::lower_bound(table.begin(), table.end(), key, before);
+         it != table.end() && it->cx == cx && it->cy <= cy1; ++it) {
+      for (std::uint32_t i = it->first; i < it->first + it->count; ++i) {
+        const SnapshotReward& r = all[i];
+        if (r.x >= bottom_left.x && r.x <= top_right.x && r.y >= bottom_left.y && r.y <= top_right.y) {
+          fn(r);
+        }
+      }
+    }
+  }
+}
+
+} // end namespace cell
+
+#endif // CELL_SNAPSHOT_HPP
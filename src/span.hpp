@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file span.hpp
+/// @brief Non-owning view over a contiguous run of objects.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_SPAN_HPP
+#define CELL_SPAN_HPP
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace cell {
+
+/** @brief Pointer and size pair, a stand-in for std::span until we can move
+  *        past C++14. span<const T> binds to const and non-const containers.
+  */
+template<class T>
+class span {
+public:
+  typedef T element_type;
+  typedef typename std::remove_cv<T>::type value_type;
+  typedef T* iterator;
+
+  constexpr span() : data_(nullptr), size_(0) { }
+  constexpr span(T* data, std::size_t size) : data_(data), size_(size) { }
+
+  template<class U, class = typename std::enable_if<std::is_convertible<U(*)[], T(*)[]>::value>::type>
+  constexpr span(const span<U>& other) : data_(other.data()), size_(other.size()) { }
+
+  template<class A>
+  span(std::vector<value_type, A>& v) : data_(v.data()), size_(v.size()) { }
+  template<class A, class U = T, class = typename std::enable_if<std::is_const<U>::value>::type>
+  span(const std::vector<value_type, A>& v) : data_(v.data()), size_(v.size()) { }
+
+  template<std::size_t N>
+  span(std::array<value_type, N>& a) : data_(a.data()), size_(N) { }
+  template<std::size_t N, class U = T, class = typename std::enable_if<std::is_const<U>::value>::type>
+  span(const std::array<value_type, N>& a) : data_(a.data()), size_(N) { }
+
+  constexpr T* data() const { return data_; }
+  constexpr std::size_t size() const { return size_; }
+  constexpr bool empty() const { return size_ == 0; }
+
+  constexpr T& operator[](std::size_t i) const { return data_[i]; }
+
+  constexpr iterator begin() const { return data_; }
+  constexpr iterator end() const { return data_ + size_; }
+
+  /// Elements [offset, offset + count).
+  constexpr span subspan(std::size_t offset, std::size_t count) const {
+    return span(data_ + offset, count);
+  }
+
+private:
+  T* data_;
+  std::size_t size_;
+};
+
+} // end namespace cell
+
+#endif // CELL_SPAN_HPP
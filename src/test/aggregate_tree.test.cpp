@@ -0,0 +1,199 @@
+// gtest
+#include <gtest/gtest.h>
+#include <aggregate_tree.hpp>
+#include <grid.hpp>
+#include <scan_kernel.hpp>
+#include <cell.test.hpp>
+#include <algorithm>
+#include <map>
+#include <random>
+
+using namespace std;
+using namespace cell;
+using namespace cell::test;
+
+namespace {
+
+/// Same rewards in two grids, one of them scanned with AGGREGATE rings.
+void fill_grids(Grid& exact, Grid& aggregate, const Location& center, int spread, int count,
+                unsigned seed) {
+  for (const Reward& r : random_rewards(seed, count, center, spread)) {
+    exact.add_reward(r);
+    aggregate.add_reward(r);
+  }
+}
+
+} // end anonymous namespace
+
+TEST(AggregateTreeTests, zeroErrorIsExact) {
+  const Location center(-5000, 123456);
+  Grid exact, aggregate;
+  aggregate.set_aggregate_error(0.0);
+  fill_grids(exact, aggregate, center, 1200, 20000, 1);
+
+  mt19937 gen(2);
+  uniform_int_distribution<int> offset(-300, 300);
+  const int min_dists[] = { 20, 100, 0, 7, 500 };
+  const int max_dists[] = { 100, 1000, 30, 8, 1025 };
+  for (int round = 0; round < 10; ++round) {
+    Player p;
+    p.location() = Location(center.x + offset(gen), center.y + offset(gen));
+    InfluenceRing expected[5], rings[5];
+    exact.scan_rings(p, min_dists, max_dists, 5, expected);
+    aggregate.scan_rings_aggregate(p, min_dists, max_dists, 5, rings);
+    for (int r = 0; r < 5; ++r) EXPECT_EQ(expected[r], rings[r]);
+  }
+}
+
+TEST(AggregateTreeTests, errorBound) {
+  constexpr double MAX_ERROR = 0.05;
+  mt19937 gen(3);
+  uniform_int_distribution<int> offset(-1100, 1100), quantity(1, 1000);
+  vector<AggregateTree::Entry> entries;
+  for (int i = 0; i < 50000; ++i) {
+    entries.push_back(AggregateTree::Entry{ offset(gen), offset(gen), quantity(gen),
+                                            i % 3 ? Reward::RewardType::DISTANCE :
+                                                    Reward::RewardType::TRIVIAL });
+  }
+  AggregateTree tree;
+  tree.build(entries);
+  EXPECT_EQ(entries.size(), tree.size());
+
+  const int min_dist = 100, max_dist = 1000;
+  for (const Location origin : { Location(0, 0), Location(37, -210), Location(-400, 5) }) {
+    InfluenceRing approx, exact;
+    tree.scan_ring(origin, min_dist, max_dist, MAX_ERROR, approx);
+    tree.scan_ring(origin, min_dist, max_dist, 0.0, exact);
+
+    // Brute force totals of the DISTANCE rewards in each direction.
+    double quantity_in[InfluenceRing::NUM_DIRECTIONS] = {};
+    int count_in[InfluenceRing::NUM_DIRECTIONS] = {};
+    const RingBounds bounds(min_dist, max_dist);
+    for (const auto& e : entries) {
+      const int64_t dx = e.x - origin.x, dy = e.y - origin.y;
+      if (e.type != Reward::RewardType::DISTANCE || !bounds.contains(distance_squared(dx, dy))) continue;
+      const int dir = SectorClassifier<InfluenceRing::NUM_DIRECTIONS>::direction(dx, dy);
+      quantity_in[dir] += e.quantity;
+      ++count_in[dir];
+    }
+    for (int d = 0; d < InfluenceRing::NUM_DIRECTIONS; ++d) {
+      // Centroids only overestimate, rounding goes either way by up to one per reward.
+      const double diff = approx.vals()[d] - exact.vals()[d];
+      EXPECT_LE(diff, MAX_ERROR * quantity_in[d] + count_in[d]);
+      EXPECT_GE(diff, -count_in[d]);
+    }
+    EXPECT_FALSE(exact == approx);
+  }
+}
+
+TEST(AggregateTreeTests, updatesMatchRebuild) {
+  mt19937 gen(6);
+  uniform_int_distribution<int> offset(-1100, 1100), quantity(0, 1000), type(0, 2);
+  const auto random_entry = [&]() {
+    return AggregateTree::Entry{ offset(gen), offset(gen), quantity(gen), Reward::RewardType(type(gen)) };
+  };
+  // Unique locations, the way a grid holds them.
+  map<pair<int, int>, AggregateTree::Entry> entries;
+  while (entries.size() < 20000) {
+    const AggregateTree::Entry e = random_entry();
+    entries.emplace(make_pair(e.x, e.y), e);
+  }
+  vector<AggregateTree::Entry> all;
+  for (const auto& e : entries) all.push_back(e.second);
+  AggregateTree tree;
+  tree.build(all);
+
+  // Changed quantities and types, erased entries and a few new locations.
+  int updates = 0;
+  for (auto& e : entries) {
+    if (updates++ % 7 == 0) {
+      e.second.quantity = quantity(gen);
+      e.second.type = Reward::RewardType(type(gen));
+      tree.update(e.second);
+    }
+  }
+  for (int i = 0; i < 500; ++i) {
+    const AggregateTree::Entry e = random_entry();
+    entries[make_pair(e.x, e.y)] = e;
+    tree.update(e);
+  }
+  EXPECT_FALSE(tree.fragmented());
+
+  all.clear();
+  for (const auto& e : entries) {
+    if (e.second.type != Reward::RewardType::DIST_TIME) all.push_back(e.second);
+  }
+  AggregateTree rebuilt;
+  rebuilt.build(all);
+  EXPECT_EQ(all.size(), tree.size());
+
+  for (const Location origin : { Location(0, 0), Location(37, -210), Location(-400, 5) }) {
+    for (const double max_error : { 0.0, 0.05 }) {
+      InfluenceRing updated, expected;
+      tree.scan_ring(origin, 100, 1000, max_error, updated);
+      rebuilt.scan_ring(origin, 100, 1000, max_error, expected);
+      if (max_error == 0.0) {
+        EXPECT_EQ(expected, updated);
+        continue;
+      }
+      // Kept boxes group the entries differently, within the same bound.
+      for (int d = 0; d < InfluenceRing::NUM_DIRECTIONS; ++d) {
+        EXPECT_NEAR(expected.vals()[d], updated.vals()[d], 0.1 * max(1, expected.vals()[d]));
+      }
+    }
+  }
+
+  // Erasing everything leaves the tree in need of a rebuild.
+  for (const auto& e : entries) tree.erase(Location(e.first.first, e.first.second));
+  EXPECT_EQ(0u, tree.size());
+  EXPECT_TRUE(tree.fragmented());
+  InfluenceRing empty;
+  tree.scan_ring(Location(0, 0), 0, 1000, 0.0, empty);
+  EXPECT_EQ(InfluenceRing(), empty);
+  tree.rebuild();
+  EXPECT_EQ(0u, tree.num_nodes());
+  EXPECT_FALSE(tree.fragmented());
+}
+
+TEST(AggregateTreeTests, gridRingModes) {
+  const Location center(700, 700);
+  Grid exact, aggregate;
+  aggregate.set_aggregate_error(0.0);
+  aggregate.set_ring_mode(1, Grid::RingMode::AGGREGATE);
+  EXPECT_EQ(Grid::RingMode::EXACT, aggregate.ring_mode(0));
+  fill_grids(exact, aggregate, center, 1100, 5000, 4);
+
+  Player p;
+  p.location() = center;
+  EXPECT_EQ(exact.scan_player_fixed(p), aggregate.scan_player_fixed(p));
+
+  // Changes to the rewards show up in the next aggregated scan.
+  exact.add_reward(make_reward(-1, 5000, Reward::RewardType::TRIVIAL, Location(center.x + 500, center.y)));
+  aggregate.add_reward(make_reward(-1, 5000, Reward::RewardType::TRIVIAL, Location(center.x + 500, center.y)));
+  Scan s = aggregate.scan_player_fixed(p);
+  EXPECT_EQ(exact.scan_player_fixed(p), s);
+  exact.remove_reward(Location(center.x + 500, center.y));
+  aggregate.remove_reward(Location(center.x + 500, center.y));
+  EXPECT_EQ(exact.scan_player_fixed(p), aggregate.scan_player_fixed(p));
+
+  // So do hits, and the quantity they leave redistributed.
+  vector<HitRequest> hits;
+  for (int i = 0; i < 200; ++i) {
+    hits.push_back(HitRequest(i, Location(center.x - 1000 + 10 * i, center.y + 300)));
+  }
+  vector<HitRequest> same_hits = hits;
+  exact.resolve_hits(hits);
+  aggregate.resolve_hits(same_hits);
+  EXPECT_GT(count_if(hits.begin(), hits.end(), [](const HitRequest& h) { return h.value > 0; }), 0);
+  EXPECT_EQ(exact.reward_manager().size(), aggregate.reward_manager().size());
+  EXPECT_EQ(exact.scan_player_fixed(p), aggregate.scan_player_fixed(p));
+
+  // Batched scans use the ring modes too.
+  exact.reset_seed(9);
+  aggregate.reset_seed(9);
+  vector<Player> players(5, p);
+  vector<Scan> expected(players.size()), scans(players.size());
+  exact.scan_players(players, expected);
+  aggregate.scan_players(players, scans);
+  EXPECT_TRUE(expected == scans);
+}
@@ -43,6 +43,27 @@ TEST(CellTests, scanRingTest) {
   ss << s1 << endl;
 }
 
+TEST(CellTests, fixedSizeScanTest) {
+  // Rings and scans are plain values, usable at compile time.
+  constexpr InfluenceRing empty_ring;
+  static_assert(empty_ring.vals()[0] == 0, "rings start out empty");
+  constexpr BasicScan<4, 16> wide_scan;
+  static_assert(wide_scan.rings().size() == 4, "ring count is fixed");
+  static_assert(wide_scan.rings()[3].vals().size() == 16, "direction count is fixed");
+
+  InfluenceRing i1(vector<int>{1, 2, 3, 4, 5, 6, 7, 8});
+  InfluenceRing i2(InfluenceRing::vals_t{{10, 20, 30, 40, 50, 60, 70, 80}});
+  i1 += i2;
+  EXPECT_TRUE(areEqual(i1.vals(), vector<int>{11, 22, 33, 44, 55, 66, 77, 88}));
+
+  Scan s1(vector<InfluenceRing>{i1, i2});
+  Scan s2 = s1;
+  s2 += s1;
+  EXPECT_TRUE(areEqual(s2.rings()[0].vals(), vector<int>{22, 44, 66, 88, 110, 132, 154, 176}));
+  EXPECT_TRUE(areEqual(s2.rings()[1].vals(), vector<int>{20, 40, 60, 80, 100, 120, 140, 160}));
+  EXPECT_FALSE(s1 == s2);
+}
+
 TEST(CellTests, joinLeaveTest) {
   World w;
 
@@ -74,3 +95,82 @@ TEST(CellTests, joinLeaveTest) {
   EXPECT_TRUE(w.player_join(Player(4)));
 }
 
+
+TEST(CellTests, movePlayerTest) {
+  World w;
+  for (int i = 1; i <= 4; ++i) EXPECT_TRUE(w.player_join(Player(i)));
+  EXPECT_FALSE(w.move_player(5, Location(1, 1)));
+
+  // Within the starting index cell, then into another one.
+  EXPECT_TRUE(w.move_player(1, Location(10, 20)));
+  EXPECT_TRUE(w.move_player(2, Location(5000, -5000)));
+  EXPECT_EQ(Location(10, 20), w.find_player(1)->location());
+  EXPECT_EQ(Location(5000, -5000), w.find_player(2)->location());
+  EXPECT_EQ(nullptr, w.find_player(5));
+
+  auto at_origin = w.grid().player_grid().find(Location(0, 0), Location(0, 0));
+  ASSERT_EQ(2u, at_origin.size());
+  // Players sharing a location come back in no particular order.
+  EXPECT_EQ(7, w.player(at_origin[0].second)->id() + w.player(at_origin[1].second)->id());
+  EXPECT_NE(w.player(at_origin[0].second)->id(), w.player(at_origin[1].second)->id());
+  auto moved = w.grid().player_grid().find(Location(1, -10000), Location(10000, 10000));
+  ASSERT_EQ(2u, moved.size());
+  EXPECT_EQ(1, w.player(moved[0].second)->id());
+  EXPECT_EQ(2, w.player(moved[1].second)->id());
+
+  // Batched moves apply in order and skip unknown players.
+  vector<Move> moves = { { 3, Location(-1, -1) }, { 9, Location(0, 0) },
+                         { 4, Location(300, 300) }, { 3, Location(-2, -2) } };
+  EXPECT_EQ(3u, w.apply_moves(moves));
+  EXPECT_EQ(Location(-2, -2), w.find_player(3)->location());
+  EXPECT_EQ(Location(300, 300), w.find_player(4)->location());
+  EXPECT_EQ(4u, w.grid().player_grid().size());
+  EXPECT_TRUE(w.grid().player_grid().find(Location(-1, -1), Location(0, 0)).empty());
+
+  // Leaving still finds the player where they moved to.
+  EXPECT_TRUE(w.player_leave(2));
+  EXPECT_TRUE(w.grid().player_grid().find(Location(5000, -5000), Location(5000, -5000)).empty());
+  EXPECT_EQ(3u, w.grid().player_grid().size());
+}
+
+TEST(CellTests, playerHandleTest) {
+  World w;
+  for (int i = 0; i < 100; ++i) {
+    Player p(i * 3);
+    p.location() = Location(i, -i);
+    EXPECT_TRUE(w.player_join(p));
+  }
+  EXPECT_EQ(100u, w.num_players());
+  EXPECT_TRUE(w.player_handle(1).is_null());
+
+  const PlayerHandle h = w.player_handle(30);
+  ASSERT_NE(nullptr, w.player(h));
+  EXPECT_EQ(Location(10, -10), w.player(h)->location());
+
+  // Handles of other players survive leaves, the leaving player's goes stale.
+  for (int i = 0; i < 100; i += 2) EXPECT_TRUE(w.player_leave(i * 3));
+  EXPECT_EQ(50u, w.num_players());
+  EXPECT_EQ(nullptr, w.player(h));
+  const PlayerHandle h33 = w.player_handle(33);
+  EXPECT_EQ(33, w.player(h33)->id());
+
+  // Rejoining gets a new handle.
+  EXPECT_TRUE(w.player_join(Player(30)));
+  EXPECT_NE(h, w.player_handle(30));
+  EXPECT_EQ(nullptr, w.player(h));
+  EXPECT_EQ(33, w.player(h33)->id());
+
+  // Iteration covers exactly the players in the world.
+  int id_sum = 0;
+  for (const Player& p : w.players()) id_sum += p.id();
+  int expected_sum = 30;
+  for (int i = 1; i < 100; i += 2) expected_sum += i * 3;
+  EXPECT_EQ(expected_sum, id_sum);
+
+  // The player grid holds handles that resolve to the players at each spot.
+  for (const auto& entry : w.grid().player_grid().find(Location(-100, -100), Location(100, 100))) {
+    ASSERT_NE(nullptr, w.player(entry.second));
+    EXPECT_EQ(entry.first, w.player(entry.second)->location());
+  }
+  EXPECT_EQ(51u, w.grid().player_grid().size());
+}
@@ -2,6 +2,8 @@
 #ifndef CELL_TESTUTILS_HPP
 #define CELL_TESTUTILS_HPP
 #include <reward.hpp>
+#include <array>
+#include <random>
 #include <vector>
 
 using namespace cell;
@@ -18,6 +20,11 @@ bool areEqual(const std::vector<T>& v1, const std::vector<T>& v2) {
   return true;
 }
 
+template <typename T, std::size_t N>
+bool areEqual(const std::array<T, N>& a, const std::vector<T>& v) {
+  return areEqual(std::vector<T>(a.begin(), a.end()), v);
+}
+
 template <typename T>
 bool quantitiesEqual(const std::vector<Reward>& v1, const std::vector<T>& v2) {
   if (v1.size() != v2.size()) return false;
@@ -53,6 +60,29 @@ static Reward make_reward(RewardId id, int quantity, Reward::RewardType type, Lo
   return r;
 }
 
+/// count rewards with ids from 0, quantities in [1, 1000] and any type, at
+/// uniformly random locations in the rectangle [bottom_left, top_right].
+static std::vector<Reward> random_rewards(std::mt19937& gen, int count, Location bottom_left,
+                                          Location top_right) {
+  std::uniform_int_distribution<int> x(bottom_left.x, top_right.x), y(bottom_left.y, top_right.y);
+  std::uniform_int_distribution<int> quantity(1, 1000), type(0, 2);
+  std::vector<Reward> rewards;
+  rewards.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    const Location l(x(gen), y(gen));
+    const int q = quantity(gen);
+    rewards.push_back(make_reward(i, q, Reward::RewardType(type(gen)), l));
+  }
+  return rewards;
+}
+
+/// The same around center, at most spread away on either axis.
+static std::vector<Reward> random_rewards(unsigned seed, int count, Location center, int spread) {
+  std::mt19937 gen(seed);
+  return random_rewards(gen, count, Location(center.x - spread, center.y - spread),
+                        Location(center.x + spread, center.y + spread));
+}
+
 }
 }
 #endif
@@ -3,6 +3,10 @@
 #include <grid_map.hpp>
 #include <cell.test.hpp>
 #include <vector>
+#include <map>
+#include <random>
+#include <limits>
+#include <algorithm>
 
 using namespace std;
 using namespace cell;
@@ -133,3 +137,96 @@ TEST(GridMap, removeReward) {
   EXPECT_EQ(i, 910);
 }
 
+
+TEST(GridMap, findAcrossCells) {
+  // Small cells so that every query below spans several of them, including
+  // cells on both sides of zero.
+  GridMap<int> gridmap(2);
+  std::map<Location, int> reference;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> coord(-40, 40);
+  for (int i = 0; i < 500; ++i) {
+    Location l(coord(gen), coord(gen));
+    gridmap.insert(l, i);
+    reference.emplace(l, i);
+  }
+  EXPECT_EQ(reference.size(), gridmap.size());
+
+  // Remove a few so that some cells run empty.
+  for (int i = 0; i < 100; ++i) {
+    Location l(coord(gen), coord(gen));
+    int removed = -1;
+    EXPECT_EQ(reference.erase(l) == 1, gridmap.remove(l, removed));
+  }
+
+  typedef std::vector<std::pair<Location,int>> RetType;
+  for (int i = 0; i < 200; ++i) {
+    int x1 = coord(gen), x2 = coord(gen), y1 = coord(gen), y2 = coord(gen);
+    Location bl(std::min(x1, x2), std::min(y1, y2)), tr(std::max(x1, x2), std::max(y1, y2));
+    RetType expected_result;
+    for (const auto& p : reference) {
+      if (p.first.between(bl, tr)) expected_result.push_back(p);
+    }
+    EXPECT_TRUE(areEqual(expected_result, gridmap.find(bl, tr)));
+    EXPECT_GE(gridmap.candidates(bl, tr), expected_result.size());
+  }
+
+  // Rectangles covering far more cells than are occupied.
+  RetType everything(reference.begin(), reference.end());
+  Location min_loc(std::numeric_limits<int>::min(), std::numeric_limits<int>::min());
+  Location max_loc(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+  EXPECT_TRUE(areEqual(everything, gridmap.find(min_loc, max_loc)));
+  EXPECT_EQ(everything.size(), gridmap.candidates(min_loc, max_loc));
+}
+
+TEST(GridMap, forEachInRect) {
+  GridMap<int> gridmap(1);
+  for (int x = -5; x <= 5; ++x) {
+    for (int y = -5; y <= 5; ++y) {
+      gridmap.insert(Location(x, y), x * 100 + y);
+    }
+  }
+
+  // Visits exactly what find returns, in whatever order.
+  typedef std::vector<std::pair<Location,int>> RetType;
+  Location bl(-3, -2), tr(4, 1);
+  RetType visited;
+  gridmap.for_each_in_rect(bl, tr, [&visited](const Location& l, int i) {
+    visited.emplace_back(l, i);
+  });
+  std::sort(visited.begin(), visited.end(),
+            [](const std::pair<Location,int>& a, const std::pair<Location,int>& b) {
+              return a.first < b.first;
+            });
+  EXPECT_TRUE(areEqual(gridmap.find(bl, tr), visited));
+
+  // Objects can be modified in place.
+  gridmap.for_each_in_rect(Location(0, 0), Location(0, 0), [](const Location&, int& i) {
+    i = 12345;
+  });
+  RetType expected_result = { { Location(0, 0), 12345 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(Location(0, 0), Location(0, 0))));
+
+  // Early exit.
+  int calls = 0;
+  EXPECT_TRUE(gridmap.for_each_in_rect_until(bl, tr, [&calls](const Location&, int) {
+    return ++calls == 3;
+  }));
+  EXPECT_EQ(3, calls);
+
+  calls = 0;
+  EXPECT_FALSE(gridmap.for_each_in_rect_until(bl, tr, [&calls](const Location&, int) {
+    ++calls;
+    return false;
+  }));
+  EXPECT_EQ(int(visited.size()), calls);
+
+  // Empty and inverted rectangles visit nothing.
+  const GridMap<int>& const_map = gridmap;
+  const_map.for_each_in_rect(Location(20, 20), Location(30, 30), [](const Location&, const int&) {
+    ADD_FAILURE();
+  });
+  const_map.for_each_in_rect(tr, bl, [](const Location&, const int&) {
+    ADD_FAILURE();
+  });
+}
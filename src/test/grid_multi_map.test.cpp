@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <grid_multimap.hpp>
 #include <cell.test.hpp>
+#include <algorithm>
 #include <vector>
 
 using namespace std;
@@ -92,3 +93,115 @@ TEST(GridMultiMap, findLocations) {
   EXPECT_EQ(ret_str[0].second, ret_str2[0].second);
 }
 
+
+TEST(GridMultiMap, eraseAcrossCells) {
+  GridMultiMap<int> gridmap(1);
+  Location a(-3, -3), b(-2, -3), c(5, 7);
+  gridmap.insert(a, 1);
+  gridmap.insert(b, 2);
+  gridmap.insert(a, 3);
+  gridmap.insert(a, 1);
+  gridmap.insert(c, 4);
+
+  typedef std::vector<std::pair<Location, int>> RetType;
+  RetType expected_result = { { a, 1 }, { a, 3 }, { a, 1 }, { b, 2 }, { c, 4 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(a, c)));
+
+  // Wrong location, nothing should go.
+  gridmap.erase_one(b, 1);
+  EXPECT_EQ(5, gridmap.size());
+
+  gridmap.erase_all(a, 1);
+  expected_result = { { a, 3 }, { b, 2 }, { c, 4 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(a, c)));
+
+  gridmap.erase_one(a, 3);
+  gridmap.erase_one(c, 4);
+  expected_result = { { b, 2 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(a, c)));
+  EXPECT_EQ(1, gridmap.size());
+}
+
+TEST(GridMultiMap, moveOne) {
+  GridMultiMap<int> gridmap(2);
+  Location a(0, 0), b(1, 3), c(9, -9);
+  gridmap.insert(a, 1);
+  gridmap.insert(a, 2);
+  gridmap.insert(a, 1);
+
+  // Not stored there.
+  EXPECT_FALSE(gridmap.move_one(b, a, 1));
+  EXPECT_FALSE(gridmap.move_one(a, b, 3));
+
+  // Same cell keeps its place, another cell goes to the back of that cell.
+  EXPECT_TRUE(gridmap.move_one(a, b, 1));
+  EXPECT_TRUE(gridmap.move_one(a, c, 2));
+  EXPECT_EQ(3, gridmap.size());
+
+  typedef std::vector<std::pair<Location, int>> RetType;
+  RetType expected_result = { { a, 1 }, { b, 1 }, { c, 2 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(Location(-10, -10), Location(10, 10))));
+  EXPECT_EQ(1u, gridmap.candidates(c, c));
+
+  EXPECT_TRUE(gridmap.move_one(c, a, 2));
+  EXPECT_EQ(0u, gridmap.candidates(c, c));
+  expected_result = { { a, 1 }, { a, 2 }, { b, 1 } };
+  EXPECT_TRUE(areEqual(expected_result, gridmap.find(Location(-10, -10), Location(10, 10))));
+}
+
+TEST(GridMultiMap, handlesAreTracked) {
+  // SlotHandles are found through their back reference, which has to follow
+  // the entries that erases move around inside a bucket.
+  GridMultiMap<SlotHandle> gridmap(4);
+  Location a(1, 1), b(20, 20), c(100, 100);
+  std::vector<SlotHandle> handles;
+  for (std::uint32_t i = 0; i < 6; ++i) {
+    handles.push_back(SlotHandle{ i, 7 });
+    gridmap.insert(i % 2 ? a : b, handles.back());
+  }
+
+  // Right slot, wrong generation or location.
+  EXPECT_FALSE(gridmap.move_one(b, a, SlotHandle{ 0, 8 }));
+  EXPECT_FALSE(gridmap.move_one(a, b, handles[0]));
+
+  gridmap.erase_one(b, handles[0]);
+  EXPECT_TRUE(gridmap.move_one(a, b, handles[1]));
+  EXPECT_TRUE(gridmap.move_one(b, c, handles[4]));
+  EXPECT_TRUE(gridmap.move_one(a, c, handles[5]));
+  gridmap.erase_one(b, handles[2]);
+  EXPECT_EQ(4, gridmap.size());
+
+  vector<pair<Location, uint32_t>> found;
+  for (const auto& e : gridmap.find(a, c)) found.emplace_back(e.first, e.second.index);
+  sort(found.begin(), found.end());
+  const vector<pair<Location, uint32_t>> expected = { { a, 3 }, { b, 1 }, { c, 4 }, { c, 5 } };
+  EXPECT_EQ(expected, found);
+
+  gridmap.erase_one(b, handles[1]);
+  gridmap.erase_one(a, handles[3]);
+  EXPECT_TRUE(gridmap.move_one(c, a, handles[5]));
+  gridmap.erase_one(c, handles[4]);
+  gridmap.erase_one(a, handles[5]);
+  EXPECT_EQ(0, gridmap.size());
+}
+
+TEST(GridMultiMap, forEachInRect) {
+  GridMultiMap<int> gridmap;
+  Location a(1, 1), b(2, 2), c(300, 300);
+  gridmap.insert(a, 1);
+  gridmap.insert(a, 2);
+  gridmap.insert(b, 3);
+  gridmap.insert(c, 4);
+
+  int sum = 0;
+  gridmap.for_each_in_rect(a, b, [&sum](const Location&, int i) { sum += i; });
+  EXPECT_EQ(6, sum);
+
+  int calls = 0;
+  EXPECT_TRUE(gridmap.for_each_in_rect_until(a, c, [&calls](const Location&, int i) {
+    ++calls;
+    return i == 4;
+  }));
+  EXPECT_GE(calls, 1);
+  EXPECT_LE(calls, 4);
+}
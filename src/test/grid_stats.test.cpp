@@ -0,0 +1,158 @@
+// gtest
+#include <gtest/gtest.h>
+#include <grid.hpp>
+#include <grid_stats.hpp>
+#include <cell.test.hpp>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+using namespace cell::test;
+
+namespace {
+
+uint64_t influence_calls(const GridStats& s) {
+  uint64_t total = 0;
+  for (uint64_t calls : s.influence_calls) total += calls;
+  return total;
+}
+
+} // end anonymous namespace
+
+TEST(GridStatsTests, histogramPercentiles) {
+  LatencyHistogram h;
+  EXPECT_EQ(0.0, h.percentile_ns(0.5));
+  for (uint64_t ns = 1; ns <= 1000; ++ns) h.add(ns * 1000);
+  EXPECT_EQ(1000u, h.count());
+  EXPECT_NEAR(500500.0, h.mean_ns(), 1e-6);
+  // Buckets are a quarter of a power of two wide.
+  EXPECT_NEAR(500000.0, h.percentile_ns(0.5), 500000.0 * 0.13);
+  EXPECT_NEAR(990000.0, h.percentile_ns(0.99), 990000.0 * 0.13);
+  for (int b = 0; b < LatencyHistogram::NUM_BUCKETS - 5; ++b) {
+    EXPECT_EQ(b, LatencyHistogram::bucket_of(LatencyHistogram::bucket_floor(b)));
+    EXPECT_EQ(b, LatencyHistogram::bucket_of(LatencyHistogram::bucket_floor(b + 1) - 1));
+  }
+
+  LatencyHistogram other;
+  other.add(7);
+  h.merge(other);
+  EXPECT_EQ(1001u, h.count());
+  EXPECT_EQ(1u, h.bucket(7));
+}
+
+#ifndef CELL_NO_STATS
+
+TEST(GridStatsTests, ringScanCounts) {
+  Grid grid;
+  const Location center(1000, -1000);
+  grid.add_reward(make_reward(1, 10, Reward::RewardType::TRIVIAL, Location(center.x + 5, center.y)));
+  grid.add_reward(make_reward(2, 10, Reward::RewardType::DISTANCE, Location(center.x, center.y + 8)));
+  grid.add_reward(make_reward(3, 10, Reward::RewardType::DIST_TIME, Location(center.x + 30, center.y)));
+  grid.add_reward(make_reward(4, 10, Reward::RewardType::TRIVIAL, Location(center.x + 5000, center.y)));
+  Player p(1);
+  p.location() = center;
+
+  grid.scan_single_ring(p, 0, 10);
+  GridStats s = grid.stats();
+  EXPECT_EQ(0u, s.scans);
+  EXPECT_EQ(1u, s.ring_scans);
+  EXPECT_EQ(1u, s.queries);
+  EXPECT_EQ(2u, s.rings[0].accepted);
+  EXPECT_GE(s.rings[0].candidates, 2u);
+  EXPECT_EQ(s.candidates, s.rings[0].candidates);
+  EXPECT_EQ(1u, s.influence_calls[int(Reward::RewardType::TRIVIAL)]);
+  EXPECT_EQ(1u, s.influence_calls[int(Reward::RewardType::DISTANCE)]);
+  EXPECT_EQ(0u, s.influence_calls[int(Reward::RewardType::DIST_TIME)]);
+  EXPECT_EQ(1u, s.ring_scan_latency.count());
+
+  // Ring counts go by position in the call.
+  const int min_dists[] = { 0, 20 }, max_dists[] = { 10, 40 };
+  InfluenceRing rings[2];
+  grid.scan_rings(p, min_dists, max_dists, 2, rings);
+  s = grid.stats();
+  EXPECT_EQ(2u, s.ring_scans);
+  EXPECT_EQ(4u, s.rings[0].accepted);
+  EXPECT_EQ(1u, s.rings[1].accepted);
+  EXPECT_EQ(5u, influence_calls(s));
+
+  grid.reset_stats();
+  s = grid.stats();
+  EXPECT_EQ(0u, s.ring_scans);
+  EXPECT_EQ(0u, s.candidates);
+  EXPECT_EQ(0u, s.ring_scan_latency.count());
+}
+
+TEST(GridStatsTests, fullScanCounts) {
+  Grid grid;
+  const Location center(-20000, 5000);
+  grid.add_rewards(random_rewards(3, 5000, center, 1500));
+  mt19937 gen(9);
+  uniform_int_distribution<int> offset(-1000, 1000);
+  for (int i = 0; i < 50; ++i) {
+    Player p(i);
+    p.location() = Location(center.x + offset(gen), center.y + offset(gen));
+    if (i % 2) grid.scan_player(p);
+    else grid.scan_player_fixed(p);
+  }
+  const GridStats s = grid.stats();
+  EXPECT_EQ(50u, s.scans);
+  EXPECT_EQ(50u, s.scan_latency.count());
+  EXPECT_EQ(0u, s.ring_scans);
+  EXPECT_GT(s.accepted(), 0u);
+  EXPECT_EQ(s.accepted(), influence_calls(s));
+  for (int r = 0; r < Scan::NUM_RINGS; ++r) {
+    EXPECT_GT(s.rings[r].accepted, 0u);
+    EXPECT_GE(s.rings[r].candidates, s.rings[r].accepted);
+  }
+  // The inner ring is fetched with the outer one's rectangle.
+  EXPECT_GT(s.rings[0].candidates_per_accepted(), s.rings[1].candidates_per_accepted());
+
+  ostringstream dump;
+  dump << s;
+  EXPECT_NE(string::npos, dump.str().find("scans: 50 full"));
+}
+
+TEST(GridStatsTests, threadedScansMerge) {
+  const Location center(0, 0);
+  vector<Player> players;
+  for (int i = 0; i < 64; ++i) {
+    Player p(i);
+    p.location() = Location(i * 40 - 1280, (i % 8) * 100);
+    players.push_back(p);
+  }
+  vector<Scan> out(players.size());
+
+  GridStats stats[2];
+  const unsigned threads[2] = { 1, 4 };
+  for (int t = 0; t < 2; ++t) {
+    Grid grid;
+    grid.add_rewards(random_rewards(3, 5000, center, 1500));
+    grid.reset_seed(11);
+    grid.set_scan_threads(threads[t]);
+    grid.scan_players(players, out);
+    stats[t] = grid.stats();
+  }
+  // The batch scans the same rings whatever the number of threads.
+  EXPECT_EQ(players.size(), stats[1].scans);
+  EXPECT_EQ(stats[0].candidates, stats[1].candidates);
+  EXPECT_EQ(stats[0].accepted(), stats[1].accepted());
+  for (int r = 0; r < Scan::NUM_RINGS; ++r) {
+    EXPECT_EQ(stats[0].rings[r].candidates, stats[1].rings[r].candidates);
+  }
+  EXPECT_EQ(stats[1].accepted(), influence_calls(stats[1]));
+}
+
+#else
+
+TEST(GridStatsTests, compiledOut) {
+  Grid grid;
+  grid.add_rewards(random_rewards(3, 1000, Location(0, 0), 1500));
+  Player p(1);
+  grid.scan_player_fixed(p);
+  EXPECT_EQ(0u, grid.stats().scans);
+  EXPECT_EQ(0u, grid.stats().scan_latency.count());
+}
+
+#endif // CELL_NO_STATS
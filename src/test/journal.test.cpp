@@ -0,0 +1,237 @@
+// google test
+#include <gtest/gtest.h>
+#include <journal.hpp>
+#include <snapshot.hpp>
+#include <world.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+string journal_path(const string& name) {
+  return "/tmp/cell." + name + ".journal";
+}
+
+typedef tuple<RewardId, int, int, int, int, int> RewardRow;
+
+/// Everything a journal restores: rewards without their scan bookkeeping,
+/// players and the per level quantities.
+struct WorldState {
+  vector<RewardRow> rewards;
+  vector<tuple<PlayerId, int, int>> players;
+  vector<uint64_t> quantities;
+
+  bool operator==(const WorldState& o) const {
+    return rewards == o.rewards && players == o.players && quantities == o.quantities;
+  }
+};
+
+WorldState world_state(const World& world) {
+  WorldState state;
+  const RewardManager& rm = world.grid().reward_manager();
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    rm.for_each_reward(Reward::RewardLevel(level), [&](RewardHandle, const Reward& r) {
+      state.rewards.emplace_back(r.id(), int(r.type()), int(r.level()), r.quantity(), r.location().x,
+                                 r.location().y);
+    });
+    state.quantities.push_back(rm.total_quantity(Reward::RewardLevel(level)));
+    state.quantities.push_back(rm.undistributed(Reward::RewardLevel(level)));
+  }
+  for (const Player& p : world.players()) state.players.emplace_back(p.id(), p.location().x, p.location().y);
+  sort(state.rewards.begin(), state.rewards.end());
+  sort(state.players.begin(), state.players.end());
+  EXPECT_EQ(world.grid().reward_grid().size(), state.rewards.size());
+  return state;
+}
+
+void fill_world(World& world) {
+  mt19937 gen(5);
+  uniform_int_distribution<int> coord(-500, 500);
+  for (int i = 0; i < 2000; ++i) {
+    Reward r(i, Reward::RewardType(i % 3));
+    r.level() = Reward::RewardLevel(i % (Reward::RewardLevel::NUM_LEVELS - 1));
+    r.quantity() = 1 + i % 50;
+    r.location() = Location(coord(gen), coord(gen));
+    world.grid().add_reward(r);
+  }
+  for (int i = 0; i < 100; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+}
+
+/// One tick of everything the journal records, committed at the end.
+void play_tick(World& world, Journal& journal, int tick) {
+  mt19937 gen(100 + tick);
+  uniform_int_distribution<int> coord(-500, 500);
+  Grid& grid = world.grid();
+  RewardManager& rm = grid.reward_manager();
+
+  for (int i = 0; i < 20; ++i) {
+    Reward r(10000 + tick * 100 + i, Reward::RewardType::DISTANCE);
+    r.level() = Reward::RewardLevel(i % Reward::RewardLevel::NUM_LEVELS);
+    r.quantity() = 10 + i;
+    r.location() = Location(coord(gen), coord(gen));
+    grid.add_reward(r);
+  }
+  // Removals redistribute stepwise, a large one in bulk.
+  for (RewardId id = tick * 50; id < tick * 50 + 10; ++id) {
+    const Reward* r = rm.get(rm.find(id));
+    if (r) grid.remove_reward(r->location());
+  }
+  const RewardHandle big = rm.find(tick * 50 + 20);
+  if (rm.get(big)) {
+    rm.set_quantity(big, 200000);
+    grid.remove_reward(rm.get(big)->location());
+  }
+  rm.distribute_quantity(Reward::RewardLevel::SMALL, 500);
+
+  vector<HitRequest> hits;
+  for (int i = 0; i < 30; ++i) hits.emplace_back(i, Location(coord(gen), coord(gen)));
+  grid.resolve_hits(hits);
+
+  Player p(1000 + tick);
+  p.location() = Location(coord(gen), coord(gen));
+  world.player_join(p);
+  world.player_leave(tick);
+  vector<Move> moves;
+  for (PlayerId id = 20; id < 60; ++id) moves.push_back(Move{ id, Location(coord(gen), coord(gen)) });
+  world.apply_moves(moves);
+  journal.commit();
+}
+
+string read_file(const string& path) {
+  ifstream in(path, ios::binary);
+  return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+void write_file(const string& path, const string& bytes) {
+  ofstream out(path, ios::binary | ios::trunc);
+  out.write(bytes.data(), bytes.size());
+}
+
+} // end anonymous namespace
+
+TEST(JournalTests, recoversSnapshotPlusJournal) {
+  World world;
+  fill_world(world);
+  // The last level stays empty, quantity distributed to it is held back.
+  world.grid().reward_manager().distribute_quantity(Reward::RewardLevel::GRAND, 77);
+  const string snapshot = journal_path("recovers.snapshot");
+  const string path = journal_path("recovers");
+  ASSERT_TRUE(save_snapshot(world, snapshot));
+
+  Journal journal;
+  ASSERT_TRUE(journal.open(path));
+  world.set_journal(&journal);
+  EXPECT_EQ(&journal, world.grid().reward_manager().journal());
+  for (int tick = 0; tick < 8; ++tick) play_tick(world, journal, tick);
+  EXPECT_TRUE(journal.sync());
+  EXPECT_EQ(8u, journal.durable_sequence());
+  EXPECT_EQ(0u, journal.pending_records());
+  EXPECT_TRUE(journal.close());
+  world.set_journal(nullptr);
+
+  World recovered;
+  ASSERT_TRUE(load_snapshot(snapshot, recovered));
+  JournalReplayStats stats;
+  ASSERT_TRUE(Journal::replay(path, recovered, &stats));
+  EXPECT_EQ(8u, stats.frames);
+  EXPECT_GT(stats.records, 8u * 100);
+  EXPECT_FALSE(stats.torn_tail);
+  EXPECT_TRUE(world_state(world) == world_state(recovered));
+  EXPECT_EQ(world.grid().reward_manager().total_quantity(), recovered.grid().reward_manager().total_quantity());
+  remove(snapshot.c_str());
+  remove(path.c_str());
+}
+
+TEST(JournalTests, ignoresTornTail) {
+  World world;
+  fill_world(world);
+  const string snapshot = journal_path("torn.snapshot");
+  const string path = journal_path("torn");
+  ASSERT_TRUE(save_snapshot(world, snapshot));
+
+  Journal journal;
+  ASSERT_TRUE(journal.open(path));
+  world.set_journal(&journal);
+  for (int tick = 0; tick < 3; ++tick) play_tick(world, journal, tick);
+  ASSERT_TRUE(journal.sync());
+  const WorldState before_last = world_state(world);
+  const size_t before_last_size = read_file(path).size();
+  play_tick(world, journal, 3);
+  ASSERT_TRUE(journal.close());
+  const string good = read_file(path);
+  ASSERT_GT(good.size(), before_last_size);
+
+  // Cut anywhere inside the last frame, or damaged in it, only it is lost.
+  for (size_t cut : { before_last_size + 5, good.size() - 8 }) {
+    write_file(path, good.substr(0, cut));
+    World recovered;
+    ASSERT_TRUE(load_snapshot(snapshot, recovered));
+    JournalReplayStats stats;
+    EXPECT_TRUE(Journal::replay(path, recovered, &stats));
+    EXPECT_TRUE(stats.torn_tail);
+    EXPECT_EQ(3u, stats.frames);
+    EXPECT_TRUE(before_last == world_state(recovered));
+  }
+  string bad = good;
+  bad[(before_last_size + good.size()) / 2] ^= 0x01;
+  write_file(path, bad);
+  World recovered;
+  ASSERT_TRUE(load_snapshot(snapshot, recovered));
+  JournalReplayStats stats;
+  EXPECT_TRUE(Journal::replay(path, recovered, &stats));
+  EXPECT_TRUE(stats.torn_tail);
+  EXPECT_TRUE(before_last == world_state(recovered));
+
+  // Not a journal at all.
+  write_file(path, "CELLSNAP and then some");
+  EXPECT_FALSE(Journal::replay(path, recovered));
+  EXPECT_FALSE(Journal::replay(journal_path("missing"), recovered));
+  remove(snapshot.c_str());
+  remove(path.c_str());
+}
+
+TEST(JournalTests, recordsOnlyWhileAttached) {
+  World world;
+  Journal journal;
+  const string path = journal_path("attached");
+  ASSERT_TRUE(journal.open(path));
+  EXPECT_EQ(0u, journal.commit());
+
+  Player p(1);
+  world.player_join(p);
+  EXPECT_EQ(0u, journal.pending_records());
+  world.set_journal(&journal);
+  world.move_player(1, Location(3, 4));
+  world.move_player(2, Location(3, 4));
+  Reward r(1, Reward::RewardType::TRIVIAL);
+  r.quantity() = 5;
+  world.grid().add_reward(r);
+  // A second reward at the same location isn't added, nor journaled.
+  world.grid().add_reward(Reward(2, Reward::RewardType::TRIVIAL));
+  EXPECT_EQ(2u, journal.pending_records());
+  EXPECT_EQ(1u, journal.commit());
+  EXPECT_EQ(1u, journal.commit());
+  EXPECT_TRUE(journal.sync());
+  world.set_journal(nullptr);
+  EXPECT_TRUE(journal.close());
+
+  World replayed;
+  replayed.player_join(p);
+  ASSERT_TRUE(Journal::replay(path, replayed));
+  ASSERT_NE(nullptr, replayed.find_player(1));
+  EXPECT_EQ(Location(3, 4), replayed.find_player(1)->location());
+  EXPECT_EQ(5u, replayed.grid().reward_manager().total_quantity());
+  remove(path.c_str());
+}
@@ -5,10 +5,15 @@
 #include <scan.hpp>
 #include <reward.hpp>
 #include <rewardmanager.hpp>
+#include <grid.hpp>
 #include <rewardclass.hpp>
 #include <influence_ring.hpp>
 #include <cell.test.hpp>
+#include <algorithm>
+#include <limits>
+#include <random>
 #include <sstream>
+#include <thread>
 
 using namespace std;
 using namespace cell;
@@ -181,8 +186,431 @@ TEST(RewardTests, rewardClassDistribution) {
   }
 }
 
+TEST(RewardTests, waterLevelTest) {
+  // Against raising the sorted quantities one at a time.
+  mt19937 gen(5);
+  for (int round = 0; round < 200; ++round) {
+    uniform_int_distribution<int> size(1, 50), value(0, round % 2 ? 10 : 100000);
+    vector<uint64_t> quantities(size(gen));
+    for (auto& q : quantities) q = value(gen);
+    const uint64_t quantity = uniform_int_distribution<uint64_t>(0, 2000000)(gen);
+
+    vector<uint64_t> sorted = quantities;
+    sort(sorted.begin(), sorted.end());
+    uint64_t sum = 0;
+    size_t k = 0;
+    while (k < sorted.size() && sorted[k] * k - sum <= quantity) sum += sorted[k++];
+    EXPECT_EQ((quantity + sum) / k, RewardClass::water_level(quantities, quantity));
+  }
+}
+
+TEST(RewardTests, rewardClassBulkDistribution) {
+  mt19937 gen(11);
+  uniform_int_distribution<int> value(0, 1000);
+  vector<Reward> rewards;
+  uint64_t total = 0;
+  for (int i = 0; i < 1000; ++i) {
+    rewards.push_back(make_reward(i, value(gen)));
+    total += rewards.back().quantity();
+  }
+  const vector<Reward> before = rewards;
+  RewardClass rc(move(rewards));
+
+  // Larger than the class total, so it is poured in by water filling.
+  const uint64_t quantity = 5 * total + 12345;
+  rc.distribute_quantity(quantity);
+  EXPECT_EQ(total + quantity, rc.total_quantity());
+  uint64_t sum = 0;
+  int lowest = numeric_limits<int>::max(), highest = 0;
+  for (size_t i = 0; i < rc.rewards().size(); ++i) {
+    const int q = rc.rewards()[i].quantity();
+    EXPECT_GE(q, before[i].quantity());
+    sum += q;
+    lowest = min(lowest, q);
+    highest = max(highest, q);
+  }
+  EXPECT_EQ(total + quantity, sum);
+  // Everything ends up at the water level, apart from the remainder walk
+  // which stays under 120% of the average.
+  const uint64_t avg = sum / rc.rewards().size();
+  EXPECT_LE(uint64_t(lowest), avg);
+  EXPECT_LT(uint64_t(highest), avg + avg / 5);
+  EXPECT_GE(uint64_t(lowest), avg - 1);
+}
+
+TEST(RewardTests, scanStateTest) {
+  // Every NUM_SCANS_BEFORE_RESET-th scan resets the state to its own time.
+  Reward r = make_reward(1, 100, Reward::RewardType::DIST_TIME, Location(0, 0));
+  for (int i = 1; i < Reward::NUM_SCANS_BEFORE_RESET; ++i) {
+    r.record_scan(1000 + i);
+    EXPECT_EQ(i, r.scan_state().scans());
+    EXPECT_EQ(0u, r.scan_state().last_scanned());
+  }
+  r.record_scan(5000);
+  EXPECT_EQ(0, r.scan_state().scans());
+  EXPECT_EQ(5000u, r.scan_state().last_scanned());
+  EXPECT_EQ(0, r.influence_at(1.0, 5000));
+  EXPECT_EQ(50, r.influence_at(1.0, 5000 + Reward::RECOVERY_TIME / 2));
+  EXPECT_EQ(100, r.influence_at(1.0, 5000 + Reward::RECOVERY_TIME * 2));
+
+  // Rewards owned by a manager keep their state in its table, starting fresh.
+  RewardManager rm;
+  Reward* managed = rm.get(rm.add_reward(r));
+  EXPECT_EQ(1u, rm.scan_states().size());
+  EXPECT_EQ(5000u, managed->scan_state().last_scanned());
+  managed->record_scan(6000);
+  EXPECT_EQ(1, managed->scan_state().scans());
+  EXPECT_EQ(0, r.scan_state().scans());
+
+  // Copies of a managed reward don't share its slot, whichever way they're made.
+  Reward copy(*managed);
+  Reward assigned = r;
+  assigned = *managed;
+  copy.record_scan(7000);
+  EXPECT_EQ(2, copy.scan_state().scans());
+  EXPECT_EQ(1, assigned.scan_state().scans());
+  EXPECT_EQ(1, managed->scan_state().scans());
+  // Assigning to a managed reward writes into its own slot.
+  *managed = r;
+  EXPECT_EQ(0, managed->scan_state().scans());
+  managed->record_scan(8000);
+  EXPECT_EQ(1, managed->scan_state().scans());
+  EXPECT_EQ(1u, rm.scan_states().size());
+  EXPECT_EQ(0, r.scan_state().scans());
+}
+
+TEST(RewardTests, moveIntoManagedTest) {
+  // Moving into a managed reward keeps its slot, so it can still be removed
+  // and the slot handed out again.
+  Grid grid;
+  const Location l(100, 100);
+  grid.add_reward(make_reward(1, 100, Reward::RewardType::DIST_TIME, l));
+  RewardManager& rm = grid.reward_manager();
+  Reward* managed = rm.get(rm.find(1));
+  Reward moved = make_reward(1, 100, Reward::RewardType::DIST_TIME, l);
+  moved.record_scan(1000);
+  *managed = std::move(moved);
+  *managed = make_reward(1, 100, Reward::RewardType::DIST_TIME, l);
+  managed->record_scan(2000);
+  EXPECT_EQ(1, managed->scan_state().scans());
+  EXPECT_EQ(1u, rm.scan_states().size());
+
+  grid.remove_reward(l);
+  EXPECT_EQ(0u, rm.scan_states().size());
+  grid.add_reward(make_reward(2, 100, Reward::RewardType::DIST_TIME, Location(200, 200)));
+  grid.add_reward(make_reward(3, 100, Reward::RewardType::DIST_TIME, Location(300, 300)));
+  EXPECT_EQ(2u, rm.scan_states().size());
+  for (RewardId id = 2; id <= 3; ++id) {
+    Reward* r = rm.get(rm.find(id));
+    r->record_scan(3000);
+    EXPECT_EQ(1, r->scan_state().scans());
+  }
+}
+
+TEST(RewardTests, concurrentScanStateTest) {
+  constexpr int NUM_THREADS = 8, SCANS_PER_THREAD = 30000, SCANS_PER_REWARD = 200;
+
+  RewardScanState state;
+  std::atomic<int> resets(0);
+  vector<thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < SCANS_PER_THREAD; ++i) {
+        if (state.record(uint64_t(t) * SCANS_PER_THREAD + i + 1, Reward::NUM_SCANS_BEFORE_RESET)) {
+          ++resets;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  // No scan is lost or double counted.
+  const int total = NUM_THREADS * SCANS_PER_THREAD;
+  EXPECT_EQ(total / Reward::NUM_SCANS_BEFORE_RESET, resets.load());
+  EXPECT_EQ(total % Reward::NUM_SCANS_BEFORE_RESET, state.scans());
+  EXPECT_LT(0u, state.last_scanned());
+
+  // Same through managed rewards being scanned from several threads, each
+  // thread scanning every reward SCANS_PER_REWARD times.
+  RewardManager rm;
+  for (int i = 0; i < 16; ++i) {
+    rm.add_reward(make_reward(i, 100, Reward::RewardType::DIST_TIME, Location(i, 0)));
+  }
+  vector<Reward*> rewards;
+  rm.for_each_reward(Reward::RewardLevel::SMALL, [&](RewardHandle, Reward& r) {
+    rewards.push_back(&r);
+  });
+  threads.clear();
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < SCANS_PER_REWARD * 16; ++i) {
+        rewards[(t + i) % rewards.size()]->get_influence(1.0, uint64_t(i));
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  const int per_reward = NUM_THREADS * SCANS_PER_REWARD;
+  for (Reward* r : rewards) {
+    EXPECT_EQ(per_reward % Reward::NUM_SCANS_BEFORE_RESET, r->scan_state().scans());
+  }
+}
+
+TEST(RewardTests, rewardManagerStorageTest) {
+  RewardManager rm;
+  vector<RewardHandle> handles;
+  for (int i = 0; i < 1000; ++i) {
+    Reward r = make_reward(i, i, Reward::RewardType::DISTANCE, Location(i, -i));
+    r.level() = Reward::RewardLevel(i % Reward::RewardLevel::NUM_LEVELS);
+    handles.push_back(rm.add_reward(r));
+  }
+  EXPECT_EQ(1000u, rm.size());
+  EXPECT_EQ(1000u, rm.scan_states().size());
+  EXPECT_EQ(handles[7], rm.add_reward(make_reward(7, 1)));
+  EXPECT_EQ(7, rm.get(handles[7])->quantity());
+  EXPECT_EQ(handles[500], rm.find(500));
+  EXPECT_TRUE(rm.find(1000).is_null());
+
+  // Each level holds its own rewards, pointers stay put as rewards are added.
+  const Reward* first = rm.get(handles[0]);
+  for (int i = 1000; i < 20000; ++i) rm.add_reward(make_reward(i, 0));
+  EXPECT_EQ(first, rm.get(handles[0]));
+  for (int i = 1000; i < 20000; ++i) EXPECT_TRUE(rm.remove_reward(rm.find(i)));
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    int count = 0;
+    rm.for_each_reward(Reward::RewardLevel(level), [&](RewardHandle h, const Reward& r) {
+      EXPECT_EQ(level, r.level());
+      EXPECT_EQ(&r, rm.get(h));
+      ++count;
+    });
+    EXPECT_EQ(250, count);
+    EXPECT_EQ(250u, rm.size(Reward::RewardLevel(level)));
+  }
+
+  // Removed rewards drop out, the others stay reachable through their handles.
+  for (int i = 0; i < 1000; i += 3) EXPECT_TRUE(rm.remove_reward(handles[i]));
+  EXPECT_FALSE(rm.remove_reward(handles[0]));
+  EXPECT_FALSE(rm.remove_reward(make_reward(3, 0)));
+  EXPECT_EQ(666u, rm.size());
+  EXPECT_EQ(666u, rm.scan_states().size());
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 3 == 0) {
+      EXPECT_EQ(nullptr, rm.get(handles[i]));
+      EXPECT_TRUE(rm.find(i).is_null());
+    } else {
+      ASSERT_NE(nullptr, rm.get(handles[i]));
+      EXPECT_EQ(i, rm.get(handles[i])->id());
+      EXPECT_EQ(Location(i, -i), rm.get(handles[i])->location());
+    }
+  }
+
+  // Slots are reused, stale handles don't see the new reward.
+  const RewardHandle reused = rm.add_reward(make_reward(5000, 1));
+  EXPECT_EQ(nullptr, rm.get(handles[3]));
+  EXPECT_EQ(5000, rm.get(reused)->id());
+  EXPECT_TRUE(rm.remove_reward(make_reward(5000, 0)));
+  EXPECT_EQ(nullptr, rm.get(reused));
+}
+
 TEST(RewardTests, rewardManagerRedistribution) {
   RewardManager rm;
+  vector<Reward> small;
+  vector<RewardHandle> handles;
+  for (int i = 0; i < 12; ++i) {
+    Reward r = make_reward(i, 10 * (i % 4) + 5);
+    r.level() = i < 10 ? Reward::RewardLevel::SMALL : Reward::RewardLevel::LARGE;
+    if (i < 10) small.push_back(r);
+    handles.push_back(rm.add_reward(r));
+  }
+  EXPECT_EQ(180u, rm.total_quantity(Reward::RewardLevel::SMALL));
+  EXPECT_EQ(60u, rm.total_quantity(Reward::RewardLevel::LARGE));
+  EXPECT_EQ(240u, rm.total_quantity());
+
+  // The removed quantity goes to the rest of its level, the same way
+  // RewardClass would hand it out.
+  const int removed = rm.get(handles[3])->quantity();
+  EXPECT_TRUE(rm.remove_reward(handles[3]));
+  small.erase(small.begin() + 3);
+  RewardClass rc(move(small));
+  rc.distribute_quantity(removed);
+  EXPECT_EQ(180u, rm.total_quantity(Reward::RewardLevel::SMALL));
+  EXPECT_EQ(60u, rm.total_quantity(Reward::RewardLevel::LARGE));
+  vector<int> expected;
+  for (const Reward& r : rc.rewards()) expected.push_back(r.quantity());
+  vector<int> actual;
+  for (int i = 0; i < 10; ++i) {
+    if (i != 3) actual.push_back(rm.get(handles[i])->quantity());
+  }
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(25, rm.get(handles[10])->quantity());
+
+  // A batch frees its quantity in one go, skipping stale handles.
+  const uint64_t small_total = 180 - rm.get(handles[0])->quantity() + 100;
+  rm.set_quantity(handles[0], 100);
+  EXPECT_EQ(small_total, rm.total_quantity(Reward::RewardLevel::SMALL));
+  const vector<RewardHandle> batch{ handles[0], handles[3], handles[5], handles[11] };
+  EXPECT_EQ(3u, rm.remove_rewards(batch));
+  EXPECT_EQ(small_total, rm.total_quantity(Reward::RewardLevel::SMALL));
+  EXPECT_EQ(60u, rm.total_quantity(Reward::RewardLevel::LARGE));
+  EXPECT_EQ(60, rm.get(handles[10])->quantity());
+  uint64_t sum = 0;
+  rm.for_each_reward(Reward::RewardLevel::SMALL, [&](RewardHandle, const Reward& r) {
+    sum += r.quantity();
+  });
+  EXPECT_EQ(small_total, sum);
+
+  // An emptied level keeps its quantity until it has rewards again.
+  EXPECT_TRUE(rm.remove_reward(handles[10]));
+  EXPECT_EQ(0u, rm.total_quantity(Reward::RewardLevel::LARGE));
+  EXPECT_EQ(60u, rm.undistributed(Reward::RewardLevel::LARGE));
+  Reward large = make_reward(20, 1);
+  large.level() = Reward::RewardLevel::LARGE;
+  const RewardHandle h = rm.add_reward(large);
+  rm.distribute_quantity(Reward::RewardLevel::LARGE, 0);
+  EXPECT_EQ(61, rm.get(h)->quantity());
+  EXPECT_EQ(0u, rm.undistributed(Reward::RewardLevel::LARGE));
+
+  // Bulk quantities raise the rewards to the new average, staying under 120%
+  // of it.
+  for (int i = 100; i < 200; ++i) {
+    Reward r = make_reward(i, i);
+    r.level() = Reward::RewardLevel::MEDIUM;
+    rm.add_reward(r);
+  }
+  rm.distribute_quantity(Reward::RewardLevel::MEDIUM, 100000);
+  EXPECT_EQ(114950u, rm.total_quantity(Reward::RewardLevel::MEDIUM));
+  sum = 0;
+  rm.for_each_reward(Reward::RewardLevel::MEDIUM, [&](RewardHandle, const Reward& r) {
+    EXPECT_GE(r.quantity(), 1149);
+    EXPECT_LT(r.quantity(), 1149 * 6 / 5);
+    sum += r.quantity();
+  });
+  EXPECT_EQ(114950u, sum);
+
+  // Only as many rewards as the quantity fills are raised, the rest of a
+  // large level is left alone.
+  for (int i = 1000; i < 2000; ++i) {
+    Reward r = make_reward(i, i % 2 ? 150 : 50);
+    r.level() = Reward::RewardLevel::GRAND;
+    rm.add_reward(r);
+  }
+  rm.distribute_quantity(Reward::RewardLevel::GRAND, 5000);
+  EXPECT_EQ(105000u, rm.total_quantity(Reward::RewardLevel::GRAND));
+  int raised = 0;
+  sum = 0;
+  rm.for_each_reward(Reward::RewardLevel::GRAND, [&](RewardHandle, const Reward& r) {
+    if (r.quantity() != (r.id() % 2 ? 150 : 50)) ++raised;
+    EXPECT_LE(r.quantity(), r.id() % 2 ? 150 : 105);
+    sum += r.quantity();
+  });
+  EXPECT_EQ(105000u, sum);
+  EXPECT_EQ(91, raised);
+}
+
+TEST(RewardTests, gridRemoveRewards) {
+  Grid grid;
+  for (int i = 0; i < 100; ++i) grid.add_reward(make_reward(i, 10, Location(i, 0)));
+  // Rewards can't share a location.
+  grid.add_reward(make_reward(100, 10, Location(5, 0)));
+  EXPECT_EQ(100u, grid.reward_manager().size());
+  EXPECT_EQ(1000u, grid.reward_manager().total_quantity());
+
+  vector<Location> collected;
+  for (int i = 0; i < 100; i += 2) collected.push_back(Location(i, 0));
+  collected.push_back(Location(-1, -1));
+  grid.remove_rewards(collected);
+  EXPECT_EQ(50u, grid.reward_manager().size());
+  EXPECT_EQ(1000u, grid.reward_manager().total_quantity());
+
+  // The remaining rewards carry the quantity in scans.
+  Player p;
+  p.location() = Location(50, 200);
+  const InfluenceRing ring = grid.scan_single_ring(p, 0, 1000);
+  int total = 0;
+  for (int v : ring.vals()) total += v;
+  EXPECT_EQ(1000, total);
+
+  grid.remove_reward(Location(1, 0));
+  EXPECT_EQ(49u, grid.reward_manager().size());
+  EXPECT_EQ(1000u, grid.reward_manager().total_quantity());
+}
+
+TEST(RewardTests, gridRejectsDuplicateIds) {
+  Grid grid;
+  grid.add_reward(make_reward(1, 10, Location(0, 0)));
+  grid.add_reward(make_reward(2, 10, Location(10, 0)));
+  // A second reward with a taken id isn't indexed anywhere.
+  grid.add_reward(make_reward(1, 10, Location(500, 500)));
+  const vector<Reward> batch = { make_reward(2, 10, Location(600, 600)),
+                                 make_reward(3, 10, Location(20, 0)),
+                                 make_reward(3, 10, Location(700, 700)) };
+  EXPECT_EQ(1u, grid.add_rewards(batch));
+  EXPECT_EQ(3u, grid.reward_manager().size());
+  EXPECT_EQ(3u, grid.reward_grid().size());
+  for (const Location& l : { Location(500, 500), Location(600, 600), Location(700, 700) }) {
+    EXPECT_FALSE(grid.reward_grid().contains(l));
+  }
+
+  // Once the reward is gone and its slot reused, nothing near where the
+  // duplicate was sees it.
+  grid.remove_reward(Location(0, 0));
+  grid.add_reward(make_reward(4, 10, Location(-500, -500)));
+  Player p;
+  p.location() = Location(500, 500);
+  const InfluenceRing ring = grid.scan_single_ring(p, 0, 100);
+  for (int v : ring.vals()) EXPECT_EQ(0, v);
+}
+
+TEST(RewardTests, hitFalloffTableTest) {
+  // The table must give exactly what evaluating the falloff per hit gave.
+  for (int quantity : { 1, 7, 100, 12345 }) {
+    Reward r = make_reward(1, quantity, Location(3, -4));
+    for (int dx = -12; dx <= 12; ++dx) {
+      for (int dy = -12; dy <= 12; ++dy) {
+        const Location l(3 + dx, -4 + dy);
+        const double dist = l.distanceTo(r.location());
+        const double percent = pow((Reward::HIT_RADIUS - dist) / Reward::HIT_RADIUS,
+                                   Reward::HIT_VALUE_FALLOFF);
+        const int expected = max(dist <= Reward::HIT_RADIUS ? 1 : 0, int(percent * double(quantity)));
+        EXPECT_EQ(expected, r.value_from_location(l)) << dx << "," << dy;
+      }
+    }
+  }
+}
+
+TEST(RewardTests, gridResolveHits) {
+  const auto resolve = [](bool reversed) {
+    Grid grid;
+    grid.add_reward(make_reward(1, 100, Location(0, 0)));
+    grid.add_reward(make_reward(2, 100, Location(100, 0)));
+    grid.add_reward(make_reward(3, 10, Location(200, 0)));
+    grid.add_reward(make_reward(4, 10, Location(300, 0)));
+
+    vector<HitRequest> hits = {
+      HitRequest(1, Location(0, 0)),      // Direct hit, takes all of reward 1.
+      HitRequest(2, Location(105, 0)),    // 5 away from reward 2, 12.
+      HitRequest(3, Location(103, 0)),    // 3 away from reward 2, 34.
+      HitRequest(4, Location(201, 0)),    // Wants 7 of reward 3, paid after 5.
+      HitRequest(5, Location(200, 0)),    // Direct hit, takes all of reward 3.
+      HitRequest(7, Location(300, 1)),    // Ties with 6 on reward 4, gets the last 3.
+      HitRequest(6, Location(300, -1)),   // 1 away from reward 4, 7.
+      HitRequest(8, Location(500, 500)),  // Nothing in reach.
+    };
+    if (reversed) reverse(hits.begin(), hits.end());
+    grid.resolve_hits(hits);
+
+    sort(hits.begin(), hits.end(), [](const HitRequest& a, const HitRequest& b) {
+      return a.player < b.player;
+    });
+    EXPECT_EQ(1u, grid.reward_manager().size());
+    EXPECT_EQ(54u, grid.reward_manager().total_quantity());
+    EXPECT_EQ(54, grid.reward_manager().get(grid.reward_manager().find(2))->quantity());
+    vector<int> values;
+    for (const HitRequest& hit : hits) values.push_back(hit.value);
+    return values;
+  };
 
+  const vector<int> expected = { 100, 12, 34, 0, 10, 7, 3, 0 };
+  EXPECT_EQ(expected, resolve(false));
+  EXPECT_EQ(expected, resolve(true));
 }
 
@@ -0,0 +1,126 @@
+// google test
+#include <gtest/gtest.h>
+#include <grid.hpp>
+#include <reward_spawner.hpp>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+SpawnRequest make_request(size_t count, int spacing, int side) {
+  SpawnRequest req;
+  req.level = Reward::RewardLevel::MEDIUM;
+  req.type = Reward::RewardType::DISTANCE;
+  req.quantity = 5;
+  req.count = count;
+  req.min_spacing = spacing;
+  req.bottom_left = Location(-side / 2, 10);
+  req.top_right = Location(side / 2 - 1, 10 + side - 1);
+  return req;
+}
+
+/// Checks every pair of rewards within spacing of each other through an index.
+void expect_spaced(const vector<Location>& locations, int spacing) {
+  const int64_t limit2 = int64_t(spacing) * spacing;
+  GridMap<int> index;
+  for (const Location& l : locations) ASSERT_TRUE(index.insert(l, 0)) << l;
+  for (const Location& l : locations) {
+    index.for_each_in_rect(Location(l.x - spacing, l.y - spacing), Location(l.x + spacing, l.y + spacing),
+      [&](const Location& o, int) {
+        if (o == l) return;
+        const int64_t dx = l.x - o.x, dy = l.y - o.y;
+        EXPECT_GE(dx * dx + dy * dy, limit2) << l << " " << o;
+      });
+  }
+}
+
+vector<Location> grid_locations(const Grid& grid) {
+  vector<Location> locations;
+  grid.reward_grid().for_each_in_rect(Location(-100000, -100000), Location(100000, 100000),
+    [&](const Location& l, const RewardHandle&) { locations.push_back(l); });
+  return locations;
+}
+
+} // end anonymous namespace
+
+TEST(RewardSpawnerTests, fillKeepsSpacing) {
+  for (int spacing : { 1, 2, 3, 7, 20 }) {
+    // Spacing 1 fills every point, keep that one small.
+    const int side = spacing == 1 ? 100 : 300;
+    Grid grid;
+    RewardSpawner spawner(9, 2);
+    const SpawnRequest req = make_request(1000000, spacing, side);
+    const size_t added = spawner.spawn(grid, req);
+    // A Poisson-disc fill holds well over one reward per 2 * spacing^2.
+    EXPECT_GT(added, size_t(side * side / (2 * spacing * spacing)));
+    EXPECT_EQ(added, grid.reward_manager().size(Reward::RewardLevel::MEDIUM));
+    EXPECT_EQ(added * 5, grid.reward_manager().total_quantity());
+
+    const vector<Location> locations = grid_locations(grid);
+    ASSERT_EQ(added, locations.size());
+    for (const Location& l : locations) EXPECT_TRUE(l.between(req.bottom_left, req.top_right));
+    expect_spaced(locations, spacing);
+  }
+}
+
+TEST(RewardSpawnerTests, countAndIds) {
+  Grid grid;
+  RewardSpawner spawner(1, 1);
+  spawner.set_next_id(100);
+  // Fills, then keeps a subset.
+  const vector<Reward> filled = spawner.generate(grid, make_request(500, 5, 200));
+  ASSERT_EQ(500u, filled.size());
+  // Throws darts.
+  const vector<Reward> darts = spawner.generate(grid, make_request(20, 5, 200));
+  ASSERT_EQ(20u, darts.size());
+  EXPECT_EQ(620, spawner.next_id());
+  for (size_t i = 0; i < filled.size(); ++i) {
+    EXPECT_EQ(RewardId(100 + i), filled[i].id());
+    EXPECT_EQ(Reward::RewardLevel::MEDIUM, filled[i].level());
+    EXPECT_EQ(Reward::RewardType::DISTANCE, filled[i].type());
+    EXPECT_EQ(5, filled[i].quantity());
+  }
+  vector<Location> locations;
+  for (const Reward& r : filled) locations.push_back(r.location());
+  expect_spaced(locations, 5);
+
+  // Requests that can't place anything.
+  EXPECT_TRUE(spawner.generate(grid, make_request(0, 5, 200)).empty());
+  SpawnRequest empty = make_request(10, 5, 200);
+  empty.top_right = Location(empty.bottom_left.x - 1, empty.top_right.y);
+  EXPECT_TRUE(spawner.generate(grid, empty).empty());
+}
+
+TEST(RewardSpawnerTests, spacedFromExistingRewards) {
+  Grid grid;
+  RewardSpawner spawner(4, 2);
+  // A sparse first level, then a denser one filled and topped up around it.
+  ASSERT_EQ(20u, spawner.spawn(grid, make_request(20, 30, 200)));
+  SpawnRequest dense = make_request(1000000, 6, 200);
+  spawner.spawn(grid, dense);
+  dense.count = 30;
+  spawner.spawn(grid, dense);
+  expect_spaced(grid_locations(grid), 6);
+}
+
+TEST(RewardSpawnerTests, sameForAnyThreadCount) {
+  for (size_t count : { size_t(10), size_t(1000000) }) {
+    vector<Location> expected;
+    for (unsigned threads : { 1u, 2u, 5u }) {
+      Grid grid;
+      RewardSpawner spawner(12, threads);
+      vector<Location> locations;
+      for (int i = 0; i < 2; ++i) {
+        for (const Reward& r : spawner.generate(grid, make_request(count, 4, 128))) {
+          locations.push_back(r.location());
+        }
+      }
+      if (expected.empty()) expected = locations;
+      EXPECT_EQ(expected, locations);
+    }
+    EXPECT_FALSE(expected.empty());
+  }
+}
@@ -4,8 +4,12 @@
 #include <location.hpp>
 #include <scan.hpp>
 #include <influence_ring.hpp>
+#include <scan_kernel.hpp>
+#include <scan_batch.hpp>
 #include <cell.test.hpp>
 #include <sstream>
+#include <cmath>
+#include <thread>
 
 using namespace std;
 using namespace cell;
@@ -134,6 +138,30 @@ void distance_test_from_player_location(int x, int y) {
   }
 }
 
+/// The atan2 based classification scan_single_ring originally used.
+template<int NumDirections>
+int atan2_direction(int dx, int dy) {
+  const double PI = 3.141592653589793238462;
+  const double PI2_BY_DIRS = (PI * 2.0) / double(NumDirections * 2);
+  double rads = atan2(double(dy), double(dx));
+  int slice = (int(rads / PI2_BY_DIRS) + (NumDirections * 2)) % (NumDirections * 2);
+  return ((slice + 1) / 2) % NumDirections;
+}
+
+template<int NumDirections>
+void sector_kernel_matches_atan2(int radius) {
+  int mismatches = 0;
+  for (int dx = -radius; dx <= radius; ++dx) {
+    for (int dy = -radius; dy <= radius; ++dy) {
+      if (atan2_direction<NumDirections>(dx, dy) !=
+          SectorClassifier<NumDirections>::direction(dx, dy)) {
+        ++mismatches;
+      }
+    }
+  }
+  EXPECT_EQ(0, mismatches) << NumDirections << " directions";
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ///                             ACTUAL TESTS                                 ///
 ////////////////////////////////////////////////////////////////////////////////
@@ -237,3 +265,193 @@ TEST(CellTests, randScanTest) {
 }
 
 
+
+TEST(CellTests, multiRingScanTest) {
+  // A single pass over several rings must give exactly what one
+  // scan_single_ring per ring gives, including overlapping ring bounds.
+  Player p;
+  p.location() = Location(-300, 4000);
+
+  Grid single, multi;
+  std::mt19937 gen(99);
+  std::uniform_int_distribution<int> offset(-1100, 1100), quantity(1, 1000);
+  for (int i = 0; i < 2000; ++i) {
+    Location l(p.location().x + offset(gen), p.location().y + offset(gen));
+    Reward::RewardType type = i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::TRIVIAL;
+    int q = quantity(gen);
+    single.add_reward(make_reward(i, q, type, l));
+    multi.add_reward(make_reward(i, q, type, l));
+  }
+
+  const int min_dists[] = { 20, 100, 50, 0, 400 };
+  const int max_dists[] = { 100, 1000, 300, 20, 401 };
+  InfluenceRing rings[5];
+  multi.scan_rings(p, min_dists, max_dists, 5, rings);
+  for (int r = 0; r < 5; ++r) {
+    EXPECT_EQ(single.scan_single_ring(p, min_dists[r], max_dists[r]), rings[r]);
+  }
+
+  // Same for the randomized full scan given the same seed.
+  single.reset_seed(7);
+  multi.reset_seed(7);
+  std::mt19937 rand_gen(7);
+  Scan expected;
+  for (int i = 0; i < Scan::NUM_RINGS; ++i) {
+    std::uniform_int_distribution<int> dist(-Scan::RING_RANGE_VARIANCE[i],
+                                             Scan::RING_RANGE_VARIANCE[i]);
+    int var1 = dist(rand_gen);
+    int var2 = dist(rand_gen);
+    expected.rings()[i] = single.scan_single_ring(p, Scan::RING_RANGES[i*2] + var1,
+                                                  Scan::RING_RANGES[(i*2)+1] + var2);
+  }
+  EXPECT_EQ(expected, multi.scan_player(p));
+}
+
+TEST(CellTests, sectorKernelTest) {
+  // Every offset a default scan can reach, plus other direction counts.
+  sector_kernel_matches_atan2<InfluenceRing::NUM_DIRECTIONS>(1025);
+  sector_kernel_matches_atan2<4>(300);
+  sector_kernel_matches_atan2<6>(300);
+  sector_kernel_matches_atan2<16>(300);
+}
+
+TEST(CellTests, ringBoundsTest) {
+  for (int min_dist : { -5, 0, 1, 20, 71, 72, 100 }) {
+    for (int max_dist : { -1, 0, 1, 71, 73, 100, 1025 }) {
+      RingBounds bounds(min_dist, max_dist);
+      for (int dx = 0; dx <= 110; ++dx) {
+        for (int dy = 0; dy <= 110; dy += 3) {
+          double dist = Location(0, 0).distanceTo(Location(dx, dy));
+          EXPECT_EQ(dist >= double(min_dist) && dist <= double(max_dist),
+                    bounds.contains(distance_squared(dx, dy)));
+        }
+      }
+    }
+  }
+}
+
+TEST(CellTests, batchKernelTest) {
+  if (!batch_kernel_supported(BatchKernel::AVX2)) return;
+
+  std::mt19937 gen(5);
+  std::uniform_int_distribution<int> offset(-1300, 1300);
+  const Location origin(std::numeric_limits<int>::max() - 1500, -77);
+  const int min_dists[] = { 20, 100, 0, 72, 500 };
+  const int max_dists[] = { 100, 1000, 0, 73, 500 };
+  ScanBatchRings rings(origin, min_dists, max_dists, 5);
+
+  int xs[ScanBatch::SIZE], ys[ScanBatch::SIZE];
+  for (int round = 0; round < 20000; ++round) {
+    const int count = 1 + round % ScanBatch::SIZE;
+    for (int i = 0; i < count; ++i) {
+      // Mix in axis and diagonal offsets, which sit on direction boundaries.
+      int dx = offset(gen), dy = offset(gen);
+      if (round % 5 == 1) dy = 0;
+      if (round % 5 == 2) dy = (i % 2 ? dx : -dx);
+      xs[i] = origin.x + dx;
+      ys[i] = origin.y + dy;
+    }
+    ScanBatch scalar, avx2;
+    classify_batch(BatchKernel::SCALAR, rings, xs, ys, count, scalar);
+    classify_batch(BatchKernel::AVX2, rings, xs, ys, count, avx2);
+    for (int i = 0; i < ScanBatch::SIZE; ++i) {
+      ASSERT_EQ(scalar.ring_mask[i], avx2.ring_mask[i]);
+      if (scalar.ring_mask[i] == 0) continue;
+      EXPECT_EQ(scalar.direction[i], avx2.direction[i]);
+      for (int r = 0; r < 5; ++r) {
+        if (scalar.ring_mask[i] & (1u << r)) {
+          EXPECT_EQ(scalar.falloff[r][i], avx2.falloff[r][i]);
+        }
+      }
+    }
+  }
+
+  // Whole scans agree too.
+  Player p;
+  p.location() = Location(1000, -1000);
+  Grid scalar_grid, avx2_grid;
+  scalar_grid.set_batch_kernel(BatchKernel::SCALAR);
+  avx2_grid.set_batch_kernel(BatchKernel::AVX2);
+  for (int i = 0; i < 3000; ++i) {
+    Location l(p.location().x + offset(gen), p.location().y + offset(gen));
+    scalar_grid.add_reward(make_reward(i, i, Reward::RewardType::DISTANCE, l));
+    avx2_grid.add_reward(make_reward(i, i, Reward::RewardType::DISTANCE, l));
+  }
+  EXPECT_EQ(scalar_grid.scan_player_fixed(p), avx2_grid.scan_player_fixed(p));
+}
+
+TEST(CellTests, scanPlayersTest) {
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<int> coord(0, 3000), quantity(1, 1000);
+  vector<Reward> rewards;
+  for (int i = 0; i < 3000; ++i) {
+    Reward::RewardType type = i % 2 ? Reward::RewardType::DISTANCE : Reward::RewardType::DIST_TIME;
+    rewards.push_back(make_reward(i, quantity(gen), type, Location(coord(gen), coord(gen))));
+  }
+  vector<Player> players;
+  for (int i = 0; i < 61; ++i) {
+    players.emplace_back(i * 7);
+    players.back().location() = Location(coord(gen), coord(gen));
+  }
+
+  // Two batches on fresh grids give the same scans for any number of threads.
+  vector<vector<Scan>> expected;
+  for (unsigned threads : { 1u, 2u, 4u, 7u }) {
+    Grid grid;
+    grid.set_scan_threads(threads);
+    grid.reset_seed(3);
+    for (const auto& r : rewards) grid.add_reward(r);
+
+    vector<Scan> scans(players.size() * 2);
+    grid.scan_players(players, span<Scan>(scans.data(), players.size()));
+    grid.scan_players(players, span<Scan>(scans.data() + players.size(), players.size()));
+    if (expected.empty()) {
+      // The second batch draws different ring variance and sees the
+      // bookkeeping of the first.
+      EXPECT_FALSE(std::equal(scans.begin(), scans.begin() + players.size(),
+                              scans.begin() + players.size()));
+    } else {
+      EXPECT_TRUE(expected.front() == scans);
+    }
+    expected.push_back(scans);
+  }
+
+  // Scans in one batch see the rewards as they were when the batch started.
+  Player p;
+  p.location() = Location(100, 100);
+  Grid grid;
+  grid.add_reward(make_reward(1, 100, Reward::RewardType::DIST_TIME, Location(150, 100)));
+  vector<Player> same(Reward::NUM_SCANS_BEFORE_RESET, p);
+  vector<Scan> scans(same.size());
+  grid.scan_players(same, scans);
+  for (const auto& s : scans) {
+    EXPECT_LT(0, s.rings()[0].vals()[0] + s.rings()[1].vals()[0]);
+  }
+  EXPECT_EQ(InfluenceRing(), grid.scan_player_fixed(p).rings()[0]);
+}
+
+TEST(CellTests, gameClockTest) {
+  Player p;
+  p.location() = Location(100, 100);
+  ManualClock clock(10 * Reward::RECOVERY_TIME);
+  Grid grid;
+  grid.set_clock(clock);
+  grid.add_reward(make_reward(1, 100, Reward::RewardType::DIST_TIME, Location(150, 100)));
+
+  InfluenceRing full(vector<int>{49, 0, 0, 0, 0, 0, 0, 0});
+  for (int i = 0; i < Reward::NUM_SCANS_BEFORE_RESET; ++i) {
+    EXPECT_EQ(full, grid.scan_single_ring(p, 1, 100));
+  }
+  // Reset by the last scan, then recovering linearly in game time only.
+  EXPECT_EQ(InfluenceRing(), grid.scan_single_ring(p, 1, 100));
+  clock.advance(Reward::RECOVERY_TIME / 2);
+  EXPECT_EQ(InfluenceRing(vector<int>{24, 0, 0, 0, 0, 0, 0, 0}), grid.scan_single_ring(p, 1, 100));
+  clock.advance(Reward::RECOVERY_TIME);
+  EXPECT_EQ(full, grid.scan_single_ring(p, 1, 100));
+
+  // A fast-forwarded clock covers an hour of game time in a second.
+  ScaledClock fast(3600.0, 5);
+  EXPECT_LE(5u, fast.now_ms());
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_LE(36000u, fast.now_ms());
+}
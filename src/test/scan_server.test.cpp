@@ -0,0 +1,276 @@
+// gtest
+#include <gtest/gtest.h>
+#include <scan_server.hpp>
+#include <cell.test.hpp>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cell;
+using namespace cell::test;
+
+namespace {
+
+string socket_path(const char* name) {
+  return "/tmp/cell_" + string(name) + "_" + to_string(::getpid()) + ".sock";
+}
+
+void add_rewards(World& world) {
+  for (int i = 0; i < 50; ++i) {
+    world.grid().add_reward(make_reward(i, 100 + i, Reward::RewardType(i % 3),
+                                        Location(1000 + 37 * (i % 10), 2000 + 53 * (i / 10))));
+  }
+}
+
+WireRequest request(WireOp op, uint32_t tag, PlayerId player, const Location& l = Location(0, 0)) {
+  return WireRequest{ op, tag, player, l };
+}
+
+void send_all(int fd, const vector<char>& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    ASSERT_GT(n, 0);
+    sent += size_t(n);
+  }
+}
+
+/// Runs the server until count responses have come back on fd.
+vector<WireResponse> receive(ScanServer& server, int fd, size_t count) {
+  vector<WireResponse> out;
+  vector<char> in;
+  for (int round = 0; round < 1000 && out.size() < count; ++round) {
+    server.poll(chrono::milliseconds(5));
+    char buf[4096];
+    const ssize_t n = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) in.insert(in.end(), buf, buf + n);
+    size_t at = 0, used;
+    WireResponse r;
+    while (decode_response(in.data() + at, in.size() - at, r, used) == WireResult::OK) {
+      out.push_back(r);
+      at += used;
+    }
+    in.erase(in.begin(), in.begin() + at);
+  }
+  return out;
+}
+
+} // end anonymous namespace
+
+TEST(ScanServerTests, protocolRoundTrip) {
+  vector<char> buf;
+  encode_request(request(WireOp::MOVE, 7, 42, Location(-5, 1 << 30)), buf);
+  encode_request(request(WireOp::SCAN, 8, 43), buf);
+  EXPECT_EQ(4u + 5 + 12 + 4 + 5 + 4, buf.size());
+
+  WireRequest req;
+  size_t used;
+  for (size_t size = 0; size < 21; ++size) {
+    EXPECT_EQ(WireResult::INCOMPLETE, decode_request(buf.data(), size, req, used));
+  }
+  ASSERT_EQ(WireResult::OK, decode_request(buf.data(), buf.size(), req, used));
+  EXPECT_EQ(21u, used);
+  EXPECT_EQ(WireOp::MOVE, req.op);
+  EXPECT_EQ(7u, req.tag);
+  EXPECT_EQ(42, req.player);
+  EXPECT_EQ(Location(-5, 1 << 30), req.location);
+  ASSERT_EQ(WireResult::OK, decode_request(buf.data() + used, buf.size() - used, req, used));
+  EXPECT_EQ(WireOp::SCAN, req.op);
+  EXPECT_EQ(43, req.player);
+
+  WireResponse res = {};
+  res.op = WireOp::SCAN;
+  res.tag = 9;
+  res.status = WireStatus::OK;
+  res.scan.rings()[1].vals()[3] = -17;
+  res.scan.rings()[0].vals()[7] = 1 << 20;
+  buf.clear();
+  encode_response(res, buf);
+  res.status = WireStatus::UNKNOWN_PLAYER;
+  encode_response(res, buf);
+  WireResponse got;
+  ASSERT_EQ(WireResult::OK, decode_response(buf.data(), buf.size(), got, used));
+  EXPECT_EQ(WireStatus::OK, got.status);
+  EXPECT_EQ(res.scan, got.scan);
+  ASSERT_EQ(WireResult::OK, decode_response(buf.data() + used, buf.size() - used, got, used));
+  EXPECT_EQ(WireStatus::UNKNOWN_PLAYER, got.status);
+  EXPECT_EQ(9u, got.tag);
+  EXPECT_EQ(Scan(), got.scan);
+
+  // Unknown ops, wrong lengths and oversized frames don't decode.
+  buf.clear();
+  encode_request(request(WireOp::LEAVE, 1, 2), buf);
+  buf[4] = 99;
+  EXPECT_EQ(WireResult::BAD, decode_request(buf.data(), buf.size(), req, used));
+  buf[4] = char(WireOp::JOIN);
+  EXPECT_EQ(WireResult::BAD, decode_request(buf.data(), buf.size(), req, used));
+  const char huge[4] = { 0, 1, 0, 0 };
+  EXPECT_EQ(WireResult::BAD, decode_request(huge, sizeof(huge), req, used));
+}
+
+TEST(ScanServerTests, answersPipelinedRequests) {
+  World world, reference;
+  add_rewards(world);
+  add_rewards(reference);
+  world.grid().reset_seed(8);
+  reference.grid().reset_seed(8);
+  ScanServer server(world);
+  server.set_tick(chrono::microseconds(0));
+  const string path = socket_path("pipeline");
+  ASSERT_TRUE(server.listen_unix(path));
+  const int fd = connect_unix(path);
+  ASSERT_GE(fd, 0);
+  for (int i = 0; i < 10 && server.num_connections() == 0; ++i) server.poll(chrono::milliseconds(5));
+
+  const Location near(1100, 2100);
+  vector<char> out;
+  encode_request(request(WireOp::JOIN, 1, 1, Location(0, 0)), out);
+  encode_request(request(WireOp::JOIN, 2, 2, near), out);
+  encode_request(request(WireOp::JOIN, 3, 1, near), out);
+  encode_request(request(WireOp::MOVE, 4, 1, near), out);
+  encode_request(request(WireOp::SCAN, 5, 1), out);
+  encode_request(request(WireOp::SCAN, 6, 99), out);
+  encode_request(request(WireOp::HIT, 7, 2, Location(1000, 2000)), out);
+  // A frame split over two writes is put back together.
+  const size_t split = out.size() + 3;
+  encode_request(request(WireOp::LEAVE, 8, 2), out);
+  encode_request(request(WireOp::LEAVE, 9, 2), out);
+  send_all(fd, vector<char>(out.begin(), out.begin() + split));
+  server.poll(chrono::milliseconds(5));
+  send_all(fd, vector<char>(out.begin() + split, out.end()));
+
+  const vector<WireResponse> got = receive(server, fd, 9);
+  ASSERT_EQ(9u, got.size());
+  for (size_t i = 0; i < got.size(); ++i) EXPECT_EQ(i + 1, got[i].tag);
+  EXPECT_EQ(WireStatus::OK, got[0].status);
+  EXPECT_EQ(WireStatus::OK, got[1].status);
+  EXPECT_EQ(WireStatus::DUPLICATE_PLAYER, got[2].status);
+  EXPECT_EQ(WireStatus::OK, got[3].status);
+  EXPECT_EQ(WireStatus::UNKNOWN_PLAYER, got[5].status);
+  EXPECT_EQ(WireStatus::OK, got[7].status);
+  EXPECT_EQ(WireStatus::UNKNOWN_PLAYER, got[8].status);
+
+  Player p(1);
+  p.location() = near;
+  vector<Player> scanners(1, p);
+  vector<Scan> expected(1);
+  reference.grid().scan_players(scanners, expected);
+  EXPECT_EQ(WireStatus::OK, got[4].status);
+  EXPECT_EQ(expected[0], got[4].scan);
+  EXPECT_FALSE(Scan() == got[4].scan);
+  vector<HitRequest> hits(1, HitRequest(2, Location(1000, 2000)));
+  reference.grid().resolve_hits(hits);
+  EXPECT_EQ(WireStatus::OK, got[6].status);
+  EXPECT_EQ(hits[0].value, got[6].value);
+  EXPECT_GT(got[6].value, 0);
+
+  EXPECT_EQ(1u, world.num_players());
+  EXPECT_EQ(near, world.find_player(1)->location());
+  EXPECT_EQ(9u, server.stats().requests);
+  EXPECT_EQ(2u, server.stats().ticks);
+  ::close(fd);
+  for (int i = 0; i < 10 && server.num_connections() > 0; ++i) server.poll(chrono::milliseconds(5));
+  EXPECT_EQ(0u, server.num_connections());
+}
+
+TEST(ScanServerTests, keepsEachPlayersOrderInATick) {
+  World world, reference;
+  add_rewards(world);
+  add_rewards(reference);
+  world.grid().reset_seed(8);
+  reference.grid().reset_seed(8);
+  ScanServer server(world);
+  server.set_tick(chrono::milliseconds(20));
+  const string path = socket_path("order");
+  ASSERT_TRUE(server.listen_unix(path));
+  const int fd = connect_unix(path);
+  ASSERT_GE(fd, 0);
+  for (int i = 0; i < 10 && server.num_connections() == 0; ++i) server.poll(chrono::milliseconds(5));
+
+  // Each player's requests see the ones sent before them and not the ones
+  // after, even though a tick applies leaves before moves and scans.
+  const Location near(1100, 2100), far(-100000, -100000);
+  vector<char> out;
+  encode_request(request(WireOp::JOIN, 1, 1, near), out);
+  encode_request(request(WireOp::SCAN, 2, 1), out);
+  encode_request(request(WireOp::MOVE, 3, 1, far), out);
+  encode_request(request(WireOp::SCAN, 4, 1), out);
+  encode_request(request(WireOp::LEAVE, 5, 1), out);
+  encode_request(request(WireOp::SCAN, 6, 1), out);
+  encode_request(request(WireOp::JOIN, 7, 2, near), out);
+  encode_request(request(WireOp::MOVE, 8, 2, far), out);
+  encode_request(request(WireOp::LEAVE, 9, 2), out);
+  send_all(fd, out);
+
+  const vector<WireResponse> got = receive(server, fd, 9);
+  ASSERT_EQ(9u, got.size());
+  for (size_t i = 0; i < 5; ++i) EXPECT_EQ(WireStatus::OK, got[i].status) << i;
+  EXPECT_EQ(WireStatus::UNKNOWN_PLAYER, got[5].status);
+  for (size_t i = 6; i < 9; ++i) EXPECT_EQ(WireStatus::OK, got[i].status) << i;
+
+  vector<Player> scanners(2, Player(1));
+  scanners[0].location() = near;
+  scanners[1].location() = far;
+  vector<Scan> expected(2);
+  reference.grid().scan_players(scanners, expected);
+  EXPECT_EQ(expected[0], got[1].scan);
+  EXPECT_FALSE(Scan() == got[1].scan);
+  EXPECT_EQ(expected[1], got[3].scan);
+  EXPECT_EQ(0u, world.num_players());
+  EXPECT_EQ(1u, server.stats().ticks);
+  ::close(fd);
+}
+
+TEST(ScanServerTests, batchesConnectionsPerTick) {
+  World world;
+  add_rewards(world);
+  ScanServer server(world);
+  server.set_tick(chrono::milliseconds(20));
+  ASSERT_TRUE(server.listen_tcp("127.0.0.1", 0));
+  ASSERT_NE(0, server.tcp_port());
+  int fds[3];
+  for (int& fd : fds) {
+    fd = connect_tcp("127.0.0.1", server.tcp_port());
+    ASSERT_GE(fd, 0);
+  }
+  for (int i = 0; i < 10 && server.num_connections() < 3; ++i) server.poll(chrono::milliseconds(5));
+  ASSERT_EQ(3u, server.num_connections());
+
+  for (int c = 0; c < 3; ++c) {
+    vector<char> out;
+    encode_request(request(WireOp::JOIN, 0, c, Location(1100 + c, 2100)), out);
+    for (uint32_t tag = 1; tag <= 20; ++tag) encode_request(request(WireOp::SCAN, tag, c), out);
+    send_all(fds[c], out);
+  }
+  for (int c = 0; c < 3; ++c) {
+    const vector<WireResponse> got = receive(server, fds[c], 21);
+    ASSERT_EQ(21u, got.size());
+    for (uint32_t tag = 0; tag <= 20; ++tag) {
+      EXPECT_EQ(tag, got[tag].tag);
+      EXPECT_EQ(WireStatus::OK, got[tag].status);
+    }
+    ::close(fds[c]);
+  }
+  EXPECT_EQ(63u, server.stats().requests);
+  // Everything was sent before the server looked, and is answered together.
+  EXPECT_EQ(1u, server.stats().ticks);
+}
+
+TEST(ScanServerTests, badFrameClosesConnection) {
+  World world;
+  ScanServer server(world);
+  const string path = socket_path("bad");
+  ASSERT_TRUE(server.listen_unix(path));
+  const int fd = connect_unix(path);
+  ASSERT_GE(fd, 0);
+  const char frame[9] = { 5, 0, 0, 0, 42, 0, 0, 0, 0 };
+  send_all(fd, vector<char>(frame, frame + sizeof(frame)));
+  for (int i = 0; i < 20 && server.stats().bad_frames == 0; ++i) server.poll(chrono::milliseconds(5));
+  EXPECT_EQ(1u, server.stats().bad_frames);
+  EXPECT_EQ(0u, server.num_connections());
+  char c;
+  EXPECT_EQ(0, ::recv(fd, &c, 1, 0));
+  ::close(fd);
+}
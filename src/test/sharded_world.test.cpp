@@ -0,0 +1,250 @@
+// gtest
+#include <gtest/gtest.h>
+#include <sharded_world.hpp>
+#include <world.hpp>
+#include <cell.test.hpp>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+using namespace cell::test;
+
+namespace {
+
+constexpr int BOARD = 8000;
+
+/// The same rewards and players in a sharded world and in one World.
+void fill_worlds(ShardedWorld& sharded, World& world, int num_rewards, int num_players) {
+  mt19937 gen(17);
+  const vector<Reward> rewards =
+      random_rewards(gen, num_rewards, Location(0, 0), Location(BOARD - 1, BOARD - 1));
+  for (const Reward& r : rewards) {
+    sharded.add_reward(r);
+    world.grid().add_reward(r);
+  }
+  uniform_int_distribution<int> coord(0, BOARD - 1);
+  for (int i = 0; i < num_players; ++i) {
+    Player p(i);
+    p.location() = Location(coord(gen), coord(gen));
+    sharded.player_join(p);
+    world.player_join(p);
+  }
+}
+
+/// The players of a world in id order, as scan_players takes them.
+vector<Player> players_by_id(const World& world, int num_players) {
+  vector<Player> players;
+  for (PlayerId id = 0; id < num_players; ++id) {
+    if (const Player* p = world.find_player(id)) players.push_back(*p);
+  }
+  return players;
+}
+
+} // end anonymous namespace
+
+TEST(ShardedWorldTests, shardsSplitTheBoard) {
+  ShardedWorld sharded(4, 0, BOARD);
+  EXPECT_EQ(4u, sharded.num_shards());
+  EXPECT_EQ(2000, sharded.boundary(0));
+  EXPECT_EQ(0u, sharded.shard_of(-100000));
+  EXPECT_EQ(0u, sharded.shard_of(1999));
+  EXPECT_EQ(1u, sharded.shard_of(2000));
+  EXPECT_EQ(3u, sharded.shard_of(100000));
+
+  Player p(7);
+  p.location() = Location(4500, 10);
+  EXPECT_TRUE(sharded.player_join(p));
+  EXPECT_FALSE(sharded.player_join(p));
+  EXPECT_EQ(2, sharded.shard_of_player(7));
+  EXPECT_EQ(1u, sharded.shard(2).num_players());
+
+  // Crossing a boundary hands the player off.
+  EXPECT_TRUE(sharded.move_player(7, Location(1500, 20)));
+  EXPECT_EQ(0, sharded.shard_of_player(7));
+  EXPECT_EQ(0u, sharded.shard(2).num_players());
+  EXPECT_EQ(Location(1500, 20), sharded.find_player(7)->location());
+  EXPECT_EQ(1u, sharded.handoffs());
+
+  EXPECT_TRUE(sharded.player_leave(7));
+  EXPECT_FALSE(sharded.player_leave(7));
+  EXPECT_EQ(nullptr, sharded.find_player(7));
+  EXPECT_EQ(-1, sharded.shard_of_player(7));
+}
+
+TEST(ShardedWorldTests, movesHandOffPlayers) {
+  const int num_players = 3000;
+  ShardedWorld sharded(6, 0, BOARD);
+  World world;
+  fill_worlds(sharded, world, 0, num_players);
+
+  mt19937 gen(4);
+  uniform_int_distribution<int> player(0, num_players + 10), step(-600, 600);
+  for (int tick = 0; tick < 10; ++tick) {
+    vector<Move> moves;
+    for (int i = 0; i < 2000; ++i) {
+      const PlayerId id = player(gen);
+      const Player* p = world.find_player(id);
+      const Location from = p ? p->location() : Location(0, 0);
+      moves.push_back(Move{ id, Location(from.x + step(gen), from.y + step(gen)) });
+      // Some players move twice in a tick, maybe across a boundary and back.
+      if (i % 7 == 0) moves.push_back(Move{ id, Location(from.x + step(gen), from.y) });
+    }
+    EXPECT_EQ(world.apply_moves(moves), sharded.apply_moves(moves));
+  }
+  EXPECT_GT(sharded.handoffs(), 0u);
+
+  size_t total = 0;
+  for (unsigned s = 0; s < sharded.num_shards(); ++s) {
+    total += sharded.shard(s).num_players();
+    for (const Player& p : sharded.shard(s).players()) {
+      EXPECT_EQ(s, sharded.shard_of(p.location().x));
+      EXPECT_EQ(int(s), sharded.shard_of_player(p.id()));
+    }
+  }
+  EXPECT_EQ(size_t(num_players), total);
+  EXPECT_EQ(size_t(num_players), sharded.num_players());
+  for (const Player& p : world.players()) {
+    ASSERT_NE(nullptr, sharded.find_player(p.id()));
+    EXPECT_EQ(p.location(), sharded.find_player(p.id())->location());
+  }
+}
+
+TEST(ShardedWorldTests, scansMatchOneWorld) {
+  const int num_players = 400;
+  // Strips narrower than the outer ring, so scans span several shards.
+  ShardedWorld sharded(8, 0, BOARD);
+  World world;
+  fill_worlds(sharded, world, 20000, num_players);
+  ManualClock clock(1000);
+  sharded.set_clock(clock);
+  world.set_clock(clock);
+  sharded.reset_seed(5);
+  world.grid().reset_seed(5);
+
+  vector<PlayerId> ids;
+  for (PlayerId id = 0; id < num_players; ++id) ids.push_back(id);
+  ids.push_back(num_players + 1);
+  const vector<Player> players = players_by_id(world, num_players);
+
+  // Several batches, so the scan bookkeeping of DIST_TIME rewards matters.
+  for (int batch = 0; batch < 3; ++batch) {
+    vector<Scan> expected(players.size()), got(ids.size());
+    world.grid().scan_players(players, expected);
+    sharded.scan_players(ids, got);
+    for (int i = 0; i < num_players; ++i) EXPECT_EQ(expected[i], got[i]) << "player " << i;
+    EXPECT_EQ(Scan(), got.back());
+    clock.advance(500);
+  }
+}
+
+TEST(ShardedWorldTests, hitsMatchOneWorld) {
+  ShardedWorld sharded(4, 0, BOARD);
+  World world;
+  // Rewards on both sides of a boundary, within reach of the same hits.
+  const int x = sharded.boundary(1);
+  for (int i = 0; i < 6; ++i) {
+    const Reward r = make_reward(i, 40, Reward::RewardType::TRIVIAL, Location(x - 3 + i, 100));
+    sharded.add_reward(r);
+    world.grid().add_reward(r);
+  }
+  vector<HitRequest> a, b;
+  for (int i = 0; i < 5; ++i) {
+    a.emplace_back(i, Location(x - 4 + 2 * i, 101));
+    b.emplace_back(i, Location(x - 4 + 2 * i, 101));
+  }
+  world.grid().resolve_hits(a);
+  sharded.resolve_hits(b);
+  int collected = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].value, b[i].value) << "hit " << i;
+    collected += b[i].value;
+  }
+  EXPECT_GT(collected, 0);
+  EXPECT_EQ(world.grid().reward_grid().size(),
+            sharded.shard(1).grid().reward_grid().size() + sharded.shard(2).grid().reward_grid().size());
+}
+
+TEST(ShardedWorldTests, rebalanceFollowsHotSpot) {
+  const int board = 1 << 14, num_players = 3000;
+  ShardedWorld sharded(8, 0, board);
+  World world;
+  mt19937 gen(23);
+  const vector<Reward> spread =
+      random_rewards(gen, 20000, Location(0, 0), Location(board - 1, board - 1));
+  for (const Reward& r : spread) {
+    sharded.add_reward(r);
+    world.grid().add_reward(r);
+  }
+  // Players crowding around one point.
+  normal_distribution<double> crowd(0.0, 400.0);
+  for (int i = 0; i < num_players; ++i) {
+    Player p(i);
+    p.location() = Location(5000 + int(crowd(gen)), 8000 + int(crowd(gen)));
+    sharded.player_join(p);
+    world.player_join(p);
+  }
+  ManualClock clock(1000);
+  sharded.set_clock(clock);
+  world.set_clock(clock);
+  sharded.reset_seed(3);
+  world.grid().reset_seed(3);
+
+  vector<PlayerId> ids;
+  for (PlayerId id = 0; id < num_players; ++id) ids.push_back(id);
+  const auto scan_both = [&] {
+    const vector<Player> players = players_by_id(world, num_players);
+    vector<Scan> expected(players.size()), got(ids.size());
+    world.grid().scan_players(players, expected);
+    sharded.scan_players(ids, got);
+    clock.advance(100);
+    for (int i = 0; i < num_players; ++i) {
+      if (!(expected[i] == got[i])) return false;
+    }
+    return true;
+  };
+
+  EXPECT_TRUE(scan_both());
+  vector<Move> moves;
+  for (PlayerId id = 0; id < num_players; ++id) {
+    const Location l = world.find_player(id)->location();
+    moves.push_back(Move{ id, Location(l.x + 1, l.y) });
+  }
+  world.apply_moves(moves);
+  sharded.apply_moves(moves);
+
+  // Without a budget every call takes a single step. The player boundaries
+  // move at once, the rewards follow.
+  const int reward_boundary = sharded.reward_boundary(0);
+  int calls = 1;
+  EXPECT_FALSE(sharded.rebalance(chrono::microseconds(0)));
+  EXPECT_GT(sharded.boundary(0), 3000);
+  EXPECT_EQ(reward_boundary, sharded.reward_boundary(0));
+  // Still usable halfway through.
+  EXPECT_TRUE(scan_both());
+  while (!sharded.rebalance(chrono::microseconds(0))) ASSERT_LT(++calls, 100000);
+  EXPECT_GT(calls, 10);
+
+  // The shards now split the crowd.
+  EXPECT_GT(sharded.boundary(0), 3000);
+  EXPECT_LT(sharded.boundary(sharded.num_shards() - 2), 7000);
+  size_t rewards = 0, most_players = 0;
+  for (unsigned s = 0; s < sharded.num_shards(); ++s) {
+    const World& shard = sharded.shard(s);
+    most_players = max(most_players, shard.num_players());
+    for (const Player& p : shard.players()) EXPECT_EQ(s, sharded.shard_of(p.location().x));
+    for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+      shard.grid().reward_manager().for_each_reward(Reward::RewardLevel(level),
+        [&](RewardHandle, const Reward& r) { EXPECT_EQ(s, sharded.reward_shard_of(r.location().x)); });
+    }
+    rewards += shard.grid().reward_grid().size();
+  }
+  EXPECT_EQ(world.grid().reward_grid().size(), rewards);
+  EXPECT_LT(most_players, size_t(2 * num_players / sharded.num_shards()));
+  EXPECT_EQ(size_t(num_players), sharded.num_players());
+  EXPECT_TRUE(scan_both());
+
+  // Balanced now, so a further call has nothing to do.
+  EXPECT_TRUE(scan_both());
+  EXPECT_TRUE(sharded.rebalance(chrono::microseconds(0)));
+}
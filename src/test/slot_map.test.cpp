@@ -0,0 +1,68 @@
+// gtest
+#include <gtest/gtest.h>
+#include <slot_map.hpp>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+TEST(SlotMapTests, insertEraseGet) {
+  SlotMap<string> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(nullptr, map.get(SlotHandle()));
+
+  const SlotHandle a = map.insert("a"), b = map.insert("b"), c = map.insert("c");
+  EXPECT_EQ(3u, map.size());
+  EXPECT_EQ("a", *map.get(a));
+  EXPECT_EQ("b", *map.get(b));
+  EXPECT_EQ("c", *map.get(c));
+
+  // Erasing moves the last object into the hole, handles still resolve.
+  EXPECT_TRUE(map.erase(a));
+  EXPECT_FALSE(map.erase(a));
+  EXPECT_FALSE(map.contains(a));
+  EXPECT_EQ("b", *map.get(b));
+  EXPECT_EQ("c", *map.get(c));
+  EXPECT_EQ(2u, map.size());
+
+  // The slot is reused with a new generation.
+  const SlotHandle d = map.insert("d");
+  EXPECT_EQ(a.index, d.index);
+  EXPECT_NE(a, d);
+  EXPECT_EQ(nullptr, map.get(a));
+  EXPECT_EQ("d", *map.get(d));
+
+  for (size_t i = 0; i < map.size(); ++i) {
+    EXPECT_EQ(&map.values()[i], map.get(map.handle_at(i)));
+  }
+}
+
+TEST(SlotMapTests, randomChurn) {
+  SlotMap<int> map;
+  vector<pair<SlotHandle, int>> live;
+  vector<SlotHandle> dead;
+  mt19937 gen(17);
+  for (int step = 0; step < 20000; ++step) {
+    if (live.empty() || gen() % 3 != 0) {
+      live.emplace_back(map.insert(step), step);
+    } else {
+      const size_t i = gen() % live.size();
+      EXPECT_TRUE(map.erase(live[i].first));
+      dead.push_back(live[i].first);
+      live[i] = live.back();
+      live.pop_back();
+    }
+  }
+  ASSERT_EQ(live.size(), map.size());
+  for (const auto& e : live) EXPECT_EQ(e.second, *map.get(e.first));
+  for (const auto& h : dead) EXPECT_FALSE(map.contains(h));
+
+  vector<int> values(map.values().begin(), map.values().end()), expected;
+  for (const auto& e : live) expected.push_back(e.second);
+  sort(values.begin(), values.end());
+  sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, values);
+}
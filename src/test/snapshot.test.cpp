@@ -0,0 +1,201 @@
+// google test
+#include <gtest/gtest.h>
+#include <snapshot.hpp>
+#include <world.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+namespace {
+
+string snapshot_path(const string& name) {
+  return "/tmp/cell." + name + ".snapshot";
+}
+
+void fill_world(World& world) {
+  mt19937 gen(21);
+  uniform_int_distribution<int> coord(-2000, 2000);
+  for (int i = 0; i < 5000; ++i) {
+    Reward r(i, Reward::RewardType(i % 3));
+    r.level() = Reward::RewardLevel(i % Reward::RewardLevel::NUM_LEVELS);
+    r.quantity() = 1 + i % 97;
+    r.location() = Location(coord(gen), coord(gen));
+    world.grid().add_reward(r);
+  }
+  for (int i = 0; i < 300; ++i) {
+    Player p(1000 + i);
+    p.location() = Location(coord(gen), coord(gen));
+    world.player_join(p);
+  }
+  // Some scan history and an empty level holding quantity.
+  Player scanner(1);
+  for (int i = 0; i < 4; ++i) world.grid().scan_player_fixed(scanner);
+  world.grid().reward_manager().set_undistributed(Reward::RewardLevel::GRAND, 1234);
+}
+
+typedef tuple<RewardId, int, int, int, int, int, int, uint64_t> RewardRow;
+
+vector<RewardRow> reward_rows(const World& world) {
+  vector<RewardRow> rows;
+  const RewardManager& rm = world.grid().reward_manager();
+  for (int level = 0; level < Reward::RewardLevel::NUM_LEVELS; ++level) {
+    rm.for_each_reward(Reward::RewardLevel(level), [&](RewardHandle, const Reward& r) {
+      rows.emplace_back(r.id(), int(r.type()), int(r.level()), r.quantity(), r.location().x,
+                        r.location().y, r.scan_state().scans(), r.scan_state().last_scanned());
+    });
+  }
+  sort(rows.begin(), rows.end());
+  return rows;
+}
+
+vector<tuple<PlayerId, int, int>> player_rows(const World& world) {
+  vector<tuple<PlayerId, int, int>> rows;
+  for (const Player& p : world.players()) rows.emplace_back(p.id(), p.location().x, p.location().y);
+  sort(rows.begin(), rows.end());
+  return rows;
+}
+
+} // end anonymous namespace
+
+TEST(SnapshotTests, roundTrip) {
+  World world;
+  fill_world(world);
+  const string path = snapshot_path("roundTrip");
+  ASSERT_TRUE(save_snapshot(world, path));
+  const vector<RewardRow> rows = reward_rows(world);
+  EXPECT_TRUE(any_of(rows.begin(), rows.end(), [](const RewardRow& r) { return get<6>(r) != 0; }));
+  EXPECT_TRUE(any_of(rows.begin(), rows.end(), [](const RewardRow& r) { return get<7>(r) != 0; }));
+
+  for (unsigned threads : { 1u, 3u }) {
+    World loaded;
+    ASSERT_TRUE(load_snapshot(path, loaded, threads));
+    EXPECT_EQ(reward_rows(world), reward_rows(loaded));
+    EXPECT_EQ(player_rows(world), player_rows(loaded));
+    EXPECT_EQ(world.grid().reward_manager().total_quantity(), loaded.grid().reward_manager().total_quantity());
+    EXPECT_EQ(1234u, loaded.grid().reward_manager().undistributed(Reward::RewardLevel::GRAND));
+    EXPECT_EQ(world.grid().reward_grid().size(), loaded.grid().reward_grid().size());
+    EXPECT_NE(nullptr, loaded.find_player(1000));
+
+    // Loading only goes into an empty world.
+    EXPECT_FALSE(load_snapshot(path, loaded, threads));
+  }
+  remove(path.c_str());
+}
+
+TEST(SnapshotTests, mappedQueries) {
+  World world;
+  fill_world(world);
+  const string path = snapshot_path("mappedQueries");
+  ASSERT_TRUE(save_snapshot(world, path));
+
+  MappedSnapshot snapshot;
+  ASSERT_TRUE(snapshot.open(path, 2));
+  EXPECT_EQ(5000u, snapshot.rewards().size());
+  EXPECT_EQ(300u, snapshot.players().size());
+
+  const Location rects[][2] = {
+    { Location(-100, -100), Location(100, 100) },
+    { Location(-2000, 0), Location(2000, 1) },
+    { Location(-5000, -5000), Location(5000, 5000) },
+    { Location(300, 300), Location(299, 400) },
+  };
+  for (const auto& rect : rects) {
+    vector<pair<int, int>> expected, found;
+    world.grid().reward_grid().for_each_in_rect(rect[0], rect[1], [&](const Location& l, const RewardHandle&) {
+      expected.emplace_back(l.x, l.y);
+    });
+    snapshot.for_each_reward_in_rect(rect[0], rect[1], [&](const SnapshotReward& r) {
+      found.emplace_back(r.x, r.y);
+    });
+    sort(expected.begin(), expected.end());
+    sort(found.begin(), found.end());
+    EXPECT_EQ(expected, found);
+  }
+  snapshot.close();
+  remove(path.c_str());
+}
+
+TEST(SnapshotTests, rejectsDamagedFiles) {
+  World world;
+  fill_world(world);
+  const string path = snapshot_path("rejectsDamagedFiles");
+  ASSERT_TRUE(save_snapshot(world, path));
+  ifstream in(path, ios::binary);
+  const string good((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  in.close();
+
+  const auto write_file = [&](const string& bytes) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(bytes.data(), bytes.size());
+  };
+
+  MappedSnapshot snapshot;
+  EXPECT_FALSE(snapshot.open(snapshot_path("missing")));
+
+  // One flipped bit anywhere, in the header or in a record.
+  for (size_t pos : { size_t(0), size_t(40), good.size() / 2, good.size() - 1 }) {
+    string bad = good;
+    bad[pos] ^= 0x10;
+    write_file(bad);
+    EXPECT_FALSE(snapshot.open(path)) << pos;
+    EXPECT_FALSE(snapshot.is_open());
+    World loaded;
+    EXPECT_FALSE(load_snapshot(path, loaded));
+    EXPECT_EQ(0u, loaded.grid().reward_manager().size());
+  }
+
+  write_file(good.substr(0, good.size() - 8));
+  EXPECT_FALSE(snapshot.open(path));
+  write_file(good.substr(0, 10));
+  EXPECT_FALSE(snapshot.open(path));
+
+  write_file(good);
+  EXPECT_TRUE(snapshot.open(path));
+  snapshot.close();
+  remove(path.c_str());
+}
+
+TEST(SnapshotTests, backgroundWriter) {
+  World world;
+  fill_world(world);
+  const string path = snapshot_path("backgroundWriter");
+  SnapshotWriter writer;
+  ASSERT_TRUE(writer.start(world, path));
+  // The world can change as soon as start returns, the snapshot has what it
+  // held at the time.
+  const vector<RewardRow> expected = reward_rows(world);
+  world.grid().remove_reward(world.grid().reward_manager().get(world.grid().reward_manager().find(7))->location());
+  world.player_leave(1000);
+  EXPECT_TRUE(writer.wait());
+  EXPECT_FALSE(writer.busy());
+
+  World loaded;
+  ASSERT_TRUE(load_snapshot(path, loaded));
+  EXPECT_EQ(5000u, loaded.grid().reward_manager().size());
+  EXPECT_EQ(expected, reward_rows(loaded));
+  EXPECT_NE(nullptr, loaded.find_player(1000));
+
+  // Records are sorted on the writer thread, so the file doesn't depend on
+  // the order the rewards are stored in.
+  const string resaved = snapshot_path("backgroundWriterResaved");
+  ASSERT_TRUE(save_snapshot(loaded, resaved));
+  const auto contents = [](const string& file) {
+    ifstream in(file, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  };
+  EXPECT_EQ(contents(path), contents(resaved));
+  remove(resaved.c_str());
+
+  EXPECT_TRUE(writer.start(world, path));
+  EXPECT_TRUE(writer.wait());
+  EXPECT_FALSE(writer.start(world, "/nonexistent/dir/snapshot") && writer.wait());
+  remove(path.c_str());
+}
@@ -0,0 +1,44 @@
+// google test
+#include <gtest/gtest.h>
+#include <thread_pool.hpp>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+using namespace cell;
+
+TEST(ThreadPoolTests, parallelForCoversRange) {
+  for (unsigned threads : { 1u, 2u, 5u }) {
+    ThreadPool pool(threads);
+    EXPECT_EQ(threads, pool.size());
+    for (size_t n : { 0u, 1u, 7u, 1000u }) {
+      for (size_t grain : { 0u, 1u, 3u, 64u }) {
+        vector<atomic<int>> hits(n);
+        for (auto& h : hits) h = 0;
+        pool.parallel_for(n, grain, [&](size_t begin, size_t end) {
+          EXPECT_LT(begin, end);
+          EXPECT_LE(end - begin, max<size_t>(grain, 1));
+          for (size_t i = begin; i < end; ++i) ++hits[i];
+        });
+        for (auto& h : hits) EXPECT_EQ(1, h.load());
+      }
+    }
+  }
+}
+
+TEST(ThreadPoolTests, parallelForFromSeveralThreads) {
+  ThreadPool pool(4);
+  atomic<long> total(0);
+  vector<thread> callers;
+  for (int c = 0; c < 4; ++c) {
+    callers.emplace_back([&] {
+      for (int round = 0; round < 50; ++round) {
+        pool.parallel_for(100, 1, [&](size_t begin, size_t end) {
+          total += long(end - begin);
+        });
+      }
+    });
+  }
+  for (auto& t : callers) t.join();
+  EXPECT_EQ(4 * 50 * 100, total.load());
+}
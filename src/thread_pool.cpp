@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file thread_pool.cpp
+/// @brief Implementation of ThreadPool class.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+
+// cell
+#include <thread_pool.hpp>
+
+namespace cell {
+
+ThreadPool::ThreadPool(unsigned num_threads)
+{
+  if (num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+  workers_.reserve(num_threads - 1);
+  for (unsigned i = 1; i < num_threads; ++i) {
+    workers_.emplace_back([this] { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& w : workers_) w.join();
+}
+
+void ThreadPool::parallel_for(std::size_t n, std::size_t grain, const RangeFn& fn)
+{
+  if (n == 0) return;
+  grain = std::max<std::size_t>(grain, 1);
+  if (workers_.empty() || n <= grain) {
+    for (std::size_t begin = 0; begin < n; begin += grain) fn(begin, std::min(n, begin + grain));
+    return;
+  }
+
+  std::lock_guard<std::mutex> submit(submit_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    n_ = n;
+    grain_ = grain;
+    next_.store(0, std::memory_order_relaxed);
+    busy_ = unsigned(workers_.size());
+    ++generation_;
+  }
+  wake_.notify_all();
+
+  run_chunks();
+
+  // fn lives on this stack frame, so wait until no worker can touch it.
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return busy_ == 0; });
+  fn_ = nullptr;
+}
+
+void ThreadPool::run_chunks()
+{
+  for (;;) {
+    const std::size_t begin = next_.fetch_add(grain_, std::memory_order_relaxed);
+    if (begin >= n_) return;
+    (*fn_)(begin, std::min(n_, begin + grain_));
+  }
+}
+
+void ThreadPool::worker_loop()
+{
+  std::uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+      if (stop_) return;
+      seen = generation_;
+    }
+
+    run_chunks();
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last = --busy_ == 0;
+    }
+    if (last) done_.notify_one();
+  }
+}
+
+} // end namespace cell
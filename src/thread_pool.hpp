@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////
+///
+/// @file thread_pool.hpp
+/// @brief Fixed set of worker threads for splitting batches of work.
+/// @author Zenon Parker
+/// @author Matthew Avery
+/// @date 2014
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CELL_THREAD_POOL_HPP
+#define CELL_THREAD_POOL_HPP
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cell {
+
+/** @brief The pool owns num_threads - 1 workers and the thread calling
+  *        parallel_for acts as the last one, so a pool of size one runs
+  *        everything inline. Work is handed out in chunks from a shared
+  *        counter, so uneven items (e.g. scans in crowded areas) balance
+  *        themselves out.
+  */
+class ThreadPool {
+public:
+
+  typedef std::function<void(std::size_t begin, std::size_t end)> RangeFn;
+
+  /// A num_threads of zero uses one thread per hardware thread.
+  explicit ThreadPool(unsigned num_threads = 0);
+  ~ThreadPool();
+
+  /// Number of threads taking part in parallel_for, including the caller.
+  unsigned size() const { return unsigned(workers_.size()) + 1; }
+
+  /** @brief Calls fn(begin, end) over consecutive ranges of at most grain
+    *        items until [0, n) is covered, and returns once every range is
+    *        done. Ranges may run in any order on any thread. Calls from
+    *        several threads at once are serialized.
+    */
+  void parallel_for(std::size_t n, std::size_t grain, const RangeFn& fn);
+
+private:
+
+  void worker_loop();
+
+  /// Takes chunks of the current job until there are none left.
+  void run_chunks();
+
+  std::vector<std::thread> workers_;
+
+  // Serializes parallel_for callers.
+  std::mutex submit_mutex_;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::uint64_t generation_ = 0;
+  unsigned busy_ = 0;
+  bool stop_ = false;
+
+  // Current job, only written while no worker is busy.
+  const RangeFn* fn_ = nullptr;
+  std::size_t n_ = 0;
+  std::size_t grain_ = 1;
+  std::atomic<std::size_t> next_{0};
+
+  // No copy construction/assignment.
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+};
+
+} // end namespace cell
+
+#endif // CELL_THREAD_POOL_HPP
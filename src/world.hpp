@@ -13,10 +13,19 @@
 
 #include <player.hpp>
 #include <grid.hpp>
-#include <map>
+#include <journal.hpp>
+#include <slot_map.hpp>
+#include <span.hpp>
+#include <unordered_map>
 
 namespace cell {
 
+/// A player's new position, see World::apply_moves.
+struct Move {
+  PlayerId id;
+  Location to;
+};
+
 class World {
 public:
   
@@ -31,41 +40,126 @@ public:
     * @return True if the player was removed, false otherwise.
     */
   bool player_leave(PlayerId id);
-  
+
+  /// The player with the given id, nullptr if they are not in the world.
+  /// The pointer is invalidated by the next join or leave.
+  const Player* find_player(PlayerId id) const;
+
+  /// Handle of the player with the given id, a null handle if they are not
+  /// in the world. Handles stay valid until the player leaves.
+  PlayerHandle player_handle(PlayerId id) const;
+
+  /// The player a handle names, as stored in the player grid. nullptr once
+  /// the player has left.
+  const Player* player(PlayerHandle h) const { return players_.get(h); }
+
+  /// Every player in the world, densely packed in no particular order. For
+  /// per tick processing, e.g. Grid::scan_players.
+  span<const Player> players() const { return players_.values(); }
+
+  std::size_t num_players() const { return players_.size(); }
+
+  /// Makes room for n players in total.
+  void reserve(std::size_t n) {
+    players_.reserve(n);
+    handles_.reserve(n);
+  }
+
+  /** @brief Moves a player and updates the player grid to match. Players in
+    *        a world must only be moved through here. A move that stays inside
+    *        one index cell is an in place update.
+    * @return True if the player was moved, false if they are not in the world.
+    */
+  bool move_player(PlayerId id, const Location& to);
+
+  /** @brief Applies a tick's worth of moves in one pass, in order, so a player
+    *        moved twice ends up at their last position.
+    * @return Number of moves applied, moves of unknown players are skipped.
+    */
+  std::size_t apply_moves(span<const Move> moves);
+
+  /// Clock for everything time based in the world, see Grid::set_clock.
+  const GameClock& clock() const { return grid_.clock(); }
+  void set_clock(const GameClock& clock) { grid_.set_clock(clock); }
+
   Grid& grid();
   const Grid& grid() const;
 
+  /** @brief Records every later change to the world's rewards and players in
+    *        journal, nullptr to stop. The caller commits the journal once per
+    *        tick, see Journal.
+    */
+  void set_journal(Journal* journal) {
+    journal_ = journal;
+    grid_.set_journal(journal);
+  }
+  Journal* journal() const { return journal_; }
+
 private:
   // No copy construction/assignment.
   World(const World&) = delete;
   World& operator=(const World&) = delete;
-  std::map<PlayerId, Player> players_;
+  SlotMap<Player> players_;
+  std::unordered_map<PlayerId, PlayerHandle> handles_;
   Grid grid_;
+  Journal* journal_ = nullptr;
 };
 
 inline bool World::player_join(const Player& p) {
-  auto ret = players_.emplace(p.id(),p);
+  auto ret = handles_.emplace(p.id(), PlayerHandle());
   if (ret.second) {
-    auto &player = ret.first->second;
-    grid_.player_grid().insert(player.location(), &player);
+    const PlayerHandle h = players_.insert(p);
+    ret.first->second = h;
+    grid_.player_grid().insert(p.location(), h);
+    if (journal_) journal_->player_join(p);
   }
   return ret.second;
 }
 
 inline bool World::player_leave(PlayerId id) {
-  const auto cit = players_.find(id);
-  if (cit != players_.end()) {
-    grid_.player_grid().erase_one(cit->second.location(), &cit->second);
-    players_.erase(cit);
+  const auto cit = handles_.find(id);
+  if (cit != handles_.end()) {
+    const PlayerHandle h = cit->second;
+    grid_.player_grid().erase_one(players_.get(h)->location(), h);
+    players_.erase(h);
+    handles_.erase(cit);
+    if (journal_) journal_->player_leave(id);
     return true;
   }
   return false;
 }
 
+inline const Player* World::find_player(PlayerId id) const {
+  const auto cit = handles_.find(id);
+  return cit == handles_.end() ? nullptr : players_.get(cit->second);
+}
+
+inline PlayerHandle World::player_handle(PlayerId id) const {
+  const auto cit = handles_.find(id);
+  return cit == handles_.end() ? PlayerHandle() : cit->second;
+}
+
+inline bool World::move_player(PlayerId id, const Location& to) {
+  const auto cit = handles_.find(id);
+  if (cit == handles_.end()) return false;
+  Player& player = *players_.get(cit->second);
+  grid_.player_grid().move_one(player.location(), to, cit->second);
+  player.location() = to;
+  if (journal_) journal_->player_move(id, to);
+  return true;
+}
+
+inline std::size_t World::apply_moves(span<const Move> moves) {
+  std::size_t applied = 0;
+  for (const Move& m : moves) {
+    if (move_player(m.id, m.to)) ++applied;
+  }
+  return applied;
+}
+
 inline Grid& World::grid() { return grid_; }
 inline const Grid& World::grid() const { return grid_; }
 
 } // end namespace cell
 
 #endif // CELL_WORLD_HPP
-